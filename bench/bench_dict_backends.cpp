@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <random>
+#include <chrono>
+#include <cmath>
+
+#include "fastcws/freq_dict.hpp"
+
+namespace freq_dict = fastcws::freq_dict;
+
+void usage(std::string_view program) {
+	std::cerr << "usage: " << program << " [freq_dict.txt] [corpus.txt]\n"
+		<< "\n"
+		<< "compares build time, bytes per word & scan throughput of the dict backends\n"
+		<< "without arguments, a zipf distributed vocabulary & corpus of cjk words are synthesized\n"
+		<< std::endl;
+}
+
+std::string utf8_encode(char32_t c) {
+	std::string ret;
+	ret.push_back(static_cast<char>(0xe0 | (c >> 12)));
+	ret.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+	ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+	return ret;
+}
+
+void synthesize(std::string& dict_text, std::string& corpus) {
+	constexpr size_t num_words = 300000;
+	constexpr size_t corpus_words = 1000000;
+	std::mt19937 rng{42};
+	// skewed character distribution so that words share prefixes like real vocabularies do
+	std::geometric_distribution<size_t> char_dist{0.002};
+	std::discrete_distribution<size_t> len_dist{{0, 5, 60, 15, 15, 3, 2}};
+
+	std::vector<std::string> words;
+	std::unordered_set<std::string> seen;
+	std::ostringstream oss;
+	while (words.size() < num_words) {
+		std::string word;
+		size_t len = len_dist(rng);
+		for (size_t j = 0; j < len; j++) {
+			word += utf8_encode(0x4e00 + (char_dist(rng) % 0x5000));
+		}
+		if (!seen.insert(word).second) {
+			continue;
+		}
+		uint64_t freq = static_cast<uint64_t>(1e7 / (words.size() + 1)) + 1;
+		oss << word << " " << freq << "\n";
+		words.push_back(std::move(word));
+	}
+	dict_text = oss.str();
+
+	// zipf over the vocabulary, approximated by inverting the harmonic cdf
+	std::uniform_real_distribution<double> u{0, 1};
+	for (size_t i = 0; i < corpus_words; i++) {
+		size_t rank = static_cast<size_t>(std::pow(static_cast<double>(num_words), u(rng))) - 1;
+		corpus += words[rank % num_words];
+	}
+}
+
+template <class Clock = std::chrono::steady_clock>
+double ms_since(typename Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template <class Dict>
+size_t storage_bytes(const Dict& d) {
+	return d.storage_.size() * Dict::blk_size
+		+ d.freq_.size() * sizeof(typename decltype(d.freq_)::value_type);
+}
+
+template <class Dict, class TrieBytes, class Prepare>
+void run(std::string_view name, const std::string& dict_text, const std::string& corpus, TrieBytes trie_bytes, Prepare prepare) {
+	auto start = std::chrono::steady_clock::now();
+	Dict d;
+	{
+		std::istringstream iss{dict_text};
+		freq_dict::load_dict(iss, d, true);
+	}
+	prepare(d);
+	double build_ms = ms_since(start);
+
+	size_t words = 0;
+	d.for_each_word([&words](std::string_view, uint64_t) {
+		words++;
+	});
+	size_t bytes = trie_bytes(d) + storage_bytes(d);
+
+	// scan in sentence sized chunks like word_break does
+	constexpr size_t chunk = 256;
+	size_t matches = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < corpus.size(); i += chunk) {
+		std::string_view sentence = std::string_view{corpus}.substr(i, chunk);
+		d.trie_holder_.scan(sentence, [&matches](size_t, std::string_view) {
+			matches++;
+		});
+	}
+	double scan_ms = ms_since(start);
+
+	std::cout << name << ":\n"
+		<< "  build:      " << build_ms << " ms\n"
+		<< "  words:      " << words << "\n"
+		<< "  bytes:      " << bytes << " (" << static_cast<double>(bytes) / words << " per word)\n"
+		<< "  scan:       " << scan_ms * 1e6 / corpus.size() << " ns/byte, "
+			<< corpus.size() / scan_ms / 1e3 << " MB/s, " << matches << " matches\n"
+		<< std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::string dict_text;
+	std::string corpus;
+	if (argc == 1) {
+		synthesize(dict_text, corpus);
+	} else if (argc == 3) {
+		std::ifstream dict_ifs{argv[1]};
+		std::ifstream corpus_ifs{argv[2]};
+		if (!dict_ifs.good() || !corpus_ifs.good()) {
+			usage({argv[0]});
+			return 1;
+		}
+		dict_text.assign(std::istreambuf_iterator<char>{dict_ifs}, {});
+		corpus.assign(std::istreambuf_iterator<char>{corpus_ifs}, {});
+	} else {
+		usage({argv[0]});
+		return 1;
+	}
+	std::cout << "corpus: " << corpus.size() << " bytes\n" << std::endl;
+
+	using dat_dict = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	using louds_dict = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::louds>;
+
+	auto dat_bytes = [](const dat_dict& d) {
+		const auto& dat = d.trie_holder_.dat_;
+		return dat.units_.size() * sizeof(typename decltype(dat.units_)::value_type)
+			+ dat.tails_.size() * sizeof(typename decltype(dat.tails_)::value_type);
+	};
+	run<dat_dict>("double_array", dict_text, corpus, dat_bytes, [](dat_dict&) {});
+	// profiled on the first tenth of the corpus, like a sample of production traffic
+	run<dat_dict>("double_array, profile guided layout", dict_text, corpus, dat_bytes, [&corpus](dat_dict& d) {
+		auto prof = d.make_profile();
+		d.record_profile(std::string_view{corpus}.substr(0, corpus.size() / 10), prof);
+		size_t unmatched = 0;
+		d.for_each_unmatched_word(prof, [&unmatched](std::string_view) {
+			unmatched++;
+		});
+		std::cout << "words never matched in the sample: " << unmatched << "\n" << std::endl;
+		d.relayout(prof, true);
+	});
+	run<louds_dict>("louds", dict_text, corpus, [](const louds_dict& d) {
+		return d.trie_holder_.trie_.bytes_used();
+	}, [](louds_dict&) {});
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+#include "fastcws/freq_dict.hpp"
+
+namespace freq_dict = fastcws::freq_dict;
+
+void usage(std::string_view program) {
+	std::cerr << "usage: " << program << " [freq_dict.txt]\n"
+		<< "\n"
+		<< "compares the istream loader with the memory mapped parallel loader, then times a full load into a double array dict\n"
+		<< "without arguments, a 5M line `word freq tag` dictionary is synthesized into a temporary file\n"
+		<< std::endl;
+}
+
+std::string utf8_encode(char32_t c) {
+	std::string ret;
+	ret.push_back(static_cast<char>(0xe0 | (c >> 12)));
+	ret.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+	ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+	return ret;
+}
+
+void synthesize(const char* filename) {
+	constexpr size_t num_words = 5000000;
+	constexpr const char* tags[] = {"n", "v", "a", "nr", "ns", "d"};
+	std::mt19937 rng{42};
+	std::geometric_distribution<size_t> char_dist{0.002};
+	std::discrete_distribution<size_t> len_dist{{0, 5, 60, 15, 15, 3, 2}};
+	std::ofstream ofs{filename, std::ios::binary};
+	for (size_t i = 0; i < num_words; i++) {
+		size_t len = len_dist(rng);
+		for (size_t j = 0; j < len; j++) {
+			ofs << utf8_encode(0x4e00 + (char_dist(rng) % 0x5000));
+		}
+		ofs << " " << (static_cast<uint64_t>(1e7 / (i + 1)) + 1) << " " << tags[rng() % 6] << "\n";
+	}
+}
+
+// takes the words like dict does, without building anything, so that parsing is measured alone
+struct parse_only_dict {
+	size_t words = 0;
+	uint64_t total = 0;
+
+	void reserve(size_t n) {
+		(void)n;
+	}
+
+	void add_word(std::string_view word, uint64_t freq) {
+		(void)word;
+		words++;
+		total += freq;
+	}
+
+	void finalize(bool quiet) {
+		(void)quiet;
+	}
+};
+
+template <class Clock = std::chrono::steady_clock>
+double ms_since(typename Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template <class Dict, class Load>
+void run(std::string_view name, Load load) {
+	Dict d;
+	auto start = std::chrono::steady_clock::now();
+	load(d);
+	std::cout << name << ": " << ms_since(start) << " ms\n";
+}
+
+int main(int argc, char** argv) {
+	if (argc > 2) {
+		usage({argv[0]});
+		return 1;
+	}
+	std::string filename;
+	if (argc == 2) {
+		filename = argv[1];
+	} else {
+		filename = (std::filesystem::temp_directory_path() / "fastcws_bench_dict_loading.txt").string();
+		synthesize(filename.c_str());
+	}
+
+	using dat_dict = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	const size_t hw = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+	run<parse_only_dict>("parse only, istream", [&filename](auto& d) {
+		std::ifstream ifs{filename};
+		freq_dict::load_dict(ifs, d, true);
+	});
+	for (size_t threads = 1; threads <= hw; threads *= 2) {
+		run<parse_only_dict>("parse only, mapped, " + std::to_string(threads) + " threads", [&filename, threads](auto& d) {
+			freq_dict::load_dict_file(filename.c_str(), d, threads, true);
+		});
+	}
+	// finalize() building the automaton is the rest of the time it takes to load a real dict
+	run<dat_dict>("double array, mapped, " + std::to_string(hw) + " threads", [&filename](auto& d) {
+		freq_dict::load_dict_file(filename.c_str(), d, 0, true);
+	});
+
+	if (argc != 2) {
+		std::remove(filename.c_str());
+	}
+	return 0;
+}
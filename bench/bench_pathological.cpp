@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+
+#include "fastcws.hpp"
+
+namespace freq_dict = fastcws::freq_dict;
+namespace hmm = fastcws::hmm;
+
+using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+using model_type = hmm::wseg_4tag::model<>;
+using dag_type = fastcws::word_dag::dag<>;
+
+void usage(std::string_view program) {
+	std::cerr << "usage: " << program << " [size in bytes] [freq_dict.txt wseg_model.hmm]\n"
+		<< "\n"
+		<< "runs the segmentation pipeline stage by stage over inputs crafted to hit worst cases,\n"
+		<< "and reports ns/byte of each stage next to an average case input of the same size\n"
+		<< "without dict & model, a synthesized vocabulary & a model trained on it are used\n"
+		<< std::endl;
+}
+
+std::string utf8_encode(char32_t c) {
+	std::string ret;
+	ret.push_back(static_cast<char>(0xe0 | (c >> 12)));
+	ret.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+	ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+	return ret;
+}
+
+struct vocabulary {
+	std::vector<std::vector<std::string>> words; // as runes
+	std::string longest; // longest word, of which any prefix is a dead end
+};
+
+vocabulary synthesize_vocabulary(dict_type& d, model_type& model) {
+	vocabulary voc;
+	std::mt19937 rng{42};
+	std::geometric_distribution<size_t> char_dist{0.002};
+	std::discrete_distribution<size_t> len_dist{{0, 5, 60, 15, 15, 3, 2}};
+	std::ostringstream oss;
+	for (size_t i = 0; i < 50000; i++) {
+		std::vector<std::string> word;
+		size_t len = len_dist(rng);
+		for (size_t j = 0; j < len; j++) {
+			word.push_back(utf8_encode(0x4e00 + (char_dist(rng) % 0x5000)));
+		}
+		std::string joined;
+		for (const auto& rune : word) {
+			joined += rune;
+		}
+		oss << joined << " " << (static_cast<uint64_t>(1e6 / (i + 1)) + 1) << "\n";
+		voc.words.push_back(std::move(word));
+	}
+	// reduplicated words, which a run of one character matches at every depth
+	std::string reduplicated;
+	for (size_t i = 0; i < 8; i++) {
+		reduplicated += u8"哈";
+		oss << reduplicated << " 100\n";
+	}
+	// a long word whose prefixes are all dead ends, so a naive fail walk visits the whole prefix per byte
+	for (size_t i = 0; i < 32; i++) {
+		voc.longest += u8"嘿";
+	}
+	voc.longest += u8"哟";
+	oss << voc.longest << " 1\n";
+
+	std::istringstream iss{oss.str()};
+	freq_dict::load_dict(iss, d, true);
+
+	for (size_t i = 0; i < 20000; i++) {
+		std::vector<std::string_view> runes;
+		std::vector<hmm::wseg_4tag::state> tags;
+		for (size_t j = 0; j < 10; j++) {
+			const auto& word = voc.words[rng() % voc.words.size()];
+			for (size_t k = 0; k < word.size(); k++) {
+				runes.push_back(word[k]);
+				if (word.size() == 1) {
+					tags.push_back(hmm::wseg_4tag::state::S);
+				} else if (k == 0) {
+					tags.push_back(hmm::wseg_4tag::state::B);
+				} else if (k + 1 == word.size()) {
+					tags.push_back(hmm::wseg_4tag::state::E);
+				} else {
+					tags.push_back(hmm::wseg_4tag::state::M);
+				}
+			}
+		}
+		model.train(runes.begin(), runes.end(), tags.begin(), tags.end());
+	}
+	model.normalize();
+	return voc;
+}
+
+struct input_case {
+	std::string name;
+	std::string text;
+};
+
+std::vector<input_case> generate_inputs(const vocabulary& voc, size_t size) {
+	std::vector<input_case> ret;
+	std::mt19937 rng{4242};
+	auto fill = [size](auto gen) {
+		std::string s;
+		while (s.size() < size) {
+			s += gen();
+		}
+		return s;
+	};
+	auto random_word = [&voc, &rng]() {
+		std::string s;
+		for (const auto& rune : voc.words[rng() % voc.words.size()]) {
+			s += rune;
+		}
+		return s;
+	};
+
+	size_t words_in_sentence = 0;
+	ret.push_back({"average (sentences of ~12 words)", fill([&]() {
+		words_in_sentence++;
+		if ((words_in_sentence % 12) == 0) {
+			return random_word() + u8"。";
+		}
+		return random_word();
+	})});
+	ret.push_back({"no delimiters", fill(random_word)});
+	ret.push_back({"repeated rune", fill([]() {
+		return std::string{u8"哈"};
+	})});
+	ret.push_back({"dead end prefix", fill([]() {
+		return std::string{u8"嘿"};
+	})});
+	ret.push_back({"others", fill([&rng]() {
+		return std::string(1, static_cast<char>('a' + rng() % 26));
+	})});
+	ret.push_back({"alternating specials", fill([&rng]() {
+		const char* pick[] = {"a", " ", u8"哈", "1", u8"—", "\t", u8"…"};
+		return std::string{pick[rng() % 7]};
+	})});
+	return ret;
+}
+
+template <class Clock = std::chrono::steady_clock>
+double ns_since(typename Clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+void run(const input_case& input, const dict_type& d, const model_type& model) {
+	struct stage_t {
+		const char* name;
+		double ns = 0;
+	};
+	stage_t split{"sentence split"};
+	stage_t rune_chain{"rune chain"};
+	stage_t special{"special edges"};
+	stage_t dict_edges{"dict edges"};
+	stage_t hmm_edges{"hmm edges"};
+	stage_t shortest_path{"shortest path"};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> sentences;
+	fastcws::sentence_tokenizer tok{[&sentences](std::string sentence) {
+		sentences.emplace_back(std::move(sentence));
+	}};
+	tok.process(input.text);
+	tok.finish();
+	split.ns += ns_since(start);
+
+	size_t words = 0;
+	std::vector<std::string_view> out;
+	std::vector<std::string_view> chunks;
+	for (const auto& sentence : sentences) {
+		const std::string_view sv{sentence};
+		for (size_t begin = 0; begin < sv.size();) {
+			size_t end = fastcws::chunk_end(sv, begin, fastcws::max_dag_sentence_size);
+			chunks.push_back(sv.substr(begin, end - begin));
+			begin = end;
+		}
+	}
+	for (const auto chunk : chunks) {
+		start = std::chrono::steady_clock::now();
+		dag_type dag{chunk};
+		fastcws::populate_rune_chain(dag, d.suggest_single_rune_weight<dag_type>());
+		rune_chain.ns += ns_since(start);
+
+		start = std::chrono::steady_clock::now();
+		fastcws::add_special_edges(dag);
+		special.ns += ns_since(start);
+
+		start = std::chrono::steady_clock::now();
+		d.add_edges(dag);
+		dict_edges.ns += ns_since(start);
+
+		start = std::chrono::steady_clock::now();
+		model.add_edges<dag_type, fastcws::rune_hopper::utf8_hopper>(dag, d.suggest_hmm_model_weight<dag_type>());
+		hmm_edges.ns += ns_since(start);
+
+		start = std::chrono::steady_clock::now();
+		out.clear();
+		fastcws::word_break_by_dag(dag, std::back_inserter(out));
+		shortest_path.ns += ns_since(start);
+		words += out.size();
+	}
+
+	const double bytes = static_cast<double>(input.text.size());
+	double total = 0;
+	std::cout << input.name << " (" << sentences.size() << " sentences, " << chunks.size() << " chunks, " << words << " words):\n";
+	for (const auto* stage : {&split, &rune_chain, &special, &dict_edges, &hmm_edges, &shortest_path}) {
+		std::cout << "  " << stage->name << ": " << stage->ns / bytes << " ns/byte\n";
+		total += stage->ns;
+	}
+	std::cout << "  total: " << total / bytes << " ns/byte\n" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	size_t size = 1024 * 1024;
+	if (argc > 1) {
+		size = std::stoul(argv[1]);
+	}
+	if ((argc != 1) && (argc != 2) && (argc != 4)) {
+		usage({argv[0]});
+		return 1;
+	}
+
+	dict_type d;
+	model_type model;
+	vocabulary voc;
+	{
+		dict_type synth_dict;
+		model_type synth_model;
+		voc = synthesize_vocabulary((argc == 4) ? synth_dict : d, (argc == 4) ? synth_model : model);
+	}
+	if (argc == 4) {
+		std::ifstream dict_ifs{argv[2]};
+		std::ifstream model_ifs{argv[3]};
+		if (!dict_ifs.good() || !model_ifs.good()) {
+			usage({argv[0]});
+			return 1;
+		}
+		freq_dict::load_dict(dict_ifs, d, true);
+		model = hmm::wseg_4tag::load(model_ifs);
+	}
+
+	for (const auto& input : generate_inputs(voc, size)) {
+		run(input, d, model);
+	}
+	return 0;
+}
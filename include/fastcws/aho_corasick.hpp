@@ -4,4 +4,5 @@
 
 #include "fastcws/aho_corasick/trie.hpp"
 #include "fastcws/aho_corasick/double_array_trie.hpp"
-
+#include "fastcws/aho_corasick/dynamic_double_array_trie.hpp"
+#include "fastcws/aho_corasick/louds_trie.hpp"
@@ -6,6 +6,12 @@
 #include <memory>
 #include <utility>
 #include <limits>
+#include <array>
+#include <iterator>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <queue>
 
 #include "fastcws/bindings/containers.hpp"
 #include "fastcws/rep_aware/string_view.hpp"
@@ -14,15 +20,18 @@ namespace fastcws {
 
 namespace aho_corasick {
 
-template <class Allocator = std::allocator<int>>
+// Offset bounds the number of units & tails, uint32_t is enough for common dictionaries
+// while uint64_t lifts the limit at the cost of twice the unit size
+template <class Allocator = std::allocator<int>, class Offset = uint32_t>
 struct double_array_trie {
-	using offset_t = uint32_t;
+	static_assert(std::is_unsigned_v<Offset>, "Offset must be an unsigned integer type");
+	using offset_t = Offset;
 	using allocator_traits = std::allocator_traits<Allocator>;
 	using string_view_type = rep_aware::basic_string_view<char, std::char_traits<char>,
 		  typename allocator_traits::template rebind_alloc<char>>;
 
 	struct unit_type {
-		static constexpr size_t not_used = std::numeric_limits<offset_t>::max();
+		static constexpr offset_t not_used = std::numeric_limits<offset_t>::max();
 		offset_t base = not_used;
 		offset_t check = not_used;
 		offset_t fail = 0;
@@ -36,6 +45,8 @@ struct double_array_trie {
 	struct tail_type {
 		string_view_type match;
 		size_t tail_size = 0;
+		offset_t next = 0; // next tail down the fail chain, so scan() never walks units without output
+		offset_t word = 0; // index of the word in the sorted list handed to build_from_sorted()
 	};
 
 	vector<unit_type,
@@ -45,6 +56,13 @@ struct double_array_trie {
 		typename allocator_traits::template rebind_alloc<
 			tail_type>> tails_;
 
+	// n units or tails must be addressable by offset_t, not_used excluded
+	static void _check_size(size_t n) {
+		if (n >= static_cast<size_t>(unit_type::not_used)) {
+			throw std::overflow_error{"fastcws::double_array_trie: offset_t too narrow for this dictionary"};
+		}
+	}
+
 	double _calc_load_factor(size_t begin, size_t end) {
 		size_t used = 0;
 		for (size_t i = begin; i != end; i++) {
@@ -58,6 +76,44 @@ struct double_array_trie {
 		return static_cast<double>(used) / (end - begin);
 	}
 
+	// first-fit search of a base which fits all labels, starting from skip
+	// skip is advanced once the area behind it is densely populated
+	size_t _place_base(const uint8_t* labels, size_t num_labels, size_t& skip) {
+		size_t new_base = skip;
+		for (;;) {
+			if (units_.size() <= new_base) {
+				break;
+			}
+			if (units_[new_base].used()) {
+				new_base++;
+				continue;
+			}
+			bool good = true;
+			for (size_t i = 0; i < num_labels; i++) {
+				size_t place_child = new_base + labels[i];
+				if (units_.size() <= place_child) {
+					break;
+				}
+				if (units_[place_child].used()) {
+					good = false;
+					break;
+				}
+			}
+			if (good) {
+				break;
+			}
+			new_base++;
+		}
+		if ((_calc_load_factor(skip, new_base) > 0.80) || ((new_base - skip) > 5000)) {
+			skip = new_base;
+		}
+		if (units_.size() <= (new_base + 0xff)) {
+			_check_size(new_base + 0xff + 1);
+			units_.resize(new_base + 0xff + 1);
+		}
+		return new_base;
+	}
+
 	template <class Trie>
 	void build_from(const Trie& tr, bool quiet=false) {
 		units_ = {};
@@ -92,7 +148,7 @@ struct double_array_trie {
 				tails_.emplace_back(std::move(tail));
 			}
 		}
-		assert(tails_.size() < std::numeric_limits<offset_t>::max());
+		_check_size(tails_.size());
 
 		vector<size_t> node_id_to_unit_idx(tr.nodes_.size(), 0);
 		queue<size_t> q;
@@ -118,44 +174,19 @@ struct double_array_trie {
 			}
 
 			const auto& node = tr.nodes_[id];
-			size_t new_base = skip;
-			for (;;) {
-				if (units_.size() <= new_base) {
-					break;
-				}
-				if (units_[new_base].used()) {
-					new_base++;
-					continue;
-				}
-				bool good = true;
-				for (auto [ch, child_id] : node.children) {
-					size_t place_child = new_base + static_cast<uint8_t>(ch);
-					if (units_.size() <= place_child) {
-						break;
-					}
-					if (units_[place_child].used()) {
-						good = false;
-						break;
-					}
-				}
-				if (good) {
-					break;
-				}
-				new_base++;
-			}
-			if ((_calc_load_factor(skip, new_base) > 0.80) || ((new_base - skip) > 5000)) {
-				skip = new_base;
-			}
-			if (units_.size() <= (new_base + 0xff)) {
-				units_.resize(new_base + 0xff + 1);
-				assert(units_.size() < std::numeric_limits<offset_t>::max());
+			std::array<uint8_t, 256> labels;
+			size_t num_labels = 0;
+			for (auto [ch, child_id] : node.children) {
+				(void)child_id;
+				labels[num_labels++] = static_cast<uint8_t>(ch);
 			}
+			size_t new_base = _place_base(labels.data(), num_labels, skip);
 			units_[node_id_to_unit_idx[id]].base = static_cast<offset_t>(new_base);
 			for (auto [ch, child_id] : node.children) {
 				size_t place_child = new_base + static_cast<uint8_t>(ch);
 				if (units_.size() <= place_child) {
+					_check_size(place_child + 1);
 					units_.resize(place_child + 1);
-					assert(units_.size() < std::numeric_limits<offset_t>::max());
 				}
 				units_[place_child].check = static_cast<offset_t>(node_id_to_unit_idx[id]);
 				units_[place_child].fail = static_cast<offset_t>(node_id_to_unit_idx[tr.nodes_[child_id].fail]);
@@ -167,6 +198,7 @@ struct double_array_trie {
 				}
 			}
 		}
+		_link_outputs();
 
 		if (!quiet) {
 			std::cout << "\r" // remove curr line
@@ -174,8 +206,382 @@ struct double_array_trie {
 		}
 	}
 
+	// builds the automaton straight from words sorted in byte order (e.g. the sorted freq_ of a dict),
+	// without going through a pointer based trie, so the peak memory usage stays close to the final arrays.
+	// word_of(*it) gives the word of an element, the words must outlive this automaton.
+	template <class SortedIterator, class WordOf>
+	void build_from_sorted(SortedIterator first, SortedIterator last, WordOf word_of, bool quiet=false) {
+		_build_sorted(first, last, word_of,
+			static_cast<const double_array_trie*>(nullptr), static_cast<const profile_type*>(nullptr), quiet);
+	}
+
+	// same as above, but nodes often visited in prof, which was recorded on prev built from the same words,
+	// get their children placed first, so hot paths end up packed together at the front of units_
+	template <class SortedIterator, class WordOf, class PrevAllocator, class PrevOffset>
+	void build_from_sorted(SortedIterator first, SortedIterator last, WordOf word_of,
+			const double_array_trie<PrevAllocator, PrevOffset>& prev,
+			const typename double_array_trie<PrevAllocator, PrevOffset>::profile_type& prof, bool quiet=false) {
+		_build_sorted(first, last, word_of, &prev, &prof, quiet);
+	}
+
+	template <class SortedIterator, class WordOf, class Prev, class Profile>
+	void _build_sorted(SortedIterator first, SortedIterator last, WordOf& word_of,
+			const Prev* prev, const Profile* prof, bool quiet) {
+		units_ = {};
+		units_.resize(0x100); // root, and room for its transitions in case it ends up a leaf
+		tails_ = {};
+		tails_.emplace_back(); // sentinel
+		const SortedIterator begin = first;
+		while ((first != last) && std::string_view{word_of(*first)}.empty()) {
+			first++;
+		}
+
+		constexpr size_t no_prev = std::numeric_limits<size_t>::max();
+		// [first, last) shares the first depth bytes, which lead to unit (& prev_unit in prev)
+		struct pending_t {
+			size_t unit;
+			SortedIterator first;
+			SortedIterator last;
+			size_t depth;
+			size_t prev_unit;
+			uint64_t heat;
+			size_t seq;
+
+			bool operator<(const pending_t& rhs) const noexcept {
+				// hottest first, in dfs order among equally hot nodes, which keeps parents near their children
+				return (heat != rhs.heat) ? (heat < rhs.heat) : (seq < rhs.seq);
+			}
+		};
+		auto heat_of = [prof](size_t prev_unit) -> uint64_t {
+			if ((prof == nullptr) || (prev_unit == no_prev) || (prev_unit >= prof->visits.size())) {
+				return 0;
+			}
+			return prof->visits[prev_unit];
+		};
+		std::priority_queue<pending_t, vector<pending_t>> q;
+		size_t seq = 0;
+		q.push(pending_t{0, first, last, 0, (prev == nullptr) ? no_prev : 0, heat_of(0), seq++});
+
+		size_t total = std::distance(first, last);
+		size_t count = 0;
+		size_t skip = 0;
+		while (!q.empty()) {
+			auto [unit, node_first, node_last, depth, prev_unit, heat, node_seq] = q.top();
+			(void)heat;
+			(void)node_seq;
+			q.pop();
+
+			while ((node_first != node_last) && (std::string_view{word_of(*node_first)}.size() == depth)) {
+				if (units_[unit].tail == 0) {
+					std::string_view word{word_of(*node_first)};
+					tail_type tail;
+					tail.match = {word.data(), word.size()};
+					const size_t word_id = std::distance(begin, node_first);
+					_check_size(word_id);
+					tail.word = static_cast<offset_t>(word_id);
+					_check_size(tails_.size() + 1);
+					units_[unit].tail = static_cast<offset_t>(tails_.size());
+					tails_.emplace_back(std::move(tail));
+				}
+				if (!quiet && ((count % 1000) == 0)) {
+					double pct = count * 100.0 / total;
+					std::cout << "\r" // remove curr line
+						<< pct << "% (" << count << "/" << total << ") ...     ";
+					std::flush(std::cout);
+				}
+				count++;
+				node_first++;
+			}
+			if (node_first == node_last) {
+				// a leaf never matches any check, so base 0 is as good as any
+				units_[unit].base = 0;
+				continue;
+			}
+
+			std::array<uint8_t, 256> labels;
+			size_t num_labels = 0;
+			for (auto it = node_first; it != node_last; it++) {
+				uint8_t label = static_cast<uint8_t>(std::string_view{word_of(*it)}[depth]);
+				if ((num_labels == 0) || (labels[num_labels - 1] != label)) {
+					labels[num_labels++] = label;
+				}
+			}
+
+			size_t new_base = _place_base(labels.data(), num_labels, skip);
+			units_[unit].base = static_cast<offset_t>(new_base);
+			for (size_t i = 0; i < num_labels; i++) {
+				units_[new_base + labels[i]].check = static_cast<offset_t>(unit);
+			}
+
+			// pushed backwards, so that the first label pops first
+			auto group_end = node_last;
+			for (size_t i = num_labels; i-- > 0;) {
+				auto group_begin = group_end;
+				while ((group_begin != node_first) && (static_cast<uint8_t>(std::string_view{word_of(*std::prev(group_begin))}[depth]) == labels[i])) {
+					group_begin--;
+				}
+				size_t prev_child = (prev_unit == no_prev) ? no_prev : prev->_child(prev_unit, labels[i]);
+				q.push(pending_t{new_base + labels[i], group_begin, group_end, depth + 1,
+					prev_child, heat_of(prev_child), seq++});
+				group_end = group_begin;
+			}
+		}
+		units_.shrink_to_fit();
+		tails_.shrink_to_fit();
+		_build_fail();
+		_link_outputs();
+
+		if (!quiet) {
+			std::cout << "\r" // remove curr line
+				<< "done.      " << std::endl;
+		}
+	}
+
+	// unit reached from status by label, or not_found
+	static constexpr size_t not_found = std::numeric_limits<size_t>::max();
+	size_t _child(size_t status, uint8_t label) const noexcept {
+		const size_t base = units_[status].base;
+		const size_t to = base + label;
+		if ((base == unit_type::not_used) || (to >= units_.size()) || (units_[to].check != status)) {
+			return not_found;
+		}
+		return to;
+	}
+
+	// computes fail links by walking the finished arrays in bfs order
+	void _build_fail() {
+		if (units_.empty()) {
+			return;
+		}
+		queue<offset_t> q;
+		q.push(0);
+		while (!q.empty()) {
+			size_t status = q.front();
+			q.pop();
+
+			const size_t base = units_[status].base;
+			if ((status != 0) && (base == 0)) {
+				continue; // leaf
+			}
+			for (size_t ch = 0; ch < 0x100; ch++) {
+				const size_t child = base + ch;
+				if ((child >= units_.size()) || (units_[child].check != status)) {
+					continue;
+				}
+				size_t fail = 0;
+				if (status != 0) {
+					size_t f = units_[status].fail;
+					for (;;) {
+						const size_t to = units_[f].base + ch;
+						if ((to < units_.size()) && (units_[to].check == f)) {
+							fail = to;
+							break;
+						}
+						if (f == 0) {
+							break;
+						}
+						f = units_[f].fail;
+					}
+				}
+				units_[child].fail = static_cast<offset_t>(fail);
+				q.push(static_cast<offset_t>(child));
+			}
+		}
+	}
+
+	// per unit visit counts & per tail match counts, recorded by record() over a sample corpus
+	struct profile_type {
+		vector<uint64_t> visits; // by unit
+		vector<uint64_t> hits; // by tail
+	};
+
+	profile_type make_profile() const {
+		profile_type prof;
+		prof.visits.resize(units_.size(), 0);
+		prof.hits.resize(tails_.size(), 0);
+		return prof;
+	}
+
+	// runs haystack through the automaton like scan() does, counting into prof
+	void record(const std::string_view haystack, profile_type& prof) const {
+		_scan(haystack, [&prof](size_t end_pos, size_t tail) {
+			(void)end_pos;
+			prof.hits[tail]++;
+		}, [&prof](size_t unit) {
+			prof.visits[unit]++;
+		});
+	}
+
+	// calls cb(word) for every word which never matched while recording prof
+	template <class Callback>
+	void for_each_unmatched(const profile_type& prof, Callback cb) const {
+		for (size_t i = 1; i < tails_.size(); i++) {
+			if (prof.hits[i] == 0) {
+				cb(std::string_view{tails_[i].match.data(), tails_[i].match.size()});
+			}
+		}
+	}
+
+	// lets every unit without a tail of its own take the first tail down its fail chain,
+	// and chains each tail to the next one, so a match costs o(1) no matter how deep the fail chain is
+	void _link_outputs() {
+		if (units_.empty()) {
+			return;
+		}
+		queue<offset_t> q;
+		q.push(0);
+		while (!q.empty()) {
+			size_t status = q.front();
+			q.pop();
+
+			const size_t base = units_[status].base;
+			if (((status != 0) && (base == 0)) || (base == unit_type::not_used)) {
+				continue; // leaf
+			}
+			for (size_t ch = 0; ch < 0x100; ch++) {
+				const size_t child = base + ch;
+				if ((child >= units_.size()) || (units_[child].check != status)) {
+					continue;
+				}
+				// bfs order, the fail target is shallower and already linked
+				const offset_t inherited = units_[units_[child].fail].tail;
+				if (units_[child].tail != 0) {
+					tails_[units_[child].tail].next = inherited;
+				} else {
+					units_[child].tail = inherited;
+				}
+				q.push(static_cast<offset_t>(child));
+			}
+		}
+	}
+
 	template <class MatchCallback>
 	void scan(const std::string_view haystack, MatchCallback matched) const {
+		_scan(haystack, [this, &matched](size_t end_pos, size_t tail) {
+			matched(end_pos, std::string_view{tails_[tail].match.data(), tails_[tail].match.size()});
+		}, [](size_t unit) {
+			(void)unit;
+		});
+	}
+
+	// like scan(), with the index of the word in the sorted list it was built from, see build_from_sorted()
+	template <class MatchCallback>
+	void scan_ids(const std::string_view haystack, MatchCallback matched) const {
+		_scan(haystack, [this, &matched](size_t end_pos, size_t tail) {
+			matched(end_pos, std::string_view{tails_[tail].match.data(), tails_[tail].match.size()}, tails_[tail].word);
+		}, [](size_t unit) {
+			(void)unit;
+		});
+	}
+
+	// the queries below take an automaton built by build_from_sorted(), and report words by their index in
+	// the sorted list it was built from. none of them allocates.
+
+	// id of the word of status, which is depth bytes deep, or not_found if status only inherits a tail
+	size_t _own_word(size_t status, size_t depth) const noexcept {
+		const size_t t = units_[status].tail;
+		if ((t == 0) || (tails_[t].match.size() != depth)) {
+			return not_found;
+		}
+		return tails_[t].word;
+	}
+
+	// unit reached from the root by key, or not_found
+	size_t _walk(std::string_view key) const noexcept {
+		if (units_.empty()) {
+			return not_found;
+		}
+		size_t status = 0;
+		for (size_t i = 0; (i < key.size()) && (status != not_found); i++) {
+			status = _child(status, static_cast<uint8_t>(key[i]));
+		}
+		return status;
+	}
+
+	// id of key, or not_found
+	size_t exact_match(std::string_view key) const noexcept {
+		const size_t status = _walk(key);
+		return (status == not_found) ? not_found : _own_word(status, key.size());
+	}
+
+	// cb(length, id) for every word which is a prefix of key, shortest first
+	template <class Callback>
+	void common_prefix_search(std::string_view key, Callback cb) const {
+		if (units_.empty()) {
+			return;
+		}
+		size_t status = 0;
+		for (size_t i = 0; i < key.size(); i++) {
+			status = _child(status, static_cast<uint8_t>(key[i]));
+			if (status == not_found) {
+				return;
+			}
+			const size_t id = _own_word(status, i + 1);
+			if (id != not_found) {
+				cb(i + 1, id);
+			}
+		}
+	}
+
+	// cb(word, id) for every word starting with prefix in byte order, stopping after limit words.
+	// returns the number of words reported
+	template <class Callback>
+	size_t predictive_search(std::string_view prefix, Callback cb, size_t limit = not_found) const {
+		const size_t status = _walk(prefix);
+		if ((status == not_found) || (limit == 0)) {
+			return 0;
+		}
+		size_t left = limit;
+		_predict(status, prefix.size(), cb, left);
+		return limit - left;
+	}
+
+	template <class Callback>
+	void _predict(size_t status, size_t depth, Callback& cb, size_t& left) const {
+		const size_t id = _own_word(status, depth);
+		if (id != not_found) {
+			const auto& match = tails_[units_[status].tail].match;
+			cb(std::string_view{match.data(), match.size()}, id);
+			left--;
+		}
+		const size_t base = units_[status].base;
+		if (((status != 0) && (base == 0)) || (base == unit_type::not_used)) {
+			return; // leaf
+		}
+		for (size_t ch = 0; (ch < 0x100) && (left != 0); ch++) {
+			const size_t child = base + ch;
+			if ((child < units_.size()) && (units_[child].check == status)) {
+				_predict(child, depth + 1, cb, left);
+			}
+		}
+	}
+
+	// stepwise scanning, so that several automata built by build_from_sorted() can walk the same input
+	// in lockstep: next_state() consumes one byte, then for_each_output() reports the words ending there.
+	size_t next_state(size_t status, uint8_t label) const noexcept {
+		for (;;) {
+			const size_t to = units_[status].base + label;
+			if (units_[to].check == status) {
+				return to;
+			}
+			if (status == 0) {
+				return 0;
+			}
+			status = units_[status].fail;
+		}
+	}
+
+	// cb(word, id) for every word ending at status, longest first
+	template <class Callback>
+	void for_each_output(size_t status, Callback cb) const {
+		for (size_t t = units_[status].tail; t != 0; t = tails_[t].next) {
+			cb(std::string_view{tails_[t].match.data(), tails_[t].match.size()}, tails_[t].word);
+		}
+	}
+
+	// matched(end_pos, tail id) for each match, visit(unit) for each unit stepped on
+	template <class MatchCallback, class VisitCallback>
+	void _scan(const std::string_view haystack, MatchCallback matched, VisitCallback visit) const {
 		size_t status = 0;
 		for (size_t i = 0; i < haystack.size();) {
 			const size_t base = units_[status].base;
@@ -183,22 +589,20 @@ struct double_array_trie {
 			if (units_[to].check == status) {
 				status = to;
 				i++;
-				size_t mstatus = status;
-				while (mstatus != 0) {
-					if (units_[mstatus].tail != 0) {
-						const auto& tail = tails_[units_[mstatus].tail];
-						std::string_view match_conv = {tail.match.data(), tail.match.size()};
-						if (haystack.compare(i, tail.tail_size, match_conv, 0, tail.tail_size) == 0) {
-							matched(i + tail.tail_size, std::string_view{tail.match.data(), tail.match.size()});
-						}
+				visit(status);
+				for (size_t t = units_[status].tail; t != 0; t = tails_[t].next) {
+					const auto& tail = tails_[t];
+					std::string_view match_conv = {tail.match.data(), tail.match.size()};
+					if (haystack.compare(i, tail.tail_size, match_conv, 0, tail.tail_size) == 0) {
+						matched(i + tail.tail_size, t);
 					}
-					mstatus = units_[mstatus].fail;
 				}
 			} else {
 				if (status == 0) {
 					i++;
 				} else {
 					status = units_[status].fail;
+					visit(status);
 				}
 			}
 		}
@@ -0,0 +1,535 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <utility>
+#include <limits>
+#include <stdexcept>
+#include <array>
+#include <cassert>
+#include <cstdint>
+
+#include "fastcws/bindings/containers.hpp"
+
+namespace fastcws {
+
+namespace aho_corasick {
+
+// double array trie which can be edited in place, using the relocation scheme of cedar:
+// units are managed in blocks of 256 chained into free lists, and on conflict whichever
+// of the two nodes has fewer children is moved. terminals are children labelled '\0',
+// whose base holds the slot of their value.
+// there are no fail links to maintain, scan() does a prefix search at every position instead.
+template <class Value = uint64_t, class Allocator = std::allocator<int>>
+struct dynamic_double_array_trie {
+	using value_t = Value;
+	using offset_t = int32_t; // negative base & check of a free unit link its neighbours
+	using allocator_traits = std::allocator_traits<Allocator>;
+
+	static constexpr size_t block_size = 0x100;
+	static constexpr offset_t no_child = -1;
+	static constexpr offset_t no_block = -1;
+	static constexpr int16_t not_rejected = block_size + 1;
+	static constexpr int16_t max_trial = 1;
+
+	struct unit_type {
+		offset_t base = no_child;
+		offset_t check = -1;
+	};
+
+	struct ninfo_type {
+		uint8_t child = 0; // label of the first child
+		uint8_t sibling = 0; // label of the next sibling, children are kept sorted so 0 ends the list
+	};
+
+	enum class ring_t : uint8_t { full, closed, open };
+
+	struct block_type {
+		offset_t prev = no_block;
+		offset_t next = no_block;
+		int16_t num = block_size; // free units
+		int16_t reject = not_rejected; // fewest labels failed to fit since last change
+		int16_t trial = 0;
+		ring_t ring = ring_t::open;
+		offset_t ehead = 0; // any free unit
+	};
+
+	vector<unit_type,
+		typename allocator_traits::template rebind_alloc<
+			unit_type>> units_;
+	vector<ninfo_type,
+		typename allocator_traits::template rebind_alloc<
+			ninfo_type>> ninfos_;
+	vector<block_type,
+		typename allocator_traits::template rebind_alloc<
+			block_type>> blocks_;
+	vector<value_t,
+		typename allocator_traits::template rebind_alloc<
+			value_t>> values_;
+	vector<offset_t,
+		typename allocator_traits::template rebind_alloc<
+			offset_t>> free_values_;
+	offset_t open_head_ = no_block; // blocks worth searching for several labels
+	offset_t closed_head_ = no_block; // blocks only good for a single label
+	size_t size_ = 0;
+
+	dynamic_double_array_trie() {
+		_add_block();
+		_pop_enode(0);
+		units_[0].base = no_child;
+		units_[0].check = -1;
+	}
+
+	size_t size() const noexcept {
+		return size_;
+	}
+
+	// inserts key or updates its value, returns whether key is new
+	bool insert(std::string_view key, value_t value) {
+		assert(!key.empty());
+		offset_t s = 0;
+		for (char ch : key) {
+			assert(ch != '\0');
+			s = _follow(s, static_cast<uint8_t>(ch));
+		}
+		offset_t t = _child(s, 0);
+		if (t >= 0) {
+			values_[units_[t].base] = value;
+			return false;
+		}
+		t = _add_child(s, 0);
+		offset_t slot;
+		if (free_values_.empty()) {
+			slot = static_cast<offset_t>(values_.size());
+			values_.push_back(value);
+		} else {
+			slot = free_values_.back();
+			free_values_.pop_back();
+			values_[slot] = value;
+		}
+		units_[t].base = slot;
+		size_++;
+		return true;
+	}
+
+	// returns whether key was present
+	bool erase(std::string_view key) {
+		offset_t s = _find_node(key);
+		if (s < 0) {
+			return false;
+		}
+		offset_t node = _child(s, 0);
+		if (node < 0) {
+			return false;
+		}
+		free_values_.push_back(units_[node].base);
+		for (;;) {
+			offset_t parent = units_[node].check;
+			offset_t parent_base = units_[parent].base;
+			uint8_t label = static_cast<uint8_t>(parent_base ^ node);
+			bool only_child = (ninfos_[parent].child == label) && (ninfos_[node].sibling == 0);
+			_pop_sibling(parent, parent_base, label);
+			_push_enode(node);
+			if (!only_child) {
+				break;
+			}
+			units_[parent].base = no_child;
+			if (parent == 0) {
+				break;
+			}
+			node = parent;
+		}
+		size_--;
+		return true;
+	}
+
+	const value_t* find(std::string_view key) const noexcept {
+		offset_t s = _find_node(key);
+		if (s < 0) {
+			return nullptr;
+		}
+		offset_t t = _child(s, 0);
+		if (t < 0) {
+			return nullptr;
+		}
+		return &values_[units_[t].base];
+	}
+
+	value_t* find(std::string_view key) noexcept {
+		return const_cast<value_t*>(static_cast<const dynamic_double_array_trie*>(this)->find(key));
+	}
+
+	// visits every key in byte order
+	template <class Callback>
+	void for_each(Callback cb) const {
+		std::string key;
+		_for_each(0, key, cb);
+	}
+
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		scan_values(haystack, [&matched](size_t end_pos, std::string_view found, const value_t& value) {
+			(void)value;
+			matched(end_pos, found);
+		});
+	}
+
+	// like scan(), with the value of the key matched, read off the node the match ends at
+	template <class MatchCallback>
+	void scan_values(const std::string_view haystack, MatchCallback matched) const {
+		for (size_t i = 0; i < haystack.size(); i++) {
+			offset_t s = 0;
+			for (size_t j = i; j < haystack.size(); j++) {
+				const offset_t base = units_[s].base;
+				const uint8_t ch = static_cast<uint8_t>(haystack[j]);
+				if ((base < 0) || (ch == 0)) {
+					break;
+				}
+				const offset_t to = base ^ ch;
+				if (units_[to].check != s) {
+					break;
+				}
+				s = to;
+				const offset_t t = units_[s].base;
+				if ((t >= 0) && (units_[t].check == s)) {
+					matched(j + 1, haystack.substr(i, j + 1 - i), values_[units_[t].base]);
+				}
+			}
+		}
+	}
+
+	offset_t _child(offset_t s, uint8_t label) const noexcept {
+		const offset_t base = units_[s].base;
+		if (base < 0) {
+			return -1;
+		}
+		const offset_t to = base ^ label;
+		if (units_[to].check != s) {
+			return -1;
+		}
+		return to;
+	}
+
+	offset_t _find_node(std::string_view key) const noexcept {
+		offset_t s = 0;
+		for (char ch : key) {
+			if (ch == '\0') {
+				return -1;
+			}
+			s = _child(s, static_cast<uint8_t>(ch));
+			if (s < 0) {
+				return -1;
+			}
+		}
+		return s;
+	}
+
+	template <class Callback>
+	void _for_each(offset_t s, std::string& key, Callback& cb) const {
+		const offset_t base = units_[s].base;
+		if (base < 0) {
+			return;
+		}
+		uint8_t label = ninfos_[s].child;
+		for (;;) {
+			const offset_t to = base ^ label;
+			if (label == 0) {
+				cb(std::string_view{key}, values_[units_[to].base]);
+			} else {
+				key.push_back(static_cast<char>(label));
+				_for_each(to, key, cb);
+				key.pop_back();
+			}
+			label = ninfos_[to].sibling;
+			if (label == 0) {
+				break;
+			}
+		}
+	}
+
+	bool _is_free(offset_t u) const noexcept {
+		return (u != 0) && (units_[u].check < 0);
+	}
+
+	offset_t _follow(offset_t s, uint8_t label) {
+		offset_t to = _child(s, label);
+		if (to >= 0) {
+			return to;
+		}
+		return _add_child(s, label);
+	}
+
+	size_t _collect_labels(offset_t s, uint8_t* labels) const noexcept {
+		const offset_t base = units_[s].base;
+		if (base < 0) {
+			return 0;
+		}
+		size_t n = 0;
+		uint8_t label = ninfos_[s].child;
+		for (;;) {
+			labels[n++] = label;
+			label = ninfos_[base ^ label].sibling;
+			if (label == 0) {
+				return n;
+			}
+		}
+	}
+
+	// s may be relocated in the process, hence taken by reference
+	offset_t _add_child(offset_t& s, uint8_t label) {
+		offset_t to;
+		const bool had_children = units_[s].base >= 0;
+		if (!had_children) {
+			units_[s].base = _find_places(&label, 1);
+			to = units_[s].base ^ label;
+		} else {
+			to = units_[s].base ^ label;
+			if (!_is_free(to)) {
+				to = _resolve(s, label);
+			}
+		}
+		_pop_enode(to);
+		units_[to].base = no_child;
+		units_[to].check = s;
+		_push_sibling(s, units_[s].base, label, had_children);
+		return to;
+	}
+
+	// frees slot label of s by moving either s's children or the ones of the current owner,
+	// returns the slot s's new child should take
+	offset_t _resolve(offset_t& s, uint8_t label) {
+		const offset_t to_taken = units_[s].base ^ label;
+		const offset_t owner = units_[to_taken].check;
+
+		std::array<uint8_t, block_size + 1> labels_s;
+		std::array<uint8_t, block_size> labels_owner;
+		size_t num_s = _collect_labels(s, labels_s.data());
+		labels_s[num_s++] = label;
+		size_t num_owner = 0;
+		if (to_taken != 0) {
+			num_owner = _collect_labels(owner, labels_owner.data());
+		}
+
+		if ((to_taken == 0) || (num_s <= num_owner)) {
+			offset_t new_base = _find_places(labels_s.data(), num_s);
+			_relocate(s, new_base, labels_s.data(), num_s - 1, s);
+			return new_base ^ label;
+		}
+		offset_t new_base = _find_places(labels_owner.data(), num_owner);
+		_relocate(owner, new_base, labels_owner.data(), num_owner, s);
+		return to_taken;
+	}
+
+	// moves children of s to new_base, tracking watched in case it is one of them
+	void _relocate(offset_t s, offset_t new_base, const uint8_t* labels, size_t num_labels, offset_t& watched) {
+		const offset_t old_base = units_[s].base;
+		for (size_t i = 0; i < num_labels; i++) {
+			const offset_t old_to = old_base ^ labels[i];
+			const offset_t to = new_base ^ labels[i];
+			_pop_enode(to);
+			units_[to] = units_[old_to];
+			ninfos_[to] = ninfos_[old_to];
+			const offset_t child_base = units_[to].base;
+			if ((labels[i] != 0) && (child_base >= 0)) {
+				uint8_t child_label = ninfos_[to].child;
+				for (;;) {
+					units_[child_base ^ child_label].check = to;
+					child_label = ninfos_[child_base ^ child_label].sibling;
+					if (child_label == 0) {
+						break;
+					}
+				}
+			}
+			if (watched == old_to) {
+				watched = to;
+			}
+			_push_enode(old_to);
+		}
+		units_[s].base = new_base;
+	}
+
+	void _push_sibling(offset_t s, offset_t base, uint8_t label, bool had_children) noexcept {
+		const offset_t to = base ^ label;
+		if (!had_children || (label < ninfos_[s].child)) {
+			ninfos_[to].sibling = had_children ? ninfos_[s].child : 0;
+			ninfos_[s].child = label;
+			return;
+		}
+		uint8_t prev = ninfos_[s].child;
+		for (;;) {
+			uint8_t next = ninfos_[base ^ prev].sibling;
+			if ((next == 0) || (next > label)) {
+				break;
+			}
+			prev = next;
+		}
+		ninfos_[to].sibling = ninfos_[base ^ prev].sibling;
+		ninfos_[base ^ prev].sibling = label;
+	}
+
+	void _pop_sibling(offset_t s, offset_t base, uint8_t label) noexcept {
+		if (ninfos_[s].child == label) {
+			ninfos_[s].child = ninfos_[base ^ label].sibling;
+			return;
+		}
+		uint8_t prev = ninfos_[s].child;
+		while (ninfos_[base ^ prev].sibling != label) {
+			prev = ninfos_[base ^ prev].sibling;
+		}
+		ninfos_[base ^ prev].sibling = ninfos_[base ^ label].sibling;
+	}
+
+	// finds a base under which all labels are free
+	offset_t _find_places(const uint8_t* labels, size_t num_labels) {
+		if (num_labels == 1) {
+			offset_t bi = (closed_head_ != no_block) ? closed_head_ : open_head_;
+			if (bi == no_block) {
+				bi = _add_block();
+			}
+			return blocks_[bi].ehead ^ labels[0];
+		}
+		if (open_head_ != no_block) {
+			offset_t bi = open_head_;
+			const offset_t last = blocks_[bi].prev;
+			for (;;) {
+				block_type& b = blocks_[bi];
+				const offset_t next = b.next;
+				const bool is_last = (bi == last);
+				if ((b.num >= static_cast<int16_t>(num_labels)) && (static_cast<int16_t>(num_labels) < b.reject)) {
+					offset_t e = b.ehead;
+					do {
+						const offset_t base = e ^ labels[0];
+						bool good = true;
+						for (size_t i = 1; i < num_labels; i++) {
+							if (!_is_free(base ^ labels[i])) {
+								good = false;
+								break;
+							}
+						}
+						if (good) {
+							return base;
+						}
+						e = -units_[e].check;
+					} while (e != b.ehead);
+					b.reject = static_cast<int16_t>(num_labels);
+					if (++b.trial == max_trial) {
+						_transfer(bi, open_head_, closed_head_, ring_t::closed);
+					}
+				}
+				if (is_last) {
+					break;
+				}
+				bi = next;
+			}
+		}
+		offset_t bi = _add_block();
+		return static_cast<offset_t>(bi * block_size) ^ labels[0];
+	}
+
+	offset_t _add_block() {
+		const offset_t bi = static_cast<offset_t>(blocks_.size());
+		const size_t begin = bi * block_size;
+		if (begin + block_size >= static_cast<size_t>(std::numeric_limits<offset_t>::max())) {
+			throw std::overflow_error{"fastcws::dynamic_double_array_trie: too many units"};
+		}
+		units_.resize(begin + block_size);
+		ninfos_.resize(begin + block_size);
+		for (size_t i = 0; i < block_size; i++) {
+			units_[begin + i].base = -static_cast<offset_t>(begin + (i + block_size - 1) % block_size);
+			units_[begin + i].check = -static_cast<offset_t>(begin + (i + 1) % block_size);
+		}
+		blocks_.emplace_back();
+		blocks_.back().ehead = static_cast<offset_t>(begin);
+		_ring_push(open_head_, bi);
+		return bi;
+	}
+
+	void _pop_enode(offset_t e) {
+		const offset_t bi = e / block_size;
+		block_type& b = blocks_[bi];
+		b.num--;
+		if (b.num == 0) {
+			_ring_erase(b.ring == ring_t::open ? open_head_ : closed_head_, bi);
+			b.ring = ring_t::full;
+		} else {
+			const offset_t prev = -units_[e].base;
+			const offset_t next = -units_[e].check;
+			units_[prev].check = -next;
+			units_[next].base = -prev;
+			if (b.ehead == e) {
+				b.ehead = next;
+			}
+			if ((b.num == 1) && (b.ring == ring_t::open)) {
+				_transfer(bi, open_head_, closed_head_, ring_t::closed);
+			}
+		}
+		ninfos_[e] = ninfo_type{};
+	}
+
+	void _push_enode(offset_t e) {
+		const offset_t bi = e / block_size;
+		block_type& b = blocks_[bi];
+		b.num++;
+		if (b.num == 1) {
+			units_[e].base = -e;
+			units_[e].check = -e;
+			b.ehead = e;
+			b.ring = ring_t::closed;
+			_ring_push(closed_head_, bi);
+		} else {
+			const offset_t next = b.ehead;
+			const offset_t prev = -units_[next].base;
+			units_[e].base = -prev;
+			units_[e].check = -next;
+			units_[prev].check = -e;
+			units_[next].base = -e;
+			if (b.ring == ring_t::closed) {
+				b.trial = 0;
+				_transfer(bi, closed_head_, open_head_, ring_t::open);
+			}
+		}
+		b.reject = not_rejected;
+		ninfos_[e] = ninfo_type{};
+	}
+
+	void _ring_push(offset_t& head, offset_t bi) noexcept {
+		block_type& b = blocks_[bi];
+		if (head == no_block) {
+			b.prev = bi;
+			b.next = bi;
+			head = bi;
+			return;
+		}
+		const offset_t tail = blocks_[head].prev;
+		b.prev = tail;
+		b.next = head;
+		blocks_[tail].next = bi;
+		blocks_[head].prev = bi;
+	}
+
+	void _ring_erase(offset_t& head, offset_t bi) noexcept {
+		block_type& b = blocks_[bi];
+		if (b.next == bi) {
+			head = no_block;
+			return;
+		}
+		blocks_[b.prev].next = b.next;
+		blocks_[b.next].prev = b.prev;
+		if (head == bi) {
+			head = b.next;
+		}
+	}
+
+	void _transfer(offset_t bi, offset_t& from_head, offset_t& to_head, ring_t to_ring) noexcept {
+		_ring_erase(from_head, bi);
+		_ring_push(to_head, bi);
+		blocks_[bi].ring = to_ring;
+	}
+};
+
+}
+
+}
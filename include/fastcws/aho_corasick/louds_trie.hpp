@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <utility>
+#include <limits>
+#include <stdexcept>
+#include <iterator>
+#include <array>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+
+#include "fastcws/bindings/containers.hpp"
+#include "fastcws/misc/bit_vector.hpp"
+
+namespace fastcws {
+
+namespace aho_corasick {
+
+// succinct trie in level order unary degree sequence, built once from sorted words.
+// every node takes 2 bits of louds_, a label byte and a bit in terminals_ & tail_flags_.
+// a subtree holding a single word is cut off and its remaining bytes are kept in tails_.
+// like dynamic_double_array_trie, scan() does a prefix search at every position.
+template <class Value = uint64_t, class Allocator = std::allocator<int>>
+struct louds_trie {
+	using value_t = Value;
+	using allocator_traits = std::allocator_traits<Allocator>;
+	using bit_vector_type = bit_vector<Allocator>;
+
+	static constexpr size_t not_found = std::numeric_limits<size_t>::max();
+	static constexpr size_t min_tail_size = 2;
+
+	bit_vector_type louds_; // 1^degree 0 for each node in level order, root being node 0
+	vector<uint8_t,
+		typename allocator_traits::template rebind_alloc<
+			uint8_t>> labels_; // by node, labels_[0] is unused
+	bit_vector_type terminals_; // word ids are ranks in here
+	bit_vector_type tail_flags_;
+	vector<char,
+		typename allocator_traits::template rebind_alloc<
+			char>> tails_;
+	vector<uint32_t,
+		typename allocator_traits::template rebind_alloc<
+			uint32_t>> tail_offsets_;
+	vector<value_t,
+		typename allocator_traits::template rebind_alloc<
+			value_t>> values_; // by word id
+	std::array<uint32_t, 0x100> root_children_{}; // every scan restarts at root, so its children are looked up directly
+
+	size_t size() const noexcept {
+		return values_.size();
+	}
+
+	// words sorted in byte order, word_of(*it) & value_of(*it) give the word and its value,
+	// of duplicated words the first one is kept
+	template <class SortedIterator, class WordOf, class ValueOf>
+	void build_from_sorted(SortedIterator first, SortedIterator last, WordOf word_of, ValueOf value_of, bool quiet=false) {
+		louds_ = {};
+		labels_ = {};
+		terminals_ = {};
+		tail_flags_ = {};
+		tails_ = {};
+		tail_offsets_ = {};
+		values_ = {};
+
+		while ((first != last) && std::string_view{word_of(*first)}.empty()) {
+			first++;
+		}
+		const size_t total = std::distance(first, last);
+
+		struct pending_t {
+			SortedIterator first;
+			SortedIterator last;
+			size_t depth;
+		};
+		queue<pending_t> q;
+		q.push(pending_t{first, last, 0});
+		labels_.push_back(0);
+		tail_offsets_.push_back(0);
+		size_t count = 0;
+		while (!q.empty()) {
+			auto [node_first, node_last, depth] = q.front();
+			q.pop();
+
+			bool terminal = false;
+			while ((node_first != node_last) && (std::string_view{word_of(*node_first)}.size() == depth)) {
+				if (!terminal) {
+					values_.push_back(value_of(*node_first));
+					terminal = true;
+				}
+				node_first++;
+			}
+
+			bool tail = false;
+			if (!terminal && (node_first != node_last) && (depth != 0)) {
+				std::string_view word{word_of(*node_first)};
+				auto it = node_first;
+				while ((it != node_last) && (std::string_view{word_of(*it)} == word)) {
+					it++;
+				}
+				if ((it == node_last) && ((word.size() - depth) >= min_tail_size)) {
+					std::copy(word.cbegin() + depth, word.cend(), std::back_inserter(tails_));
+					if (tails_.size() >= std::numeric_limits<uint32_t>::max()) {
+						throw std::overflow_error{"fastcws::louds_trie: tails too long"};
+					}
+					tail_offsets_.push_back(static_cast<uint32_t>(tails_.size()));
+					values_.push_back(value_of(*node_first));
+					tail = true;
+					terminal = true;
+					node_first = node_last;
+				}
+			}
+			terminals_.push_back(terminal);
+			tail_flags_.push_back(tail);
+
+			while (node_first != node_last) {
+				const char label = std::string_view{word_of(*node_first)}[depth];
+				auto group_last = node_first;
+				while ((group_last != node_last) && (std::string_view{word_of(*group_last)}[depth] == label)) {
+					group_last++;
+				}
+				louds_.push_back(true);
+				labels_.push_back(static_cast<uint8_t>(label));
+				q.push(pending_t{node_first, group_last, depth + 1});
+				node_first = group_last;
+			}
+			louds_.push_back(false);
+
+			if (!quiet && terminal) {
+				if ((count % 1000) == 0) {
+					double pct = count * 100.0 / total;
+					std::cout << "\r" // remove curr line
+						<< pct << "% (" << count << "/" << total << ") ...     ";
+					std::flush(std::cout);
+				}
+				count++;
+			}
+		}
+
+		louds_.finalize();
+		terminals_.finalize();
+		tail_flags_.finalize();
+		labels_.shrink_to_fit();
+		tails_.shrink_to_fit();
+		tail_offsets_.shrink_to_fit();
+		values_.shrink_to_fit();
+
+		root_children_.fill(0);
+		auto [child, degree] = _children(0);
+		for (size_t i = 0; i < degree; i++) {
+			root_children_[labels_[child + i]] = static_cast<uint32_t>(child + i);
+		}
+
+		if (!quiet) {
+			std::cout << "\r" // remove curr line
+				<< "done.      " << std::endl;
+		}
+	}
+
+	// first child & number of children of node
+	std::pair<size_t, size_t> _children(size_t node) const noexcept {
+		const size_t pos = (node == 0) ? 0 : (louds_.select0(node - 1) + 1);
+		return {pos - node + 1, louds_.ones_from(pos)};
+	}
+
+	size_t _child(size_t node, uint8_t label) const noexcept {
+		if (node == 0) {
+			return (root_children_[label] == 0) ? not_found : root_children_[label];
+		}
+		auto [child, degree] = _children(node);
+		const uint8_t* begin = labels_.data() + child;
+		const uint8_t* end = begin + degree;
+		const uint8_t* it = std::lower_bound(begin, end, label);
+		if ((it == end) || (*it != label)) {
+			return not_found;
+		}
+		return child + (it - begin);
+	}
+
+	std::string_view _tail(size_t node) const noexcept {
+		const size_t tail_id = tail_flags_.rank1(node);
+		const size_t begin = tail_offsets_[tail_id];
+		return std::string_view{tails_.data() + begin, tail_offsets_[tail_id + 1] - begin};
+	}
+
+	const value_t& _value(size_t node) const noexcept {
+		return values_[terminals_.rank1(node)];
+	}
+
+	const value_t* find(std::string_view key) const noexcept {
+		if (values_.empty()) {
+			return nullptr;
+		}
+		size_t node = 0;
+		for (size_t i = 0; i < key.size(); i++) {
+			if (tail_flags_[node]) {
+				return (key.substr(i) == _tail(node)) ? &_value(node) : nullptr;
+			}
+			node = _child(node, static_cast<uint8_t>(key[i]));
+			if (node == not_found) {
+				return nullptr;
+			}
+		}
+		if ((node == 0) || !terminals_[node] || tail_flags_[node]) {
+			return nullptr;
+		}
+		return &_value(node);
+	}
+
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		scan_values(haystack, [&matched](size_t end_pos, std::string_view found, const value_t& value) {
+			(void)value;
+			matched(end_pos, found);
+		});
+	}
+
+	// like scan(), with the value of the key matched, read off the node the match ends at
+	template <class MatchCallback>
+	void scan_values(const std::string_view haystack, MatchCallback matched) const {
+		if (values_.empty()) {
+			return;
+		}
+		for (size_t i = 0; i < haystack.size(); i++) {
+			size_t node = 0;
+			for (size_t j = i;;) {
+				if (tail_flags_[node]) {
+					std::string_view tail = _tail(node);
+					if (haystack.compare(j, tail.size(), tail) == 0) {
+						matched(j + tail.size(), haystack.substr(i, j + tail.size() - i), _value(node));
+					}
+					break;
+				}
+				if ((node != 0) && terminals_[node]) {
+					matched(j, haystack.substr(i, j - i), _value(node));
+				}
+				if (j == haystack.size()) {
+					break;
+				}
+				node = _child(node, static_cast<uint8_t>(haystack[j]));
+				if (node == not_found) {
+					break;
+				}
+				j++;
+			}
+		}
+	}
+
+	// visits every word in byte order
+	template <class Callback>
+	void for_each(Callback cb) const {
+		if (values_.empty()) {
+			return;
+		}
+		std::string key;
+		_for_each(0, key, cb);
+	}
+
+	template <class Callback>
+	void _for_each(size_t node, std::string& key, Callback& cb) const {
+		if (tail_flags_[node]) {
+			std::string_view tail = _tail(node);
+			key.append(tail.data(), tail.size());
+			cb(std::string_view{key}, _value(node));
+			key.resize(key.size() - tail.size());
+			return;
+		}
+		if ((node != 0) && terminals_[node]) {
+			cb(std::string_view{key}, _value(node));
+		}
+		auto [child, degree] = _children(node);
+		for (size_t i = 0; i < degree; i++) {
+			key.push_back(static_cast<char>(labels_[child + i]));
+			_for_each(child + i, key, cb);
+			key.pop_back();
+		}
+	}
+
+	size_t bytes_used() const noexcept {
+		return louds_.bytes_used()
+			+ labels_.size() * sizeof(uint8_t)
+			+ terminals_.bytes_used()
+			+ tail_flags_.bytes_used()
+			+ tails_.size() * sizeof(char)
+			+ tail_offsets_.size() * sizeof(uint32_t)
+			+ values_.size() * sizeof(value_t)
+			+ sizeof(root_children_);
+	}
+};
+
+}
+
+}
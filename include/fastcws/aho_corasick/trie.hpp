@@ -25,6 +25,7 @@ struct trie_node {
 	char ch;
 	size_t parent;
 	size_t fail;
+	size_t output = 0; // nearest node down the fail chain with a result, 0 if none
 	map<char, size_t,
 		std::less<char>,
 		typename allocator_traits::template rebind_alloc<
@@ -97,6 +98,8 @@ struct trie {
 					}
 					curr = &nodes_[curr->fail];
 				}
+				const trie_node_type& fail = nodes_[child.fail];
+				child.output = (fail.result.size() != 0) ? fail.id : fail.output;
 				q.push(child.id);
 			}
 		}
@@ -129,11 +132,12 @@ struct trie {
 				state->node = &nodes_[state->node->children.at(haystack[i])];
 				i++;
 				const auto* mnode = state->node;
+				if (mnode->result.size() == 0) {
+					mnode = &nodes_[mnode->output];
+				}
 				while (mnode->id != 0) {
-					if (mnode->result.size() != 0) {
-						matched(i, std::string_view{mnode->result.data(), mnode->result.size()});
-					}
-					mnode = &nodes_[mnode->fail];
+					matched(i, std::string_view{mnode->result.data(), mnode->result.size()});
+					mnode = &nodes_[mnode->output];
 				}
 			} else {
 				if (state->node->id == 0) {
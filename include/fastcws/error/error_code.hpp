@@ -11,9 +11,11 @@ enum class errc : int {
 	io_error = -2,
 	bad_encoding = -3,
 	overflow_error = -4,
+	resource_busy = -5,
+	invalid_argument = -6,
 
 	// marks the minium valid errc
-	last_errc = -4
+	last_errc = -6
 };
 
 namespace details {
@@ -28,7 +30,11 @@ inline constexpr const char *const error_messages[] = {
 	// -3 = errc::bad_encoding
 	"input is not a valid utf-8 sequence",
 	// -4 = errc::overflow_error
-	"attempting to access an object beyong its limit"
+	"attempting to access an object beyong its limit",
+	// -5 = errc::resource_busy
+	"resource already in use, only one may be loaded at a time",
+	// -6 = errc::invalid_argument
+	"invalid argument"
 };
 
 }
@@ -3,12 +3,18 @@
 #pragma once
 
 #include <string_view>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
 
 #include "fastcws/freq_dict.hpp"
 #include "fastcws/word_dag.hpp"
 #include "fastcws/hmm.hpp"
 #include "fastcws/misc/rune_hopper.hpp"
 #include "fastcws/misc/special_hopper.hpp"
+#include "fastcws/misc/decoded_runes.hpp"
+#include "fastcws/error.hpp"
 
 namespace fastcws {
 
@@ -17,6 +23,16 @@ const inline no_dict_t no_dict{};
 class no_hmm_model_t{};
 const inline no_hmm_model_t no_hmm_model{};
 
+// whether the add_edges() of HMMModel takes the runes decoded by build_dag(), which otherwise it decodes itself
+template <class HMMModel, class WordDag, class RuneHopper, class = void>
+struct _takes_decoded_runes : std::false_type {};
+
+template <class HMMModel, class WordDag, class RuneHopper>
+struct _takes_decoded_runes<HMMModel, WordDag, RuneHopper, std::void_t<decltype(
+	std::declval<const HMMModel&>().template add_edges<WordDag, RuneHopper>(
+		std::declval<WordDag&>(), std::declval<typename WordDag::weight_t>(), std::declval<const decoded_runes&>()))>>
+	: std::true_type {};
+
 template <
 	class Dict,
 	class HMMModel,
@@ -39,19 +55,24 @@ WordDag build_dag(std::string_view sentence, const Dict& dict, const HMMModel& h
 	}
 	
 	WordDag dag{sentence};
-	populate_rune_chain<RuneHopper>(dag, single_rune_edge_weight);
-	add_special_edges(dag);
+	// the runes are split, decoded & classified once for every stage but the dict, whose automata scan bytes
+	const auto runes = decoded_runes::decode<RuneHopper>(sentence);
+	populate_rune_chain(dag, runes, single_rune_edge_weight);
+	add_special_edges(dag, runes);
 	if constexpr (!std::is_same_v<dict_t, no_dict_t>) {
 		dict.add_edges(dag);
 	}
-	if constexpr (!std::is_same_v<hmm_model_t, no_hmm_model_t>) {
+	// last, so that hmm::wseg_4tag::oov_only sees what the dict covers
+	if constexpr (_takes_decoded_runes<hmm_model_t, dag_t, rune_hopper_t>::value) {
+		hmm_model.template add_edges<dag_t, rune_hopper_t>(dag, hmm_edge_weight, runes);
+	} else if constexpr (!std::is_same_v<hmm_model_t, no_hmm_model_t>) {
 		hmm_model.template add_edges<dag_t, rune_hopper_t>(dag, hmm_edge_weight);
 	}
 	return dag;
 }
 
 template <class WordDag, class StringViewOutputIterator>
-void word_break_by_dag(const WordDag& dag, StringViewOutputIterator out) {
+StringViewOutputIterator word_break_by_dag(const WordDag& dag, StringViewOutputIterator out) {
 	auto sp = kahn(dag);
 	size_t ws = 0;
 	for (auto we : sp.path) {
@@ -60,6 +81,124 @@ void word_break_by_dag(const WordDag& dag, StringViewOutputIterator out) {
 		out++;
 	}
 	*out = dag.sentence().substr(ws);
+	out++;
+	return out;
+}
+
+// sentences longer than this are segmented chunk by chunk. it bounds the size of every dag, so that
+// time per byte & memory stay flat on untrusted input such as megabyte-long lines without delimiters.
+inline constexpr size_t max_dag_sentence_size = 16UL * 1024UL;
+
+// end of the chunk of sentence starting at begin, no longer than max_size unless a single rune is.
+// it is cut right after the last whitespace or line break in the second half of the chunk if any,
+// otherwise at the last rune boundary.
+template <
+	class RuneHopper = rune_hopper::utf8_hopper,
+	class SpecialHopper = special_hopper::utf8_special_hopper
+>
+size_t chunk_end(std::string_view sentence, size_t begin, size_t max_size) {
+	if ((sentence.size() - begin) <= max_size) {
+		return sentence.size();
+	}
+	size_t rune_end = begin;
+	size_t preferred_end = begin;
+	for (size_t i = begin; i < sentence.size();) {
+		size_t hop_over = RuneHopper::hop(sentence[i]);
+		if ((i + hop_over) > sentence.size()) {
+			throw exception::bad_encoding{};
+		}
+		if (((i + hop_over - begin) > max_size) && (rune_end != begin)) {
+			break;
+		}
+		special_t sp = SpecialHopper::classify_special(sentence.substr(i, hop_over));
+		i += hop_over;
+		rune_end = i;
+		if ((sp == special_t::whitespace) || (sp == special_t::crlf) || (sp == special_t::cn_taitou)) {
+			preferred_end = i;
+		}
+	}
+	if ((preferred_end - begin) > (max_size / 2)) {
+		return preferred_end;
+	}
+	return rune_end;
+}
+
+// how far before the cut chunk_end() with a dict looks for a boundary no dict word spans, & the longest
+// word in bytes it is sure to see spanning one
+inline constexpr size_t chunk_backoff_size = 256;
+inline constexpr size_t max_chunk_word_size = 64;
+
+// like chunk_end(), backing off from the cut to the last rune boundary no word of dict spans, so that cutting
+// the sentence does not split dict words. the cut is kept if every boundary within chunk_backoff_size before it
+// is spanned, and for encodings other than utf-8, whose rune boundaries cannot be told apart going backwards
+template <
+	class RuneHopper = rune_hopper::utf8_hopper,
+	class SpecialHopper = special_hopper::utf8_special_hopper,
+	class WordDag = word_dag::dag<>,
+	class Dict
+>
+size_t chunk_end(std::string_view sentence, size_t begin, size_t max_size, const Dict& dict) {
+	const size_t end = chunk_end<RuneHopper, SpecialHopper>(sentence, begin, max_size);
+	if constexpr (std::is_same_v<Dict, no_dict_t> || !std::is_same_v<RuneHopper, rune_hopper::utf8_hopper>) {
+		(void)dict;
+		return end;
+	} else {
+		if (end == sentence.size()) {
+			return end;
+		}
+		auto is_boundary = [sentence](size_t i) {
+			return (i == sentence.size()) || ((static_cast<uint8_t>(sentence[i]) & 0xc0) != 0x80);
+		};
+		// the words around the cut, a word starting before lo being seen only if it ends before lo + max_chunk_word_size
+		size_t lo = ((end - begin) > (chunk_backoff_size + max_chunk_word_size))
+			? (end - chunk_backoff_size - max_chunk_word_size) : begin;
+		while (!is_boundary(lo)) {
+			lo++;
+		}
+		size_t hi = std::min(sentence.size(), end + max_chunk_word_size);
+		while (!is_boundary(hi)) {
+			hi++;
+		}
+		WordDag window{sentence.substr(lo, hi - lo)};
+		dict.add_edges(window);
+		vector<bool> spanned(hi - lo + 1, false);
+		for (size_t from = 0; from <= (hi - lo); from++) {
+			for (const auto& edge : window.adjacents(from)) {
+				for (size_t i = from + 1; i < edge.first; i++) {
+					spanned[i] = true;
+				}
+			}
+		}
+		const size_t first = (lo == begin) ? (begin + 1) : (lo + max_chunk_word_size);
+		for (size_t i = end; i >= first; i--) {
+			if (is_boundary(i) && !spanned[i - lo]) {
+				return i;
+			}
+		}
+		return end;
+	}
+}
+
+// calls f(dag) with the dag of every chunk of sentence in order. sentences longer than max_dag_sentence_size
+// are segmented chunk by chunk, cut where chunk_end() with dict finds no dict word spanning the cut
+template <
+	class WordDag,
+	class RuneHopper,
+	class Dict,
+	class HMMModel,
+	class Callback
+>
+void for_each_dag(std::string_view sentence, const Dict& dict, const HMMModel& hmm_model, Callback f) {
+	if (sentence.size() <= max_dag_sentence_size) {
+		f(build_dag<Dict, HMMModel, RuneHopper, WordDag>(sentence, dict, hmm_model));
+		return;
+	}
+	for (size_t begin = 0; begin < sentence.size();) {
+		size_t end = chunk_end<RuneHopper, special_hopper::utf8_special_hopper, WordDag>(sentence, begin,
+			max_dag_sentence_size, dict);
+		f(build_dag<Dict, HMMModel, RuneHopper, WordDag>(sentence.substr(begin, end - begin), dict, hmm_model));
+		begin = end;
+	}
 }
 
 template <
@@ -70,9 +209,54 @@ template <
 	class WordDag = word_dag::dag<>
 >
 void word_break(std::string_view sentence, StringViewOutputIterator out, const Dict& dict, const HMMModel& hmm_model) {
-	auto dag = build_dag<Dict, HMMModel, RuneHopper, WordDag>(sentence, dict, hmm_model);
-	word_break_by_dag(dag, out);
+	for_each_dag<WordDag, RuneHopper>(sentence, dict, hmm_model, [&out](const WordDag& dag) {
+		out = word_break_by_dag(dag, out);
+	});
+}
+
+// like word_break(), writing the pairs (word, const Dict::attributes_type*) instead: the attributes of the dict
+// word, nullptr for the other tokens, e.g. those segmented by the hmm model. they are those of the dict edges on
+// the shortest path, no word is looked up again
+template <
+	class Dict,
+	class HMMModel,
+	class OutputIterator,
+	class RuneHopper = rune_hopper::utf8_hopper,
+	class WordDag = word_dag::id_dag<>
+>
+void word_break_with_attributes(std::string_view sentence, OutputIterator out, const Dict& dict, const HMMModel& hmm_model) {
+	static_assert(Dict::has_attributes && Dict::has_word_ids, "Dict must have attributes & word ids");
+	static_assert(WordDag::no_id == Dict::not_found);
+	for_each_dag<WordDag, RuneHopper>(sentence, dict, hmm_model, [&out, &dict](const WordDag& dag) {
+		auto emit = [&out, &dict, &dag](size_t ws, size_t we) {
+			const size_t id = dag.word_id(ws, we);
+			*out = std::make_pair(dag.sentence().substr(ws, we - ws), (id == WordDag::no_id) ? nullptr : &dict.attributes_at(id));
+			out++;
+		};
+		auto sp = kahn(dag);
+		size_t ws = 0;
+		for (auto we : sp.path) {
+			emit(ws, we);
+			ws = we;
+		}
+		emit(ws, dag.end());
+	});
 }
 
+// words count as dictionary words for this call only, see freq_dict::ephemeral_words
+template <
+	class Dict,
+	class HMMModel,
+	class StringViewOutputIterator,
+	class WordsAllocator,
+	class RuneHopper = rune_hopper::utf8_hopper,
+	class WordDag = word_dag::dag<>
+>
+void word_break(std::string_view sentence, StringViewOutputIterator out, const Dict& dict, const HMMModel& hmm_model,
+		const freq_dict::ephemeral_words<WordsAllocator>& words) {
+	using ephemeral_dict_t = freq_dict::ephemeral_dict<Dict, freq_dict::ephemeral_words<WordsAllocator>>;
+	word_break<ephemeral_dict_t, HMMModel, StringViewOutputIterator, RuneHopper, WordDag>(
+		sentence, out, ephemeral_dict_t{dict, words}, hmm_model);
 }
 
+}
@@ -4,4 +4,6 @@
 
 #include "fastcws/freq_dict/dict.hpp"
 #include "fastcws/freq_dict/io.hpp"
-
+#include "fastcws/freq_dict/layered_dict.hpp"
+#include "fastcws/freq_dict/compact_dict.hpp"
+#include "fastcws/freq_dict/ephemeral_words.hpp"
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+
+namespace fastcws {
+
+namespace freq_dict {
+
+// per-word attributes of a dict are any trivially copyable type providing
+// static Attributes from_columns(std::string_view columns), which parses the columns following the frequency
+// in a dictionary file. they are stored in one array indexed by word id, next to the frequencies.
+struct no_attributes {
+	static no_attributes from_columns(std::string_view columns) noexcept {
+		(void)columns;
+		return {};
+	}
+};
+
+// part of speech tag from the column following the frequency, e.g. `n`, `nr` or `eng`, up to 4 bytes
+struct pos_tag {
+	std::array<char, 4> tag{};
+
+	std::string_view view() const noexcept {
+		return std::string_view{tag.data(), static_cast<size_t>(std::find(tag.cbegin(), tag.cend(), '\0') - tag.cbegin())};
+	}
+
+	static pos_tag from_columns(std::string_view columns) noexcept {
+		pos_tag ret;
+		const size_t end = std::min(columns.find_first_of(" \t"), columns.size());
+		std::copy_n(columns.data(), std::min(end, ret.tag.size()), ret.tag.begin());
+		return ret;
+	}
+};
+
+template <class Dict, class = void>
+struct _attributes_of {
+	using type = no_attributes;
+};
+
+template <class Dict>
+struct _attributes_of<Dict, std::void_t<typename Dict::attributes_type>> {
+	using type = typename Dict::attributes_type;
+};
+
+// attributes type of Dict, no_attributes for dict-like types which have none
+template <class Dict>
+using attributes_of_t = typename _attributes_of<Dict>::type;
+
+}
+
+}
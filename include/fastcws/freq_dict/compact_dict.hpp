@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "fastcws/bindings/containers.hpp"
+#include "fastcws/aho_corasick/double_array_trie.hpp"
+#include "fastcws/misc/log2.hpp"
+
+namespace fastcws {
+
+namespace freq_dict {
+
+struct compact_options {
+	uint64_t min_freq = 0; // words less frequent are pruned
+	double coverage = 1.0; // only the most frequent words making up this share of the total frequency are kept
+	unsigned cost_bits = 16; // weights are quantized to 2^cost_bits buckets
+};
+
+// read only dictionary built offline from a dict by build_from(), for memory constrained deployments.
+// words may be pruned, frequencies are quantized to cost buckets (the weight of an edge in bits), and words
+// are front coded in buckets of front_coding_bucket. the double array keeps its units, while the tails are
+// replaced by per-word lengths & output links, so a word costs a few bytes besides its share of units.
+// provides the add_edges() / suggest_*_weight() interface used by build_dag().
+template <class Allocator = std::allocator<int>, class Offset = uint32_t, class Cost = uint16_t>
+struct compact_dict {
+	static_assert(std::is_unsigned_v<Offset> && std::is_unsigned_v<Cost>, "Offset & Cost must be unsigned integer types");
+	using allocator_traits = std::allocator_traits<Allocator>;
+	using offset_t = Offset;
+
+	static constexpr size_t front_coding_bucket = 16;
+	static constexpr size_t not_found = std::numeric_limits<size_t>::max();
+
+	struct unit_type {
+		offset_t base;
+		offset_t check;
+		offset_t fail;
+		offset_t output; // 1 + id of the longest word ending here, 0 if none
+	};
+
+	vector<unit_type,
+		typename allocator_traits::template rebind_alloc<
+			unit_type>> units_;
+	vector<uint16_t,
+		typename allocator_traits::template rebind_alloc<
+			uint16_t>> lengths_; // by word id
+	vector<offset_t,
+		typename allocator_traits::template rebind_alloc<
+			offset_t>> next_output_; // by word id, 1 + id of the next word down the fail chain, 0 if none
+	vector<Cost,
+		typename allocator_traits::template rebind_alloc<
+			Cost>> costs_; // by word id
+	vector<char,
+		typename allocator_traits::template rebind_alloc<
+			char>> strings_; // front coded words
+	vector<offset_t,
+		typename allocator_traits::template rebind_alloc<
+			offset_t>> string_buckets_; // offset in strings_ of every front_coding_bucket-th word
+	double cost_step_ = 0;
+	uint64_t total_ = 0;
+
+	size_t size() const noexcept {
+		return lengths_.size();
+	}
+
+	static void _check_size(size_t n) {
+		if (n >= static_cast<size_t>(std::numeric_limits<offset_t>::max())) {
+			throw std::overflow_error{"fastcws::compact_dict: offset_t too narrow for this dictionary"};
+		}
+	}
+
+	void _put_varint(size_t v) {
+		while (v >= 0x80) {
+			strings_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+			v >>= 7;
+		}
+		strings_.push_back(static_cast<char>(v));
+	}
+
+	size_t _get_varint(size_t& pos) const noexcept {
+		size_t v = 0;
+		for (size_t shift = 0;; shift += 7) {
+			const uint8_t b = static_cast<uint8_t>(strings_[pos++]);
+			v |= static_cast<size_t>(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) {
+				return v;
+			}
+		}
+	}
+
+	// src is any finalized dict, its total frequency is kept so that weights & suggestions stay comparable
+	template <class Dict>
+	void build_from(const Dict& src, const compact_options& opt = {}, bool quiet=true) {
+		if ((opt.cost_bits == 0) || (opt.cost_bits > std::numeric_limits<Cost>::digits)) {
+			throw std::invalid_argument{"fastcws::compact_dict: cost_bits does not fit Cost"};
+		}
+		units_ = {};
+		lengths_ = {};
+		next_output_ = {};
+		costs_ = {};
+		strings_ = {};
+		string_buckets_ = {};
+		total_ = src.total_;
+
+		// the words are borrowed from src, which outlives this function
+		vector<std::pair<std::string_view, uint64_t>> words;
+		src.for_each_word([&words](std::string_view word, uint64_t freq) {
+			if (words.empty() || (words.back().first != word)) {
+				words.emplace_back(word, freq);
+			}
+		});
+
+		uint64_t min_kept_freq = opt.min_freq;
+		if (opt.coverage < 1.0) {
+			vector<uint64_t> freqs;
+			uint64_t sum = 0;
+			for (const auto& [word, freq] : words) {
+				freqs.push_back(freq);
+				sum += freq;
+			}
+			std::sort(freqs.begin(), freqs.end(), std::greater<uint64_t>{});
+			// words as frequent as the last one needed are kept too
+			uint64_t covered = 0;
+			for (uint64_t freq : freqs) {
+				covered += freq;
+				if (static_cast<double>(covered) >= opt.coverage * static_cast<double>(sum)) {
+					min_kept_freq = std::max(min_kept_freq, freq);
+					break;
+				}
+			}
+		}
+		words.erase(std::remove_if(words.begin(), words.end(), [min_kept_freq](const auto& word_freq) {
+			return (word_freq.second < min_kept_freq) || (word_freq.second == 0);
+		}), words.end());
+		_check_size(words.size() + 1);
+
+		uint64_t min_freq = std::numeric_limits<uint64_t>::max();
+		for (const auto& [word, freq] : words) {
+			if (word.size() > std::numeric_limits<uint16_t>::max()) {
+				throw std::overflow_error{"fastcws::compact_dict: word too long"};
+			}
+			min_freq = std::min(min_freq, freq);
+		}
+		const double log2_total = calc_log2<double>::log2(total_);
+		const double max_cost = words.empty() ? 0 : (log2_total - calc_log2<double>::log2(min_freq));
+		const double buckets = static_cast<double>((uint64_t{1} << opt.cost_bits) - 1);
+		cost_step_ = (max_cost > 0) ? (max_cost / buckets) : 1;
+
+		std::string_view prev;
+		for (size_t id = 0; id < words.size(); id++) {
+			const auto [word, freq] = words[id];
+			lengths_.push_back(static_cast<uint16_t>(word.size()));
+			const double cost = std::max(log2_total - calc_log2<double>::log2(freq), 0.0);
+			costs_.push_back(static_cast<Cost>(std::min(std::round(cost / cost_step_), buckets)));
+
+			if ((id % front_coding_bucket) == 0) {
+				_check_size(strings_.size());
+				string_buckets_.push_back(static_cast<offset_t>(strings_.size()));
+				_put_varint(word.size());
+				strings_.insert(strings_.end(), word.cbegin(), word.cend());
+			} else {
+				const size_t lcp = std::mismatch(prev.cbegin(), prev.cend(), word.cbegin(), word.cend()).first - prev.cbegin();
+				_put_varint(lcp);
+				_put_varint(word.size() - lcp);
+				strings_.insert(strings_.end(), word.cbegin() + lcp, word.cend());
+			}
+			prev = word;
+		}
+
+		aho_corasick::double_array_trie<std::allocator<int>, Offset> dat;
+		dat.build_from_sorted(words.cbegin(), words.cend(), [](const auto& word_freq) {
+			return word_freq.first;
+		}, quiet);
+		units_.reserve(dat.units_.size());
+		for (const auto& unit : dat.units_) {
+			const offset_t output = (unit.tail == 0) ? 0 : static_cast<offset_t>(dat.tails_[unit.tail].word + 1);
+			units_.push_back(unit_type{unit.base, unit.check, unit.fail, output});
+		}
+		next_output_.resize(words.size(), 0);
+		for (size_t t = 1; t < dat.tails_.size(); t++) {
+			const auto& tail = dat.tails_[t];
+			next_output_[tail.word] = (tail.next == 0) ? 0 : static_cast<offset_t>(dat.tails_[tail.next].word + 1);
+		}
+		strings_.shrink_to_fit();
+		string_buckets_.shrink_to_fit();
+	}
+
+	// decodes the word of id into out
+	void word_at(size_t id, std::string& out) const {
+		size_t pos = string_buckets_[id / front_coding_bucket];
+		const size_t first_size = _get_varint(pos);
+		out.assign(strings_.data() + pos, first_size);
+		pos += first_size;
+		for (size_t i = 0; i < (id % front_coding_bucket); i++) {
+			const size_t lcp = _get_varint(pos);
+			const size_t suffix_size = _get_varint(pos);
+			out.resize(lcp);
+			out.append(strings_.data() + pos, suffix_size);
+			pos += suffix_size;
+		}
+	}
+
+	double cost_at(size_t id) const noexcept {
+		return static_cast<double>(costs_[id]) * cost_step_;
+	}
+
+	// the frequency of id, as recovered from its quantized cost
+	uint64_t freq_at(size_t id) const noexcept {
+		return static_cast<uint64_t>(std::llround(std::exp2(calc_log2<double>::log2(total_) - cost_at(id))));
+	}
+
+	size_t _child(size_t status, uint8_t label) const noexcept {
+		const size_t base = units_[status].base;
+		const size_t to = base + label;
+		if ((base == std::numeric_limits<offset_t>::max()) || (to >= units_.size()) || (units_[to].check != status)) {
+			return not_found;
+		}
+		return to;
+	}
+
+	// id of word, or not_found
+	size_t exact_match(std::string_view word) const noexcept {
+		if (units_.empty()) {
+			return not_found;
+		}
+		size_t status = 0;
+		for (size_t i = 0; (i < word.size()) && (status != not_found); i++) {
+			status = _child(status, static_cast<uint8_t>(word[i]));
+		}
+		if ((status == not_found) || (units_[status].output == 0) || (lengths_[units_[status].output - 1] != word.size())) {
+			return not_found;
+		}
+		return units_[status].output - 1;
+	}
+
+	uint64_t get_freq(std::string_view word) const noexcept {
+		const size_t id = exact_match(word);
+		return (id == not_found) ? 0 : freq_at(id);
+	}
+
+	// visits every word with its recovered frequency in byte order
+	template <class Callback>
+	void for_each_word(Callback cb) const {
+		std::string word;
+		for (size_t id = 0; id < size(); id++) {
+			word_at(id, word);
+			cb(std::string_view{word}, freq_at(id));
+		}
+	}
+
+	// matched(end_pos, length, id) for every word in haystack
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		if (units_.empty()) {
+			return;
+		}
+		size_t status = 0;
+		for (size_t i = 0; i < haystack.size();) {
+			const size_t to = units_[status].base + static_cast<uint8_t>(haystack[i]);
+			if (units_[to].check == status) {
+				status = to;
+				i++;
+				for (size_t w = units_[status].output; w != 0; w = next_output_[w - 1]) {
+					matched(i, static_cast<size_t>(lengths_[w - 1]), w - 1);
+				}
+			} else if (status == 0) {
+				i++;
+			} else {
+				status = units_[status].fail;
+			}
+		}
+	}
+
+	template<class WordDag>
+	void add_edges(WordDag& dag) const {
+		using weight_t = typename WordDag::weight_t;
+		const weight_t step = static_cast<weight_t>(cost_step_);
+		scan(dag.sentence(), [this, step, &dag](size_t end_pos, size_t length, size_t id) {
+			dag.add_edge(end_pos - length, end_pos, step * static_cast<weight_t>(costs_[id]));
+		});
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_single_rune_weight() const noexcept {
+		using weight_t = typename WordDag::weight_t;
+		return calc_log2<weight_t>::log2(total_ + 1);
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_hmm_model_weight() const noexcept {
+		using weight_t = typename WordDag::weight_t;
+		return 2 * (calc_log2<weight_t>::log2(total_) - calc_log2<weight_t>::log2(std::min<uint64_t>(total_, 2000)));
+	}
+
+	size_t bytes_used() const noexcept {
+		return units_.size() * sizeof(unit_type)
+			+ lengths_.size() * sizeof(uint16_t)
+			+ next_output_.size() * sizeof(offset_t)
+			+ costs_.size() * sizeof(Cost)
+			+ strings_.size() * sizeof(char)
+			+ string_buckets_.size() * sizeof(offset_t);
+	}
+};
+
+}
+
+}
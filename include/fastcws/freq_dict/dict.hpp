@@ -6,9 +6,14 @@
 #include <cassert>
 #include <algorithm>
 #include <array>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
 
 #include "fastcws/bindings/containers.hpp"
 #include "fastcws/aho_corasick.hpp"
+#include "fastcws/freq_dict/attributes.hpp"
 #include "fastcws/misc/log2.hpp"
 #include "fastcws/rep_aware/string_view.hpp"
 #include "fastcws/rep_aware/unique_ptr.hpp"
@@ -17,45 +22,110 @@ namespace fastcws {
 
 namespace freq_dict {
 
-template <class Allocator, class IntermediateAllocator, bool UseDAT> struct dict_trie_holder;
+enum class trie_backend {
+	trie, // aho_corasick::trie, words may still be added after finalize()
+	double_array, // aho_corasick::double_array_trie, compact and fast, built once by finalize()
+	dynamic_double_array, // aho_corasick::dynamic_double_array_trie, words may be added, erased or updated any time
+	louds // aho_corasick::louds_trie, smallest but slower, built once by finalize()
+};
+
+// frequency of s in a sorted vector of (word, freq), s must be present
+template <class Freqs>
+uint64_t _sorted_freq_lookup(const Freqs& freqs, std::string_view s) noexcept {
+	using entry_type = typename Freqs::value_type;
+	using string_view_type = typename entry_type::first_type;
+	auto it = std::lower_bound(freqs.cbegin(), freqs.cend(), entry_type{string_view_type{s.data(), s.size()}, 0});
+	return it->second;
+}
+
+// frequency of s in a sorted vector of (word, freq), 0 if absent
+template <class Freqs>
+uint64_t _sorted_freq_find(const Freqs& freqs, std::string_view s) noexcept {
+	using entry_type = typename Freqs::value_type;
+	using string_view_type = typename entry_type::first_type;
+	auto it = std::lower_bound(freqs.cbegin(), freqs.cend(), entry_type{string_view_type{s.data(), s.size()}, 0});
+	if ((it == freqs.cend()) || (std::string_view{it->first.data(), it->first.size()} != s)) {
+		return 0;
+	}
+	return it->second;
+}
+
+// whether add_edges() tells WordDag the id of every word, through add_word_edge(), e.g. word_dag::id_dag
+template <class WordDag, class = void>
+struct _records_word_ids : std::false_type {};
+
+template <class WordDag>
+struct _records_word_ids<WordDag, std::void_t<decltype(std::declval<WordDag&>().add_word_edge(
+	size_t{}, size_t{}, std::declval<typename WordDag::weight_t>(), size_t{}))>>
+	: std::true_type {};
+
+// every holder provides scan_with_freq(haystack, freqs, matched(end_pos, word, freq)), where freqs is
+// the sorted freq_ of dict (empty when owns_words), so that matching a word never costs a binary search
+template <class Allocator, class IntermediateAllocator, trie_backend Backend, class Offset> struct dict_trie_holder;
 
-template <class Allocator, class IntermediateAllocator>
-struct dict_trie_holder<Allocator, IntermediateAllocator, true> {
+template <class Allocator, class IntermediateAllocator, class Offset>
+struct dict_trie_holder<Allocator, IntermediateAllocator, trie_backend::double_array, Offset> {
 	using allocator_traits = std::allocator_traits<Allocator>;
-	using intermediate_allocator_traits = std::allocator_traits<IntermediateAllocator>;
-	using trie_type = aho_corasick::trie<IntermediateAllocator>;
-	using trie_allocator = typename intermediate_allocator_traits::template rebind_alloc<trie_type>;
-	using double_array_trie_type = aho_corasick::double_array_trie<Allocator>;
+	using double_array_trie_type = aho_corasick::double_array_trie<Allocator, Offset>;
+
+	static constexpr bool dynamic = false;
+	static constexpr bool owns_words = false;
 
-	rep_aware::unique_ptr<trie_type, trie_allocator> trie_ = rep_aware::make_unique<trie_type, trie_allocator>(IntermediateAllocator{});
 	double_array_trie_type dat_;
 	bool finalized_ = false;
 
 	void add_word(std::string_view s) {
+		(void)s; // words are taken from the sorted list handed to finalize()
 		assert(!finalized_); // when using double_array_trie, you cannot add word after finalized
-		trie_->add(s);
 	}
 
-	void finalize(bool quiet=false) {
+	template <class SortedIterator, class WordOf, class FreqOf>
+	void finalize(SortedIterator first, SortedIterator last, WordOf word_of, FreqOf freq_of, bool quiet=false) {
+		(void)freq_of;
 		assert(!finalized_); // when using double_array_trie, duplicate call to finalize() is forbidden
-		trie_->finalize();
-		dat_.build_from(*trie_, quiet);
-		trie_ = nullptr;
+		dat_.build_from_sorted(first, last, word_of, quiet);
 		finalized_ = true;
 	}
 
+	using profile_type = typename double_array_trie_type::profile_type;
+
+	// rebuilds dat_ from the same sorted list, placing the nodes hot in prof first
+	template <class SortedIterator, class WordOf>
+	void relayout(SortedIterator first, SortedIterator last, WordOf word_of, const profile_type& prof, bool quiet=false) {
+		assert(finalized_);
+		double_array_trie_type relaid;
+		relaid.build_from_sorted(first, last, word_of, dat_, prof, quiet);
+		dat_ = std::move(relaid);
+	}
+
 	template <class MatchCallback>
 	void scan(const std::string_view haystack, MatchCallback matched) const {
 		assert(finalized_);
 		dat_.scan(haystack, matched);
 	}
+
+	const double_array_trie_type& automaton() const noexcept {
+		assert(finalized_);
+		return dat_;
+	}
+
+	template <class Freqs, class MatchCallback>
+	void scan_with_freq(const std::string_view haystack, const Freqs& freqs, MatchCallback matched) const {
+		assert(finalized_);
+		dat_.scan_ids(haystack, [&freqs, &matched](size_t end_pos, std::string_view word, size_t word_id) {
+			matched(end_pos, word, freqs[word_id].second);
+		});
+	}
 };
 
-template <class Allocator, class IntermediateAllocator>
-struct dict_trie_holder<Allocator, IntermediateAllocator, false> {
+template <class Allocator, class IntermediateAllocator, class Offset>
+struct dict_trie_holder<Allocator, IntermediateAllocator, trie_backend::trie, Offset> {
 	using allocator_traits = std::allocator_traits<Allocator>;
 	using trie_type = aho_corasick::trie<Allocator>;
 
+	static constexpr bool dynamic = false;
+	static constexpr bool owns_words = false;
+
 	trie_type trie_;
 	bool finalized_ = false;
 
@@ -64,7 +134,12 @@ struct dict_trie_holder<Allocator, IntermediateAllocator, false> {
 		finalized_ = false;
 	}
 
-	void finalize(bool quiet=false) {
+	template <class SortedIterator, class WordOf, class FreqOf>
+	void finalize(SortedIterator first, SortedIterator last, WordOf word_of, FreqOf freq_of, bool quiet=false) {
+		(void)first;
+		(void)last;
+		(void)word_of;
+		(void)freq_of;
 		(void)quiet;
 		trie_.finalize();
 		finalized_ = true;
@@ -75,9 +150,129 @@ struct dict_trie_holder<Allocator, IntermediateAllocator, false> {
 		assert(finalized_);
 		trie_.scan(haystack, matched);
 	}
+
+	template <class Freqs, class MatchCallback>
+	void scan_with_freq(const std::string_view haystack, const Freqs& freqs, MatchCallback matched) const {
+		assert(finalized_);
+		trie_.scan(haystack, [&freqs, &matched](size_t end_pos, std::string_view word) {
+			matched(end_pos, word, _sorted_freq_lookup(freqs, word));
+		});
+	}
+};
+
+// words and frequencies live in the trie itself, dict never fills storage_ or freq_ with this backend
+template <class Allocator, class IntermediateAllocator, class Offset>
+struct dict_trie_holder<Allocator, IntermediateAllocator, trie_backend::dynamic_double_array, Offset> {
+	using allocator_traits = std::allocator_traits<Allocator>;
+	using trie_type = aho_corasick::dynamic_double_array_trie<uint64_t, Allocator>;
+
+	static constexpr bool dynamic = true;
+	static constexpr bool owns_words = true;
+
+	trie_type trie_;
+
+	// returns the frequency replaced, 0 if s is new
+	uint64_t set_freq(std::string_view s, uint64_t freq) {
+		const uint64_t* old = trie_.find(s);
+		uint64_t ret = (old == nullptr) ? 0 : *old;
+		trie_.insert(s, freq);
+		return ret;
+	}
+
+	// returns the frequency erased, 0 if s is absent
+	uint64_t erase_word(std::string_view s) {
+		const uint64_t* old = trie_.find(s);
+		if (old == nullptr) {
+			return 0;
+		}
+		uint64_t ret = *old;
+		trie_.erase(s);
+		return ret;
+	}
+
+	uint64_t get_freq(std::string_view s) const noexcept {
+		const uint64_t* freq = trie_.find(s);
+		return (freq == nullptr) ? 0 : *freq;
+	}
+
+	template <class SortedIterator, class WordOf, class FreqOf>
+	void finalize(SortedIterator first, SortedIterator last, WordOf word_of, FreqOf freq_of, bool quiet=false) {
+		(void)first;
+		(void)last;
+		(void)word_of;
+		(void)freq_of;
+		(void)quiet;
+	}
+
+	template <class Callback>
+	void for_each_word(Callback cb) const {
+		trie_.for_each(cb);
+	}
+
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		trie_.scan(haystack, matched);
+	}
+
+	template <class Freqs, class MatchCallback>
+	void scan_with_freq(const std::string_view haystack, const Freqs& freqs, MatchCallback matched) const {
+		(void)freqs;
+		trie_.scan_values(haystack, matched);
+	}
+};
+
+// words and frequencies are encoded into the trie by finalize(), after which dict drops storage_ and freq_
+template <class Allocator, class IntermediateAllocator, class Offset>
+struct dict_trie_holder<Allocator, IntermediateAllocator, trie_backend::louds, Offset> {
+	using allocator_traits = std::allocator_traits<Allocator>;
+	using trie_type = aho_corasick::louds_trie<uint64_t, Allocator>;
+
+	static constexpr bool dynamic = false;
+	static constexpr bool owns_words = true;
+
+	trie_type trie_;
+	bool finalized_ = false;
+
+	void add_word(std::string_view s) {
+		(void)s; // words are taken from the sorted list handed to finalize()
+		assert(!finalized_); // when using louds_trie, you cannot add word after finalized
+	}
+
+	template <class SortedIterator, class WordOf, class FreqOf>
+	void finalize(SortedIterator first, SortedIterator last, WordOf word_of, FreqOf freq_of, bool quiet=false) {
+		assert(!finalized_); // when using louds_trie, duplicate call to finalize() is forbidden
+		trie_.build_from_sorted(first, last, word_of, freq_of, quiet);
+		finalized_ = true;
+	}
+
+	uint64_t get_freq(std::string_view s) const noexcept {
+		const uint64_t* freq = trie_.find(s);
+		return (freq == nullptr) ? 0 : *freq;
+	}
+
+	template <class Callback>
+	void for_each_word(Callback cb) const {
+		trie_.for_each(cb);
+	}
+
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		assert(finalized_);
+		trie_.scan(haystack, matched);
+	}
+
+	template <class Freqs, class MatchCallback>
+	void scan_with_freq(const std::string_view haystack, const Freqs& freqs, MatchCallback matched) const {
+		assert(finalized_);
+		(void)freqs;
+		trie_.scan_values(haystack, matched);
+	}
 };
 
-template <class Allocator = std::allocator<int>, class IntermediateAllocator = Allocator, bool UseDAT = false>
+// Offset is the index type of the double array, pick uint64_t for dictionaries beyond 4G units.
+// Attributes are stored per word & looked up by word id, see attributes.hpp
+template <class Allocator = std::allocator<int>, class IntermediateAllocator = Allocator,
+	trie_backend Backend = trie_backend::trie, class Offset = uint32_t, class Attributes = no_attributes>
 struct dict {
 	using allocator_traits = std::allocator_traits<Allocator>;
 
@@ -94,34 +289,208 @@ struct dict {
 			std::pair<string_view_type, uint64_t>>> freq_;
 	uint64_t total_ = 0;
 
-	dict_trie_holder<Allocator, IntermediateAllocator, UseDAT> trie_holder_;
+	using trie_holder_type = dict_trie_holder<Allocator, IntermediateAllocator, Backend, Offset>;
+	static constexpr bool dynamic = trie_holder_type::dynamic;
+	static constexpr bool owns_words = trie_holder_type::owns_words;
 
-	void add_word(std::string_view word, uint64_t freq) {
-		assert(word.size() <= blk_size);
-		if (storage_.empty()) {
-			storage_.emplace_back();
+	using attributes_type = Attributes;
+	static constexpr bool has_attributes = !std::is_same_v<Attributes, no_attributes>;
+	static_assert(!has_attributes || !owns_words, "per-word attributes require trie_backend::trie or trie_backend::double_array");
+	static_assert(std::is_trivially_copyable_v<Attributes>, "Attributes must be trivially copyable");
+	vector<Attributes,
+		typename allocator_traits::template rebind_alloc<
+			Attributes>> attributes_; // by word id once finalized, empty without attributes
+
+	trie_holder_type trie_holder_;
+
+	// room for n more words before finalize(), a no-op with a dynamic backend
+	void reserve(size_t n) {
+		if constexpr (!dynamic) {
+			freq_.reserve(freq_.size() + n);
 		}
-		if ((storage_last_blk_used_ + word.size()) > blk_size) {
-			storage_.emplace_back();
-			storage_last_blk_used_ = 0;
+		if constexpr (has_attributes) {
+			attributes_.reserve(attributes_.size() + n);
 		}
-		std::copy(word.cbegin(), word.cend(), storage_.back().begin() + storage_last_blk_used_);
-		string_view_type sv{storage_.back().data() + storage_last_blk_used_, word.size()};
-		storage_last_blk_used_ += word.size();
+	}
+
+	void add_word(std::string_view word, uint64_t freq, const Attributes& attributes) {
+		static_assert(has_attributes, "this dict has no per-word attributes");
+		add_word(word, freq);
+		attributes_.back() = attributes;
+	}
+
+	// with a dynamic backend, adding a word again replaces its frequency
+	void add_word(std::string_view word, uint64_t freq) {
+		if constexpr (dynamic) {
+			total_ -= trie_holder_.set_freq(word, freq);
+			total_ += freq;
+		} else {
+			assert(word.size() <= blk_size);
+			if (storage_.empty()) {
+				storage_.emplace_back();
+			}
+			if ((storage_last_blk_used_ + word.size()) > blk_size) {
+				storage_.emplace_back();
+				storage_last_blk_used_ = 0;
+			}
+			std::copy(word.cbegin(), word.cend(), storage_.back().begin() + storage_last_blk_used_);
+			string_view_type sv{storage_.back().data() + storage_last_blk_used_, word.size()};
+			storage_last_blk_used_ += word.size();
 
-		freq_.emplace_back(sv, freq);
-		trie_holder_.add_word(std::string_view{sv.data(), sv.size()});
-		total_ += freq;
+			freq_.emplace_back(sv, freq);
+			if constexpr (has_attributes) {
+				attributes_.emplace_back();
+			}
+			trie_holder_.add_word(std::string_view{sv.data(), sv.size()});
+			total_ += freq;
+		}
 	}
 
 	void finalize(bool quiet=false) {
-		std::sort(freq_.begin(), freq_.end());
-		trie_holder_.finalize(quiet);
+		if constexpr (has_attributes) {
+			// attributes_ follows freq_ through the sort
+			vector<size_t> order(freq_.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs) {
+				return freq_[lhs] < freq_[rhs];
+			});
+			auto sorted_freq = freq_;
+			auto sorted_attributes = attributes_;
+			for (size_t i = 0; i < order.size(); i++) {
+				sorted_freq[i] = freq_[order[i]];
+				sorted_attributes[i] = attributes_[order[i]];
+			}
+			freq_ = std::move(sorted_freq);
+			attributes_ = std::move(sorted_attributes);
+		} else {
+			std::sort(freq_.begin(), freq_.end());
+		}
+		trie_holder_.finalize(freq_.cbegin(), freq_.cend(), [](const auto& word_freq) {
+			return std::string_view{word_freq.first.data(), word_freq.first.size()};
+		}, [](const auto& word_freq) {
+			return word_freq.second;
+		}, quiet);
+		if constexpr (owns_words) {
+			freq_ = {};
+			storage_ = {};
+			storage_last_blk_used_ = 0;
+		}
+	}
+
+	void erase_word(std::string_view word) {
+		static_assert(dynamic, "erasing words requires trie_backend::dynamic_double_array");
+		total_ -= trie_holder_.erase_word(word);
 	}
 
 	uint64_t get_freq(std::string_view s) const noexcept {
-		auto it = std::lower_bound(freq_.cbegin(), freq_.cend(), std::pair<string_view_type, uint64_t>{string_view_type{s.data(), s.size()}, 0});
-		return it->second;
+		if constexpr (owns_words) {
+			return trie_holder_.get_freq(s);
+		} else {
+			return _sorted_freq_find(freq_, s);
+		}
+	}
+
+	// visits every word with its frequency in byte order, once finalized
+	template <class Callback>
+	void for_each_word(Callback cb) const {
+		if constexpr (owns_words) {
+			trie_holder_.for_each_word(cb);
+		} else {
+			for (const auto& [word, freq] : freq_) {
+				cb(std::string_view{word.data(), word.size()}, freq);
+			}
+		}
+	}
+
+	// profile guided layout, trie_backend::double_array only:
+	// record_profile() over a sample corpus, then relayout() packs the hot part of the automaton together.
+	// words never matched in the sample are reported by for_each_unmatched_word(), which must be called before
+	// relayout() since prof refers to the units & tails of the layout it was recorded on.
+	auto make_profile() const {
+		static_assert(Backend == trie_backend::double_array, "profiling requires trie_backend::double_array");
+		return trie_holder_.dat_.make_profile();
+	}
+
+	template <class Profile>
+	void record_profile(std::string_view text, Profile& prof) const {
+		trie_holder_.dat_.record(text, prof);
+	}
+
+	template <class Profile>
+	void relayout(const Profile& prof, bool quiet=false) {
+		trie_holder_.relayout(freq_.cbegin(), freq_.cend(), [](const auto& word_freq) {
+			return std::string_view{word_freq.first.data(), word_freq.first.size()};
+		}, prof, quiet);
+	}
+
+	template <class Profile, class Callback>
+	void for_each_unmatched_word(const Profile& prof, Callback cb) const {
+		trie_holder_.dat_.for_each_unmatched(prof, cb);
+	}
+
+	// lookups on the automaton, trie_backend::double_array only. words are reported by id, their index in the
+	// sorted vocabulary, along with their frequency, see word_at() & freq_at(). nothing is allocated.
+	static constexpr size_t not_found = std::numeric_limits<size_t>::max();
+	static constexpr bool has_word_ids = (Backend == trie_backend::double_array);
+
+	// id of word, or not_found
+	size_t exact_match(std::string_view word) const noexcept {
+		static_assert(Backend == trie_backend::double_array, "lookups require trie_backend::double_array");
+		return trie_holder_.automaton().exact_match(word);
+	}
+
+	// cb(length, id, freq) for every word which is a prefix of key, shortest first
+	template <class Callback>
+	void common_prefix_search(std::string_view key, Callback cb) const {
+		static_assert(Backend == trie_backend::double_array, "lookups require trie_backend::double_array");
+		trie_holder_.automaton().common_prefix_search(key, [this, &cb](size_t length, size_t id) {
+			cb(length, id, freq_[id].second);
+		});
+	}
+
+	// cb(word, id, freq) for every word starting with prefix in byte order, at most limit of them.
+	// returns the number of words reported
+	template <class Callback>
+	size_t predictive_search(std::string_view prefix, Callback cb, size_t limit = not_found) const {
+		static_assert(Backend == trie_backend::double_array, "lookups require trie_backend::double_array");
+		return trie_holder_.automaton().predictive_search(prefix, [this, &cb](std::string_view word, size_t id) {
+			cb(word, id, freq_[id].second);
+		}, limit);
+	}
+
+	const auto& automaton() const noexcept {
+		static_assert(Backend == trie_backend::double_array, "the automaton is only exposed with trie_backend::double_array");
+		return trie_holder_.automaton();
+	}
+
+	const Attributes& attributes_at(size_t id) const noexcept {
+		static_assert(has_attributes, "this dict has no per-word attributes");
+		return attributes_[id];
+	}
+
+	// attributes of word, nullptr if word is not in the dict, e.g. a token segmented by the hmm model. a lookup of
+	// its own, word_break_with_attributes() has those of the tokens it segments at no cost
+	const Attributes* find_attributes(std::string_view word) const noexcept {
+		static_assert(has_attributes, "this dict has no per-word attributes");
+		size_t id = not_found;
+		if constexpr (Backend == trie_backend::double_array) {
+			id = trie_holder_.automaton().exact_match(word);
+		} else {
+			using entry_type = typename decltype(freq_)::value_type;
+			auto it = std::lower_bound(freq_.cbegin(), freq_.cend(), entry_type{string_view_type{word.data(), word.size()}, 0});
+			if ((it != freq_.cend()) && (std::string_view{it->first.data(), it->first.size()} == word)) {
+				id = static_cast<size_t>(it - freq_.cbegin());
+			}
+		}
+		return (id == not_found) ? nullptr : &attributes_[id];
+	}
+
+	std::string_view word_at(size_t id) const noexcept {
+		return std::string_view{freq_[id].first.data(), freq_[id].first.size()};
+	}
+
+	uint64_t freq_at(size_t id) const noexcept {
+		return freq_[id].second;
 	}
 
 	template <class Weight>
@@ -135,9 +504,16 @@ struct dict {
 		using weight_t = typename dag_t::weight_t;
 	
 		auto sentence = dag.sentence();
-		trie_holder_.scan(sentence, [this, sentence, &dag](size_t end_pos, std::string_view word) {
-			dag.add_edge(end_pos - word.size(), end_pos, this->_calc_weight<weight_t>(this->get_freq(word)));
-		});
+		const weight_t log2_total = calc_log2<weight_t>::log2(total_);
+		if constexpr (has_word_ids && _records_word_ids<dag_t>::value) {
+			trie_holder_.automaton().scan_ids(sentence, [this, log2_total, &dag](size_t end_pos, std::string_view word, size_t id) {
+				dag.add_word_edge(end_pos - word.size(), end_pos, log2_total - calc_log2<weight_t>::log2(freq_[id].second), id);
+			});
+		} else {
+			trie_holder_.scan_with_freq(sentence, freq_, [log2_total, &dag](size_t end_pos, std::string_view word, uint64_t freq) {
+				dag.add_edge(end_pos - word.size(), end_pos, log2_total - calc_log2<weight_t>::log2(freq));
+			});
+		}
 	}
 
 	template<class WordDag>
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+#include "fastcws/bindings/containers.hpp"
+#include "fastcws/aho_corasick/double_array_trie.hpp"
+#include "fastcws/misc/log2.hpp"
+
+namespace fastcws {
+
+namespace freq_dict {
+
+// a handful of words that count as dictionary words for a single request, e.g. names mentioned earlier in
+// a conversation, merged into the dag of the request by ephemeral_dict without touching the shared dict.
+// the words are borrowed, they must outlive this object. a few words are matched with string_view::find,
+// larger lists are compiled into a throwaway double array by finalize().
+template <class Allocator = std::allocator<int>>
+struct ephemeral_words {
+	using allocator_traits = std::allocator_traits<Allocator>;
+
+	// as if the word made up the whole dictionary, its edges weigh nothing and it always wins its span
+	static constexpr uint64_t preferred = std::numeric_limits<uint64_t>::max();
+	// up to this many words, matching each one separately beats building an automaton
+	static constexpr size_t small_set_size = 16;
+
+	vector<std::pair<std::string_view, uint64_t>,
+		typename allocator_traits::template rebind_alloc<
+			std::pair<std::string_view, uint64_t>>> words_;
+	aho_corasick::double_array_trie<Allocator> dat_;
+	bool compiled_ = false;
+
+	// freq is on the scale of the dict the words are merged into, words of freq 0 are ignored
+	void add_word(std::string_view word, uint64_t freq = preferred) {
+		if (!word.empty() && (freq != 0)) {
+			words_.emplace_back(word, freq);
+		}
+		compiled_ = false;
+	}
+
+	size_t size() const noexcept {
+		return words_.size();
+	}
+
+	bool empty() const noexcept {
+		return words_.empty();
+	}
+
+	// sorts & dedups the words, the most frequent of duplicates wins. required before matching
+	void finalize() {
+		std::sort(words_.begin(), words_.end(), [](const auto& a, const auto& b) {
+			return (a.first < b.first) || ((a.first == b.first) && (a.second > b.second));
+		});
+		words_.erase(std::unique(words_.begin(), words_.end(), [](const auto& a, const auto& b) {
+			return a.first == b.first;
+		}), words_.end());
+		dat_ = {};
+		if (words_.size() > small_set_size) {
+			dat_.build_from_sorted(words_.cbegin(), words_.cend(), [](const auto& word_freq) {
+				return word_freq.first;
+			}, true);
+		}
+		compiled_ = true;
+	}
+
+	// matched(end_pos, length, freq) for every occurrence of every word in haystack
+	template <class MatchCallback>
+	void scan(const std::string_view haystack, MatchCallback matched) const {
+		assert(compiled_);
+		if (words_.size() > small_set_size) {
+			dat_.scan_ids(haystack, [this, &matched](size_t end_pos, std::string_view word, size_t id) {
+				matched(end_pos, word.size(), words_[id].second);
+			});
+			return;
+		}
+		for (const auto& [word, freq] : words_) {
+			for (size_t pos = haystack.find(word); pos != std::string_view::npos; pos = haystack.find(word, pos + 1)) {
+				matched(pos + word.size(), word.size(), freq);
+			}
+		}
+	}
+};
+
+// a dict plus the ephemeral words of one request, usable wherever a dict is by build_dag().
+// both are referenced, so making one per request costs nothing
+template <class BaseDict, class Words = ephemeral_words<>>
+struct ephemeral_dict {
+	const BaseDict* base_;
+	const Words* words_;
+
+	ephemeral_dict(const BaseDict& base, const Words& words) : base_(&base), words_(&words) {}
+
+	template<class WordDag>
+	void add_edges(WordDag& dag) const {
+		using weight_t = typename WordDag::weight_t;
+		base_->add_edges(dag);
+		if (words_->empty()) {
+			return;
+		}
+		const weight_t log2_total = calc_log2<weight_t>::log2(base_->total_);
+		words_->scan(dag.sentence(), [&dag, log2_total](size_t end_pos, size_t length, uint64_t freq) {
+			weight_t weight = 0;
+			if (freq != Words::preferred) {
+				weight = std::max<weight_t>(log2_total - calc_log2<weight_t>::log2(freq), 0);
+			}
+			dag.add_edge(end_pos - length, end_pos, weight);
+		});
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_single_rune_weight() const noexcept {
+		return base_->template suggest_single_rune_weight<WordDag>();
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_hmm_model_weight() const noexcept {
+		return base_->template suggest_hmm_model_weight<WordDag>();
+	}
+};
+
+}
+
+}
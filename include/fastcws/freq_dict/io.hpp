@@ -3,28 +3,91 @@
 #pragma once
 
 #include <istream>
-#include <sstream>
-#include <cassert>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <type_traits>
+#include <algorithm>
 
 #include "fastcws/freq_dict/dict.hpp"
+#include "fastcws/freq_dict/attributes.hpp"
+#include "fastcws/misc/mapped_file.hpp"
 
 namespace fastcws {
 
 namespace freq_dict {
 
+// parses a `word freq [columns...]` line, fields separated by spaces or tabs. the columns following freq,
+// e.g. a part of speech tag, are left in rest for the attributes of the dict, if any.
+// returns false on a blank line, throws std::invalid_argument on a malformed one
+inline bool _parse_dict_line(std::string_view line, std::string_view& word, uint64_t& freq, std::string_view& rest) {
+	if (!line.empty() && (line.back() == '\r')) {
+		line.remove_suffix(1);
+	}
+	constexpr std::string_view blanks = " \t";
+	const size_t word_begin = line.find_first_not_of(blanks);
+	if (word_begin == std::string_view::npos) {
+		return false;
+	}
+	const size_t word_end = std::min(line.find_first_of(blanks, word_begin), line.size());
+	const size_t freq_begin = std::min(line.find_first_not_of(blanks, word_end), line.size());
+	const char* first = line.data() + freq_begin;
+	const char* last = line.data() + line.size();
+	auto [ptr, ec] = std::from_chars(first, last, freq);
+	if ((ec != std::errc{}) || (ptr == first) || ((ptr != last) && (*ptr != ' ') && (*ptr != '\t'))) {
+		throw std::invalid_argument{"fastcws::freq_dict: malformed line: " + std::string{line}};
+	}
+	word = line.substr(word_begin, word_end - word_begin);
+	rest = line.substr(std::min(line.find_first_not_of(blanks, ptr - line.data()), line.size()));
+	return true;
+}
+
+// adds a parsed line to dict, with its attributes parsed from the rest of the line if dict has any
+template <class Dict>
+inline void _add_parsed_word(Dict& dict, std::string_view word, uint64_t freq, const attributes_of_t<Dict>& attributes) {
+	if constexpr (std::is_same_v<attributes_of_t<Dict>, no_attributes>) {
+		(void)attributes;
+		dict.add_word(word, freq);
+	} else {
+		dict.add_word(word, freq, attributes);
+	}
+}
+
+// cb(word, freq, attributes) for every line of text
+template <class Attributes, class Callback>
+inline void _for_each_dict_line(std::string_view text, Callback cb) {
+	std::string_view word;
+	uint64_t freq;
+	std::string_view rest;
+	while (!text.empty()) {
+		const size_t eol = std::min(text.find('\n'), text.size());
+		if (_parse_dict_line(text.substr(0, eol), word, freq, rest)) {
+			cb(word, freq, Attributes::from_columns(rest));
+		}
+		text.remove_prefix(std::min(eol + 1, text.size()));
+	}
+}
+
 template <class Dict>
 inline void load_dict(std::istream& is, Dict& dict, bool quiet=true) {
 	is.exceptions(std::ios_base::badbit);
 	if (!quiet) {
 		std::cout << "loading words.." << std::endl;
 	}
-	std::string word, freq_s;
-	while (std::getline(is, word, ' '), std::getline(is, freq_s, '\n')) {
-		std::istringstream freq_ss{freq_s};
-		freq_ss.exceptions(std::ios_base::badbit | std::ios_base::failbit);
-		uint64_t freq;
-		freq_ss >> freq;
-		dict.add_word(word, freq);
+	std::string line;
+	std::string_view word;
+	uint64_t freq;
+	std::string_view rest;
+	while (std::getline(is, line)) {
+		if (_parse_dict_line(line, word, freq, rest)) {
+			_add_parsed_word(dict, word, freq, attributes_of_t<Dict>::from_columns(rest));
+		}
 	}
 	if (!quiet) {
 		std::cout << "finalizing.." << std::endl;
@@ -39,15 +102,100 @@ inline Dict load_dict(std::istream& is, bool quiet=true) {
 	return ret;
 }
 
+// same format as load_dict(), but text is cut at line breaks into one chunk per worker thread
+// (hardware concurrency if threads is 0), parsed in parallel, then added to dict in the original order.
+// words are copied into dict, text may go away once this returns.
+template <class Dict>
+inline void load_dict_text(std::string_view text, Dict& dict, size_t threads=0, bool quiet=true) {
+	if (threads == 0) {
+		threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	// tiny chunks are not worth a thread
+	constexpr size_t min_chunk_size = 64UL * 1024UL;
+	threads = std::max<size_t>(std::min(threads, text.size() / min_chunk_size), 1);
+	if (!quiet) {
+		std::cout << "loading words with " << threads << " threads.." << std::endl;
+	}
+
+	std::vector<std::string_view> chunks;
+	for (size_t begin = 0; begin < text.size();) {
+		size_t end = begin + std::max<size_t>(text.size() / threads, 1);
+		end = (end >= text.size()) ? text.size() : std::min(text.find('\n', end), text.size());
+		chunks.push_back(text.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	using attributes_t = attributes_of_t<Dict>;
+	if (chunks.size() == 1) {
+		_for_each_dict_line<attributes_t>(chunks[0], [&dict](std::string_view word, uint64_t freq, const attributes_t& attributes) {
+			_add_parsed_word(dict, word, freq, attributes);
+		});
+	} else {
+		std::vector<std::vector<std::tuple<std::string_view, uint64_t, attributes_t>>> parsed(chunks.size());
+		std::vector<std::exception_ptr> errors(chunks.size());
+		auto parse_chunk = [&chunks, &parsed, &errors](size_t i) {
+			try {
+				_for_each_dict_line<attributes_t>(chunks[i], [&words = parsed[i]](std::string_view word, uint64_t freq, const attributes_t& attributes) {
+					words.emplace_back(word, freq, attributes);
+				});
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < chunks.size(); i++) {
+			workers.emplace_back(parse_chunk, i);
+		}
+		parse_chunk(0);
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		for (const auto& error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		size_t total = 0;
+		for (const auto& words : parsed) {
+			total += words.size();
+		}
+		dict.reserve(total);
+		for (auto& words : parsed) {
+			for (const auto& [word, freq, attributes] : words) {
+				_add_parsed_word(dict, word, freq, attributes);
+			}
+			words = {};
+		}
+	}
+	if (!quiet) {
+		std::cout << "finalizing.." << std::endl;
+	}
+	dict.finalize(quiet);
+}
+
+// memory maps filename and loads it with load_dict_text(), throws std::system_error if it cannot be mapped
+template <class Dict>
+inline void load_dict_file(const char* filename, Dict& dict, size_t threads=0, bool quiet=true) {
+	mapped_file file{filename};
+	load_dict_text(file.view(), dict, threads, quiet);
+}
+
+template <class Dict = dict<>>
+inline Dict load_dict_file(const char* filename, size_t threads=0, bool quiet=true) {
+	Dict ret;
+	load_dict_file(filename, ret, threads, quiet);
+	return ret;
+}
+
 template <class Dict>
 inline void save_dict(const Dict& d, std::ostream& os) {
 	os.exceptions(std::ios_base::badbit);
-	for (const auto& [word, freq] : d.freq_) {
+	d.for_each_word([&os](std::string_view word, uint64_t freq) {
 		os << word << " " << freq << "\n";
-	}
+	});
 }
 
 }
 
 }
-
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+#include "fastcws/bindings/containers.hpp"
+#include "fastcws/freq_dict/dict.hpp"
+#include "fastcws/misc/log2.hpp"
+
+namespace fastcws {
+
+namespace freq_dict {
+
+// how the words of an overlay compete with the layers below it
+struct layer_rule {
+	// added to the weight of every word of the layer, negative favours them
+	double bias = 0;
+	// if set, the weight of a word found in this layer replaces the ones of the same word in lower layers,
+	// e.g. to demote a base word, instead of the lowest weight winning
+	bool overrides = false;
+};
+
+// a shared immutable base dictionary plus small overlays, usable wherever a dict is by build_dag().
+// the dicts are referenced, not copied, so one base serves any number of layered_dicts.
+// every dict must use trie_backend::double_array, overlay frequencies are on the scale of the base,
+// and later overlays take priority over earlier ones.
+// add_edges() walks all automata in lockstep over a single pass of the sentence.
+template <class BaseDict, class OverlayDict = BaseDict, class Allocator = std::allocator<int>>
+struct layered_dict {
+	using allocator_traits = std::allocator_traits<Allocator>;
+
+	struct layer_type {
+		const OverlayDict* dict;
+		layer_rule rule;
+	};
+
+	const BaseDict* base_;
+	vector<layer_type,
+		typename allocator_traits::template rebind_alloc<
+			layer_type>> overlays_;
+
+	explicit layered_dict(const BaseDict& base) : base_(&base) {}
+
+	// overlay must outlive this layered_dict
+	void add_layer(const OverlayDict& overlay, layer_rule rule = {}) {
+		overlays_.push_back(layer_type{&overlay, rule});
+	}
+
+	size_t num_layers() const noexcept {
+		return overlays_.size() + 1;
+	}
+
+	template<class WordDag>
+	void add_edges(WordDag& dag) const {
+		using dag_t = WordDag;
+		using weight_t = typename dag_t::weight_t;
+
+		// the words ending at the current position, one per start
+		struct candidate_t {
+			size_t start;
+			weight_t weight;
+			bool final; // an overriding layer decided its weight, lower layers are ignored
+		};
+		vector<candidate_t,
+			typename allocator_traits::template rebind_alloc<
+				candidate_t>> ending;
+		auto offer = [&ending](size_t start, weight_t weight, bool overrides) {
+			for (auto& cand : ending) {
+				if (cand.start == start) {
+					if (!cand.final) {
+						cand.weight = std::min(cand.weight, weight);
+						cand.final = overrides;
+					}
+					return;
+				}
+			}
+			ending.push_back(candidate_t{start, weight, overrides});
+		};
+
+		auto sentence = dag.sentence();
+		const weight_t log2_total = calc_log2<weight_t>::log2(base_->total_);
+		vector<size_t,
+			typename allocator_traits::template rebind_alloc<
+				size_t>> states(overlays_.size(), 0);
+		size_t base_state = 0;
+		for (size_t i = 0; i < sentence.size(); i++) {
+			const uint8_t label = static_cast<uint8_t>(sentence[i]);
+			const size_t end_pos = i + 1;
+			ending.clear();
+			// highest priority first, so that an overriding layer shadows everything below it
+			for (size_t l = overlays_.size(); l-- > 0;) {
+				const auto& layer = overlays_[l];
+				const auto& dat = layer.dict->automaton();
+				states[l] = dat.next_state(states[l], label);
+				dat.for_each_output(states[l], [&](std::string_view word, size_t id) {
+					const weight_t weight = log2_total - calc_log2<weight_t>::log2(layer.dict->freq_at(id))
+						+ static_cast<weight_t>(layer.rule.bias);
+					offer(end_pos - word.size(), weight, layer.rule.overrides);
+				});
+			}
+			const auto& base_dat = base_->automaton();
+			base_state = base_dat.next_state(base_state, label);
+			base_dat.for_each_output(base_state, [&](std::string_view word, size_t id) {
+				offer(end_pos - word.size(), log2_total - calc_log2<weight_t>::log2(base_->freq_at(id)), false);
+			});
+			for (const auto& cand : ending) {
+				dag.add_edge(cand.start, end_pos, cand.weight);
+			}
+		}
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_single_rune_weight() const noexcept {
+		return base_->template suggest_single_rune_weight<WordDag>();
+	}
+
+	template<class WordDag>
+	typename WordDag::weight_t suggest_hmm_model_weight() const noexcept {
+		return base_->template suggest_hmm_model_weight<WordDag>();
+	}
+};
+
+}
+
+}
@@ -6,4 +6,7 @@
 #include "fastcws/hmm/hmm.hpp"
 #include "fastcws/hmm/normalizer.hpp"
 #include "fastcws/hmm/viterbi.hpp"
+#include "fastcws/hmm/viterbi_4state.hpp"
+#include "fastcws/hmm/compact_model.hpp"
 
+#include "fastcws/hmm/training.hpp"
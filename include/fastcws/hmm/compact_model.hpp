@@ -0,0 +1,299 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <ostream>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "fastcws/hmm/wseg_4tag.hpp"
+#include "fastcws/hmm/viterbi_4state.hpp"
+#include "fastcws/misc/mapped_file.hpp"
+#include "fastcws/misc/rune_hopper.hpp"
+#include "fastcws/bindings/containers.hpp"
+
+namespace fastcws {
+
+namespace hmm {
+
+namespace wseg_4tag {
+
+// a compact model is this header, then in native byte order & each aligned to compact_model_alignment:
+// - compact_row_t[dense_size], the rows of the characters by code point - dense_first
+// - uint32_t[sparse_size], the other code points, sorted, & compact_row_t[sparse_size], their rows
+// - the emissions, rows of 4 values of bits each, floats or quantized costs
+using compact_row_t = uint16_t;
+
+struct compact_model_header {
+	static constexpr char expected_magic[8] = {'f', 'c', 'w', 's', 'h', 'm', 'm', '2'};
+
+	char magic[8];
+	uint32_t bits; // 32 for floats, 16 or 8 for costs q standing for -q * cost_step, the largest q for impossible
+	uint32_t rows; // row 0 is for characters never seen in training
+	uint32_t dense_size; // 0, or dense_last - dense_first + 1
+	uint32_t sparse_size;
+	float cost_step;
+	uint32_t reserved;
+	packed_4state_params params;
+};
+
+static constexpr size_t compact_model_alignment = 16;
+
+inline size_t _compact_model_align(size_t offset) noexcept {
+	return (offset + compact_model_alignment - 1) / compact_model_alignment * compact_model_alignment;
+}
+
+// writes the normalized parameters of model, e.g. one of load(), as a compact model. with bits of 16 or 8 the
+// emissions are quantized to costs in steps of the largest one over 2^bits - 2. the characters of the cjk block
+// are looked up by code point only if the model covers enough of them to make it the smaller table. throws
+// std::invalid_argument on an untrained model, or one of more than 65536 rows
+template <class Model>
+void save_compact(const Model& model, std::ostream& os, unsigned bits = 32) {
+	if ((bits != 32) && (bits != 16) && (bits != 8)) {
+		throw std::invalid_argument{"fastcws::hmm::save_compact: bits must be 32, 16 or 8"};
+	}
+	if (model.trival()) {
+		throw std::invalid_argument{"fastcws::hmm::save_compact: untrained model"};
+	}
+	if (model.emissions_.size() > size_t{std::numeric_limits<compact_row_t>::max()} + 1) {
+		throw std::invalid_argument{"fastcws::hmm::save_compact: too many characters for 16 bit rows"};
+	}
+	os.exceptions(std::ios_base::badbit);
+
+	// a code point in the dense table takes a row, one in the sparse table a key & a row
+	const size_t dense_covered = static_cast<size_t>(std::count_if(model.dense_rows_.cbegin(), model.dense_rows_.cend(),
+		[](uint32_t row) { return row != 0; }));
+	const bool dense = !model.dense_rows_.empty()
+		&& (model.dense_rows_.size() * sizeof(compact_row_t) < dense_covered * (sizeof(uint32_t) + sizeof(compact_row_t)));
+	vector<compact_row_t> dense_rows;
+	vector<std::pair<uint32_t, compact_row_t>> sparse_rows;
+	for (size_t i = 0; i < model.dense_rows_.size(); i++) {
+		const compact_row_t row = static_cast<compact_row_t>(model.dense_rows_[i]);
+		if (dense) {
+			dense_rows.push_back(row);
+		} else if (row != 0) {
+			sparse_rows.emplace_back(static_cast<uint32_t>(Model::dense_first + i), row);
+		}
+	}
+	for (const auto& [cp, row] : model.sparse_rows_) {
+		sparse_rows.emplace_back(cp, static_cast<compact_row_t>(row));
+	}
+	std::sort(sparse_rows.begin(), sparse_rows.end());
+
+	compact_model_header hdr{};
+	std::memcpy(hdr.magic, compact_model_header::expected_magic, sizeof(hdr.magic));
+	hdr.bits = bits;
+	hdr.rows = static_cast<uint32_t>(model.emissions_.size());
+	hdr.dense_size = static_cast<uint32_t>(dense_rows.size());
+	hdr.sparse_size = static_cast<uint32_t>(sparse_rows.size());
+	hdr.params = model.packed_;
+
+	const uint32_t impossible = (bits == 32) ? 0 : ((uint32_t{1} << bits) - 1);
+	double max_cost = 0;
+	for (const auto& row : model.emissions_) {
+		for (auto p : row) {
+			if (std::isfinite(p)) {
+				max_cost = std::max(max_cost, -static_cast<double>(p));
+			}
+		}
+	}
+	hdr.cost_step = (bits == 32) ? 0.0f : static_cast<float>((max_cost > 0) ? (max_cost / (impossible - 1)) : 1.0);
+
+	size_t offset = 0;
+	auto put = [&os, &offset](const void* data, size_t size) {
+		os.write(static_cast<const char*>(data), size);
+		offset += size;
+	};
+	auto pad = [&os, &offset]() {
+		static const char zeros[compact_model_alignment] = {};
+		const size_t size = _compact_model_align(offset) - offset;
+		os.write(zeros, size);
+		offset += size;
+	};
+	put(&hdr, sizeof(hdr));
+	pad();
+	put(dense_rows.data(), dense_rows.size() * sizeof(compact_row_t));
+	pad();
+	for (const auto& [cp, row] : sparse_rows) {
+		put(&cp, sizeof(cp));
+	}
+	pad();
+	for (const auto& [cp, row] : sparse_rows) {
+		put(&row, sizeof(row));
+	}
+	pad();
+	for (size_t r = 0; r < model.emissions_.size(); r++) {
+		for (size_t s = 0; s < num_states; s++) {
+			const double p = model.emissions_[r][s];
+			if (bits == 32) {
+				const float f = model.packed_emissions_[r][s];
+				put(&f, sizeof(f));
+				continue;
+			}
+			uint32_t q = impossible;
+			if (std::isfinite(p)) {
+				q = static_cast<uint32_t>(std::min<double>(std::max(std::round(-p / hdr.cost_step), 0.0), impossible - 1));
+			}
+			if (bits == 16) {
+				const uint16_t q16 = static_cast<uint16_t>(q);
+				put(&q16, sizeof(q16));
+			} else {
+				const uint8_t q8 = static_cast<uint8_t>(q);
+				put(&q8, sizeof(q8));
+			}
+		}
+	}
+	pad();
+}
+
+// a read only model of 4 tags over the bytes of save_compact(), decoding like model does while holding nothing
+// but the normalized parameters. float emissions are used in place, e.g. straight from a mapped file, quantized
+// ones are expanded to floats once. provides the add_edges() interface used by build_dag()
+class compact_model : public _decoding<compact_model> {
+public:
+	using emission_t = wseg_4tag::emission_t;
+	using row_t = packed_4state_params::row_t;
+
+	static_assert(sizeof(row_t) == 4 * sizeof(float), "rows are read in place");
+
+	// bytes must outlive the model & be aligned to 4 at least. throws std::invalid_argument unless they hold
+	// a compact model
+	explicit compact_model(std::string_view bytes) {
+		_parse(bytes);
+	}
+
+	// maps filename, throws std::system_error if it cannot
+	static compact_model open(const char* filename) {
+		compact_model ret;
+		ret.file_ = mapped_file{filename};
+		ret._parse(ret.file_.view());
+		return ret;
+	}
+
+	compact_model(compact_model&&) noexcept = default;
+	compact_model& operator=(compact_model&&) noexcept = default;
+
+	bool trival() const noexcept {
+		return false;
+	}
+
+	unsigned bits() const noexcept {
+		return hdr_.bits;
+	}
+
+	size_t rows() const noexcept {
+		return hdr_.rows;
+	}
+
+	emission_t emission_of(std::string_view rune) const noexcept {
+		return emission_of_codepoint(utf8_codepoint(rune));
+	}
+
+	emission_t emission_of_codepoint(uint32_t cp) const noexcept {
+		if (static_cast<size_t>(cp - dense_first) < hdr_.dense_size) {
+			return emission_t{dense_rows_[cp - dense_first]};
+		}
+		const uint32_t* end = sparse_keys_ + hdr_.sparse_size;
+		const uint32_t* it = std::lower_bound(sparse_keys_, end, cp);
+		if ((it != end) && (*it == cp)) {
+			return emission_t{sparse_rows_[it - sparse_keys_]};
+		}
+		return emission_t{0};
+	}
+
+	const packed_4state_params& _packed_params() const noexcept {
+		return hdr_.params;
+	}
+
+	const row_t* _packed_rows() const noexcept {
+		return (rows_ != nullptr) ? rows_ : dequantized_.data();
+	}
+
+private:
+	static constexpr uint32_t dense_first = model<>::dense_first;
+	static constexpr uint32_t dense_last = model<>::dense_last;
+
+	mapped_file file_; // empty if the bytes are borrowed
+	compact_model_header hdr_{};
+	const compact_row_t* dense_rows_ = nullptr;
+	const uint32_t* sparse_keys_ = nullptr;
+	const compact_row_t* sparse_rows_ = nullptr;
+	const row_t* rows_ = nullptr; // in place, or null for dequantized_
+	vector<row_t> dequantized_;
+
+	compact_model() = default;
+
+	[[noreturn]] static void _throw_malformed() {
+		throw std::invalid_argument{"fastcws::hmm::compact_model: not a compact model"};
+	}
+
+	void _parse(std::string_view bytes) {
+		if ((bytes.size() < sizeof(hdr_)) || ((reinterpret_cast<uintptr_t>(bytes.data()) % alignof(uint32_t)) != 0)) {
+			_throw_malformed();
+		}
+		std::memcpy(&hdr_, bytes.data(), sizeof(hdr_));
+		if ((std::memcmp(hdr_.magic, compact_model_header::expected_magic, sizeof(hdr_.magic)) != 0)
+				|| ((hdr_.bits != 32) && (hdr_.bits != 16) && (hdr_.bits != 8)) || (hdr_.rows == 0)
+				|| ((hdr_.dense_size != 0) && (hdr_.dense_size != dense_last - dense_first + 1))) {
+			_throw_malformed();
+		}
+
+		// sizes are 32 bits, none of this overflows
+		size_t offset = _compact_model_align(sizeof(hdr_));
+		const size_t dense_offset = offset;
+		offset = _compact_model_align(offset + size_t{hdr_.dense_size} * sizeof(compact_row_t));
+		const size_t sparse_keys_offset = offset;
+		offset = _compact_model_align(offset + size_t{hdr_.sparse_size} * sizeof(uint32_t));
+		const size_t sparse_rows_offset = offset;
+		offset = _compact_model_align(offset + size_t{hdr_.sparse_size} * sizeof(compact_row_t));
+		const size_t rows_offset = offset;
+		offset += size_t{hdr_.rows} * num_states * (hdr_.bits / 8);
+		if (offset > bytes.size()) {
+			_throw_malformed();
+		}
+
+		dense_rows_ = reinterpret_cast<const compact_row_t*>(bytes.data() + dense_offset);
+		sparse_keys_ = reinterpret_cast<const uint32_t*>(bytes.data() + sparse_keys_offset);
+		sparse_rows_ = reinterpret_cast<const compact_row_t*>(bytes.data() + sparse_rows_offset);
+		// a row out of bounds would be read by decoding
+		for (size_t i = 0; i < hdr_.dense_size; i++) {
+			if (dense_rows_[i] >= hdr_.rows) {
+				_throw_malformed();
+			}
+		}
+		for (size_t i = 0; i < hdr_.sparse_size; i++) {
+			if ((sparse_rows_[i] >= hdr_.rows) || ((i > 0) && (sparse_keys_[i - 1] >= sparse_keys_[i]))) {
+				_throw_malformed();
+			}
+		}
+
+		const char* rows = bytes.data() + rows_offset;
+		if (hdr_.bits == 32) {
+			rows_ = reinterpret_cast<const row_t*>(rows);
+			return;
+		}
+		const uint32_t impossible = (uint32_t{1} << hdr_.bits) - 1;
+		dequantized_.resize(hdr_.rows);
+		for (size_t r = 0; r < hdr_.rows; r++) {
+			for (size_t s = 0; s < num_states; s++) {
+				const size_t i = r * num_states + s;
+				const uint32_t q = (hdr_.bits == 16) ? reinterpret_cast<const uint16_t*>(rows)[i]
+					: static_cast<uint8_t>(rows[i]);
+				dequantized_[r][s] = (q == impossible) ? -std::numeric_limits<float>::infinity()
+					: -static_cast<float>(q) * hdr_.cost_step;
+			}
+		}
+	}
+};
+
+}
+
+}
+
+}
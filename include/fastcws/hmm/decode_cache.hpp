@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include "fastcws/bindings/containers.hpp"
+
+namespace fastcws {
+
+namespace hmm {
+
+// the states decoded for runs of observations, keyed by the bytes of the run. bounded to capacity runs
+// evicted least recently used first, sharded by hash so that threads decoding at once seldom wait on each other.
+// StateEnum values must fit a byte
+template <class StateEnum>
+class basic_decode_cache {
+public:
+	// runs longer than max_span_bytes are never cached, they seldom recur
+	explicit basic_decode_cache(size_t capacity, size_t max_span_bytes = 64, size_t shards = 16)
+		: shards_(new shard[std::max<size_t>(shards, 1)]), num_shards_(std::max<size_t>(shards, 1)),
+		shard_capacity_((capacity + num_shards_ - 1) / num_shards_), max_span_bytes_(max_span_bytes) {}
+
+	bool cacheable(std::string_view span) const noexcept {
+		return (span.size() <= max_span_bytes_) && (shard_capacity_ != 0);
+	}
+
+	// copies the states of span to out if cached, which counts as a hit, otherwise as a miss
+	bool find(std::string_view span, StateEnum* out) {
+		shard& s = _shard_of(span);
+		std::lock_guard<std::mutex> lock{s.mutex};
+		auto it = s.index.find(span);
+		if (it == s.index.end()) {
+			s.misses.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		s.lru.splice(s.lru.begin(), s.lru, it->second);
+		const std::string& bytes = it->second->bytes;
+		for (size_t i = span.size(); i < bytes.size(); i++) {
+			*out++ = static_cast<StateEnum>(static_cast<uint8_t>(bytes[i]));
+		}
+		s.hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// span must be cacheable()
+	void insert(std::string_view span, const StateEnum* states, size_t size) {
+		shard& s = _shard_of(span);
+		std::string bytes;
+		bytes.reserve(span.size() + size);
+		bytes.append(span.data(), span.size());
+		for (size_t i = 0; i < size; i++) {
+			bytes.push_back(static_cast<char>(static_cast<uint8_t>(states[i])));
+		}
+		std::lock_guard<std::mutex> lock{s.mutex};
+		if (s.index.find(span) != s.index.end()) {
+			return; // decoded by another thread meanwhile
+		}
+		s.lru.push_front(entry{std::move(bytes), span.size()});
+		s.index.emplace(std::string_view{s.lru.front().bytes.data(), span.size()}, s.lru.begin());
+		if (s.lru.size() > shard_capacity_) {
+			const entry& last = s.lru.back();
+			s.index.erase(std::string_view{last.bytes.data(), last.key_size});
+			s.lru.pop_back();
+		}
+	}
+
+	// forgets every run, for a cache outliving the model it was filled by. keeps the hits & misses
+	void clear() {
+		for (size_t i = 0; i < num_shards_; i++) {
+			std::lock_guard<std::mutex> lock{shards_[i].mutex};
+			shards_[i].index.clear();
+			shards_[i].lru.clear();
+		}
+	}
+
+	uint64_t hits() const noexcept {
+		return _sum(&shard::hits);
+	}
+
+	uint64_t misses() const noexcept {
+		return _sum(&shard::misses);
+	}
+
+	size_t size() const {
+		size_t ret = 0;
+		for (size_t i = 0; i < num_shards_; i++) {
+			std::lock_guard<std::mutex> lock{shards_[i].mutex};
+			ret += shards_[i].lru.size();
+		}
+		return ret;
+	}
+
+private:
+	struct entry {
+		std::string bytes; // the span, then its states
+		size_t key_size;
+	};
+
+	using lru_t = list<entry>;
+
+	struct alignas(64) shard {
+		mutable std::mutex mutex;
+		lru_t lru; // most recently used first
+		unordered_map<std::string_view, typename lru_t::iterator, std::hash<std::string_view>> index;
+		std::atomic<uint64_t> hits{0};
+		std::atomic<uint64_t> misses{0};
+	};
+
+	std::unique_ptr<shard[]> shards_;
+	size_t num_shards_;
+	size_t shard_capacity_;
+	size_t max_span_bytes_;
+
+	shard& _shard_of(std::string_view span) noexcept {
+		return shards_[std::hash<std::string_view>{}(span) % num_shards_];
+	}
+
+	uint64_t _sum(std::atomic<uint64_t> shard::* counter) const noexcept {
+		uint64_t ret = 0;
+		for (size_t i = 0; i < num_shards_; i++) {
+			ret += (shards_[i].*counter).load(std::memory_order_relaxed);
+		}
+		return ret;
+	}
+};
+
+}
+
+}
@@ -39,7 +39,52 @@ struct _model_params{
 		>
 	> b{};
 
+	// counts the initial state, the emissions & the transitions of one tagged sequence
+	template <class ObserveTypeIterator, class StateEnumIterator> /* TODO concepts */
+	void count(const ObserveTypeIterator& x_begin, const ObserveTypeIterator& x_end,
+			const StateEnumIterator& y_begin, const StateEnumIterator& y_end) {
+		assert((x_end - x_begin) == (y_end - y_begin));
+		if (x_end == x_begin) {
+			return;
+		}
+
+		pi[static_cast<size_t>(*y_begin)]++;
+		auto x_it = x_begin;
+		auto y_it = y_begin;
+		while (x_it != x_end) {
+			b[*x_it][static_cast<size_t>(*y_it)]++;
+			x_it++;
+			y_it++;
+		}
+
+		if ((x_end - x_begin) < 2) {
+			return;
+		}
+		auto y_from_it = y_begin;
+		auto y_to_it = y_begin + 1;
+		while (y_to_it != y_end) {
+			a[static_cast<size_t>(*y_from_it)][static_cast<size_t>(*y_to_it)]++;
+			y_from_it++;
+			y_to_it++;
+		}
+	}
+
+	template <class Params>
+	void _merge_transitions(const Params& params) noexcept {
+		for (size_t i = 0; i < num_states_; i++) {
+			pi[i] += params.pi[i];
+			for (size_t j = 0; j < num_states_; j++) {
+				a[i][j] += params.a[i][j];
+			}
+		}
+	}
+
 	void dump(std::ostream& os) const {
+		_dump_transitions(os);
+		_dump_emissions(os);
+	}
+
+	void _dump_transitions(std::ostream& os) const {
 		os << "pi: [ ";
 		for (auto &ele : pi) {
 			os << ele << ", ";
@@ -53,8 +98,11 @@ struct _model_params{
 			}
 			os << "] ,\n";
 		}
-		os << "]\n"
-			<< "b: [\n";
+		os << "]\n";
+	}
+
+	void _dump_emissions(std::ostream& os) const {
+		os << "b: [\n";
 		for (auto& [k, row] : b) {
 			os << k << " : " << "[ ";
 			for (auto& ele : row) {
@@ -90,40 +138,33 @@ struct model {
 	template <class ObserveTypeIterator, class StateEnumIterator> /* TODO concepts */
 	void train(const ObserveTypeIterator& x_begin, const ObserveTypeIterator& x_end,
 			const StateEnumIterator& y_begin, const StateEnumIterator& y_end) {
-		assert((x_end - x_begin) == (y_end - y_begin));
-		if (x_end == x_begin) {
-			return;
-		}
+		training_.count(x_begin, x_end, y_begin, y_end);
+	}
 
-		training_.pi[static_cast<size_t>(*y_begin)]++;
-		auto x_it = x_begin;
-		auto y_it = y_begin;
-		while (x_it != x_end) {
-			training_.b[*x_it][static_cast<size_t>(*y_it)]++;
-			x_it++;
-			y_it++;
+	// adds the counts of params, e.g. ones of other threads, whose observations convert to observe_t
+	template <class Params>
+	void merge(const Params& params) {
+		training_._merge_transitions(params);
+		for (const auto& [obs, emit] : params.b) {
+			auto& row = training_.b[observe_t{obs}];
+			for (size_t i = 0; i < num_states_; i++) {
+				row[i] += emit[i];
+			}
 		}
+	}
 
-		if ((x_end - x_begin) < 2) {
-			return;
-		}
-		auto y_from_it = y_begin;
-		auto y_to_it = y_begin + 1;
-		while (y_to_it != y_end) {
-			training_.a[static_cast<size_t>(*y_from_it)][static_cast<size_t>(*y_to_it)]++;
-			y_from_it++;
-			y_to_it++;
+	void normalize() {
+		_normalize_transitions();
+		for (auto [obs, emit] : training_.b) {
+			Normalizer::normalize(emit.cbegin(), emit.cend(), normalized_.b[obs].begin());
 		}
 	}
 
-	void normalize() {
+	void _normalize_transitions() {
 		Normalizer::normalize(training_.pi.cbegin(), training_.pi.cend(), normalized_.pi.begin());
 		for (size_t i = 0; i < num_states_; i++) {
 			Normalizer::normalize(training_.a[i].cbegin(), training_.a[i].cend(), normalized_.a[i].begin());
 		}
-		for (auto [obs, emit] : training_.b) {
-			Normalizer::normalize(emit.cbegin(), emit.cend(), normalized_.b[obs].begin());
-		}
 	}
 
 	void dump(std::ostream& os) const {
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <cstdint>
+
+#include "fastcws/hmm/hmm.hpp"
+#include "fastcws/hmm/wseg_4tag.hpp"
+#include "fastcws/misc/corpus_chunks.hpp"
+#include "fastcws/misc/rune_hopper.hpp"
+
+namespace fastcws {
+
+namespace hmm {
+
+namespace wseg_4tag {
+
+struct training_options {
+	size_t threads = 0; // hardware concurrency if 0
+	// one sentence a line, its words separated by spaces, instead of one rune & its tag a line
+	bool segmented = false;
+	size_t chunk_size = 4UL * 1024UL * 1024UL; // bytes a thread takes at a time, cut at the next sentence end
+};
+
+// counts of one thread, keyed by views of the corpus
+template <class Freq>
+struct training_counter {
+	_model_params<Freq, std::string_view, num_states, std::allocator<int>> counts_;
+	std::vector<std::string_view> runes_;
+	std::vector<state> tags_;
+
+	// lines of a rune, a space & its tag, sentences ending with a SENTENCE END or a TEXT END line.
+	// throws std::invalid_argument on any other line
+	void add_tagged(std::string_view chunk) {
+		_for_each_line(chunk, [this](std::string_view line) {
+			if (line.empty()) {
+				return;
+			}
+			if ((line == "SENTENCE END") || (line == "TEXT END")) {
+				_flush();
+				return;
+			}
+			if ((line.size() < 3) || (line[line.size() - 2] != ' ')) {
+				throw std::invalid_argument{"fastcws::hmm::train_corpus: invalid line: " + std::string{line}};
+			}
+			switch (line.back()) {
+				case 'B':
+					tags_.push_back(state::B);
+					break;
+				case 'M':
+					tags_.push_back(state::M);
+					break;
+				case 'E':
+					tags_.push_back(state::E);
+					break;
+				case 'S':
+					tags_.push_back(state::S);
+					break;
+				default:
+					throw std::invalid_argument{"fastcws::hmm::train_corpus: invalid tag: " + std::string{line}};
+			}
+			runes_.push_back(line.substr(0, line.size() - 2));
+		});
+		_flush();
+	}
+
+	// one sentence a line, words separated by ascii or ideographic spaces, tagged B/M/E/S rune by rune
+	void add_segmented(std::string_view chunk) {
+		_for_each_line(chunk, [this](std::string_view line) {
+			for (size_t i = 0; i < line.size();) {
+				const size_t space = _space_size(line.substr(i));
+				if (space != 0) {
+					i += space;
+					continue;
+				}
+				const size_t first = runes_.size();
+				while ((i < line.size()) && (_space_size(line.substr(i)) == 0)) {
+					const size_t hop = std::min(rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(line[i])), line.size() - i);
+					runes_.push_back(line.substr(i, hop));
+					tags_.push_back(state::M);
+					i += hop;
+				}
+				if (runes_.size() - first == 1) {
+					tags_.back() = state::S;
+				} else {
+					tags_[first] = state::B;
+					tags_.back() = state::E;
+				}
+			}
+			_flush();
+		});
+	}
+
+	static size_t _space_size(std::string_view s) noexcept {
+		if ((s[0] == ' ') || (s[0] == '\t') || (s[0] == '\r')) {
+			return 1;
+		}
+		return (s.substr(0, 3) == "　") ? 3 : 0;
+	}
+
+	template <class F>
+	static void _for_each_line(std::string_view chunk, F f) {
+		for (size_t begin = 0; begin < chunk.size();) {
+			const size_t end = std::min(chunk.find('\n', begin), chunk.size());
+			std::string_view line = chunk.substr(begin, end - begin);
+			if (!line.empty() && (line.back() == '\r')) {
+				line.remove_suffix(1);
+			}
+			f(line);
+			begin = end + 1;
+		}
+	}
+
+	void _flush() {
+		counts_.count(runes_.cbegin(), runes_.cend(), tags_.cbegin(), tags_.cend());
+		runes_.clear();
+		tags_.clear();
+	}
+};
+
+// trains model on corpus on every core. the corpus is cut into chunks at sentence ends, each thread counts its
+// chunks in its own training_counter, which are merged into model once they all finished
+template <class Model>
+void train_corpus(Model& model, std::string_view corpus, const training_options& opt = {}) {
+	size_t threads = opt.threads;
+	if (threads == 0) {
+		threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	const std::vector<std::string_view> chunks = opt.segmented ? _split_corpus(corpus, opt.chunk_size)
+		: _split_corpus_at_line(corpus, opt.chunk_size, "SENTENCE END");
+	threads = std::max<size_t>(std::min(threads, chunks.size()), 1);
+
+	std::vector<training_counter<typename Model::freq_t>> counters(threads);
+	_for_each_chunk(chunks, threads, [&counters, &opt](size_t t, std::string_view chunk) {
+		if (opt.segmented) {
+			counters[t].add_segmented(chunk);
+		} else {
+			counters[t].add_tagged(chunk);
+		}
+	});
+	for (const auto& counter : counters) {
+		model.merge(counter.counts_);
+	}
+}
+
+}
+
+}
+
+}
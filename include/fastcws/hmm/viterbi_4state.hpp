@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#define FASTCWS_VITERBI_4STATE_SSE2 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FASTCWS_VITERBI_4STATE_AVX2 1
+#endif
+
+namespace fastcws {
+
+namespace hmm {
+
+// float log probabilities of a 4 state model, laid out for viterbi_4state().
+// not over aligned, as regions do not promise more than the alignment of their allocations
+struct packed_4state_params {
+	using row_t = std::array<float, 4>;
+
+	row_t pi;
+	std::array<row_t, 4> a; // a[from][to]
+};
+
+// viterbi for models of exactly 4 states. the scores of the states are kept in one vector register, the
+// best predecessor of every state is found with a few shuffles & compares, and the backpointers of a step
+// are packed 2 bits per state into backpointers[step], which must hold size bytes.
+// emission_of(i) returns the row_t of emission log probabilities of observation i. ties go to the lowest
+// state, as in viterbi().
+template <class EmissionOf, class StateEnum>
+void viterbi_4state(const packed_4state_params& params, size_t size, EmissionOf emission_of,
+		uint8_t* backpointers, StateEnum* out) {
+	using row_t = packed_4state_params::row_t;
+	if (size == 0) {
+		return;
+	}
+
+	alignas(16) row_t scores;
+#ifdef FASTCWS_VITERBI_4STATE_SSE2
+	const __m128 a0 = _mm_loadu_ps(params.a[0].data());
+	const __m128 a1 = _mm_loadu_ps(params.a[1].data());
+	const __m128 a2 = _mm_loadu_ps(params.a[2].data());
+	const __m128 a3 = _mm_loadu_ps(params.a[3].data());
+	// the index of predecessor i, already shifted into the bits of each lane
+	const __m128i from1 = _mm_setr_epi32(1, 1 << 2, 1 << 4, 1 << 6);
+	const __m128i from2 = _mm_setr_epi32(2, 2 << 2, 2 << 4, 2 << 6);
+	const __m128i from3 = _mm_setr_epi32(3, 3 << 2, 3 << 4, 3 << 6);
+
+	const row_t& first = emission_of(0);
+	__m128 s = _mm_add_ps(_mm_loadu_ps(params.pi.data()), _mm_loadu_ps(first.data()));
+	for (size_t t = 1; t < size; t++) {
+		// emission first, so that an impossible emission ties every predecessor like in viterbi()
+		const __m128 e = _mm_loadu_ps(emission_of(t).data());
+		__m128 best = _mm_add_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0)), _mm_add_ps(a0, e));
+		__m128i from = _mm_setzero_si128();
+		auto relax = [&best, &from](__m128 candidate, __m128i candidate_from) {
+			const __m128 better = _mm_cmpgt_ps(candidate, best);
+			best = _mm_or_ps(_mm_and_ps(better, candidate), _mm_andnot_ps(better, best));
+			const __m128i better_i = _mm_castps_si128(better);
+			from = _mm_or_si128(_mm_and_si128(better_i, candidate_from), _mm_andnot_si128(better_i, from));
+		};
+		relax(_mm_add_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)), _mm_add_ps(a1, e)), from1);
+		relax(_mm_add_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 2, 2, 2)), _mm_add_ps(a2, e)), from2);
+		relax(_mm_add_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3)), _mm_add_ps(a3, e)), from3);
+		s = best;
+
+		from = _mm_or_si128(from, _mm_shuffle_epi32(from, _MM_SHUFFLE(1, 0, 3, 2)));
+		from = _mm_or_si128(from, _mm_shuffle_epi32(from, _MM_SHUFFLE(2, 3, 0, 1)));
+		backpointers[t] = static_cast<uint8_t>(_mm_cvtsi128_si32(from));
+	}
+	_mm_store_ps(scores.data(), s);
+#else
+	const row_t& first = emission_of(0);
+	for (size_t j = 0; j < 4; j++) {
+		scores[j] = params.pi[j] + first[j];
+	}
+	for (size_t t = 1; t < size; t++) {
+		const row_t& emission = emission_of(t);
+		row_t next;
+		uint8_t from = 0;
+		for (size_t j = 0; j < 4; j++) {
+			// emission first, so that an impossible emission ties every predecessor like in viterbi()
+			float best = scores[0] + (params.a[0][j] + emission[j]);
+			size_t best_from = 0;
+			for (size_t i = 1; i < 4; i++) {
+				const float candidate = scores[i] + (params.a[i][j] + emission[j]);
+				if (candidate > best) {
+					best = candidate;
+					best_from = i;
+				}
+			}
+			next[j] = best;
+			from |= static_cast<uint8_t>(best_from << (2 * j));
+		}
+		scores = next;
+		backpointers[t] = from;
+	}
+#endif
+
+	size_t state = std::max_element(scores.cbegin(), scores.cend()) - scores.cbegin();
+	out[size - 1] = static_cast<StateEnum>(state);
+	for (size_t t = size - 1; t > 0; t--) {
+		state = (backpointers[t] >> (2 * state)) & 0x3;
+		out[t - 1] = static_cast<StateEnum>(state);
+	}
+}
+
+// sequences viterbi_4state_batch() decodes at once, a register of them when built for avx2 (e.g. -mavx2),
+// two with sse2
+constexpr size_t viterbi_4state_batch_lanes = 8;
+
+// viterbi_4state() over count <= viterbi_4state_batch_lanes independent sequences, one per lane: each state
+// of every lane is a float of a vector register, the rows of a step are gathered & transposed once for
+// all lanes, and a lane stops being read past its own end. sequence l is sizes[l] observations long,
+// emission_of(l, t) returns the row of observation t of it, and its states are written to out[l].
+// backpointers must hold viterbi_4state_batch_lanes bytes for every step of the longest sequence.
+// the states are the very ones viterbi_4state() finds
+template <class EmissionOf, class StateEnum>
+void viterbi_4state_batch(const packed_4state_params& params, size_t count, const size_t* sizes,
+		EmissionOf emission_of, uint8_t* backpointers, StateEnum* const* out) {
+	using row_t = packed_4state_params::row_t;
+	constexpr size_t lanes = viterbi_4state_batch_lanes;
+	count = std::min(count, lanes);
+	size_t max_size = 0;
+	for (size_t l = 0; l < count; l++) {
+		max_size = std::max(max_size, sizes[l]);
+	}
+	if (max_size == 0) {
+		return;
+	}
+
+	alignas(16) float scores[4][lanes]; // of the last step of every lane
+#if defined(FASTCWS_VITERBI_4STATE_AVX2) || defined(FASTCWS_VITERBI_4STATE_SSE2)
+	// locals, or every store to backpointers would have them reloaded
+	size_t lane_sizes[lanes];
+	for (size_t l = 0; l < lanes; l++) {
+		lane_sizes[l] = (l < count) ? sizes[l] : 0;
+	}
+	static const row_t none{};
+	auto row_of = [&](size_t l, size_t t) -> const float* {
+		return ((t < lane_sizes[l]) ? emission_of(l, t) : none).data();
+	};
+	auto size_of = [&lane_sizes](size_t l) {
+		return static_cast<int>(std::min<size_t>(lane_sizes[l], INT32_MAX));
+	};
+
+#ifdef FASTCWS_VITERBI_4STATE_AVX2
+	// all the lanes of every state in one register
+	__m256 a[4][4];
+	for (size_t i = 0; i < 4; i++) {
+		for (size_t j = 0; j < 4; j++) {
+			a[i][j] = _mm256_set1_ps(params.a[i][j]);
+		}
+	}
+	const __m256i sizes_v = _mm256_setr_epi32(size_of(0), size_of(1), size_of(2), size_of(3),
+		size_of(4), size_of(5), size_of(6), size_of(7));
+	__m256 s[4];
+	__m256 last[4];
+	for (size_t j = 0; j < 4; j++) {
+		last[j] = _mm256_setzero_ps();
+	}
+	for (size_t t = 0; t < max_size; t++) {
+		// lanes l & l + 4 share a register, the in-lane transpose then leaves lanes 0 .. 7 in order
+		auto rows_of = [&row_of, t](size_t l) {
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(row_of(l, t))),
+				_mm_loadu_ps(row_of(l + 4, t)), 1);
+		};
+		const __m256 r0 = rows_of(0);
+		const __m256 r1 = rows_of(1);
+		const __m256 r2 = rows_of(2);
+		const __m256 r3 = rows_of(3);
+		const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+		const __m256 e0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 e1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		const __m256 e2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		const __m256 e3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		if (t == 0) {
+			s[0] = _mm256_add_ps(_mm256_set1_ps(params.pi[0]), e0);
+			s[1] = _mm256_add_ps(_mm256_set1_ps(params.pi[1]), e1);
+			s[2] = _mm256_add_ps(_mm256_set1_ps(params.pi[2]), e2);
+			s[3] = _mm256_add_ps(_mm256_set1_ps(params.pi[3]), e3);
+		} else {
+			__m256i from = _mm256_setzero_si256();
+			// as in the sse2 version below
+			auto best_of = [&s, &a, &from](size_t j, __m256 e) {
+				__m256 best = _mm256_add_ps(s[0], _mm256_add_ps(a[0][j], e));
+				__m256i best_from = _mm256_setzero_si256();
+				auto relax = [&best, &best_from](__m256 candidate, __m256i candidate_from) {
+					const __m256i better = _mm256_castps_si256(_mm256_cmp_ps(candidate, best, _CMP_GT_OQ));
+					best = _mm256_max_ps(candidate, best);
+					best_from = _mm256_max_epi16(best_from, _mm256_and_si256(better, candidate_from));
+				};
+				relax(_mm256_add_ps(s[1], _mm256_add_ps(a[1][j], e)), _mm256_set1_epi32(1 << (2 * j)));
+				relax(_mm256_add_ps(s[2], _mm256_add_ps(a[2][j], e)), _mm256_set1_epi32(2 << (2 * j)));
+				relax(_mm256_add_ps(s[3], _mm256_add_ps(a[3][j], e)), _mm256_set1_epi32(3 << (2 * j)));
+				from = _mm256_or_si256(from, best_from);
+				return best;
+			};
+			const __m256 next0 = best_of(0, e0);
+			const __m256 next1 = best_of(1, e1);
+			const __m256 next2 = best_of(2, e2);
+			const __m256 next3 = best_of(3, e3);
+			s[0] = next0;
+			s[1] = next1;
+			s[2] = next2;
+			s[3] = next3;
+			from = _mm256_packs_epi32(from, from);
+			from = _mm256_packus_epi16(from, from);
+			const int packed_lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(from));
+			const int packed_hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(from, 1));
+			std::memcpy(backpointers + t * lanes, &packed_lo, 4);
+			std::memcpy(backpointers + t * lanes + 4, &packed_hi, 4);
+		}
+		const __m256 ended = _mm256_castsi256_ps(_mm256_cmpeq_epi32(sizes_v,
+			_mm256_set1_epi32(static_cast<int>(std::min<size_t>(t + 1, INT32_MAX)))));
+		if (_mm256_movemask_ps(ended) != 0) {
+			for (size_t j = 0; j < 4; j++) {
+				last[j] = _mm256_blendv_ps(last[j], s[j], ended);
+			}
+		}
+	}
+	for (size_t j = 0; j < 4; j++) {
+		_mm256_storeu_ps(scores[j], last[j]);
+	}
+#else
+	__m128 a[4][4];
+	for (size_t i = 0; i < 4; i++) {
+		for (size_t j = 0; j < 4; j++) {
+			a[i][j] = _mm_set1_ps(params.a[i][j]);
+		}
+	}
+	// 4 lanes of every state, in one register each
+	struct quad {
+		__m128 s[4];
+		__m128 last[4]; // of the last step of every lane
+		__m128i sizes;
+	} quads[lanes / 4];
+	for (size_t t = 0; t < max_size; t++) {
+		const __m128i steps = _mm_set1_epi32(static_cast<int>(std::min<size_t>(t + 1, INT32_MAX)));
+		for (size_t h = 0; h < lanes / 4; h++) {
+			quad& q = quads[h];
+			// the rows of the 4 lanes, transposed into one register per state
+			__m128 e0 = _mm_loadu_ps(row_of(4 * h, t));
+			__m128 e1 = _mm_loadu_ps(row_of(4 * h + 1, t));
+			__m128 e2 = _mm_loadu_ps(row_of(4 * h + 2, t));
+			__m128 e3 = _mm_loadu_ps(row_of(4 * h + 3, t));
+			_MM_TRANSPOSE4_PS(e0, e1, e2, e3);
+			if (t == 0) {
+				q.sizes = _mm_setr_epi32(size_of(4 * h), size_of(4 * h + 1), size_of(4 * h + 2), size_of(4 * h + 3));
+				q.s[0] = _mm_add_ps(_mm_set1_ps(params.pi[0]), e0);
+				q.s[1] = _mm_add_ps(_mm_set1_ps(params.pi[1]), e1);
+				q.s[2] = _mm_add_ps(_mm_set1_ps(params.pi[2]), e2);
+				q.s[3] = _mm_add_ps(_mm_set1_ps(params.pi[3]), e3);
+				for (size_t j = 0; j < 4; j++) {
+					q.last[j] = _mm_setzero_ps();
+				}
+			} else {
+				__m128i from = _mm_setzero_si128();
+				auto best_of = [&q, &a, &from](size_t j, __m128 e) {
+					// emission first, so that an impossible emission ties every predecessor like in viterbi()
+					__m128 best = _mm_add_ps(q.s[0], _mm_add_ps(a[0][j], e));
+					__m128i best_from = _mm_setzero_si128();
+					// max keeps best on ties, and the predecessors come in increasing order, so a max picks
+					// the last better one. the 16 bit max is enough, the indices being at most 3 << 6
+					auto relax = [&best, &best_from](__m128 candidate, __m128i candidate_from) {
+						const __m128i better = _mm_castps_si128(_mm_cmpgt_ps(candidate, best));
+						best = _mm_max_ps(candidate, best);
+						best_from = _mm_max_epi16(best_from, _mm_and_si128(better, candidate_from));
+					};
+					relax(_mm_add_ps(q.s[1], _mm_add_ps(a[1][j], e)), _mm_set1_epi32(1 << (2 * j)));
+					relax(_mm_add_ps(q.s[2], _mm_add_ps(a[2][j], e)), _mm_set1_epi32(2 << (2 * j)));
+					relax(_mm_add_ps(q.s[3], _mm_add_ps(a[3][j], e)), _mm_set1_epi32(3 << (2 * j)));
+					from = _mm_or_si128(from, best_from);
+					return best;
+				};
+				const __m128 next0 = best_of(0, e0);
+				const __m128 next1 = best_of(1, e1);
+				const __m128 next2 = best_of(2, e2);
+				const __m128 next3 = best_of(3, e3);
+				q.s[0] = next0;
+				q.s[1] = next1;
+				q.s[2] = next2;
+				q.s[3] = next3;
+				from = _mm_packs_epi32(from, from);
+				from = _mm_packus_epi16(from, from);
+				const int packed = _mm_cvtsi128_si32(from);
+				std::memcpy(backpointers + t * lanes + 4 * h, &packed, 4);
+			}
+			// keep the scores of the lanes ending here
+			const __m128 ended = _mm_castsi128_ps(_mm_cmpeq_epi32(q.sizes, steps));
+			if (_mm_movemask_ps(ended) != 0) {
+				for (size_t j = 0; j < 4; j++) {
+					q.last[j] = _mm_or_ps(_mm_and_ps(ended, q.s[j]), _mm_andnot_ps(ended, q.last[j]));
+				}
+			}
+		}
+	}
+	for (size_t h = 0; h < lanes / 4; h++) {
+		for (size_t j = 0; j < 4; j++) {
+			_mm_store_ps(&scores[j][4 * h], quads[h].last[j]);
+		}
+	}
+#endif
+#else
+	for (size_t l = 0; l < count; l++) {
+		if (sizes[l] == 0) {
+			continue;
+		}
+		const row_t& first = emission_of(l, 0);
+		for (size_t j = 0; j < 4; j++) {
+			scores[j][l] = params.pi[j] + first[j];
+		}
+		for (size_t t = 1; t < sizes[l]; t++) {
+			const row_t& emission = emission_of(l, t);
+			float next[4];
+			uint8_t from = 0;
+			for (size_t j = 0; j < 4; j++) {
+				float best = scores[0][l] + (params.a[0][j] + emission[j]);
+				size_t best_from = 0;
+				for (size_t i = 1; i < 4; i++) {
+					const float candidate = scores[i][l] + (params.a[i][j] + emission[j]);
+					if (candidate > best) {
+						best = candidate;
+						best_from = i;
+					}
+				}
+				next[j] = best;
+				from |= static_cast<uint8_t>(best_from << (2 * j));
+			}
+			for (size_t j = 0; j < 4; j++) {
+				scores[j][l] = next[j];
+			}
+			backpointers[t * lanes + l] = from;
+		}
+	}
+#endif
+
+	for (size_t l = 0; l < count; l++) {
+		if (sizes[l] == 0) {
+			continue;
+		}
+		size_t state = 0;
+		for (size_t j = 1; j < 4; j++) {
+			if (scores[j][l] > scores[state][l]) {
+				state = j;
+			}
+		}
+		out[l][sizes[l] - 1] = static_cast<StateEnum>(state);
+		for (size_t t = sizes[l] - 1; t > 0; t--) {
+			state = (backpointers[t * lanes + l] >> (2 * state)) & 0x3;
+			out[l][t - 1] = static_cast<StateEnum>(state);
+		}
+	}
+}
+
+}
+
+}
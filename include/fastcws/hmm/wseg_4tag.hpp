@@ -9,10 +9,16 @@
 #include <istream>
 #include <sstream>
 #include <set>
+#include <array>
+#include <utility>
+#include <cstdint>
 
 #include "fastcws/hmm/hmm.hpp"
 #include "fastcws/hmm/viterbi.hpp"
+#include "fastcws/hmm/viterbi_4state.hpp"
+#include "fastcws/hmm/decode_cache.hpp"
 #include "fastcws/misc/rune_hopper.hpp"
+#include "fastcws/misc/decoded_runes.hpp"
 #include "fastcws/rep_aware/string_view.hpp"
 #include "fastcws/bindings/containers.hpp"
 
@@ -31,6 +37,238 @@ enum class state {
 
 static constexpr size_t num_states = 4;
 
+using decode_cache = basic_decode_cache<state>;
+
+// an observed character, as the row of its emission log probabilities
+struct emission_t {
+	uint32_t row;
+};
+
+// buffers of _decoding, kept per thread so that decoding a sentence allocates nothing once they have grown
+struct _decoding_scratch {
+	vector<uint8_t> backpointers;
+	vector<size_t> order;
+	vector<size_t> spans;
+	vector<state> states;
+	vector<emission_t> observed;
+	vector<size_t> missed;
+	vector<const emission_t*> span_observed;
+	vector<size_t> span_sizes;
+	vector<state*> span_states;
+
+	static _decoding_scratch& of_this_thread() {
+		thread_local _decoding_scratch scratch;
+		return scratch;
+	}
+};
+
+// the decoding shared by the models of 4 tags. Derived provides trival(), emission_of_codepoint(uint32_t),
+// & the float parameters of viterbi_4state(), _packed_params() & _packed_rows() indexed by emission_t::row
+template <class Derived>
+struct _decoding {
+	const Derived& derived() const noexcept {
+		return static_cast<const Derived&>(*this);
+	}
+
+	// tags of observed, with the 4 state kernel
+	void decode(const emission_t* observed, size_t size, state* out) const {
+		auto& backpointers = _decoding_scratch::of_this_thread().backpointers;
+		backpointers.resize(std::max(backpointers.size(), size));
+		viterbi_4state(derived()._packed_params(), size,
+			[rows = derived()._packed_rows(), observed](size_t i) -> const packed_4state_params::row_t& {
+				return rows[observed[i].row];
+			}, backpointers.data(), out);
+	}
+
+	// tags of count independent sequences, viterbi_4state_batch_lanes at a time. if batching them in order
+	// idles many lanes, they are sorted by size first
+	void decode_batch(const emission_t* const* observed, const size_t* sizes, size_t count, state* const* out) const {
+		constexpr size_t lanes = viterbi_4state_batch_lanes;
+		auto& scratch = _decoding_scratch::of_this_thread();
+		auto& order = scratch.order;
+		order.resize(count);
+		size_t total = 0;
+		size_t padded = 0; // lanes * the longest sequence, of every batch
+		size_t longest = 0;
+		for (size_t i = 0; i < count; i++) {
+			order[i] = i;
+			total += sizes[i];
+			longest = std::max(longest, sizes[i]);
+			if ((i % lanes == lanes - 1) || (i + 1 == count)) {
+				padded += lanes * longest;
+				longest = 0;
+			}
+		}
+		if (padded > total + total / 4) {
+			std::sort(order.begin(), order.end(), [sizes](size_t lhs, size_t rhs) {
+				return sizes[lhs] > sizes[rhs];
+			});
+		}
+		size_t max_size = 0;
+		for (size_t i = 0; i < count; i++) {
+			max_size = std::max(max_size, sizes[i]);
+		}
+		auto& backpointers = scratch.backpointers;
+		backpointers.resize(std::max(backpointers.size(), max_size * lanes));
+		for (size_t first = 0; first < count; first += lanes) {
+			const size_t n = std::min(lanes, count - first);
+			const emission_t* batch_observed[lanes];
+			size_t batch_sizes[lanes];
+			state* batch_out[lanes];
+			for (size_t l = 0; l < n; l++) {
+				batch_observed[l] = observed[order[first + l]];
+				batch_sizes[l] = sizes[order[first + l]];
+				batch_out[l] = out[order[first + l]];
+			}
+			viterbi_4state_batch(derived()._packed_params(), n, batch_sizes,
+				[rows = derived()._packed_rows(), &batch_observed](size_t l, size_t t) -> const packed_4state_params::row_t& {
+					return rows[batch_observed[l][t].row];
+				}, backpointers.data(), batch_out);
+		}
+	}
+
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight) const {
+		_add_edges<WordDag, RuneHopper>(dag, weight, false);
+	}
+
+	// runes are those of the sentence of dag, see build_dag()
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes) const {
+		_add_edges(dag, weight, runes, false);
+	}
+
+	// like add_edges(), but only decodes the maximal runs of runes that no edge of two runes or more covers,
+	// as jieba does. call it once the dict (and the special edges) are in the dag
+	template<class WordDag, class RuneHopper>
+	void add_oov_edges(WordDag& dag, typename WordDag::weight_t weight) const {
+		_add_edges<WordDag, RuneHopper>(dag, weight, true);
+	}
+
+	template<class WordDag, class RuneHopper>
+	void add_oov_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes) const {
+		_add_edges(dag, weight, runes, true);
+	}
+
+	template<class WordDag, class RuneHopper>
+	void _add_edges(WordDag& dag, typename WordDag::weight_t weight, bool oov_only, decode_cache* cache = nullptr) const {
+		if (derived().trival()) {
+			return;
+		}
+		const auto runes = decoded_runes::decode<RuneHopper>(std::string_view{dag.sentence().data(), dag.sentence().size()});
+		_add_edges(dag, weight, runes, oov_only, cache);
+	}
+
+	// decodes the whole sentence, or only its uncovered runs if oov_only. the runs found in cache are not decoded,
+	// the others are added to it
+	template<class WordDag>
+	void _add_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes, bool oov_only,
+			decode_cache* cache = nullptr) const {
+		if (derived().trival() || (runes.size() == 0)) {
+			return;
+		}
+		auto& scratch = _decoding_scratch::of_this_thread();
+		auto& spans = scratch.spans; // first rune of every run, and the one past its end
+		spans.clear();
+		if (!oov_only) {
+			spans.push_back(0);
+			spans.push_back(runes.size());
+		} else {
+			size_t offset = 0;
+			size_t covered_end = 0; // of the longest edge starting before offset
+			size_t span = 0; // first rune of the current uncovered run
+			for (size_t i = 0; i <= runes.size(); i++) {
+				bool covered = true;
+				if (i < runes.size()) {
+					const auto& adjacents = dag.adjacents(offset);
+					const size_t end = adjacents.empty() ? offset : adjacents.rbegin()->first;
+					covered = (covered_end > offset) || (end > offset + runes.rune_size(i));
+					covered_end = std::max(covered_end, end);
+					offset += runes.rune_size(i);
+				}
+				if (covered) {
+					if (span < i) {
+						spans.push_back(span);
+						spans.push_back(i);
+					}
+					span = i + 1;
+				}
+			}
+		}
+
+		const size_t count = spans.size() / 2;
+		auto bytes_of = [&runes, &spans](size_t k) {
+			const size_t begin = runes.offset(spans[2 * k]);
+			return runes.sentence().substr(begin, runes.offset(spans[2 * k + 1]) - begin);
+		};
+		// every rune of the runs is written before being read, what is left from the last sentence is not cleared
+		auto& states = scratch.states;
+		states.resize(runes.size());
+		auto& observed = scratch.observed; // of the runs to decode only
+		observed.resize(runes.size());
+		auto& missed = scratch.missed;
+		missed.clear();
+		for (size_t k = 0; k < count; k++) {
+			if (cache != nullptr) {
+				const std::string_view bytes = bytes_of(k);
+				if (cache->cacheable(bytes) && cache->find(bytes, states.data() + spans[2 * k])) {
+					continue;
+				}
+			}
+			missed.push_back(k);
+			for (size_t i = spans[2 * k]; i < spans[2 * k + 1]; i++) {
+				observed[i] = derived().emission_of_codepoint(runes[i].codepoint);
+			}
+		}
+
+		if (!oov_only) {
+			if (!missed.empty()) {
+				decode(observed.data(), observed.size(), states.data());
+			}
+		} else {
+			// the uncovered runs are independent, they are decoded in batches
+			auto& span_observed = scratch.span_observed;
+			span_observed.resize(missed.size());
+			auto& span_sizes = scratch.span_sizes;
+			span_sizes.resize(missed.size());
+			auto& span_states = scratch.span_states;
+			span_states.resize(missed.size());
+			for (size_t j = 0; j < missed.size(); j++) {
+				const size_t k = missed[j];
+				span_observed[j] = observed.data() + spans[2 * k];
+				span_sizes[j] = spans[2 * k + 1] - spans[2 * k];
+				span_states[j] = states.data() + spans[2 * k];
+			}
+			decode_batch(span_observed.data(), span_sizes.data(), missed.size(), span_states.data());
+		}
+		if (cache != nullptr) {
+			for (size_t k : missed) {
+				const std::string_view bytes = bytes_of(k);
+				if (cache->cacheable(bytes)) {
+					cache->insert(bytes, states.data() + spans[2 * k], spans[2 * k + 1] - spans[2 * k]);
+				}
+			}
+		}
+
+		for (size_t k = 0; k < count; k++) {
+			_add_state_edges(dag, weight, runes, spans[2 * k], spans[2 * k + 1], states.data());
+		}
+	}
+
+	// edges of the words tagged by states over runes [first, last)
+	template<class WordDag>
+	static void _add_state_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes,
+			size_t first, size_t last, const state* states) {
+		size_t edge_start = runes.offset(first);
+		for (size_t i = first; i < last; i++) {
+			if ((states[i] == state::S) || (states[i] == state::E)) {
+				dag.add_edge(edge_start, runes.offset(i + 1), weight);
+				edge_start = runes.offset(i + 1);
+			}
+		}
+	}
+};
+
 template <class Normalizer = basic_normalizer<uint64_t, double>, class Allocator = std::allocator<int>>
 struct model : hmm::model<
 	rep_aware::basic_string_view<
@@ -41,7 +279,7 @@ struct model : hmm::model<
 	state,
 	num_states,
 	Normalizer,
-	Allocator> {
+	Allocator>, _decoding<model<Normalizer, Allocator>> {
 	using allocator_traits = std::allocator_traits<Allocator>;
 
 	using string_view_type = rep_aware::basic_string_view<
@@ -63,9 +301,31 @@ struct model : hmm::model<
 
 	static constexpr size_t num_states_ = base_t::num_states_;
 
+	using emission_row_t = std::array<relative_freq_t, num_states_>;
+
+	using emission_t = wseg_4tag::emission_t;
+
+	// cjk unified ideographs, which most characters are, have a row index by code point
+	static constexpr uint32_t dense_first = 0x4e00;
+	static constexpr uint32_t dense_last = 0x9fff;
+
 	set<string_type, std::less<>,
 		typename allocator_traits::template rebind_alloc<string_type>> characters_;
 
+	// built by normalize() instead of normalized_.b, so that decoding never hashes.
+	// row 0 is for characters never seen in training
+	vector<emission_row_t,
+		typename allocator_traits::template rebind_alloc<emission_row_t>> emissions_;
+	vector<uint32_t,
+		typename allocator_traits::template rebind_alloc<uint32_t>> dense_rows_; // by code point - dense_first
+	vector<std::pair<uint32_t, uint32_t>,
+		typename allocator_traits::template rebind_alloc<
+			std::pair<uint32_t, uint32_t>>> sparse_rows_; // (code point, row) of the other characters, sorted
+	// float copies of the normalized parameters, decoded by viterbi_4state()
+	packed_4state_params packed_;
+	vector<packed_4state_params::row_t,
+		typename allocator_traits::template rebind_alloc<packed_4state_params::row_t>> packed_emissions_;
+
 	// stores undelying string in characters_
 	template <class ObserveTypeIterator, class StateEnumIterator> /* TODO concepts */
 	void train(const ObserveTypeIterator& x_begin, const ObserveTypeIterator& x_end,
@@ -79,27 +339,167 @@ struct model : hmm::model<
 		base_t::train(real_x.begin(), real_x.end(), y_begin, y_end);
 	}
 
-	template<class WordDag, class RuneHopper>
-	void add_edges(WordDag& dag, typename WordDag::weight_t weight) const {
-		if (this->trival()) {
-			return;
+	// adds the counts of params, e.g. ones of other threads keyed by views of their corpus, storing the
+	// characters in characters_
+	template <class Params>
+	void merge(const Params& params) {
+		this->training_._merge_transitions(params);
+		for (const auto& [obs, emit] : params.b) {
+			auto [s_it, inserted] = characters_.insert(string_type{obs.data(), obs.size()});
+			(void)inserted;
+			auto& row = this->training_.b[string_view_type{s_it->data(), s_it->size()}];
+			for (size_t i = 0; i < num_states_; i++) {
+				row[i] += emit[i];
+			}
 		}
-		vector<string_view_type> runes;
-		split_runes<RuneHopper>(string_view_type{dag.sentence().data(), dag.sentence().size()}, std::back_inserter(runes));
+	}
 
-		vector<hmm::wseg_4tag::state> states;
-		states.resize(runes.size());
-		viterbi(*this, runes.begin(), runes.end(), states.begin());
+	// characters that are not a single rune are never observed, they get no row
+	void normalize() {
+		this->_normalize_transitions();
+		this->normalized_.b = {};
+		emissions_ = {};
+		dense_rows_ = {};
+		sparse_rows_ = {};
 
-		size_t edge_start = 0;
-		size_t edge_end = 0;
-		for (size_t i = 0; i < states.size(); i++) {
-			edge_end += runes[i].size();
-			if ((states[i] == state::S) || (states[i] == state::E)) {
-				dag.add_edge(edge_start, edge_end, weight);
-				edge_start = edge_end;
+		emission_row_t unseen;
+		unseen.fill(-calc_log2<relative_freq_t>::log2(num_states_));
+		emissions_.push_back(unseen);
+		for (const auto& character : characters_) {
+			const uint32_t cp = utf8_codepoint(std::string_view{character.data(), character.size()});
+			auto it = this->training_.b.find(string_view_type{character.data(), character.size()});
+			if ((cp == invalid_codepoint) || (it == this->training_.b.end())) {
+				continue;
+			}
+			emission_row_t row;
+			Normalizer::normalize(it->second.cbegin(), it->second.cend(), row.begin());
+			const uint32_t row_idx = static_cast<uint32_t>(emissions_.size());
+			emissions_.push_back(row);
+			if ((cp >= dense_first) && (cp <= dense_last)) {
+				if (dense_rows_.empty()) {
+					dense_rows_.resize(dense_last - dense_first + 1, 0);
+				}
+				dense_rows_[cp - dense_first] = row_idx;
+			} else {
+				sparse_rows_.emplace_back(cp, row_idx);
+			}
+		}
+		std::sort(sparse_rows_.begin(), sparse_rows_.end());
+
+		for (size_t i = 0; i < num_states_; i++) {
+			packed_.pi[i] = static_cast<float>(this->normalized_.pi[i]);
+			for (size_t j = 0; j < num_states_; j++) {
+				packed_.a[i][j] = static_cast<float>(this->normalized_.a[i][j]);
 			}
 		}
+		packed_emissions_ = {};
+		packed_emissions_.reserve(emissions_.size());
+		for (const auto& row : emissions_) {
+			packed_emissions_.push_back({static_cast<float>(row[0]), static_cast<float>(row[1]),
+				static_cast<float>(row[2]), static_cast<float>(row[3])});
+		}
+	}
+
+	emission_t emission_of(std::string_view rune) const noexcept {
+		return emission_of_codepoint(utf8_codepoint(rune));
+	}
+
+	emission_t emission_of_codepoint(uint32_t cp) const noexcept {
+		if (static_cast<size_t>(cp - dense_first) < dense_rows_.size()) {
+			return emission_t{dense_rows_[cp - dense_first]};
+		}
+		auto it = std::lower_bound(sparse_rows_.cbegin(), sparse_rows_.cend(), std::make_pair(cp, uint32_t{0}));
+		if ((it != sparse_rows_.cend()) && (it->first == cp)) {
+			return emission_t{it->second};
+		}
+		return emission_t{0};
+	}
+
+	emission_t emission_of(observe_t obs) const noexcept {
+		return emission_of(std::string_view{obs.data(), obs.size()});
+	}
+
+	relative_freq_t initial(state_enum_t state, emission_t observed) const noexcept {
+		return this->normalized_.pi[static_cast<size_t>(state)] + emissions_[observed.row][static_cast<size_t>(state)];
+	}
+
+	relative_freq_t calc_p(state_enum_t from_state, state_enum_t to_state, emission_t to_observed) const noexcept {
+		return emissions_[to_observed.row][static_cast<size_t>(to_state)]
+			+ this->normalized_.a[static_cast<size_t>(from_state)][static_cast<size_t>(to_state)];
+	}
+
+	relative_freq_t initial(state_enum_t state, observe_t observed) const noexcept {
+		return initial(state, emission_of(observed));
+	}
+
+	relative_freq_t calc_p(state_enum_t from_state, state_enum_t to_state, observe_t to_observed) const noexcept {
+		return calc_p(from_state, to_state, emission_of(to_observed));
+	}
+
+	void dump(std::ostream& os) const {
+		os << "training: \n";
+		this->training_.dump(os);
+		os << "normalized: \n";
+		this->normalized_._dump_transitions(os);
+		os << "b: [\n";
+		for (const auto& character : characters_) {
+			os << std::string_view{character.data(), character.size()} << " : " << "[ ";
+			for (auto& ele : emissions_[emission_of(std::string_view{character.data(), character.size()}).row]) {
+				os << ele << ", ";
+			}
+			os << "] ,\n";
+		}
+		os << "]\n";
+	}
+
+	const packed_4state_params& _packed_params() const noexcept {
+		return packed_;
+	}
+
+	const packed_4state_params::row_t* _packed_rows() const noexcept {
+		return packed_emissions_.data();
+	}
+};
+
+// a model decoding only the runs of runes the dict misses, see model::add_oov_edges(). can be passed to
+// build_dag() & word_break() wherever the model it wraps can
+template <class Model>
+struct oov_only {
+	const Model* model_;
+
+	explicit oov_only(const Model& model) noexcept : model_(&model) {}
+
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight) const {
+		model_->template add_oov_edges<WordDag, RuneHopper>(dag, weight);
+	}
+
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes) const {
+		model_->template add_oov_edges<WordDag, RuneHopper>(dag, weight, runes);
+	}
+};
+
+// a model looking the states of the runs it decodes up in a decode_cache first, which must only ever be used with
+// the one model. decodes only the uncovered runs if oov_only, like oov_only does. can be passed to build_dag() &
+// word_break() wherever the model it wraps can
+template <class Model>
+struct cached {
+	const Model* model_;
+	decode_cache* cache_;
+	bool oov_only_;
+
+	cached(const Model& model, decode_cache& cache, bool oov_only = false) noexcept
+		: model_(&model), cache_(&cache), oov_only_(oov_only) {}
+
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight) const {
+		model_->template _add_edges<WordDag, RuneHopper>(dag, weight, oov_only_, cache_);
+	}
+
+	template<class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight, const decoded_runes& runes) const {
+		model_->_add_edges(dag, weight, runes, oov_only_, cache_);
 	}
 };
 
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "fastcws/bindings/containers.hpp"
+
+namespace fastcws {
+
+namespace bits {
+
+inline size_t popcount(uint64_t w) noexcept {
+#ifdef _MSC_VER
+	return static_cast<size_t>(__popcnt64(w));
+#else
+	return static_cast<size_t>(__builtin_popcountll(w));
+#endif
+}
+
+// w must not be 0
+inline size_t ctz(uint64_t w) noexcept {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, w);
+	return static_cast<size_t>(idx);
+#else
+	return static_cast<size_t>(__builtin_ctzll(w));
+#endif
+}
+
+// position of the k-th (0-indexed) set bit of w, w must have more than k bits set
+inline size_t select_in_word(uint64_t w, size_t k) noexcept {
+	for (size_t i = 0; i < k; i++) {
+		w &= w - 1;
+	}
+	return ctz(w);
+}
+
+}
+
+// append-only bit vector with rank1 / select0 directories, built once by finalize()
+template <class Allocator = std::allocator<int>>
+struct bit_vector {
+	using allocator_traits = std::allocator_traits<Allocator>;
+
+	static constexpr size_t block_bits = 512;
+	static constexpr size_t words_per_block = block_bits / 64;
+	static constexpr size_t select_sample = 128;
+
+	vector<uint64_t,
+		typename allocator_traits::template rebind_alloc<
+			uint64_t>> words_;
+	vector<uint32_t,
+		typename allocator_traits::template rebind_alloc<
+			uint32_t>> ranks_; // ones before each block
+	vector<uint32_t,
+		typename allocator_traits::template rebind_alloc<
+			uint32_t>> zero_samples_; // word holding every select_sample-th zero
+	size_t size_ = 0;
+	size_t ones_ = 0;
+
+	size_t size() const noexcept {
+		return size_;
+	}
+
+	size_t ones() const noexcept {
+		return ones_;
+	}
+
+	void push_back(bool bit) {
+		if ((size_ % 64) == 0) {
+			words_.push_back(0);
+		}
+		if (bit) {
+			words_.back() |= uint64_t{1} << (size_ % 64);
+		}
+		size_++;
+	}
+
+	bool operator[](size_t i) const noexcept {
+		return (words_[i / 64] >> (i % 64)) & 1;
+	}
+
+	void finalize() {
+		if (size_ >= std::numeric_limits<uint32_t>::max()) {
+			throw std::overflow_error{"fastcws::bit_vector: too many bits"};
+		}
+		ranks_ = {};
+		zero_samples_ = {};
+		size_t ones = 0;
+		size_t zeros = 0;
+		for (size_t i = 0; i < words_.size(); i++) {
+			if ((i % words_per_block) == 0) {
+				ranks_.push_back(static_cast<uint32_t>(ones));
+			}
+			size_t word_ones = bits::popcount(words_[i]);
+			size_t word_zeros = ((i + 1) * 64 <= size_) ? (64 - word_ones) : (size_ - i * 64 - word_ones);
+			if (((zeros + select_sample - 1) / select_sample) != ((zeros + word_zeros + select_sample - 1) / select_sample)) {
+				zero_samples_.push_back(static_cast<uint32_t>(i));
+			}
+			ones += word_ones;
+			zeros += word_zeros;
+		}
+		ranks_.push_back(static_cast<uint32_t>(ones));
+		ones_ = ones;
+		words_.shrink_to_fit();
+		ranks_.shrink_to_fit();
+		zero_samples_.shrink_to_fit();
+	}
+
+	// ones in [0, i)
+	size_t rank1(size_t i) const noexcept {
+		const size_t word = i / 64;
+		const size_t block = word / words_per_block;
+		size_t ret = ranks_[block];
+		for (size_t w = block * words_per_block; w < word; w++) {
+			ret += bits::popcount(words_[w]);
+		}
+		if ((i % 64) != 0) {
+			ret += bits::popcount(words_[word] & ((uint64_t{1} << (i % 64)) - 1));
+		}
+		return ret;
+	}
+
+	size_t rank0(size_t i) const noexcept {
+		return i - rank1(i);
+	}
+
+	// position of the k-th (0-indexed) zero
+	size_t select0(size_t k) const noexcept {
+		size_t word = zero_samples_[k / select_sample];
+		size_t zeros = word * 64 - rank1(word * 64);
+		for (;;) {
+			const uint64_t inverted = ~words_[word];
+			const size_t word_zeros = bits::popcount(inverted);
+			if (zeros + word_zeros > k) {
+				return word * 64 + bits::select_in_word(inverted, k - zeros);
+			}
+			zeros += word_zeros;
+			word++;
+		}
+	}
+
+	// length of the run of ones starting at i
+	size_t ones_from(size_t i) const noexcept {
+		size_t word = i / 64;
+		uint64_t zeros = ~words_[word] >> (i % 64);
+		if (zeros != 0) {
+			return bits::ctz(zeros);
+		}
+		size_t ret = 64 - (i % 64);
+		for (;;) {
+			word++;
+			zeros = ~words_[word];
+			if (zeros != 0) {
+				return ret + bits::ctz(zeros);
+			}
+			ret += 64;
+		}
+	}
+
+	size_t bytes_used() const noexcept {
+		return words_.size() * sizeof(uint64_t)
+			+ ranks_.size() * sizeof(uint32_t)
+			+ zero_samples_.size() * sizeof(uint32_t);
+	}
+};
+
+}
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+
+namespace fastcws {
+
+// corpus cut right before a boundary, a line break by default, into chunks of about chunk_size, more chunks than
+// threads so that they finish together. the boundaries themselves belong to no chunk
+inline std::vector<std::string_view> _split_corpus(std::string_view corpus, size_t chunk_size = 4UL * 1024UL * 1024UL,
+		std::string_view boundary = "\n") {
+	std::vector<std::string_view> chunks;
+	for (size_t begin = 0; begin < corpus.size();) {
+		size_t end = begin + chunk_size;
+		end = (end >= corpus.size()) ? corpus.size() : std::min(corpus.find(boundary, end), corpus.size());
+		chunks.push_back(corpus.substr(begin, end - begin));
+		begin = end + boundary.size();
+	}
+	return chunks;
+}
+
+// like _split_corpus(), but cut right before a line reading line, followed by a line break or not as in files
+// with CRLF line breaks. those lines belong to no chunk
+inline std::vector<std::string_view> _split_corpus_at_line(std::string_view corpus, size_t chunk_size, std::string_view line) {
+	std::vector<std::string_view> chunks;
+	for (size_t begin = 0; begin < corpus.size();) {
+		size_t end = corpus.size();
+		size_t next = corpus.size();
+		for (size_t at = begin + chunk_size; at < corpus.size(); at++) {
+			at = corpus.find(line, at);
+			if (at == std::string_view::npos) {
+				break;
+			}
+			size_t after = at + line.size();
+			if ((after < corpus.size()) && (corpus[after] == '\r')) {
+				after++;
+			}
+			if ((at == 0) || (corpus[at - 1] != '\n') || ((after < corpus.size()) && (corpus[after] != '\n'))) {
+				continue;
+			}
+			end = std::max(at - 1, begin);
+			next = std::min(after + 1, corpus.size());
+			break;
+		}
+		chunks.push_back(corpus.substr(begin, end - begin));
+		begin = next;
+	}
+	return chunks;
+}
+
+// calls work(t, chunk) for every chunk on threads threads, t being the index of the thread.
+// the first exception thrown by a thread is rethrown once they all finished
+template <class Work>
+void _for_each_chunk(const std::vector<std::string_view>& chunks, size_t threads, Work work) {
+	std::atomic<size_t> next_chunk{0};
+	std::vector<std::exception_ptr> errors(threads);
+	auto run = [&](size_t t) {
+		try {
+			for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+				work(t, chunks[i]);
+			}
+		} catch (...) {
+			errors[t] = std::current_exception();
+		}
+	};
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; t++) {
+		workers.emplace_back(run, t);
+	}
+	run(0);
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	for (const auto& error : errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+#include "fastcws/misc/rune_hopper.hpp"
+#include "fastcws/misc/special_hopper.hpp"
+#include "fastcws/bindings/containers.hpp"
+#include "fastcws/error.hpp"
+
+namespace fastcws {
+
+struct decoded_rune {
+	uint32_t offset; // in bytes, sentences are far shorter than 4GiB, see max_dag_sentence_size
+	uint32_t codepoint; // invalid_codepoint unless a single well formed utf-8 sequence
+	special_t special;
+};
+
+// the runes of a sentence, split, decoded & classified in a single pass by build_dag() for every stage to share
+class decoded_runes {
+public:
+	decoded_runes() = default;
+
+	// throws exception::bad_encoding unless sentence is valid utf-8, or for other encodings if the last rune
+	// is cut short
+	template <class RuneHopper = rune_hopper::utf8_hopper, class SpecialHopper = special_hopper::utf8_special_hopper>
+	static decoded_runes decode(std::string_view sentence) {
+		decoded_runes ret;
+		ret.sentence_ = sentence;
+		auto& runes = ret.runes_;
+		if constexpr (std::is_same_v<RuneHopper, rune_hopper::utf8_hopper>) {
+			size_t size = 0;
+			const auto offsets = utf8_rune_boundaries(sentence, size);
+			runes.resize(size + 1);
+			for (size_t i = 0; i < size; i++) {
+				const std::string_view rune = sentence.substr(offsets[i], offsets[i + 1] - offsets[i]);
+				runes[i] = decoded_rune{offsets[i], utf8_codepoint(rune), SpecialHopper::classify_special(rune)};
+			}
+			runes[size] = decoded_rune{static_cast<uint32_t>(sentence.size()), invalid_codepoint, special_t::others};
+			return ret;
+		}
+		runes.reserve(sentence.size() / 3 + 1);
+		for (size_t i = 0; i < sentence.size();) {
+			const size_t hop_over = RuneHopper::hop(sentence[i]);
+			if ((i + hop_over) > sentence.size()) {
+				throw exception::bad_encoding{};
+			}
+			const std::string_view rune = sentence.substr(i, hop_over);
+			runes.push_back(decoded_rune{static_cast<uint32_t>(i), utf8_codepoint(rune), SpecialHopper::classify_special(rune)});
+			i += hop_over;
+		}
+		runes.push_back(decoded_rune{static_cast<uint32_t>(sentence.size()), invalid_codepoint, special_t::others});
+		return ret;
+	}
+
+	std::string_view sentence() const noexcept {
+		return sentence_;
+	}
+
+	size_t size() const noexcept {
+		return runes_.empty() ? 0 : (runes_.size() - 1);
+	}
+
+	const decoded_rune& operator[](size_t i) const noexcept {
+		return runes_[i];
+	}
+
+	// of rune i, or of the end of the sentence if i is size()
+	size_t offset(size_t i) const noexcept {
+		return runes_[i].offset;
+	}
+
+	size_t rune_size(size_t i) const noexcept {
+		return runes_[i + 1].offset - runes_[i].offset;
+	}
+
+	std::string_view rune(size_t i) const noexcept {
+		return sentence_.substr(offset(i), rune_size(i));
+	}
+
+private:
+	std::string_view sentence_;
+	vector<decoded_rune> runes_; // and one past the last, at the end of the sentence
+};
+
+// like populate_rune_chain(), over runes already decoded
+template <class WordDag>
+void populate_rune_chain(WordDag& dag, const decoded_runes& runes, typename WordDag::weight_t w) {
+	for (size_t i = 0; i < runes.size(); i++) {
+		dag.add_edge(runes.offset(i), runes.offset(i + 1), w);
+	}
+}
+
+// like add_special_edges(), over runes already decoded & classified
+template <class WordDag>
+void add_special_edges(WordDag& dag, const decoded_runes& runes) {
+	size_t first = 0; // of the current run of runes of the same class
+	for (size_t i = 1; i <= runes.size(); i++) {
+		if ((i == runes.size()) || (runes[i].special != runes[first].special)) {
+			if (runes[first].special != special_t::not_special) {
+				dag.add_edge(runes.offset(first), runes.offset(i), 0);
+			}
+			first = i;
+		}
+	}
+}
+
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <cstddef>
+#include <cerrno>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <string>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fastcws {
+
+// read only memory mapping of a whole file, an empty file maps to an empty view
+class mapped_file {
+public:
+	mapped_file() = default;
+
+	explicit mapped_file(const char* filename) {
+#ifdef _WIN32
+		// filename is utf-8, like everywhere else in fastcws
+		std::wstring wide_filename(MultiByteToWideChar(CP_UTF8, 0, filename, -1, nullptr, 0), L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, filename, -1, wide_filename.data(), static_cast<int>(wide_filename.size()));
+		HANDLE file = CreateFileW(wide_filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			_throw_last_error("fastcws::mapped_file: open");
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) {
+			CloseHandle(file);
+			_throw_last_error("fastcws::mapped_file: stat");
+		}
+		size_ = static_cast<size_t>(size.QuadPart);
+		if (size_ != 0) {
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping == nullptr) {
+				CloseHandle(file);
+				_throw_last_error("fastcws::mapped_file: map");
+			}
+			data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+			if (data_ == nullptr) {
+				CloseHandle(file);
+				_throw_last_error("fastcws::mapped_file: map");
+			}
+		}
+		CloseHandle(file);
+#else
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0) {
+			_throw_last_error("fastcws::mapped_file: open");
+		}
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			_throw_last_error("fastcws::mapped_file: stat");
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		if (size_ != 0) {
+			void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				_throw_last_error("fastcws::mapped_file: map");
+			}
+			::madvise(p, size_, MADV_SEQUENTIAL);
+			data_ = static_cast<const char*>(p);
+		}
+		::close(fd);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	mapped_file(mapped_file&& rhs) noexcept
+		: data_(std::exchange(rhs.data_, nullptr)), size_(std::exchange(rhs.size_, 0)) {}
+
+	mapped_file& operator=(mapped_file&& rhs) noexcept {
+		if (this != &rhs) {
+			_unmap();
+			data_ = std::exchange(rhs.data_, nullptr);
+			size_ = std::exchange(rhs.size_, 0);
+		}
+		return *this;
+	}
+
+	~mapped_file() {
+		_unmap();
+	}
+
+	std::string_view view() const noexcept {
+		return std::string_view{data_, size_};
+	}
+
+private:
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+
+	void _unmap() noexcept {
+		if (data_ == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+#else
+		::munmap(const_cast<char*>(data_), size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	[[noreturn]] static void _throw_last_error(const char* what) {
+#ifdef _WIN32
+		throw std::system_error{static_cast<int>(GetLastError()), std::system_category(), what};
+#else
+		throw std::system_error{errno, std::generic_category(), what};
+#endif
+	}
+};
+
+}
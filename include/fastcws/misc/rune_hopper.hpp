@@ -2,10 +2,13 @@
 
 #pragma once
 
+#include <string_view>
+#include <type_traits>
 #include <cstdint>
 #include <cstddef>
 
 #include "fastcws/error.hpp"
+#include "fastcws/misc/utf8_scan.hpp"
 
 namespace fastcws {
 
@@ -46,8 +49,18 @@ struct utf32_hopper {
 
 // TODO what to do with um, graphemes?
 
+// utf-8 is validated as a whole & its runes found in bulk, see utf8_rune_offsets(). other encodings are only
+// checked not to end in the middle of a rune
 template <class RuneHopper = rune_hopper::utf8_hopper, class WordDag>
 void populate_rune_chain(WordDag& dag, typename WordDag::weight_t w) {
+	if constexpr (std::is_same_v<RuneHopper, rune_hopper::utf8_hopper>) {
+		size_t runes = 0;
+		const auto offsets = utf8_rune_boundaries(dag.sentence(), runes);
+		for (size_t i = 0; i < runes; i++) {
+			dag.add_edge(offsets[i], offsets[i + 1], w);
+		}
+		return;
+	}
 	for (size_t i = 0; i < dag.sentence().size();) {
 		size_t hop_over = RuneHopper::hop(dag.sentence()[i]);
 		if ((i + hop_over) > dag.sentence().size()) {
@@ -60,6 +73,15 @@ void populate_rune_chain(WordDag& dag, typename WordDag::weight_t w) {
 
 template <class RuneHopper = rune_hopper::utf8_hopper, class StringViewOutputIterator, class StringView>
 void split_runes(StringView sentence, StringViewOutputIterator out) {
+	if constexpr (std::is_same_v<RuneHopper, rune_hopper::utf8_hopper>) {
+		size_t runes = 0;
+		const auto offsets = utf8_rune_boundaries(std::string_view{sentence.data(), sentence.size()}, runes);
+		for (size_t i = 0; i < runes; i++) {
+			*out = sentence.substr(offsets[i], offsets[i + 1] - offsets[i]);
+			out++;
+		}
+		return;
+	}
 	for (size_t i = 0; i < sentence.size();) {
 		size_t hop_over = RuneHopper::hop(sentence[i]);
 		if ((i + hop_over) > sentence.size()) {
@@ -71,5 +93,26 @@ void split_runes(StringView sentence, StringViewOutputIterator out) {
 	}
 }
 
+static constexpr uint32_t invalid_codepoint = 0xffffffff;
+
+// code point of rune if it is a single well formed utf-8 sequence, invalid_codepoint otherwise
+inline uint32_t utf8_codepoint(std::string_view rune) noexcept {
+	if (rune.empty() || (rune.size() != rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(rune[0])))) {
+		return invalid_codepoint;
+	}
+	const uint8_t lead = static_cast<uint8_t>(rune[0]);
+	if (rune.size() == 1) {
+		return (lead < 0x80) ? lead : invalid_codepoint;
+	}
+	uint32_t cp = lead & (0x7fU >> rune.size());
+	for (size_t i = 1; i < rune.size(); i++) {
+		const uint8_t b = static_cast<uint8_t>(rune[i]);
+		if ((b & 0xc0) != 0x80) {
+			return invalid_codepoint;
+		}
+		cp = (cp << 6) | (b & 0x3fU);
+	}
+	return cp;
 }
 
+}
@@ -9,7 +9,7 @@
 
 namespace fastcws {
 
-enum class special_t {
+enum class special_t : uint8_t {
 	not_special, // is_chinese() == true
 	whitespace, // space, tab
 	crlf, // '\r' & '\n'
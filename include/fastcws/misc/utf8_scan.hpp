@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "fastcws/error.hpp"
+
+// the vector scans are built for their instruction sets whatever the flags of the build, & picked at run time
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FASTCWS_UTF8_SCAN_X86 1
+#define FASTCWS_UTF8_SCAN_SSE41 __attribute__((target("sse4.1")))
+#define FASTCWS_UTF8_SCAN_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace fastcws {
+
+// validates size bytes of s as utf-8 & writes the offset of the first byte of every rune to offsets, unless it
+// is null, counting them in runes. offsets must hold size of them. invalid utf-8 is anything truncated, overlong,
+// a surrogate, beyond U+10FFFF, or a continuation byte without a lead
+using _utf8_scan_t = bool (*)(const char* s, size_t size, uint32_t* offsets, size_t& runes);
+
+inline bool _utf8_scan_scalar(const char* s, size_t size, uint32_t* offsets, size_t& runes) {
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(s);
+	uint32_t* out = offsets;
+	for (size_t i = 0; i < size;) {
+		if (out != nullptr) {
+			*out++ = static_cast<uint32_t>(i);
+		}
+		const uint8_t lead = p[i];
+		if (lead < 0x80) {
+			i++;
+			continue;
+		}
+		// the first continuation byte is the one constrained by the lead, see table 3-7 of the unicode standard
+		size_t len = 0;
+		uint8_t lo = 0x80;
+		uint8_t hi = 0xbf;
+		if ((lead >= 0xc2) && (lead <= 0xdf)) {
+			len = 2;
+		} else if ((lead & 0xf0) == 0xe0) {
+			len = 3;
+			lo = (lead == 0xe0) ? 0xa0 : 0x80;
+			hi = (lead == 0xed) ? 0x9f : 0xbf;
+		} else if ((lead >= 0xf0) && (lead <= 0xf4)) {
+			len = 4;
+			lo = (lead == 0xf0) ? 0x90 : 0x80;
+			hi = (lead == 0xf4) ? 0x8f : 0xbf;
+		} else {
+			return false;
+		}
+		if ((size - i) < len) {
+			return false;
+		}
+		if ((p[i + 1] < lo) || (p[i + 1] > hi)) {
+			return false;
+		}
+		for (size_t j = 2; j < len; j++) {
+			if ((p[i + j] & 0xc0) != 0x80) {
+				return false;
+			}
+		}
+		i += len;
+	}
+	runes = (out != nullptr) ? static_cast<size_t>(out - offsets) : 0;
+	return true;
+}
+
+#ifdef FASTCWS_UTF8_SCAN_X86
+
+// the lookup validation of keiser & lemire (validating utf-8 in less than one instruction per byte, 2021): the
+// high & low nibbles of every byte & the high nibble of the next are looked up in 3 tables of the errors each
+// pair of bytes may be part of, any error left in all 3 is real. a rune of 3 or 4 bytes is then only checked to
+// have its continuation bytes where they are expected
+namespace _utf8_lookup {
+
+enum : uint8_t {
+	too_short = 1 << 0, // a lead or ascii byte followed by a lead byte, or a lead byte by an ascii one
+	too_long = 1 << 1, // an ascii byte followed by a continuation byte
+	overlong_3 = 1 << 2,
+	too_large = 1 << 3,
+	surrogate = 1 << 4,
+	overlong_2 = 1 << 5,
+	too_large_1000 = 1 << 6,
+	overlong_4 = 1 << 6,
+	two_conts = 1 << 7, // two continuation bytes, an error unless in a rune of 3 or 4 bytes
+	carry = too_short | too_long | two_conts,
+};
+
+alignas(16) inline constexpr uint8_t byte_1_high[16] = {
+	too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+	two_conts, two_conts, two_conts, two_conts,
+	too_short | overlong_2,
+	too_short,
+	too_short | overlong_3 | surrogate,
+	too_short | too_large | too_large_1000 | overlong_4,
+};
+
+alignas(16) inline constexpr uint8_t byte_1_low[16] = {
+	carry | overlong_3 | overlong_2 | overlong_4,
+	carry | overlong_2,
+	carry,
+	carry,
+	carry | too_large,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000 | surrogate,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+};
+
+alignas(16) inline constexpr uint8_t byte_2_high[16] = {
+	too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+	too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+	too_long | overlong_2 | two_conts | overlong_3 | too_large,
+	too_long | overlong_2 | two_conts | surrogate | too_large,
+	too_long | overlong_2 | two_conts | surrogate | too_large,
+	too_short, too_short, too_short, too_short,
+};
+
+// the largest byte that does not begin a rune cut short at the end of a block, from its last 3 bytes
+alignas(32) inline constexpr uint8_t max_complete[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf,
+};
+
+}
+
+// errors of the 16 bytes of input, following those of prev
+FASTCWS_UTF8_SCAN_SSE41 inline __m128i _utf8_errors_sse41(__m128i input, __m128i prev) {
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+	const __m128i b1h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_1_high)),
+		_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+	const __m128i b1l = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_1_low)),
+		_mm_and_si128(prev1, nibble));
+	const __m128i b2h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_2_high)),
+		_mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+	const __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+	// only 111xxxxx 2 bytes back & 1111xxxx 3 bytes back are left with the high bit set
+	const __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), _mm_set1_epi8(static_cast<char>(0xe0 - 0x80)));
+	const __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), _mm_set1_epi8(static_cast<char>(0xf0 - 0x80)));
+	const __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+	return _mm_xor_si128(must_continue, special);
+}
+
+// emits the offsets of the runes beginning within the first valid bytes of input, at base
+FASTCWS_UTF8_SCAN_SSE41 inline void _utf8_emit_sse41(__m128i input, uint32_t base, unsigned valid, uint32_t*& out) {
+	// all but continuation bytes, 10xxxxxx being the signed bytes -128 to -65
+	unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpgt_epi8(input, _mm_set1_epi8(-65))));
+	if ((mask == 0xffff) && (valid == 16)) {
+		__m128i offsets = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(base)), _mm_setr_epi32(0, 1, 2, 3));
+		for (size_t i = 0; i < 4; i++) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), offsets);
+			offsets = _mm_add_epi32(offsets, _mm_set1_epi32(4));
+		}
+		out += 16;
+		return;
+	}
+	mask &= (1U << valid) - 1;
+	while (mask != 0) {
+		*out++ = base + static_cast<uint32_t>(__builtin_ctz(mask));
+		mask &= mask - 1;
+	}
+}
+
+FASTCWS_UTF8_SCAN_SSE41 inline bool _utf8_scan_sse41(const char* s, size_t size, uint32_t* offsets, size_t& runes) {
+	const __m128i max_complete = _mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::max_complete + 16));
+	__m128i error = _mm_setzero_si128();
+	__m128i prev = _mm_setzero_si128();
+	__m128i prev_incomplete = _mm_setzero_si128();
+	uint32_t* out = offsets;
+	for (size_t i = 0; i < size; i += 16) {
+		const unsigned valid = static_cast<unsigned>(((size - i) < 16) ? (size - i) : 16);
+		__m128i input;
+		if (valid == 16) {
+			input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+		} else {
+			// padded with ascii, after which a rune cut short is an error
+			alignas(16) char tail[16] = {};
+			std::memcpy(tail, s + i, valid);
+			input = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+		}
+		if (_mm_movemask_epi8(input) == 0) {
+			error = _mm_or_si128(error, prev_incomplete);
+			prev_incomplete = _mm_setzero_si128();
+		} else {
+			error = _mm_or_si128(error, _utf8_errors_sse41(input, prev));
+			prev_incomplete = _mm_subs_epu8(input, max_complete);
+		}
+		prev = input;
+		if (out != nullptr) {
+			_utf8_emit_sse41(input, static_cast<uint32_t>(i), valid, out);
+		}
+	}
+	error = _mm_or_si128(error, prev_incomplete);
+	runes = (out != nullptr) ? static_cast<size_t>(out - offsets) : 0;
+	return _mm_testz_si128(error, error) != 0;
+}
+
+// like _utf8_errors_sse41(), over 32 bytes
+FASTCWS_UTF8_SCAN_AVX2 inline __m256i _utf8_errors_avx2(__m256i input, __m256i prev) {
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	// the last 16 bytes of prev, then the first 16 of input, for the byte shifts across the 2 lanes
+	const __m256i carried = _mm256_permute2x128_si256(prev, input, 0x21);
+	const __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+	const __m256i b1h = _mm256_shuffle_epi8(
+		_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_1_high))),
+		_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+	const __m256i b1l = _mm256_shuffle_epi8(
+		_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_1_low))),
+		_mm256_and_si256(prev1, nibble));
+	const __m256i b2h = _mm256_shuffle_epi8(
+		_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(_utf8_lookup::byte_2_high))),
+		_mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+	const __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+	const __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 14),
+		_mm256_set1_epi8(static_cast<char>(0xe0 - 0x80)));
+	const __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 13),
+		_mm256_set1_epi8(static_cast<char>(0xf0 - 0x80)));
+	const __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth),
+		_mm256_set1_epi8(static_cast<char>(0x80)));
+	return _mm256_xor_si256(must_continue, special);
+}
+
+FASTCWS_UTF8_SCAN_AVX2 inline void _utf8_emit_avx2(__m256i input, uint32_t base, unsigned valid, uint32_t*& out) {
+	uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(input, _mm256_set1_epi8(-65))));
+	if ((mask == 0xffffffffU) && (valid == 32)) {
+		__m256i offsets = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(base)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		for (size_t i = 0; i < 4; i++) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 8), offsets);
+			offsets = _mm256_add_epi32(offsets, _mm256_set1_epi32(8));
+		}
+		out += 32;
+		return;
+	}
+	if (valid < 32) {
+		mask &= (uint32_t{1} << valid) - 1;
+	}
+	while (mask != 0) {
+		*out++ = base + static_cast<uint32_t>(__builtin_ctz(mask));
+		mask &= mask - 1;
+	}
+}
+
+FASTCWS_UTF8_SCAN_AVX2 inline bool _utf8_scan_avx2(const char* s, size_t size, uint32_t* offsets, size_t& runes) {
+	const __m256i max_complete = _mm256_load_si256(reinterpret_cast<const __m256i*>(_utf8_lookup::max_complete));
+	__m256i error = _mm256_setzero_si256();
+	__m256i prev = _mm256_setzero_si256();
+	__m256i prev_incomplete = _mm256_setzero_si256();
+	uint32_t* out = offsets;
+	for (size_t i = 0; i < size; i += 32) {
+		const unsigned valid = static_cast<unsigned>(((size - i) < 32) ? (size - i) : 32);
+		__m256i input;
+		if (valid == 32) {
+			input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+		} else {
+			alignas(32) char tail[32] = {};
+			std::memcpy(tail, s + i, valid);
+			input = _mm256_load_si256(reinterpret_cast<const __m256i*>(tail));
+		}
+		if (_mm256_movemask_epi8(input) == 0) {
+			error = _mm256_or_si256(error, prev_incomplete);
+			prev_incomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(error, _utf8_errors_avx2(input, prev));
+			prev_incomplete = _mm256_subs_epu8(input, max_complete);
+		}
+		prev = input;
+		if (out != nullptr) {
+			_utf8_emit_avx2(input, static_cast<uint32_t>(i), valid, out);
+		}
+	}
+	error = _mm256_or_si256(error, prev_incomplete);
+	runes = (out != nullptr) ? static_cast<size_t>(out - offsets) : 0;
+	return _mm256_testz_si256(error, error) != 0;
+}
+
+#endif
+
+// the fastest scan the cpu supports
+inline _utf8_scan_t _utf8_pick_scan() noexcept {
+#ifdef FASTCWS_UTF8_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return _utf8_scan_avx2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return _utf8_scan_sse41;
+	}
+#endif
+	return _utf8_scan_scalar;
+}
+
+inline _utf8_scan_t _utf8_scan() noexcept {
+	static const _utf8_scan_t scan = _utf8_pick_scan();
+	return scan;
+}
+
+inline bool utf8_valid(std::string_view s) noexcept {
+	size_t runes = 0;
+	return _utf8_scan()(s.data(), s.size(), nullptr, runes);
+}
+
+// writes the offset of the first byte of every rune of s to offsets, which must hold s.size() of them, & returns
+// how many runes there are. throws exception::bad_encoding unless s is valid utf-8
+inline size_t utf8_rune_offsets(std::string_view s, uint32_t* offsets) {
+	size_t runes = 0;
+	if (!_utf8_scan()(s.data(), s.size(), offsets, runes)) {
+		throw exception::bad_encoding{};
+	}
+	return runes;
+}
+
+// the offsets of the runes of s, then of its end, with room for the offsets of every byte, uninitialized
+// beyond. throws exception::bad_encoding unless s is valid utf-8
+inline std::unique_ptr<uint32_t[]> utf8_rune_boundaries(std::string_view s, size_t& runes) {
+	std::unique_ptr<uint32_t[]> ret{new uint32_t[s.size() + 1]};
+	runes = utf8_rune_offsets(s, ret.get());
+	ret[runes] = static_cast<uint32_t>(s.size());
+	return ret;
+}
+
+}
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fastcws/suspendable_region/managed_region.hpp"
+
+namespace fastcws {
+
+namespace suspendable_region {
+
+// a region image published into a named POSIX shared memory object, so that every process of a host maps
+// the same physical pages read only instead of recovering a private copy.
+// offset_ptrs are relative to the base of the region, so the mapping may land at a different address in
+// every process. as with any region, only one shared_region (or managed_region) per Seat may be alive.
+// the object outlives the processes, unlink() it when the image changes, e.g. on upgrade.
+// the publisher holds an flock() on the object until the image is ready, so that a publisher killed halfway
+// is told apart from a slow one: an object left unready & unlocked is unlinked, & published again by
+// attach_or_publish().
+template <class Region>
+class shared_region {
+public:
+	using region_t = Region;
+	using basic_t = typename region_t::basic_t;
+
+	static constexpr uint64_t magic = 0x6677637372676e31; // "fwcsrgn1"
+	static constexpr std::chrono::milliseconds default_timeout{10000};
+
+	shared_region() = default;
+
+	shared_region(const shared_region&) = delete;
+	shared_region& operator=(const shared_region&) = delete;
+
+	shared_region(shared_region&& rhs) noexcept
+		: mapping_(std::exchange(rhs.mapping_, nullptr)), mapping_size_(std::exchange(rhs.mapping_size_, 0)),
+		  published_(rhs.published_), region_(std::move(rhs.region_)) {}
+
+	shared_region& operator=(shared_region&& rhs) noexcept {
+		if (this != &rhs) {
+			region_ = std::move(rhs.region_);
+			_unmap();
+			mapping_ = std::exchange(rhs.mapping_, nullptr);
+			mapping_size_ = std::exchange(rhs.mapping_size_, 0);
+			published_ = rhs.published_;
+		}
+		return *this;
+	}
+
+	~shared_region() {
+		region_ = {};
+		_unmap();
+	}
+
+	// read only, allocating from it fails
+	const region_t& region() const noexcept {
+		return region_;
+	}
+
+	// whether this process created the object, rather than attached to it
+	bool published() const noexcept {
+		return published_;
+	}
+
+	// version tells images apart, attaching to an object of another version fails. throws std::system_error
+	// of std::errc::owner_dead, having unlinked the object, if its publisher died before the image was ready
+	static shared_region attach(const char* name, uint64_t version,
+			std::chrono::milliseconds timeout = default_timeout) {
+		int fd = ::shm_open(name, O_RDONLY, 0);
+		if (fd < 0) {
+			_throw_errno("fastcws::shared_region: shm_open");
+		}
+		return _attach(name, fd, version, timeout);
+	}
+
+	// attaches to name, or if nobody published it yet, creates it and calls make_image(publish) with a
+	// callable publish(std::istream&) taking the suspended region, so that the image is only produced
+	// by the first process
+	template <class MakeImage>
+	static shared_region attach_or_publish(const char* name, uint64_t version, MakeImage make_image,
+			std::chrono::milliseconds timeout = default_timeout) {
+		int fd = -1;
+		for (size_t attempt = 0; fd < 0; attempt++) {
+			fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+			if (fd >= 0) {
+				break;
+			}
+			if (errno != EEXIST) {
+				_throw_errno("fastcws::shared_region: shm_open");
+			}
+			try {
+				return attach(name, version, timeout);
+			} catch (const std::system_error& e) {
+				// the publisher died, take over unless the next ones keep dying too
+				if ((e.code() != std::errc::owner_dead) || (attempt >= max_takeovers)) {
+					throw;
+				}
+			}
+		}
+		// before anything else, so that the waiters see a publisher alive. filesystems without flock() on
+		// shared memory leave the waiters waiting, as if the lock was always held
+		::flock(fd, LOCK_EX);
+		try {
+			shared_region ret;
+			make_image([&ret, fd, version](std::istream& is) {
+				ret._publish(fd, version, is);
+			});
+			if (ret.mapping_ == nullptr) {
+				throw std::logic_error{"fastcws::shared_region: make_image did not publish"};
+			}
+			::close(fd);
+			return ret;
+		} catch (...) {
+			// so that the others do not wait for an image that never comes
+			::close(fd);
+			::shm_unlink(name);
+			throw;
+		}
+	}
+
+	static void unlink(const char* name) {
+		if ((::shm_unlink(name) != 0) && (errno != ENOENT)) {
+			_throw_errno("fastcws::shared_region: shm_unlink");
+		}
+	}
+
+private:
+	struct header_t {
+		uint64_t magic;
+		uint64_t version;
+		uint64_t used;
+		std::atomic<uint64_t> ready;
+	};
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ready flag is shared between processes");
+
+	// how many dead publishers attach_or_publish() takes over from in a row
+	static constexpr size_t max_takeovers = 3;
+	// how long the lock of an unready object must stay free before its publisher is taken for dead. it covers
+	// the moment between the creation of the object & the publisher locking it
+	static constexpr std::chrono::milliseconds dead_publisher_grace{20};
+
+	// keeps the region page aligned, like the base of the mapping
+	static constexpr size_t region_offset = 4096;
+	static_assert(sizeof(header_t) <= region_offset);
+
+	void* mapping_ = nullptr;
+	size_t mapping_size_ = 0;
+	bool published_ = false;
+	region_t region_;
+
+	header_t& _header() const noexcept {
+		return *reinterpret_cast<header_t*>(mapping_);
+	}
+
+	char* _region_begin() const noexcept {
+		return reinterpret_cast<char*>(mapping_) + region_offset;
+	}
+
+	void _publish(int fd, uint64_t version, std::istream& is) {
+		if (mapping_ != nullptr) {
+			throw std::logic_error{"fastcws::shared_region: published twice"};
+		}
+		size_t use;
+		is.read(reinterpret_cast<char*>(&use), sizeof(use));
+		if (!is) {
+			throw std::invalid_argument{"fastcws::shared_region: truncated image"};
+		}
+		const size_t size = region_offset + use;
+		if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+			_throw_errno("fastcws::shared_region: ftruncate");
+		}
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			_throw_errno("fastcws::shared_region: mmap");
+		}
+		mapping_ = p;
+		mapping_size_ = size;
+
+		std::vector<std::pair<size_t, size_t>> freed;
+		basic_t::_recover_after_read_use(is, _region_begin(), use, use, freed);
+		if (!is) {
+			throw std::invalid_argument{"fastcws::shared_region: truncated image"};
+		}
+		header_t& hdr = _header();
+		hdr.magic = magic;
+		hdr.version = version;
+		hdr.used = use;
+		hdr.ready.store(1, std::memory_order_release);
+		// the publisher does not get to write to it either
+		::mprotect(mapping_, mapping_size_, PROT_READ);
+		region_ = region_t(std::make_unique<basic_t>(_region_begin(), use, use, std::move(freed)));
+		published_ = true;
+	}
+
+	static shared_region _attach(const char* name, int fd, uint64_t version, std::chrono::milliseconds timeout) {
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		auto unlocked_since = std::chrono::steady_clock::time_point::max();
+		// ready() tells whether the image is ready, checked again once the lock is found free
+		auto wait = [&deadline, &unlocked_since, name, fd](auto ready) {
+			const auto now = std::chrono::steady_clock::now();
+			if (_publisher_gone(fd) && !ready()) {
+				unlocked_since = std::min(unlocked_since, now);
+				if ((now - unlocked_since) >= dead_publisher_grace) {
+					_unlink_if_same(name, fd);
+					::close(fd);
+					throw std::system_error{std::make_error_code(std::errc::owner_dead),
+						"fastcws::shared_region: publisher died before the image was ready"};
+				}
+			} else {
+				unlocked_since = std::chrono::steady_clock::time_point::max();
+			}
+			if (now > deadline) {
+				::close(fd);
+				throw std::system_error{ETIMEDOUT, std::generic_category(), "fastcws::shared_region: not published in time"};
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		};
+
+		// the publisher sizes the object once it knows the size of the image
+		struct stat st;
+		auto sized = [&st, fd]() {
+			if (::fstat(fd, &st) != 0) {
+				_close_and_throw_errno(fd, "fastcws::shared_region: fstat");
+			}
+			return static_cast<size_t>(st.st_size) >= region_offset;
+		};
+		while (!sized()) {
+			wait(sized);
+		}
+		shared_region ret;
+		const size_t size = static_cast<size_t>(st.st_size);
+		void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			_close_and_throw_errno(fd, "fastcws::shared_region: mmap");
+		}
+		ret.mapping_ = p;
+		ret.mapping_size_ = size;
+
+		const header_t& hdr = ret._header();
+		auto ready = [&hdr]() {
+			return hdr.ready.load(std::memory_order_acquire) != 0;
+		};
+		while (!ready()) {
+			wait(ready);
+		}
+		::close(fd);
+		if ((hdr.magic != magic) || (hdr.version != version) || (region_offset + hdr.used != size)) {
+			throw std::system_error{EPROTO, std::generic_category(), "fastcws::shared_region: incompatible image"};
+		}
+		ret.region_ = region_t(std::make_unique<basic_t>(ret._region_begin(), hdr.used, hdr.used,
+			std::vector<std::pair<size_t, size_t>>{}));
+		return ret;
+	}
+
+	// whether nobody holds the lock of the publisher, probing it without keeping it
+	static bool _publisher_gone(int fd) noexcept {
+		if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+			return false; // held, or flock() unsupported
+		}
+		::flock(fd, LOCK_UN);
+		return true;
+	}
+
+	// unlinks name unless it was published again meanwhile, by another process taking over
+	static void _unlink_if_same(const char* name, int fd) noexcept {
+		const int current = ::shm_open(name, O_RDONLY, 0);
+		if (current < 0) {
+			return;
+		}
+		struct stat ours;
+		struct stat theirs;
+		if ((::fstat(fd, &ours) == 0) && (::fstat(current, &theirs) == 0)
+				&& (ours.st_dev == theirs.st_dev) && (ours.st_ino == theirs.st_ino)) {
+			::shm_unlink(name);
+		}
+		::close(current);
+	}
+
+	void _unmap() noexcept {
+		if (mapping_ == nullptr) {
+			return;
+		}
+		::munmap(mapping_, mapping_size_);
+		mapping_ = nullptr;
+		mapping_size_ = 0;
+	}
+
+	[[noreturn]] static void _throw_errno(const char* what) {
+		throw std::system_error{errno, std::generic_category(), what};
+	}
+
+	[[noreturn]] static void _close_and_throw_errno(int fd, const char* what) {
+		const int err = errno;
+		::close(fd);
+		throw std::system_error{err, std::generic_category(), what};
+	}
+};
+
+}
+
+}
+
+#endif
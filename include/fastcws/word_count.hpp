@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <iostream>
+#include <tuple>
+#include <system_error>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+
+#include "fastcws/fastcws.hpp"
+#include "fastcws/sentence_split.hpp"
+#include "fastcws/freq_dict/io.hpp"
+#include "fastcws/misc/corpus_chunks.hpp"
+
+namespace fastcws {
+
+struct count_options {
+	size_t threads = 0; // hardware concurrency if 0
+	// bytes the counts of words missing from the dict may take, over all threads, before spilling to disk
+	size_t memory_limit = 1024UL * 1024UL * 1024UL;
+	uint64_t min_count = 1; // rarer words are left out of the output
+	std::filesystem::path spill_dir = std::filesystem::temp_directory_path();
+	bool quiet = true;
+};
+
+// sorted (word, count) runs, from a spilled file or from memory, merged by _merge_count_runs()
+struct _count_run {
+	std::unique_ptr<std::ifstream> file;
+	std::vector<std::pair<std::string_view, uint64_t>> mem;
+	size_t mem_pos = 0;
+	std::string line;
+	std::string_view word;
+	uint64_t count = 0;
+
+	static _count_run of_file(const std::filesystem::path& path) {
+		_count_run ret;
+		ret.file = std::make_unique<std::ifstream>(path, std::ios::binary);
+		if (!ret.file->good()) {
+			throw std::system_error{make_error_code(errc::io_error), "fastcws::_count_run: cannot read " + path.string()};
+		}
+		return ret;
+	}
+
+	bool next() {
+		if (file) {
+			std::string_view rest;
+			while (std::getline(*file, line)) {
+				if (freq_dict::_parse_dict_line(line, word, count, rest)) {
+					return true;
+				}
+			}
+			return false;
+		}
+		if (mem_pos >= mem.size()) {
+			return false;
+		}
+		std::tie(word, count) = mem[mem_pos++];
+		return true;
+	}
+};
+
+// calls cb(word, count) with the summed counts of runs in byte order
+template <class Callback>
+void _merge_count_runs(std::vector<_count_run>& runs, Callback cb) {
+	// k-way merge, a run whose current word is the smallest one is advanced until they all moved past it
+	std::vector<size_t> live;
+	for (size_t i = 0; i < runs.size(); i++) {
+		if (runs[i].next()) {
+			live.push_back(i);
+		}
+	}
+	auto greater_word = [&runs](size_t a, size_t b) {
+		return runs[a].word > runs[b].word;
+	};
+	std::make_heap(live.begin(), live.end(), greater_word);
+	std::string word;
+	uint64_t count = 0;
+	while (!live.empty()) {
+		std::pop_heap(live.begin(), live.end(), greater_word);
+		_count_run& run = runs[live.back()];
+		if (run.word != word) {
+			if (!word.empty()) {
+				cb(std::string_view{word}, count);
+			}
+			word = run.word;
+			count = 0;
+		}
+		count += run.count;
+		if (run.next()) {
+			std::push_heap(live.begin(), live.end(), greater_word);
+		} else {
+			live.pop_back();
+		}
+	}
+	if (!word.empty()) {
+		cb(std::string_view{word}, count);
+	}
+}
+
+// counts of strings, spilled to disk as sorted runs in the load_dict format once they outgrow spill_bytes.
+// the runs are removed along with the counter
+struct spilling_counter {
+	// rough footprint of a hash table entry, besides the characters of the string
+	static constexpr size_t entry_overhead = 64;
+	// runs kept on disk before they are compacted into one
+	static constexpr size_t max_runs = 16;
+
+	std::unordered_map<std::string, uint64_t> counts_;
+	std::string key_; // reused, so that counting a string already seen does not allocate
+	size_t bytes_ = 0;
+	size_t spill_bytes_;
+	std::filesystem::path spill_prefix_;
+	std::vector<std::filesystem::path> runs_;
+	size_t spilled_ = 0;
+
+	spilling_counter(size_t spill_bytes, std::filesystem::path spill_prefix)
+		: spill_bytes_(spill_bytes), spill_prefix_(std::move(spill_prefix)) {}
+
+	spilling_counter(const spilling_counter&) = delete;
+	spilling_counter& operator=(const spilling_counter&) = delete;
+	spilling_counter(spilling_counter&&) = default;
+	spilling_counter& operator=(spilling_counter&&) = default;
+
+	~spilling_counter() {
+		for (const auto& run : runs_) {
+			std::error_code ec;
+			std::filesystem::remove(run, ec);
+		}
+	}
+
+	void add(std::string_view s, uint64_t count = 1) {
+		key_.assign(s.data(), s.size());
+		auto it = counts_.find(key_);
+		if (it != counts_.end()) {
+			it->second += count;
+			return;
+		}
+		counts_.emplace(key_, count);
+		bytes_ += s.size() + entry_overhead;
+		if (bytes_ > spill_bytes_) {
+			spill();
+		}
+	}
+
+	std::vector<std::pair<std::string_view, uint64_t>> sorted() const {
+		std::vector<std::pair<std::string_view, uint64_t>> ret{counts_.cbegin(), counts_.cend()};
+		std::sort(ret.begin(), ret.end());
+		return ret;
+	}
+
+	void spill() {
+		const std::filesystem::path path = _next_run_path();
+		_write_run(path, [this](auto emit) {
+			for (const auto& [word, count] : sorted()) {
+				emit(word, count);
+			}
+		});
+		runs_.push_back(path);
+		counts_ = {};
+		bytes_ = 0;
+		if (runs_.size() >= max_runs) {
+			_compact();
+		}
+	}
+
+	// merges the runs into one, so that merging them later does not open too many files at once
+	void _compact() {
+		const std::filesystem::path path = _next_run_path();
+		_write_run(path, [this](auto emit) {
+			std::vector<_count_run> runs;
+			for (const auto& run : runs_) {
+				runs.push_back(_count_run::of_file(run));
+			}
+			_merge_count_runs(runs, emit);
+		});
+		for (const auto& run : runs_) {
+			std::error_code ec;
+			std::filesystem::remove(run, ec);
+		}
+		runs_ = {path};
+	}
+
+	std::filesystem::path _next_run_path() {
+		return spill_prefix_.string() + "_" + std::to_string(spilled_++) + ".txt";
+	}
+
+	// fill(emit) calls emit(word, count) for every line of the run
+	template <class Fill>
+	static void _write_run(const std::filesystem::path& path, Fill fill) {
+		std::ofstream ofs{path, std::ios::binary};
+		if (!ofs.good()) {
+			throw std::system_error{make_error_code(errc::io_error), "fastcws::spilling_counter: cannot spill to " + path.string()};
+		}
+		fill([&ofs](std::string_view word, uint64_t count) {
+			ofs << word << " " << count << "\n";
+		});
+		if (!ofs.good()) {
+			throw std::system_error{make_error_code(errc::io_error), "fastcws::spilling_counter: cannot spill to " + path.string()};
+		}
+	}
+};
+
+// counts of the words of one thread. words of the dict are keyed by their id, the others by their text
+template <class Dict>
+struct word_counter {
+	const Dict* dict_;
+	std::unordered_map<size_t, uint64_t> known_;
+	spilling_counter unknown_;
+
+	word_counter(const Dict& dict, size_t spill_bytes, std::filesystem::path spill_prefix)
+		: dict_(&dict), unknown_(spill_bytes, std::move(spill_prefix)) {}
+
+	// words with blanks cannot be told apart from the columns of the load_dict format, they are not counted
+	static bool countable(std::string_view word) noexcept {
+		return !word.empty() && (word.find_first_of(" \t\r\n") == std::string_view::npos);
+	}
+
+	// id of word in the dict, or Dict::not_found
+	void add(std::string_view word, size_t id) {
+		if (!countable(word)) {
+			return;
+		}
+		if (id != Dict::not_found) {
+			known_[id]++;
+			return;
+		}
+		unknown_.add(word);
+	}
+
+	// the words on the shortest path of dag, the dict words by the id their edge was added with
+	template <class Weight>
+	void add_path(const word_dag::id_dag<Weight>& dag) {
+		static_assert(word_dag::id_dag<Weight>::no_id == Dict::not_found);
+		auto sp = kahn(dag);
+		size_t ws = 0;
+		for (auto we : sp.path) {
+			add(dag.sentence().substr(ws, we - ws), dag.word_id(ws, we));
+			ws = we;
+		}
+		add(dag.sentence().substr(ws), dag.word_id(ws, dag.end()));
+	}
+};
+
+// whether count_words() takes Dict, which must report the id of the words it adds to a dag
+template <class Dict, class = void>
+struct can_count_words : std::false_type {};
+
+template <class Dict>
+struct can_count_words<Dict, std::enable_if_t<Dict::has_word_ids>> : std::true_type {};
+
+template <class Dict>
+inline constexpr bool can_count_words_v = can_count_words<Dict>::value;
+
+// calls cb(word, count) with the summed counts of counters in byte order, counters must not change meanwhile
+template <class Callback>
+void merge_spilled_counts(const std::vector<const spilling_counter*>& counters, Callback cb) {
+	std::vector<_count_run> runs;
+	for (const spilling_counter* counter : counters) {
+		for (const auto& path : counter->runs_) {
+			runs.push_back(_count_run::of_file(path));
+		}
+		_count_run run;
+		run.mem = counter->sorted();
+		runs.push_back(std::move(run));
+	}
+	_merge_count_runs(runs, cb);
+}
+
+// writes the summed counts of counters to os in the load_dict format, the words of the dict first
+template <class Dict>
+void merge_word_counts(std::vector<word_counter<Dict>>& counters, std::ostream& os, uint64_t min_count) {
+	if (counters.empty()) {
+		return;
+	}
+	const Dict& dict = *counters.front().dict_;
+	std::unordered_map<size_t, uint64_t> known;
+	for (auto& counter : counters) {
+		for (const auto& [id, count] : counter.known_) {
+			known[id] += count;
+		}
+		counter.known_ = {};
+	}
+	std::vector<std::pair<size_t, uint64_t>> known_sorted{known.cbegin(), known.cend()};
+	std::sort(known_sorted.begin(), known_sorted.end());
+	for (const auto& [id, count] : known_sorted) {
+		if (count >= min_count) {
+			os << dict.word_at(id) << " " << count << "\n";
+		}
+	}
+
+	std::vector<const spilling_counter*> unknown;
+	for (const auto& counter : counters) {
+		unknown.push_back(&counter.unknown_);
+	}
+	merge_spilled_counts(unknown, [&os, min_count](std::string_view word, uint64_t count) {
+		if (count >= min_count) {
+			os << word << " " << count << "\n";
+		}
+	});
+}
+
+// prefix of the spill files of one run, unique enough for runs sharing spill_dir
+inline std::filesystem::path _spill_prefix(const std::filesystem::path& spill_dir, std::string_view name) {
+	return spill_dir / (std::string{name} + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+}
+
+// segments corpus on every core and writes the count of every word to os in the load_dict format,
+// ready to be loaded as a dict. dict must have word ids, e.g. trie_backend::double_array.
+template <class Dict, class HMMModel>
+void count_words(std::string_view corpus, const Dict& dict, const HMMModel& hmm_model, std::ostream& os,
+		const count_options& opt = {}) {
+	static_assert(can_count_words_v<Dict>, "count_words() requires a dict with word ids, e.g. trie_backend::double_array");
+	size_t threads = opt.threads;
+	if (threads == 0) {
+		threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	const std::vector<std::string_view> chunks = _split_corpus(corpus);
+	threads = std::max<size_t>(std::min(threads, chunks.size()), 1);
+	if (!opt.quiet) {
+		std::cout << "counting words of " << chunks.size() << " chunks with " << threads << " threads.." << std::endl;
+	}
+
+	const std::filesystem::path spill_prefix = _spill_prefix(opt.spill_dir, "fastcws_count");
+	std::vector<word_counter<Dict>> counters;
+	for (size_t i = 0; i < threads; i++) {
+		counters.emplace_back(dict, opt.memory_limit / threads, spill_prefix.string() + "_" + std::to_string(i));
+	}
+	std::vector<std::unique_ptr<sentence_tokenizer>> tokenizers;
+	for (size_t t = 0; t < threads; t++) {
+		tokenizers.push_back(std::make_unique<sentence_tokenizer>(
+				[&dict, &hmm_model, &counter = counters[t]](std::string sentence) {
+			using dag_t = word_dag::id_dag<>;
+			for_each_dag<dag_t, rune_hopper::utf8_hopper>(sentence, dict, hmm_model, [&counter](const dag_t& dag) {
+				counter.add_path(dag);
+			});
+		}));
+	}
+	_for_each_chunk(chunks, threads, [&tokenizers](size_t t, std::string_view chunk) {
+		tokenizers[t]->process(chunk);
+		tokenizers[t]->finish();
+	});
+	if (!opt.quiet) {
+		std::cout << "merging counts.." << std::endl;
+	}
+	merge_word_counts(counters, os, opt.min_count);
+}
+
+}
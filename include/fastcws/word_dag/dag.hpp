@@ -5,6 +5,7 @@
 #include <string_view>
 #include <ostream>
 #include <sstream>
+#include <limits>
 
 #include "fastcws/bindings/containers.hpp"
 
@@ -46,13 +47,11 @@ struct dag {
 	}
 
 	void add_edge(size_t from, size_t to, weight_t weight) {
-		if (adjacents_[from].count(to)) {
-			if (adjacents_[from][to] > weight) {
-				adjacents_[from][to] = weight;
-			}
-		} else {
-			adjacents_[from][to] = weight;
+		auto [it, inserted] = adjacents_[from].try_emplace(to, weight);
+		if (inserted) {
 			in_degree_[to]++;
+		} else if (it->second > weight) {
+			it->second = weight;
 		}
 	}
 
@@ -96,6 +95,44 @@ struct dag {
 	}
 };
 
+// remembers the id of the dict words whose edges a dict adds through add_word_edge(), so that the words on
+// the shortest path are told apart from the others without being looked up again, see count_words()
+template <class Weight = long double>
+struct id_dag : dag<Weight> {
+	using weight_t = Weight;
+
+	static constexpr size_t no_id = std::numeric_limits<size_t>::max();
+
+	struct word_edge {
+		size_t to;
+		size_t id;
+		size_t next; // 1 + index of the next word edge from the same position, 0 if none
+	};
+
+	vector<size_t> first_word_edge_; // by from, 1 + index in word_edges_, 0 if none
+	vector<word_edge> word_edges_;
+
+	id_dag(std::string_view sentence)
+		: dag<Weight>(sentence),
+		  first_word_edge_(sentence.size() + 1, 0) {}
+
+	void add_word_edge(size_t from, size_t to, weight_t weight, size_t id) {
+		this->add_edge(from, to, weight);
+		word_edges_.push_back(word_edge{to, id, first_word_edge_[from]});
+		first_word_edge_[from] = word_edges_.size();
+	}
+
+	// id of the dict word spanning [from, to), or no_id
+	size_t word_id(size_t from, size_t to) const noexcept {
+		for (size_t i = first_word_edge_[from]; i != 0; i = word_edges_[i - 1].next) {
+			if (word_edges_[i - 1].to == to) {
+				return word_edges_[i - 1].id;
+			}
+		}
+		return no_id;
+	}
+};
+
 }
 
 }
@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <iostream>
+#include <system_error>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+
+#include "fastcws/word_count.hpp"
+#include "fastcws/misc/log2.hpp"
+#include "fastcws/misc/rune_hopper.hpp"
+
+namespace fastcws {
+
+struct discovery_options {
+	size_t threads = 0; // hardware concurrency if 0
+	// bytes the n-gram counts may take, over all threads, before spilling to disk
+	size_t memory_limit = 1024UL * 1024UL * 1024UL;
+	// bytes a partition of the candidates may take at least, even past memory_limit. every partition
+	// reads the whole merged file once, a tiny one would make scoring quadratic
+	size_t min_partition_bytes = 16UL * 1024UL * 1024UL;
+	std::filesystem::path spill_dir = std::filesystem::temp_directory_path();
+	size_t max_runes = 4; // longest candidate, in runes
+	uint64_t min_count = 5;
+	double min_cohesion = 4.0; // bits of mutual information between the two halves of the weakest split
+	double min_entropy = 1.0; // bits, of the runes found on either side of the candidate
+	bool quiet = true;
+};
+
+// the runes new words are made of, cjk ideographs. anything else, including punctuation & latin words, ends an n-gram
+inline bool _is_discoverable_rune(std::string_view rune) noexcept {
+	const uint32_t cp = utf8_codepoint(rune);
+	return ((cp >= 0x3400) && (cp <= 0x4dbf)) || ((cp >= 0x4e00) && (cp <= 0x9fff))
+		|| ((cp >= 0xf900) && (cp <= 0xfaff)) || ((cp >= 0x20000) && (cp <= 0x3134f));
+}
+
+// bytes of the first & the last rune of a valid utf-8 string
+inline size_t _first_rune_size(std::string_view s) noexcept {
+	return std::min(rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(s.front())), s.size());
+}
+
+inline size_t _last_rune_size(std::string_view s) noexcept {
+	size_t n = 1;
+	while ((n < s.size()) && ((static_cast<uint8_t>(s[s.size() - n]) & 0xc0) == 0x80)) {
+		n++;
+	}
+	return n;
+}
+
+inline size_t _count_runes(std::string_view s) noexcept {
+	size_t n = 0;
+	for (size_t i = 0; i < s.size(); i += rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(s[i]))) {
+		n++;
+	}
+	return n;
+}
+
+// n-gram counts of one thread, every n-gram of 1 .. max_runes + 1 runes, the longest ones only being
+// there as neighbours of the candidates
+struct ngram_counter {
+	spilling_counter counts_;
+	size_t window_;
+	uint64_t runes_ = 0;
+	std::vector<size_t> starts_; // of the last window_ runes of the current run of discoverable runes
+
+	ngram_counter(size_t max_runes, size_t spill_bytes, std::filesystem::path spill_prefix)
+		: counts_(spill_bytes, std::move(spill_prefix)), window_(max_runes + 1) {}
+
+	void add(std::string_view text) {
+		starts_.clear();
+		for (size_t i = 0; i < text.size();) {
+			const size_t hop = rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(text[i]));
+			if ((i + hop > text.size()) || !_is_discoverable_rune(text.substr(i, hop))) {
+				starts_.clear();
+				i++;
+				continue;
+			}
+			if (starts_.size() == window_) {
+				starts_.erase(starts_.begin());
+			}
+			starts_.push_back(i);
+			i += hop;
+			runes_++;
+			for (size_t start : starts_) {
+				counts_.add(text.substr(start, i - start));
+			}
+		}
+	}
+};
+
+// the candidates of one partition of the merged n-gram file, a range of it in byte order, sorted, with what
+// is known of their neighbours & of the halves they may be cut into
+struct _ngram_table {
+	struct entry {
+		size_t offset;
+		size_t size;
+		uint64_t count;
+		// sum of c * log2(c) over the counts c of the n-grams one rune longer on either side
+		double left = 0;
+		double right = 0;
+	};
+
+	std::string chars_;
+	std::vector<entry> entries_;
+	std::vector<entry> halves_; // into chars_, their count is 0 until seen
+	size_t bytes_ = 0; // taken once the halves are indexed
+
+	std::string_view word(const entry& e) const noexcept {
+		return std::string_view{chars_}.substr(e.offset, e.size);
+	}
+
+	// how many bytes a candidate takes, with an entry for each of its halves
+	static size_t bytes_of(std::string_view word, size_t runes) noexcept {
+		return sizeof(entry) * (1 + 2 * (runes - 1)) + word.size();
+	}
+
+	// words must come in byte order
+	void push_back(std::string_view word, uint64_t count, size_t runes) {
+		entries_.push_back(entry{chars_.size(), word.size(), count});
+		chars_.append(word.data(), word.size());
+		bytes_ += bytes_of(word, runes);
+	}
+
+	// every way to cut the candidates in two, once all of them are in
+	void index_halves() {
+		for (const auto& e : entries_) {
+			const std::string_view w = word(e);
+			for (size_t cut = _first_rune_size(w); cut < w.size();
+					cut += rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(w[cut]))) {
+				halves_.push_back(entry{e.offset, cut, 0});
+				halves_.push_back(entry{e.offset + cut, e.size - cut, 0});
+			}
+		}
+		auto less = [this](const entry& a, const entry& b) {
+			return word(a) < word(b);
+		};
+		std::sort(halves_.begin(), halves_.end(), less);
+		halves_.erase(std::unique(halves_.begin(), halves_.end(), [this](const entry& a, const entry& b) {
+			return word(a) == word(b);
+		}), halves_.end());
+	}
+
+	entry* _find(std::vector<entry>& entries, std::string_view w) noexcept {
+		auto it = std::lower_bound(entries.begin(), entries.end(), w, [this](const entry& e, std::string_view rhs) {
+			return word(e) < rhs;
+		});
+		return ((it == entries.end()) || (word(*it) != w)) ? nullptr : &(*it);
+	}
+
+	entry* find(std::string_view w) noexcept {
+		if (entries_.empty() || (w < word(entries_.front())) || (word(entries_.back()) < w)) {
+			return nullptr;
+		}
+		return _find(entries_, w);
+	}
+
+	entry* find_half(std::string_view w) noexcept {
+		return _find(halves_, w);
+	}
+
+	// -sum(p * log2(p)) of the neighbours, the occurrences with none count as distinct neighbours
+	static double entropy(uint64_t count, double sum_c_log2_c) noexcept {
+		const double n = static_cast<double>(count);
+		return std::max(calc_log2<double>::log2(count) - sum_c_log2_c / n, 0.0);
+	}
+};
+
+// cb(ngram, count, line_size) for the lines of the merged n-gram file from its current position, until cb
+// returns false
+template <class Callback>
+void _for_each_merged_ngram(std::istream& is, Callback cb) {
+	std::string line;
+	std::string_view ngram, rest;
+	uint64_t count;
+	while (std::getline(is, line)) {
+		if (!freq_dict::_parse_dict_line(line, ngram, count, rest)) {
+			continue;
+		}
+		if (!cb(ngram, count, line.size() + 1)) {
+			return;
+		}
+	}
+}
+
+// finds words of corpus that dict misses, by counting the n-grams of runs of cjk ideographs on every core.
+// a candidate must be frequent, cohesive (every way to cut it in two has a high mutual information)
+// and free (the runes found on both sides vary). writes them in the load_dict format with their count in
+// corpus to os. the n-gram counts are spilled to disk as sorted runs past memory_limit, merged into a
+// file holding those seen twice at least. the candidates are then scored in partitions of
+// max(memory_limit, min_partition_bytes), each costing one full pass over the merged file.
+template <class Dict>
+void discover_words(std::string_view corpus, const Dict& dict, std::ostream& os, const discovery_options& opt = {}) {
+	if (opt.max_runes < 2) {
+		throw std::invalid_argument{"fastcws::discover_words: max_runes must be at least 2"};
+	}
+	size_t threads = opt.threads;
+	if (threads == 0) {
+		threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	const std::vector<std::string_view> chunks = _split_corpus(corpus);
+	threads = std::max<size_t>(std::min(threads, chunks.size()), 1);
+	if (!opt.quiet) {
+		std::cout << "counting n-grams of " << chunks.size() << " chunks with " << threads << " threads.." << std::endl;
+	}
+
+	const std::filesystem::path spill_prefix = _spill_prefix(opt.spill_dir, "fastcws_discover");
+	std::vector<ngram_counter> counters;
+	for (size_t t = 0; t < threads; t++) {
+		counters.emplace_back(opt.max_runes, opt.memory_limit / threads, spill_prefix.string() + "_" + std::to_string(t));
+	}
+	_for_each_chunk(chunks, threads, [&counters](size_t t, std::string_view chunk) {
+		counters[t].add(chunk);
+	});
+
+	uint64_t total_runes = 0;
+	std::vector<const spilling_counter*> counts;
+	for (const auto& counter : counters) {
+		total_runes += counter.runes_;
+		counts.push_back(&counter.counts_);
+	}
+	if (!opt.quiet) {
+		std::cout << "merging counts of " << total_runes << " runes.." << std::endl;
+	}
+	// n-grams seen once add nothing to the entropy of their neighbours, nor are they candidates
+	struct merged_file {
+		std::filesystem::path path;
+		~merged_file() {
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		}
+	} merged{spill_prefix.string() + "_merged.txt"};
+	// candidates, those scored: frequent, short & unknown words of two runes at least
+	auto candidate_runes = [&dict, &opt](std::string_view ngram, uint64_t count) -> size_t {
+		if (count < opt.min_count) {
+			return 0;
+		}
+		const size_t runes = _count_runes(ngram);
+		return ((runes < 2) || (runes > opt.max_runes) || (dict.get_freq(ngram) != 0)) ? 0 : runes;
+	};
+	size_t candidates = 0;
+	{
+		std::ofstream ofs{merged.path, std::ios::binary};
+		merge_spilled_counts(counts, [&](std::string_view ngram, uint64_t count) {
+			if (count < 2) {
+				return;
+			}
+			ofs << ngram << " " << count << "\n";
+			candidates += (candidate_runes(ngram, count) != 0) ? 1 : 0;
+		});
+		if (!ofs.good()) {
+			throw std::system_error{make_error_code(errc::io_error), "fastcws::discover_words: cannot spill to " + merged.path.string()};
+		}
+	}
+	counters.clear();
+
+	// the candidates are scored a partition at a time, as many as fit the partition budget, each partition
+	// reading the whole merged file again for the neighbours & halves of its candidates
+	auto open_merged = [&merged]() {
+		std::ifstream ifs{merged.path, std::ios::binary};
+		if (!ifs.good()) {
+			throw std::system_error{make_error_code(errc::io_error), "fastcws::discover_words: cannot read " + merged.path.string()};
+		}
+		return ifs;
+	};
+	if (!opt.quiet) {
+		std::cout << "scoring " << candidates << " n-grams.." << std::endl;
+	}
+	const double log2_total = calc_log2<double>::log2(std::max<uint64_t>(total_runes, 1));
+	const size_t partition_bytes = std::max(opt.memory_limit, opt.min_partition_bytes);
+	std::ifstream partitions = open_merged();
+	for (size_t scored = 0; scored < candidates;) {
+		_ngram_table table;
+		std::streamoff next_offset = partitions.tellg();
+		_for_each_merged_ngram(partitions, [&](std::string_view ngram, uint64_t count, size_t line_size) {
+			if (const size_t runes = candidate_runes(ngram, count); runes != 0) {
+				if (!table.entries_.empty() && (table.bytes_ + _ngram_table::bytes_of(ngram, runes) > partition_bytes)) {
+					return false;
+				}
+				table.push_back(ngram, count, runes);
+			}
+			next_offset += static_cast<std::streamoff>(line_size);
+			return true;
+		});
+		partitions.clear();
+		partitions.seekg(next_offset);
+		if (table.entries_.empty()) {
+			break;
+		}
+		table.index_halves();
+		scored += table.entries_.size();
+
+		std::ifstream ifs = open_merged();
+		_for_each_merged_ngram(ifs, [&table](std::string_view ngram, uint64_t count, size_t) {
+			if (auto* h = table.find_half(ngram); h != nullptr) {
+				h->count = count;
+			}
+			const size_t first = _first_rune_size(ngram);
+			if (first == ngram.size()) {
+				return true;
+			}
+			const double c_log2_c = static_cast<double>(count) * calc_log2<double>::log2(count);
+			if (auto* e = table.find(ngram.substr(first)); e != nullptr) {
+				e->left += c_log2_c;
+			}
+			if (auto* e = table.find(ngram.substr(0, ngram.size() - _last_rune_size(ngram))); e != nullptr) {
+				e->right += c_log2_c;
+			}
+			return true;
+		});
+
+		for (const auto& e : table.entries_) {
+			const std::string_view word = table.word(e);
+			if (std::min(_ngram_table::entropy(e.count, e.left), _ngram_table::entropy(e.count, e.right)) < opt.min_entropy) {
+				continue;
+			}
+			// the halves are at least as frequent as the word, the merged file has them
+			double cohesion = std::numeric_limits<double>::infinity();
+			for (size_t cut = _first_rune_size(word); cut < word.size();
+					cut += rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(word[cut]))) {
+				const auto* a = table.find_half(word.substr(0, cut));
+				const auto* b = table.find_half(word.substr(cut));
+				if ((a->count < opt.min_count) || (b->count < opt.min_count)) {
+					cohesion = -std::numeric_limits<double>::infinity();
+					break;
+				}
+				cohesion = std::min(cohesion, calc_log2<double>::log2(e.count) + log2_total
+					- calc_log2<double>::log2(a->count) - calc_log2<double>::log2(b->count));
+			}
+			if (cohesion >= opt.min_cohesion) {
+				os << word << " " << e.count << "\n";
+			}
+		}
+	}
+}
+
+}
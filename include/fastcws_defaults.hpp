@@ -4,4 +4,5 @@
 
 #include "fastcws/fastcws.hpp"
 #include "fastcws_defaults/defaults.hpp"
+#include "fastcws_defaults/snapshot.hpp"
 
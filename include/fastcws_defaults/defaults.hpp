@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "fastcws/bindings/containers.hpp"
 
 #ifndef FASTCWS_HAS_BOOST
@@ -22,6 +24,25 @@ void init() noexcept {
 	init_freq_dict();
 }
 
+// for hosts running many fastcws processes, every one maps the same read only copy of the defaults.
+// prefix names the shared memory objects, e.g. "/fastcws", and the first process to call this publishes them.
+// returns false if any of them fell back to a private copy
+inline bool init_shared(const std::string& prefix) noexcept {
+	const bool model_shared = init_hmm_model_shared((prefix + "_hmm_model").c_str());
+	const bool dict_shared = init_freq_dict_shared((prefix + "_freq_dict").c_str());
+	return model_shared && dict_shared;
+}
+
+// removes the shared memory objects of init_shared(prefix), processes attached to them keep their mappings
+inline void unlink_shared(const std::string& prefix) {
+#ifndef _WIN32
+	suspendable_region::shared_region<hmm_model_region_t>::unlink((prefix + "_hmm_model").c_str());
+	suspendable_region::shared_region<freq_dict_region_t>::unlink((prefix + "_freq_dict").c_str());
+#else
+	(void)prefix;
+#endif
+}
+
 };
 
 };
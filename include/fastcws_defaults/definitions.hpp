@@ -2,15 +2,62 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstddef>
+
 namespace fastcws {
 
 namespace defaults {
 
 struct seat_dict{};
 struct seat_model{};
+// compiled custom dicts & models live in their own seats, so that they can be used along the defaults
+struct seat_custom_dict{};
+struct seat_custom_model{};
+struct seat_custom_compact_dict{};
 inline constexpr uint16_t dict_ptr_tag = 0x1551;
 inline constexpr uint16_t model_ptr_tag = 0x2334;
 
+// fnv-1a, for versions that only have to tell builds apart
+class fnv1a {
+public:
+	void mix(uint64_t v) noexcept {
+		for (size_t i = 0; i < sizeof(v); i++) {
+			mix_byte(static_cast<uint8_t>(v >> (i * 8)));
+		}
+	}
+
+	void mix(const char* s) noexcept {
+		for (; *s != '\0'; s++) {
+			mix_byte(static_cast<uint8_t>(*s));
+		}
+	}
+
+	void mix_byte(uint8_t b) noexcept {
+		h_ = (h_ ^ b) * 0x100000001b3;
+	}
+
+	uint64_t value() const noexcept {
+		return h_;
+	}
+
+private:
+	uint64_t h_ = 0xcbf29ce484222325;
+};
+
+// tells the embedded images of different builds apart, so that a stale shared region is not attached to.
+// a sample of the compressed bytes is enough, and keeps attaching fast
+inline uint64_t image_version(const uint8_t* compressed, size_t compressed_size, size_t decompressed_size, size_t object_size) noexcept {
+	fnv1a h;
+	h.mix(compressed_size);
+	h.mix(decompressed_size);
+	h.mix(object_size);
+	for (size_t i = 0; i < compressed_size; i += 997) {
+		h.mix(compressed[i]);
+	}
+	return h.value();
+}
+
 }
 
 }
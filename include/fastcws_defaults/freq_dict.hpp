@@ -6,6 +6,7 @@
 
 #include "fastcws/freq_dict.hpp"
 #include "fastcws/suspendable_region.hpp"
+#include "fastcws/suspendable_region/shared_region.hpp"
 #include "fastcws_defaults/definitions.hpp"
 
 namespace fastcws {
@@ -16,11 +17,14 @@ using freq_dict_region_t = suspendable_region::managed_region<seat_dict>;
 using freq_dict_t = freq_dict::dict<
 	suspendable_region::allocator<int, freq_dict_region_t>,
 	std::allocator<int>,
-	true
+	freq_dict::trie_backend::double_array
 >;
 
 extern freq_dict_t* freq_dict;
 void init_freq_dict() noexcept;
+// attaches to the named POSIX shared memory object holding the freq dict, publishing it if this is the first
+// process to ask. falls back to init_freq_dict() and returns false if it cannot be shared
+bool init_freq_dict_shared(const char* name) noexcept;
 
 };
 
@@ -4,6 +4,7 @@
 
 #include "fastcws/hmm.hpp"
 #include "fastcws/suspendable_region.hpp"
+#include "fastcws/suspendable_region/shared_region.hpp"
 #include "fastcws_defaults/definitions.hpp"
 
 namespace fastcws {
@@ -18,6 +19,9 @@ using hmm_model_t = hmm::wseg_4tag::model<
 
 extern hmm_model_t* hmm_model;
 void init_hmm_model() noexcept;
+// attaches to the named POSIX shared memory object holding the hmm model, publishing it if this is the first
+// process to ask. falls back to init_hmm_model() and returns false if it cannot be shared
+bool init_hmm_model_shared(const char* name) noexcept;
 
 };
 
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+
+#include "fastcws/freq_dict.hpp"
+#include "fastcws/hmm.hpp"
+#include "fastcws/suspendable_region.hpp"
+#include "fastcws/error.hpp"
+#include "fastcws_defaults/definitions.hpp"
+
+namespace fastcws {
+
+namespace defaults {
+
+// compiled custom resources, written by `snapshot_utils compile_dict`, `compile_model` & `compact_dict_snapshot`.
+// loading one recovers the finalized object as it was suspended, instead of parsing & finalizing text on every start.
+template <class Region>
+using custom_freq_dict_in = freq_dict::dict<
+	suspendable_region::allocator<int, Region>,
+	std::allocator<int>,
+	freq_dict::trie_backend::double_array
+>;
+template <class Region>
+using custom_compact_dict_in = freq_dict::compact_dict<suspendable_region::allocator<int, Region>>;
+template <class Region>
+using custom_hmm_model_in = hmm::wseg_4tag::model<
+	fastcws::hmm::basic_normalizer<uint64_t, double>,
+	suspendable_region::allocator<int, Region>
+>;
+
+using custom_freq_dict_region_t = suspendable_region::managed_region<seat_custom_dict>;
+using custom_freq_dict_t = custom_freq_dict_in<custom_freq_dict_region_t>;
+using custom_compact_dict_region_t = suspendable_region::managed_region<seat_custom_compact_dict>;
+using custom_compact_dict_t = custom_compact_dict_in<custom_compact_dict_region_t>;
+using custom_hmm_model_region_t = suspendable_region::managed_region<seat_custom_model>;
+using custom_hmm_model_t = custom_hmm_model_in<custom_hmm_model_region_t>;
+
+enum class snapshot_kind : uint32_t {
+	freq_dict = 1,
+	hmm_model = 2,
+	compact_dict = 3
+};
+
+namespace details {
+
+// bumped whenever the members of the dict or model change, which the signature below cannot see
+inline constexpr uint64_t snapshot_format = 2;
+
+struct seat_layout_probe{};
+using layout_probe_region_t = suspendable_region::managed_region<seat_layout_probe>;
+
+// the name of T as the compiler spells it, with its template arguments
+template <class T>
+const char* type_signature() noexcept {
+#ifdef _MSC_VER
+	return __FUNCSIG__;
+#else
+	return __PRETTY_FUNCTION__;
+#endif
+}
+
+template <class T>
+uint64_t layout_of() noexcept {
+	fnv1a h;
+	h.mix(snapshot_format);
+	h.mix(type_signature<T>());
+	h.mix(sizeof(T));
+	h.mix(alignof(T));
+	h.mix(sizeof(void*));
+	const uint16_t byte_order = 0x0102;
+	h.mix(*reinterpret_cast<const uint8_t*>(&byte_order));
+#if defined(_LIBCPP_VERSION)
+	h.mix("libc++");
+#elif defined(__GLIBCXX__)
+	h.mix("libstdc++");
+#endif
+	return h.value();
+}
+
+}
+
+// the layout of the objects snapshots of kind hold, so that those compiled by another build are refused
+// rather than recovered into garbage. every Region lays them out alike, the seat being an empty tag
+inline uint64_t snapshot_layout(snapshot_kind kind) noexcept {
+	switch (kind) {
+	case snapshot_kind::freq_dict:
+		return details::layout_of<custom_freq_dict_in<details::layout_probe_region_t>>();
+	case snapshot_kind::hmm_model:
+		return details::layout_of<custom_hmm_model_in<details::layout_probe_region_t>>();
+	case snapshot_kind::compact_dict:
+		return details::layout_of<custom_compact_dict_in<details::layout_probe_region_t>>();
+	}
+	return 0;
+}
+
+// precedes the suspended region, so that a snapshot of another kind or layout is refused
+struct snapshot_header {
+	static constexpr char expected_magic[8] = {'f', 'c', 'w', 's', 's', 'n', 'p', '2'};
+
+	char magic[8];
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t layout; // snapshot_layout(kind) of the build that wrote it
+
+	static snapshot_header of(snapshot_kind kind) noexcept {
+		snapshot_header ret;
+		std::memcpy(ret.magic, expected_magic, sizeof(magic));
+		ret.kind = static_cast<uint32_t>(kind);
+		ret.reserved = 0;
+		ret.layout = snapshot_layout(kind);
+		return ret;
+	}
+
+	void write(std::ostream& os) const {
+		os.write(reinterpret_cast<const char*>(this), sizeof(*this));
+	}
+
+	// throws std::invalid_argument unless is continues with a snapshot of kind, laid out by this build
+	static void check(std::istream& is, snapshot_kind kind) {
+		snapshot_header hdr;
+		is.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+		if (!is || (std::memcmp(hdr.magic, expected_magic, sizeof(magic)) != 0)) {
+			throw std::invalid_argument{"fastcws: not a compiled snapshot"};
+		}
+		if (hdr.kind != static_cast<uint32_t>(kind)) {
+			throw std::invalid_argument{"fastcws: snapshot of another kind"};
+		}
+		if (hdr.layout != snapshot_layout(kind)) {
+			throw std::invalid_argument{"fastcws: snapshot compiled by another version, compile it again"};
+		}
+	}
+};
+
+// a recovered snapshot, object points into region
+template <class T, class Region>
+struct loaded_snapshot {
+	Region region;
+	T* object;
+};
+
+// only one snapshot per seat may be loaded at a time, loading another throws errc::resource_busy
+template <class T, class Region>
+loaded_snapshot<T, Region> load_snapshot(const char* filename, snapshot_kind kind, uint16_t tag) {
+	if (Region::basic_t::pinned_instance_t::instance_ptr() != nullptr) {
+		throw std::system_error{make_error_code(errc::resource_busy)};
+	}
+	std::ifstream ifs{filename, std::ios::binary};
+	if (!ifs.good()) {
+		throw std::system_error{make_error_code(errc::io_error)};
+	}
+	snapshot_header::check(ifs, kind);
+	loaded_snapshot<T, Region> ret{Region::recover(ifs), nullptr};
+	if (!ifs) {
+		throw std::invalid_argument{"fastcws: truncated snapshot"};
+	}
+	ret.object = &(*ret.region.template retrieve_ptr<T>(tag));
+	return ret;
+}
+
+inline loaded_snapshot<custom_freq_dict_t, custom_freq_dict_region_t> load_freq_dict_snapshot(const char* filename) {
+	return load_snapshot<custom_freq_dict_t, custom_freq_dict_region_t>(filename, snapshot_kind::freq_dict, dict_ptr_tag);
+}
+
+inline loaded_snapshot<custom_hmm_model_t, custom_hmm_model_region_t> load_hmm_model_snapshot(const char* filename) {
+	return load_snapshot<custom_hmm_model_t, custom_hmm_model_region_t>(filename, snapshot_kind::hmm_model, model_ptr_tag);
+}
+
+inline loaded_snapshot<custom_compact_dict_t, custom_compact_dict_region_t> load_compact_freq_dict_snapshot(const char* filename) {
+	return load_snapshot<custom_compact_dict_t, custom_compact_dict_region_t>(filename, snapshot_kind::compact_dict, dict_ptr_tag);
+}
+
+}
+
+}
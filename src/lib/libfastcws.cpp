@@ -4,10 +4,70 @@
 #include <fstream>
 #include <string_view>
 #include <optional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <filesystem>
 
 #include "fastcws.hpp"
 #include "fastcws_defaults.hpp"
 
+namespace {
+
+// a compiled snapshot pins the seat of its kind, so the ctx loading the same file share the one loaded
+template <class Snapshot>
+struct shared_snapshot {
+	std::recursive_mutex mutex; // recursive, the last owner may let go while it is held
+	std::string filename;
+	std::weak_ptr<Snapshot> loaded;
+};
+
+// loads filename into held, which keeps what it held if that fails. throws errc::resource_busy if another file
+// is loaded, unless held is the last one holding it: held then lets go of it first, once the header of filename
+// checks out
+template <class Snapshot, class Load>
+void share_snapshot(shared_snapshot<Snapshot>& shared, std::shared_ptr<Snapshot>& held, const char* filename,
+		fastcws::defaults::snapshot_kind kind, Load load) {
+	std::lock_guard<std::recursive_mutex> lock{shared.mutex};
+	auto is_loaded = [&shared, filename]() {
+		std::error_code ec;
+		return std::filesystem::equivalent(shared.filename, filename, ec) && !ec;
+	};
+	if (held && (held.use_count() == 1) && !is_loaded()) {
+		std::ifstream ifs{filename, std::ios::binary};
+		if (!ifs.good()) {
+			throw std::system_error{make_error_code(fastcws::errc::io_error)};
+		}
+		fastcws::defaults::snapshot_header::check(ifs, kind);
+		held.reset();
+	}
+	if (auto loaded = shared.loaded.lock()) {
+		if (!is_loaded()) {
+			throw std::system_error{make_error_code(fastcws::errc::resource_busy)};
+		}
+		held = std::move(loaded);
+		return;
+	}
+	std::shared_ptr<Snapshot> ret{new Snapshot(load(filename)), [&shared](Snapshot* p) {
+		// frees the seat before anybody finds the slot empty
+		std::lock_guard<std::recursive_mutex> lock{shared.mutex};
+		delete p;
+	}};
+	shared.filename = filename;
+	shared.loaded = ret;
+	held = std::move(ret);
+}
+
+using freq_dict_snapshot_t = decltype(fastcws::defaults::load_freq_dict_snapshot(""));
+using compact_freq_dict_snapshot_t = decltype(fastcws::defaults::load_compact_freq_dict_snapshot(""));
+using hmm_model_snapshot_t = decltype(fastcws::defaults::load_hmm_model_snapshot(""));
+
+shared_snapshot<freq_dict_snapshot_t> shared_freq_dict_snapshot;
+shared_snapshot<compact_freq_dict_snapshot_t> shared_compact_freq_dict_snapshot;
+shared_snapshot<hmm_model_snapshot_t> shared_hmm_model_snapshot;
+
+}
+
 extern "C" {
 
 #define FASTCWS_EXPORTING
@@ -16,6 +76,12 @@ extern "C" {
 typedef struct fastcws_ctx_s {
 	std::optional<fastcws::freq_dict::dict<>> dict_ptr;
 	std::optional<fastcws::hmm::wseg_4tag::model<>> model_ptr;
+	std::shared_ptr<freq_dict_snapshot_t> dict_snapshot;
+	std::shared_ptr<compact_freq_dict_snapshot_t> compact_dict_snapshot;
+	std::shared_ptr<hmm_model_snapshot_t> model_snapshot;
+	std::optional<fastcws::hmm::wseg_4tag::compact_model> compact_model;
+	bool hmm_oov_only = false;
+	std::unique_ptr<fastcws::hmm::wseg_4tag::decode_cache> hmm_cache; // shared by the threads using ctx
 } fastcws_ctx;
 
 typedef struct fastcws_result_s {
@@ -23,10 +89,63 @@ typedef struct fastcws_result_s {
 	size_t cursor = 0;
 } fastcws_result;
 
+// calls f(dict, model) with the dict & model of ctx, the defaults standing in for those it lacks
+static const auto with_resources = [](const fastcws_ctx* ctx, auto f) {
+	auto with_model = [ctx, &f](const auto& dict) {
+		auto g = [ctx, &f, &dict](const auto& model) {
+			if ((ctx != nullptr) && ctx->hmm_cache) {
+				f(dict, fastcws::hmm::wseg_4tag::cached{model, *ctx->hmm_cache, ctx->hmm_oov_only});
+			} else if ((ctx != nullptr) && ctx->hmm_oov_only) {
+				f(dict, fastcws::hmm::wseg_4tag::oov_only{model});
+			} else {
+				f(dict, model);
+			}
+		};
+		if ((ctx != nullptr) && ctx->model_ptr) {
+			g(*ctx->model_ptr);
+		} else if ((ctx != nullptr) && ctx->model_snapshot) {
+			g(*ctx->model_snapshot->object);
+		} else if ((ctx != nullptr) && ctx->compact_model) {
+			g(*ctx->compact_model);
+		} else {
+			g(*fastcws::defaults::hmm_model);
+		}
+	};
+	if ((ctx != nullptr) && ctx->dict_ptr) {
+		with_model(*ctx->dict_ptr);
+	} else if ((ctx != nullptr) && ctx->dict_snapshot) {
+		with_model(*ctx->dict_snapshot->object);
+	} else if ((ctx != nullptr) && ctx->compact_dict_snapshot) {
+		with_model(*ctx->compact_dict_snapshot->object);
+	} else {
+		with_model(*fastcws::defaults::freq_dict);
+	}
+};
+
+// the cache is keyed by the bytes of the runs, the tags decoded by the model ctx held before are stale
+static void forget_decoded(fastcws_ctx* ctx) {
+	if (ctx->hmm_cache) {
+		ctx->hmm_cache->clear();
+	}
+}
+
 void fastcws_init() {
 	fastcws::defaults::init();
 }
 
+int fastcws_init_shared(const char *name_prefix) {
+	return fastcws::defaults::init_shared(name_prefix) ? FASTCWS_OK : FASTCWS_E_IO;
+}
+
+int fastcws_unlink_shared(const char *name_prefix) {
+	try {
+		fastcws::defaults::unlink_shared(name_prefix);
+	} catch (const std::exception&) {
+		return FASTCWS_E_IO;
+	}
+	return FASTCWS_OK;
+}
+
 fastcws_ctx *fastcws_alloc_ctx() {
 	return new fastcws_ctx();
 }
@@ -36,15 +155,13 @@ void fastcws_ctx_free(fastcws_ctx* ctx) {
 }
 
 int fastcws_load_freq_dict(const char *filename, fastcws_ctx* ctx) {
-	std::ifstream f{filename};
-	if (!f.good()) {
-		return FASTCWS_E_IO;
-	}
 	try {
-		ctx->dict_ptr.emplace(fastcws::freq_dict::load_dict(f));
+		ctx->dict_ptr.emplace(fastcws::freq_dict::load_dict_file(filename));
 	} catch (...) {
 		return FASTCWS_E_IO;
 	}
+	ctx->dict_snapshot.reset();
+	ctx->compact_dict_snapshot.reset();
 	return FASTCWS_OK;
 }
 
@@ -58,9 +175,84 @@ int fastcws_load_hmm_model(const char *filename, fastcws_ctx* ctx) {
 	} catch (...) {
 		return FASTCWS_E_IO;
 	}
+	ctx->model_snapshot.reset();
+	ctx->compact_model.reset();
+	forget_decoded(ctx);
+	return FASTCWS_OK;
+}
+
+int fastcws_load_freq_dict_snapshot(const char *filename, fastcws_ctx* ctx) {
+	try {
+		share_snapshot(shared_freq_dict_snapshot, ctx->dict_snapshot, filename, fastcws::defaults::snapshot_kind::freq_dict,
+			fastcws::defaults::load_freq_dict_snapshot);
+	} catch (const std::system_error& e) {
+		return (e.code() == fastcws::errc::resource_busy) ? FASTCWS_E_BUSY : FASTCWS_E_IO;
+	} catch (...) {
+		return FASTCWS_E_IO;
+	}
+	ctx->dict_ptr.reset();
+	ctx->compact_dict_snapshot.reset();
+	return FASTCWS_OK;
+}
+
+int fastcws_load_compact_freq_dict_snapshot(const char *filename, fastcws_ctx* ctx) {
+	try {
+		share_snapshot(shared_compact_freq_dict_snapshot, ctx->compact_dict_snapshot, filename,
+			fastcws::defaults::snapshot_kind::compact_dict, fastcws::defaults::load_compact_freq_dict_snapshot);
+	} catch (const std::system_error& e) {
+		return (e.code() == fastcws::errc::resource_busy) ? FASTCWS_E_BUSY : FASTCWS_E_IO;
+	} catch (...) {
+		return FASTCWS_E_IO;
+	}
+	ctx->dict_ptr.reset();
+	ctx->dict_snapshot.reset();
 	return FASTCWS_OK;
 }
 
+int fastcws_load_hmm_model_snapshot(const char *filename, fastcws_ctx* ctx) {
+	try {
+		share_snapshot(shared_hmm_model_snapshot, ctx->model_snapshot, filename, fastcws::defaults::snapshot_kind::hmm_model,
+			fastcws::defaults::load_hmm_model_snapshot);
+	} catch (const std::system_error& e) {
+		return (e.code() == fastcws::errc::resource_busy) ? FASTCWS_E_BUSY : FASTCWS_E_IO;
+	} catch (...) {
+		return FASTCWS_E_IO;
+	}
+	ctx->model_ptr.reset();
+	ctx->compact_model.reset();
+	forget_decoded(ctx);
+	return FASTCWS_OK;
+}
+
+int fastcws_load_compact_hmm_model(const char *filename, fastcws_ctx* ctx) {
+	try {
+		ctx->compact_model.emplace(fastcws::hmm::wseg_4tag::compact_model::open(filename));
+	} catch (...) {
+		return FASTCWS_E_IO;
+	}
+	ctx->model_ptr.reset();
+	ctx->model_snapshot.reset();
+	forget_decoded(ctx);
+	return FASTCWS_OK;
+}
+
+void fastcws_set_hmm_oov_only(fastcws_ctx* ctx, int enabled) {
+	ctx->hmm_oov_only = (enabled != 0);
+}
+
+void fastcws_set_hmm_cache(fastcws_ctx* ctx, size_t capacity) {
+	if (capacity == 0) {
+		ctx->hmm_cache.reset();
+	} else {
+		ctx->hmm_cache = std::make_unique<fastcws::hmm::wseg_4tag::decode_cache>(capacity);
+	}
+}
+
+void fastcws_hmm_cache_stats(const fastcws_ctx* ctx, uint64_t* hits, uint64_t* misses) {
+	*hits = ctx->hmm_cache ? ctx->hmm_cache->hits() : 0;
+	*misses = ctx->hmm_cache ? ctx->hmm_cache->misses() : 0;
+}
+
 fastcws_result *fastcws_alloc_result() {
 	return new fastcws_result();
 }
@@ -70,7 +262,7 @@ int fastcws_word_break(const char *cstr, fastcws_result* result) {
 		result->words.resize(0);
 		result->cursor = 0;
 		fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words), *fastcws::defaults::freq_dict, *fastcws::defaults::hmm_model);
-	} catch (std::system_error e) {
+	} catch (const std::system_error& e) {
 		if (e.code().category() != fastcws::category) {
 			return FASTCWS_E_INTERNAL;
 		}
@@ -81,24 +273,42 @@ int fastcws_word_break(const char *cstr, fastcws_result* result) {
 
 int fastcws_word_break2(const char *cstr, fastcws_result *result, const fastcws_ctx* ctx) {
 	try {
-		if (ctx->dict_ptr) {
-			if (ctx->model_ptr) {
-				fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words),
-						*ctx->dict_ptr, *ctx->model_ptr);
-			} else {
-				fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words),
-						*ctx->dict_ptr, *fastcws::defaults::hmm_model);
+		with_resources(ctx, [cstr, result](const auto& dict, const auto& model) {
+			fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words), dict, model);
+		});
+	} catch (const std::system_error& e) {
+		if (e.code().category() != fastcws::category) {
+			return FASTCWS_E_INTERNAL;
+		}
+		return e.code().value();
+	}
+	return FASTCWS_OK;
+}
+
+int fastcws_word_break3(const char *cstr, fastcws_result* result, const fastcws_ctx* ctx,
+		const char *const *words, const uint64_t *freqs, size_t num_words) {
+	try {
+		result->words.resize(0);
+		result->cursor = 0;
+		if ((words == nullptr) && (num_words != 0)) {
+			return FASTCWS_E_INVALID_ARGUMENT;
+		}
+		fastcws::freq_dict::ephemeral_words<> ephemeral;
+		for (size_t i = 0; i < num_words; i++) {
+			if (words[i] == nullptr) {
+				return FASTCWS_E_INVALID_ARGUMENT;
 			}
-		} else {
-			if (ctx->model_ptr) {
-				fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words),
-						*fastcws::defaults::freq_dict, *ctx->model_ptr);
+			if (freqs == nullptr) {
+				ephemeral.add_word(words[i]);
 			} else {
-				fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words),
-						*fastcws::defaults::freq_dict, *fastcws::defaults::hmm_model);
+				ephemeral.add_word(words[i], freqs[i]);
 			}
 		}
-	} catch (std::system_error e) {
+		ephemeral.finalize();
+		with_resources(ctx, [cstr, result, &ephemeral](const auto& dict, const auto& model) {
+			fastcws::word_break(std::string_view{cstr}, std::back_inserter(result->words), dict, model, ephemeral);
+		});
+	} catch (const std::system_error& e) {
 		if (e.code().category() != fastcws::category) {
 			return FASTCWS_E_INTERNAL;
 		}
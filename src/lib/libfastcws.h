@@ -25,11 +25,18 @@
 #define FASTCWS_E_IO -2
 #define FASTCWS_E_BAD_ENCODING -3
 #define FASTCWS_E_OVERFLOW -4
+#define FASTCWS_E_BUSY -5
+#define FASTCWS_E_INVALID_ARGUMENT -6
 
 typedef struct fastcws_ctx_s fastcws_ctx;
 typedef struct fastcws_result_s fastcws_result;
 
 FASTCWS_API void fastcws_init();
+/* like fastcws_init, but the defaults are mapped from POSIX shared memory objects named by name_prefix, which the
+ * first process to call it publishes. returns FASTCWS_E_IO if they fell back to private copies, still usable */
+FASTCWS_API int fastcws_init_shared(const char *name_prefix);
+/* removes the objects of fastcws_init_shared, e.g. before upgrading */
+FASTCWS_API int fastcws_unlink_shared(const char *name_prefix);
 
 FASTCWS_API fastcws_ctx* fastcws_alloc_ctx();
 FASTCWS_API fastcws_result* fastcws_alloc_result();
@@ -38,9 +45,33 @@ FASTCWS_API void fastcws_result_free(fastcws_result*);
 
 FASTCWS_API int fastcws_load_freq_dict(const char *filename, fastcws_ctx* ctx);
 FASTCWS_API int fastcws_load_hmm_model(const char *filename, fastcws_ctx* ctx);
+/* compiled by snapshot_utils compile_dict / compile_model, recovered without parsing nor building. snapshots compiled
+ * by another version of fastcws are refused with FASTCWS_E_IO. a process holds one compiled dict (and one compiled
+ * model) at a time: the ctx loading the same file share it, loading another file while any other ctx holds the first
+ * one gets FASTCWS_E_BUSY. ctx keeps what it had loaded if loading fails, unless it alone held another file and
+ * the new one turns out truncated */
+FASTCWS_API int fastcws_load_freq_dict_snapshot(const char *filename, fastcws_ctx* ctx);
+FASTCWS_API int fastcws_load_hmm_model_snapshot(const char *filename, fastcws_ctx* ctx);
+/* written by snapshot_utils compact_dict_snapshot: pruned & quantized, for tight memory. shared like the above */
+FASTCWS_API int fastcws_load_compact_freq_dict_snapshot(const char *filename, fastcws_ctx* ctx);
+/* written by snapshot_utils compact_model, mapped read only. any number of ctx may hold one */
+FASTCWS_API int fastcws_load_compact_hmm_model(const char *filename, fastcws_ctx* ctx);
+/* if enabled, the HMM only segments the runs of characters no dictionary word of two characters or more covers,
+ * which is faster and keeps it from splitting known words. off by default */
+FASTCWS_API void fastcws_set_hmm_oov_only(fastcws_ctx* ctx, int enabled);
+/* remembers the tags of the last capacity runs of characters the HMM decoded, so that recurring unknown words are
+ * looked up instead of decoded again. safe to share between threads, 0 to disable (the default). not to be changed
+ * while ctx is in use. emptied whenever ctx loads another model */
+FASTCWS_API void fastcws_set_hmm_cache(fastcws_ctx* ctx, size_t capacity);
+FASTCWS_API void fastcws_hmm_cache_stats(const fastcws_ctx* ctx, uint64_t* hits, uint64_t* misses);
 
 FASTCWS_API int fastcws_word_break(const char *cstr, fastcws_result* result);
 FASTCWS_API int fastcws_word_break2(const char *cstr, fastcws_result* result, const fastcws_ctx* ctx);
+/* words count as dictionary words for this call only, without touching the dictionary. freqs are on the scale of
+ * the dictionary, if NULL the words always win. ctx may be NULL to use the defaults. returns
+ * FASTCWS_E_INVALID_ARGUMENT if words is NULL while num_words is not 0, or any of the words is NULL */
+FASTCWS_API int fastcws_word_break3(const char *cstr, fastcws_result* result, const fastcws_ctx* ctx,
+		const char *const *words, const uint64_t *freqs, size_t num_words);
 
 FASTCWS_API int fastcws_result_next(fastcws_result*, const char** word_begin, size_t* word_len);
 
@@ -5,6 +5,7 @@
 #include "fastcws_defaults/imemstream.hpp"
 
 #include <vector>
+#include <exception>
 
 #include "freq_dict_gen.hpp"
 
@@ -20,7 +21,8 @@ extern const size_t decompressed_freq_dict_data_size;
 freq_dict_region_t freq_dict_region;
 freq_dict_t* freq_dict;
 
-void init_freq_dict() noexcept {
+template <class Callback>
+static void with_freq_dict_image(Callback cb) {
 	std::vector<char> decompress_buffer;
 	decompress_buffer.resize(decompressed_freq_dict_data_size);
 
@@ -29,11 +31,48 @@ void init_freq_dict() noexcept {
 			decompress_buffer.data(), decompress_buffer.size());
 
 	imemstream is{decompress_buffer.data(), deflate_size};
-	freq_dict_region = freq_dict_region_t::recover(is);
+	cb(is);
+}
+
+void init_freq_dict() noexcept {
+	with_freq_dict_image([](std::istream& is) {
+		freq_dict_region = freq_dict_region_t::recover(is);
+	});
 	auto dict_ptr = freq_dict_region.retrieve_ptr<freq_dict_t>(dict_ptr_tag);
 	freq_dict = &(*dict_ptr);
 }
 
+#ifndef _WIN32
+
+suspendable_region::shared_region<freq_dict_region_t> freq_dict_shared_region;
+
+bool init_freq_dict_shared(const char* name) noexcept {
+	try {
+		const uint64_t version = image_version(compressed_freq_dict_data_begin, compressed_freq_dict_data_size,
+			decompressed_freq_dict_data_size, sizeof(freq_dict_t));
+		freq_dict_shared_region = decltype(freq_dict_shared_region)::attach_or_publish(name, version, [](auto publish) {
+			with_freq_dict_image(publish);
+		});
+	} catch (const std::exception&) {
+		// e.g. a stale object of another version, or no shm support
+		init_freq_dict();
+		return false;
+	}
+	auto dict_ptr = freq_dict_shared_region.region().retrieve_ptr<freq_dict_t>(dict_ptr_tag);
+	freq_dict = &(*dict_ptr);
+	return true;
+}
+
+#else
+
+bool init_freq_dict_shared(const char* name) noexcept {
+	(void)name;
+	init_freq_dict();
+	return false;
+}
+
+#endif
+
 };
 
 };
@@ -5,6 +5,7 @@
 #include "fastcws_defaults/imemstream.hpp"
 
 #include <vector>
+#include <exception>
 
 #include "hmm_model_gen.hpp"
 
@@ -20,7 +21,8 @@ extern const size_t decompressed_hmm_model_data_size;
 hmm_model_region_t hmm_model_region;
 hmm_model_t* hmm_model;
 
-void init_hmm_model() noexcept {
+template <class Callback>
+static void with_hmm_model_image(Callback cb) {
 	std::vector<char> decompress_buffer;
 	decompress_buffer.resize(decompressed_hmm_model_data_size);
 
@@ -29,11 +31,48 @@ void init_hmm_model() noexcept {
 			decompress_buffer.data(), decompress_buffer.size());
 
 	imemstream is{decompress_buffer.data(), deflate_size};
-	hmm_model_region = hmm_model_region_t::recover(is);
+	cb(is);
+}
+
+void init_hmm_model() noexcept {
+	with_hmm_model_image([](std::istream& is) {
+		hmm_model_region = hmm_model_region_t::recover(is);
+	});
 	auto model_ptr = hmm_model_region.retrieve_ptr<hmm_model_t>(model_ptr_tag);
 	hmm_model = &(*model_ptr);
 }
 
+#ifndef _WIN32
+
+suspendable_region::shared_region<hmm_model_region_t> hmm_model_shared_region;
+
+bool init_hmm_model_shared(const char* name) noexcept {
+	try {
+		const uint64_t version = image_version(compressed_hmm_model_data_begin, compressed_hmm_model_data_size,
+			decompressed_hmm_model_data_size, sizeof(hmm_model_t));
+		hmm_model_shared_region = decltype(hmm_model_shared_region)::attach_or_publish(name, version, [](auto publish) {
+			with_hmm_model_image(publish);
+		});
+	} catch (const std::exception&) {
+		// e.g. a stale object of another version, or no shm support
+		init_hmm_model();
+		return false;
+	}
+	auto model_ptr = hmm_model_shared_region.region().retrieve_ptr<hmm_model_t>(model_ptr_tag);
+	hmm_model = &(*model_ptr);
+	return true;
+}
+
+#else
+
+bool init_hmm_model_shared(const char* name) noexcept {
+	(void)name;
+	init_hmm_model();
+	return false;
+}
+
+#endif
+
 };
 
 };
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <iostream>
+#include <fstream>
+#include <string_view>
+#include <string>
+#include <exception>
+
+#include "fastcws/freq_dict.hpp"
+#include "fastcws/word_discovery.hpp"
+#include "fastcws/misc/mapped_file.hpp"
+
+int usage(std::string_view program) {
+	std::cerr << "usage: " << program << " [options] <freq_dict.txt> <corpus.txt> <new_words.txt>\n"
+		<< "\n"
+		<< "finds words of a raw corpus missing from a frequency dictionary, counting the n-grams\n"
+		<< "of cjk ideographs on all cores. candidates are scored by their count, the mutual\n"
+		<< "information of their halves and the entropy of the runes on both sides. they are\n"
+		<< "written in the dictionary format with their count in the corpus\n"
+		<< "\n"
+		<< "options:\n"
+		<< "  --threads <n>            worker threads, defaults to all cores\n"
+		<< "  --memory-limit <MiB>     memory the n-gram counts may take before being\n"
+		<< "                           spilled to disk, at least 1, defaults to 1024\n"
+		<< "  --spill-dir <path>       where to spill, defaults to the temp directory\n"
+		<< "  --max-length <n>         longest word in runes, defaults to 4\n"
+		<< "  --min-count <n>          leave out rarer words, defaults to 5\n"
+		<< "  --min-cohesion <bits>    defaults to 4\n"
+		<< "  --min-entropy <bits>     defaults to 1\n"
+		<< std::endl;
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+	fastcws::discovery_options opt;
+	opt.quiet = false;
+	const char* dict_filename = nullptr;
+	const char* corpus_filename = nullptr;
+	const char* output_filename = nullptr;
+	for (int i = 1; i < argc; i++) {
+		std::string_view sv{argv[i]};
+		const bool has_value = (i + 1) < argc;
+		if ((sv == "--threads") && has_value) {
+			opt.threads = std::stoul(argv[++i]);
+		} else if ((sv == "--memory-limit") && has_value) {
+			opt.memory_limit = std::stoul(argv[++i]) * 1024UL * 1024UL;
+		} else if ((sv == "--spill-dir") && has_value) {
+			opt.spill_dir = argv[++i];
+		} else if ((sv == "--max-length") && has_value) {
+			opt.max_runes = std::stoul(argv[++i]);
+		} else if ((sv == "--min-count") && has_value) {
+			opt.min_count = std::stoull(argv[++i]);
+		} else if ((sv == "--min-cohesion") && has_value) {
+			opt.min_cohesion = std::stod(argv[++i]);
+		} else if ((sv == "--min-entropy") && has_value) {
+			opt.min_entropy = std::stod(argv[++i]);
+		} else if ((dict_filename == nullptr) && !sv.empty() && (sv[0] != '-')) {
+			dict_filename = argv[i];
+		} else if ((corpus_filename == nullptr) && !sv.empty() && (sv[0] != '-')) {
+			corpus_filename = argv[i];
+		} else if ((output_filename == nullptr) && !sv.empty() && (sv[0] != '-')) {
+			output_filename = argv[i];
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if ((output_filename == nullptr) || (opt.memory_limit == 0)) {
+		return usage(argv[0]);
+	}
+
+	try {
+		auto dict = fastcws::freq_dict::load_dict_file(dict_filename, 0, false);
+		fastcws::mapped_file corpus{corpus_filename};
+		std::ofstream ofs{output_filename, std::ios::binary};
+		if (!ofs.good()) {
+			std::cerr << "error: cannot write " << output_filename << std::endl;
+			return EXIT_FAILURE;
+		}
+		fastcws::discover_words(corpus.view(), dict, ofs, opt);
+		if (!ofs.good()) {
+			std::cerr << "error: cannot write " << output_filename << std::endl;
+			return EXIT_FAILURE;
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
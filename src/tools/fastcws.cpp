@@ -4,9 +4,12 @@
 #include <fstream>
 #include <string_view>
 #include <optional>
+#include <string>
 
 #include "fastcws.hpp"
 #include "fastcws_defaults.hpp"
+#include "fastcws/word_count.hpp"
+#include "fastcws/misc/mapped_file.hpp"
 
 #ifdef _WIN32
 #include "nowide/iostream.hpp"
@@ -15,6 +18,10 @@
 int usage() {
 	std::cerr
 		<< "usage: echo \'想要分词的内容\' | fastcws [options]\n"
+		<< "       fastcws count [options] <corpus> > freq_dict.txt\n"
+		<< "\n"
+		<< "count segments corpus on all cores and writes the frequency of every word\n"
+		<< "in the dictionary format accepted by --dict\n"
 		<< "\n"
 		<< "options:\n"
 		<< "  --sep <separator>        specify separator added to output between\n"
@@ -29,7 +36,40 @@ int usage() {
 		<< "  -m <path/to/model>       text for utility hmm_train on how to train your\n"
 		<< "                           own hmm model\n"
 		<< "\n"
+		<< "  --dict-snapshot <path>   load a dictionary compiled by snapshot_utils\n"
+		<< "                           compile_dict, which skips parsing & building\n"
+		<< "\n"
+		<< "  --compact-dict-snapshot <path>\n"
+		<< "                           load a pruned dictionary written by snapshot_utils\n"
+		<< "                           compact_dict_snapshot, for tight memory\n"
+		<< "\n"
+		<< "  --model-snapshot <path>  load a HMM model compiled by snapshot_utils\n"
+		<< "                           compile_model\n"
+		<< "\n"
+		<< "  --compact-model <path>   map a HMM model written by snapshot_utils\n"
+		<< "                           compact_model, which holds only what decoding\n"
+		<< "                           needs\n"
+		<< "\n"
+		<< "  --hmm-oov-only           only run the HMM over the runs of characters no\n"
+		<< "                           dictionary word covers, like jieba does\n"
+		<< "\n"
+		<< "  --hmm-cache <n>          remember the tags of the last n runs the HMM\n"
+		<< "                           decoded, for recurring unknown words. hits &\n"
+		<< "                           misses are reported to stderr at the end\n"
+		<< "\n"
+		<< "  --shared <prefix>        share the default dict & model with other\n"
+		<< "                           processes through POSIX shared memory objects\n"
+		<< "                           named by prefix, e.g. /fastcws\n"
+		<< "\n"
 		<< "  --help                   show this help message\n"
+		<< "\n"
+		<< "count options:\n"
+		<< "  --threads <n>            worker threads, defaults to all cores\n"
+		<< "  --memory-limit <MiB>     memory the counts of words missing from the\n"
+		<< "                           dictionary may take before being spilled to\n"
+		<< "                           disk, defaults to 1024\n"
+		<< "  --min-count <n>          leave out rarer words, defaults to 1\n"
+		<< "  --spill-dir <path>       where to spill, defaults to the temp directory\n"
 		<< std::endl;
 	return EXIT_FAILURE;
 }
@@ -47,11 +87,35 @@ int main(int argc, char** argv) {
 
 	const char* dict_filename = nullptr;
 	const char* model_filename = nullptr;
+	const char* dict_snapshot_filename = nullptr;
+	const char* compact_dict_snapshot_filename = nullptr;
+	const char* model_snapshot_filename = nullptr;
+	const char* compact_model_filename = nullptr;
+	std::optional<std::string> shared_prefix = std::nullopt;
 	std::string_view sep = "/";
+	bool hmm_oov_only = false;
+	size_t hmm_cache_size = 0;
+	const char* count_corpus = nullptr;
+	fastcws::count_options count_opt;
 
-	for (int i = 1; i < argc;) {
+	const bool count_mode = (argc > 1) && (std::string_view{argv[1]} == "count");
+	for (int i = count_mode ? 2 : 1; i < argc;) {
 		std::string_view sv{argv[i]};
-		if ((sv == "-s") || (sv == "--sep")) {
+		if (count_mode && (sv == "--threads") && ((i + 1) < argc)) {
+			count_opt.threads = std::stoul(argv[i + 1]);
+			i++;
+		} else if (count_mode && (sv == "--memory-limit") && ((i + 1) < argc)) {
+			count_opt.memory_limit = std::stoul(argv[i + 1]) * 1024UL * 1024UL;
+			i++;
+		} else if (count_mode && (sv == "--min-count") && ((i + 1) < argc)) {
+			count_opt.min_count = std::stoull(argv[i + 1]);
+			i++;
+		} else if (count_mode && (sv == "--spill-dir") && ((i + 1) < argc)) {
+			count_opt.spill_dir = argv[i + 1];
+			i++;
+		} else if (count_mode && (count_corpus == nullptr) && !sv.empty() && (sv[0] != '-')) {
+			count_corpus = argv[i];
+		} else if ((sv == "-s") || (sv == "--sep")) {
 			if ((i + 1) >= argc) {
 				return usage();
 			}
@@ -71,6 +135,44 @@ int main(int argc, char** argv) {
 			}
 			model_filename = argv[i + 1];
 			i++;
+		} else if (sv == "--dict-snapshot") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			dict_snapshot_filename = argv[i + 1];
+			i++;
+		} else if (sv == "--compact-dict-snapshot") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			compact_dict_snapshot_filename = argv[i + 1];
+			i++;
+		} else if (sv == "--model-snapshot") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			model_snapshot_filename = argv[i + 1];
+			i++;
+		} else if (sv == "--compact-model") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			compact_model_filename = argv[i + 1];
+			i++;
+		} else if (sv == "--shared") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			shared_prefix = argv[i + 1];
+			i++;
+		} else if (sv == "--hmm-cache") {
+			if ((i + 1) >= argc) {
+				return usage();
+			}
+			hmm_cache_size = std::stoul(argv[i + 1]);
+			i++;
+		} else if (sv == "--hmm-oov-only") {
+			hmm_oov_only = true;
 		} else if (sv == "--help") {
 			(void) usage();
 			return EXIT_SUCCESS;
@@ -80,55 +182,167 @@ int main(int argc, char** argv) {
 		i++;
 	}
 
+	if (((dict_filename != nullptr) + (dict_snapshot_filename != nullptr) + (compact_dict_snapshot_filename != nullptr) > 1)
+			|| ((model_filename != nullptr) + (model_snapshot_filename != nullptr) + (compact_model_filename != nullptr) > 1)
+			|| (count_mode && (count_corpus == nullptr))) {
+		return usage();
+	}
+	if (count_mode && (compact_dict_snapshot_filename != nullptr)) {
+		std::cerr << "counting writes out every word of the dictionary, which --compact-dict-snapshot pruned" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// counting looks words up by id, which the double array backend provides
+	using count_dict_t = fastcws::freq_dict::dict<std::allocator<int>, std::allocator<int>, fastcws::freq_dict::trie_backend::double_array>;
 	std::optional<fastcws::freq_dict::dict<>> custom_dict = std::nullopt;
-	if (dict_filename == nullptr) {
-		fastcws::defaults::init_freq_dict();
+	std::optional<count_dict_t> custom_count_dict = std::nullopt;
+	std::optional<decltype(fastcws::defaults::load_freq_dict_snapshot(""))> dict_snapshot = std::nullopt;
+	std::optional<decltype(fastcws::defaults::load_compact_freq_dict_snapshot(""))> compact_dict_snapshot = std::nullopt;
+	if (dict_snapshot_filename != nullptr) {
+		try {
+			dict_snapshot.emplace(fastcws::defaults::load_freq_dict_snapshot(dict_snapshot_filename));
+		} catch (const std::exception& e) {
+			std::cerr << "failed to load compiled freq dict : " << dict_snapshot_filename << " (" << e.what() << ")" << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else if (compact_dict_snapshot_filename != nullptr) {
+		try {
+			compact_dict_snapshot.emplace(fastcws::defaults::load_compact_freq_dict_snapshot(compact_dict_snapshot_filename));
+		} catch (const std::exception& e) {
+			std::cerr << "failed to load compact freq dict : " << compact_dict_snapshot_filename << " (" << e.what() << ")" << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else if (dict_filename == nullptr) {
+		if (shared_prefix.has_value()) {
+			fastcws::defaults::init_freq_dict_shared((*shared_prefix + "_freq_dict").c_str());
+		} else {
+			fastcws::defaults::init_freq_dict();
+		}
 	} else {
-		std::ifstream f{dict_filename};
-		if (!f.good()) {
-			std::cerr << "failed to load custom freq dict : " << dict_filename << std::endl;
+		try {
+			if (count_mode) {
+				custom_count_dict.emplace(fastcws::freq_dict::load_dict_file<count_dict_t>(dict_filename));
+			} else {
+				custom_dict.emplace(fastcws::freq_dict::load_dict_file(dict_filename));
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "failed to load custom freq dict : " << dict_filename << " (" << e.what() << ")" << std::endl;
 			return EXIT_FAILURE;
 		}
-		custom_dict.emplace(fastcws::freq_dict::load_dict(f));
 	}
 
 	std::optional<fastcws::hmm::wseg_4tag::model<>> custom_model = std::nullopt;
-	if (model_filename == nullptr) {
-		fastcws::defaults::init_hmm_model();
+	std::optional<decltype(fastcws::defaults::load_hmm_model_snapshot(""))> model_snapshot = std::nullopt;
+	std::optional<fastcws::hmm::wseg_4tag::compact_model> compact_model = std::nullopt;
+	if (compact_model_filename != nullptr) {
+		try {
+			compact_model.emplace(fastcws::hmm::wseg_4tag::compact_model::open(compact_model_filename));
+		} catch (const std::exception& e) {
+			std::cerr << "failed to load compact hmm model: " << compact_model_filename << " (" << e.what() << ")" << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else if (model_snapshot_filename != nullptr) {
+		try {
+			model_snapshot.emplace(fastcws::defaults::load_hmm_model_snapshot(model_snapshot_filename));
+		} catch (const std::exception& e) {
+			std::cerr << "failed to load compiled hmm model: " << model_snapshot_filename << " (" << e.what() << ")" << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else if (model_filename == nullptr) {
+		if (shared_prefix.has_value()) {
+			fastcws::defaults::init_hmm_model_shared((*shared_prefix + "_hmm_model").c_str());
+		} else {
+			fastcws::defaults::init_hmm_model();
+		}
 	} else {
 		std::ifstream f{model_filename};
 		if (!f.good()) {
-			std::cerr << "failed to load custom hmm model: " << dict_filename << std::endl;
+			std::cerr << "failed to load custom hmm model: " << model_filename << std::endl;
 			return EXIT_FAILURE;
 		}
 		custom_model.emplace(fastcws::hmm::wseg_4tag::load(f));
 	}
 
-	fastcws::istream_sentence_tokenizer tok{cin};
-	std::string sentence;
-	size_t i = 0;
-	while (tok >> sentence) {
-		std::vector<std::string_view> words;
+	std::optional<fastcws::hmm::wseg_4tag::decode_cache> hmm_cache = std::nullopt;
+	if (hmm_cache_size != 0) {
+		hmm_cache.emplace(hmm_cache_size);
+	}
 
-		if (custom_dict.has_value() && custom_model.has_value()) {
-			fastcws::word_break(sentence, std::back_inserter(words), *custom_dict, *custom_model);
-		} else if (!custom_dict.has_value() && custom_model.has_value()) {
-			fastcws::word_break(sentence, std::back_inserter(words), *fastcws::defaults::freq_dict, *custom_model);
-		} else if (custom_dict.has_value() && !custom_model.has_value()) {
-			fastcws::word_break(sentence, std::back_inserter(words), *custom_dict, *fastcws::defaults::hmm_model);
-		} else {
-			fastcws::word_break(sentence, std::back_inserter(words), *fastcws::defaults::freq_dict, *fastcws::defaults::hmm_model);
+	int ret = EXIT_SUCCESS;
+	auto run = [sep, count_corpus, &count_opt, &ret](const auto& dict, const auto& model) {
+		if (count_corpus != nullptr) {
+			if constexpr (fastcws::can_count_words_v<std::decay_t<decltype(dict)>>) {
+				try {
+					fastcws::mapped_file corpus{count_corpus};
+					fastcws::count_words(corpus.view(), dict, model, cout, count_opt);
+					std::flush(cout);
+				} catch (const std::exception& e) {
+					std::cerr << "failed to count words of " << count_corpus << " (" << e.what() << ")" << std::endl;
+					ret = EXIT_FAILURE;
+				}
+			} else {
+				// count mode loads its dicts with ids, see count_dict_t
+				std::cerr << "cannot count words with a dictionary without word ids" << std::endl;
+				ret = EXIT_FAILURE;
+			}
+			return;
 		}
+		fastcws::istream_sentence_tokenizer tok{cin};
+		std::string sentence;
+		size_t i = 0;
+		while (tok >> sentence) {
+			std::vector<std::string_view> words;
+			try {
+				fastcws::word_break(sentence, std::back_inserter(words), dict, model);
+			} catch (const fastcws::exception::bad_encoding&) {
+				std::cerr << "skipped a sentence of invalid utf-8" << std::endl;
+				ret = EXIT_FAILURE;
+				continue;
+			}
 
-		for (auto it = words.begin(); it != words.end(); it++) {
-			if (i != 0) {
-				cout << sep;
+			for (auto it = words.begin(); it != words.end(); it++) {
+				if (i != 0) {
+					cout << sep;
+				}
+				cout << *it;
+				i++;
 			}
-			cout << *it;
-			i++;
+			std::flush(cout);
+		}
+	};
+	auto run_with_model = [&](const auto& dict) {
+		auto run_model = [&](const auto& model) {
+			if (hmm_cache.has_value()) {
+				run(dict, fastcws::hmm::wseg_4tag::cached{model, *hmm_cache, hmm_oov_only});
+			} else if (hmm_oov_only) {
+				run(dict, fastcws::hmm::wseg_4tag::oov_only{model});
+			} else {
+				run(dict, model);
+			}
+		};
+		if (custom_model.has_value()) {
+			run_model(*custom_model);
+		} else if (model_snapshot.has_value()) {
+			run_model(*model_snapshot->object);
+		} else if (compact_model.has_value()) {
+			run_model(*compact_model);
+		} else {
+			run_model(*fastcws::defaults::hmm_model);
 		}
-		std::flush(cout);
+	};
+	if (custom_dict.has_value()) {
+		run_with_model(*custom_dict);
+	} else if (custom_count_dict.has_value()) {
+		run_with_model(*custom_count_dict);
+	} else if (dict_snapshot.has_value()) {
+		run_with_model(*dict_snapshot->object);
+	} else if (compact_dict_snapshot.has_value()) {
+		run_with_model(*compact_dict_snapshot->object);
+	} else {
+		run_with_model(*fastcws::defaults::freq_dict);
 	}
-	return 0;
+	if (hmm_cache.has_value()) {
+		std::cerr << "hmm cache: " << hmm_cache->hits() << " hits, " << hmm_cache->misses() << " misses" << std::endl;
+	}
+	return ret;
 }
-
@@ -4,13 +4,14 @@
 #include <fstream>
 #include <string>
 #include <string_view>
-#include <list>
 #include <vector>
+#include <exception>
 
 #include "fastcws/hmm.hpp"
+#include "fastcws/misc/mapped_file.hpp"
 
 void usage(std::string_view program) {
-	std::cerr << "usage: " << program << " <wseg_model.hmm> [training00.txt] [training01.txt] ..\n"
+	std::cerr << "usage: " << program << " [options] <wseg_model.hmm> [training00.txt] [training01.txt] ..\n"
 		<< "\n"
 		<< "examples:\n"
 		<< "$" << program << " wseg_model.hmm\n"
@@ -20,21 +21,47 @@ void usage(std::string_view program) {
 		<< "create model if not exist, train model with provided data\n"
 		<< "if model already exist, will train progressively\n"
 		<< "results will be saved to model file, and dumped to console\n"
+		<< "\n"
+		<< "options:\n"
+		<< "  -j <n>                   worker threads, defaults to all cores\n"
+		<< "  --segmented              training data is segmented text, one sentence a\n"
+		<< "                           line with words separated by spaces, instead of\n"
+		<< "                           one character & its B/M/E/S tag a line\n"
 		<< std::endl;
 }
 
 int main(int argc, char** argv) {
 	namespace hmm = fastcws::hmm;
 
-	if (argc < 2) {
+	hmm::wseg_4tag::training_options opt;
+	const char* model_filename = nullptr;
+	std::vector<const char*> training_filenames;
+	for (int i = 1; i < argc; i++) {
+		std::string_view sv{argv[i]};
+		if ((sv == "-j") && ((i + 1) < argc)) {
+			opt.threads = std::stoul(argv[++i]);
+		} else if (sv == "--segmented") {
+			opt.segmented = true;
+		} else if (!sv.empty() && (sv[0] != '-')) {
+			if (model_filename == nullptr) {
+				model_filename = argv[i];
+			} else {
+				training_filenames.push_back(argv[i]);
+			}
+		} else {
+			usage({argv[0]});
+			return 1;
+		}
+	}
+	if (model_filename == nullptr) {
 		usage({argv[0]});
 		return 1;
 	}
 
-	size_t training_count = argc - 2;
+	size_t training_count = training_filenames.size();
 	hmm::wseg_4tag::model<> model;
 	{
-		std::ifstream ifs{argv[1]};
+		std::ifstream ifs{model_filename};
 		if (ifs.good()) {
 			model = hmm::wseg_4tag::load<decltype(model)>(ifs);
 		} else {
@@ -45,64 +72,24 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	for (size_t i = 0; i < training_count; i++) {
-		std::ifstream ifs{argv[2 + i]};
-		if (!ifs.good()) {
-			std::cerr << "error: " << argv[2 + i] << " good() == false, skipping .." << std::endl;
+	for (const char* filename : training_filenames) {
+		fastcws::mapped_file training;
+		try {
+			training = fastcws::mapped_file{filename};
+		} catch (const std::exception& e) {
+			std::cerr << "error: " << filename << " " << e.what() << ", skipping .." << std::endl;
 			continue;
 		}
-
-		std::list<std::string> lines;
-		std::vector<std::string_view> characters;
-		std::vector<hmm::wseg_4tag::state> tags;
-		bool ended = false;
-		while (!ended) {
-			for (;;) {
-				std::string line;
-				if(!std::getline(ifs, line, '\n')) {
-					ended = true;
-					break;
-				}
-				if (line == "") continue;
-				if (line == "SENTENCE END") break;
-				if (line == "TEXT END") break;
-				assert(line.size() >= 3);
-				assert(line[line.size() - 2] == ' ');
-
-				char tag = line[line.size() - 1];
-				lines.emplace_back(std::move(line));
-				std::string_view character = std::string_view{lines.back()}.substr(0, lines.back().size() - 2);
-				characters.push_back(character);
-
-				hmm::wseg_4tag::state tag_e;
-				switch (tag) {
-					case 'B':
-						tag_e = decltype(tag_e)::B;
-						break;
-					case 'M':
-						tag_e = decltype(tag_e)::M;
-						break;
-					case 'E':
-						tag_e = decltype(tag_e)::E;
-						break;
-					case 'S':
-						tag_e = decltype(tag_e)::S;
-						break;
-					default:
-						std::cerr << "invalid tag : " << tag << std::endl;
-						return 1;
-				}
-				tags.push_back(tag_e);
-			}
-			model.train(characters.cbegin(), characters.cend(), tags.cbegin(), tags.cend());
-			characters.clear();
-			tags.clear();
-			lines.clear();
+		try {
+			hmm::wseg_4tag::train_corpus(model, training.view(), opt);
+		} catch (const std::exception& e) {
+			std::cerr << "error: " << filename << " " << e.what() << std::endl;
+			return 1;
 		}
 	}
 	
 	if (training_count > 0) {
-		std::ofstream ofs{argv[1]};
+		std::ofstream ofs{model_filename};
 		hmm::wseg_4tag::save(model, ofs);
 	}
 
@@ -1,15 +1,22 @@
 // SPDX-License-Identifier: BSD-2-Clause
 
 #include <string_view>
+#include <string>
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <utility>
 
+#include "fastcws/fastcws.hpp"
 #include "fastcws/freq_dict.hpp"
 #include "fastcws/hmm.hpp"
 #include "fastcws/suspendable_region.hpp"
 #include "fastcws_defaults/definitions.hpp"
 #include "fastcws_defaults/compressor.hpp"
+#include "fastcws_defaults/snapshot.hpp"
 
 inline constexpr size_t max_snapshot_size = 2UL * 1024UL * 1024UL * 1024UL;
 using fastcws::defaults::seat_dict;
@@ -17,27 +24,43 @@ using fastcws::defaults::seat_model;
 using fastcws::defaults::dict_ptr_tag;
 using fastcws::defaults::model_ptr_tag;
 
-void save_dict_snapshot(const char* dict_filename, const char* snapshot_filename) {
+// runs every line of the sample corpus through the dict's automaton
+template <class Dict, class Profile>
+void record_dict_profile(const Dict& dict, const char* corpus_filename, Profile& prof) {
+	std::ifstream ifs{corpus_filename};
+	assert(ifs.good());
+	std::string line;
+	while (std::getline(ifs, line)) {
+		dict.record_profile(line, prof);
+	}
+}
+
+// with a sample corpus, the double array is laid out for the paths the corpus walks most.
+// compiled snapshots start with a snapshot_header, for fastcws --dict-snapshot & fastcws_load_freq_dict_snapshot
+void save_dict_snapshot(const char* dict_filename, const char* snapshot_filename, const char* corpus_filename, bool compiled=false) {
 	namespace suspendable_region = fastcws::suspendable_region;
 	using fastcws::suspendable_region::managed_region;
 
 	managed_region<seat_dict> reg{max_snapshot_size};
-	using int_allocator = suspendable_region::allocator<int, decltype(reg)>;
-	using dict_type = fastcws::freq_dict::dict<int_allocator, std::allocator<int>, true>;
+	using dict_type = fastcws::defaults::custom_freq_dict_in<decltype(reg)>;
 	auto dict_alloc = suspendable_region::allocator_of(reg).get<dict_type>();
 	using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
 
 	auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
 	reg.tag_ptr(dict_ptr_tag, dict_ptr);
 	alloc_traits::construct(dict_alloc, dict_ptr.get());
-	{
-		std::ifstream ifs{dict_filename};
-		assert(ifs.good());
-		load_dict(ifs, *dict_ptr, false);
+	load_dict_file(dict_filename, *dict_ptr, 0, false);
+	if (corpus_filename != nullptr) {
+		auto prof = dict_ptr->make_profile();
+		record_dict_profile(*dict_ptr, corpus_filename, prof);
+		dict_ptr->relayout(prof, false);
 	}
 	{
 		std::ofstream ofs{snapshot_filename, std::ios::binary};
 		assert(ofs.good());
+		if (compiled) {
+			fastcws::defaults::snapshot_header::of(fastcws::defaults::snapshot_kind::freq_dict).write(ofs);
+		}
 		reg.suspend(ofs);
 	}
 }
@@ -51,20 +74,145 @@ void dump_dict_snapshot(const char *snapshot_filename) {
 	auto reg = managed_region<seat_dict>::recover(ifs);
 	ifs.close();
 	using int_allocator = suspendable_region::allocator<int, decltype(reg)>;
-	using dict_type = fastcws::freq_dict::dict<int_allocator, std::allocator<int>, true>;
+	using dict_type = fastcws::freq_dict::dict<int_allocator, std::allocator<int>, fastcws::freq_dict::trie_backend::double_array>;
 
 	auto dict_ptr = reg.retrieve_ptr<dict_type>(dict_ptr_tag);
 	save_dict(*dict_ptr, std::cout);
 	std::flush(std::cout);
 }
 
-void save_hmm_model_snapshot(const char* model_filename, const char* snapshot_filename) {
+void dump_unmatched_words(const char* dict_filename, const char* corpus_filename) {
+	using dict_type = fastcws::freq_dict::dict<std::allocator<int>, std::allocator<int>, fastcws::freq_dict::trie_backend::double_array>;
+	dict_type dict;
+	load_dict_file(dict_filename, dict, 0, true);
+	auto prof = dict.make_profile();
+	record_dict_profile(dict, corpus_filename, prof);
+	dict.for_each_unmatched_word(prof, [&dict](std::string_view word) {
+		std::cout << word << " " << dict.get_freq(word) << "\n";
+	});
+	std::flush(std::cout);
+}
+
+// word boundaries of line segmented by dict alone, so that the report reflects the dict only
+template <class Dict>
+std::set<size_t> dict_boundaries(std::string_view line, const Dict& dict) {
+	std::vector<std::string_view> words;
+	fastcws::word_break(line, std::back_inserter(words), dict, fastcws::no_hmm_model);
+	std::set<size_t> ret;
+	for (auto word : words) {
+		ret.insert(static_cast<size_t>(word.data() + word.size() - line.data()));
+	}
+	return ret;
+}
+
+// prunes, quantizes & front codes the dict into a compact_dict snapshot, for fastcws --compact-dict-snapshot &
+// fastcws_load_compact_freq_dict_snapshot. then reports the sizes and how much segmenting the sample corpus changes
+void compact_dict_snapshot(const char* dict_filename, const char* snapshot_filename, const char* sample_filename,
+		const fastcws::freq_dict::compact_options& opt) {
+	namespace suspendable_region = fastcws::suspendable_region;
+	using fastcws::suspendable_region::managed_region;
+	using dict_type = fastcws::freq_dict::dict<std::allocator<int>, std::allocator<int>, fastcws::freq_dict::trie_backend::double_array>;
+
+	dict_type dict;
+	load_dict_file(dict_filename, dict, 0, true);
+	size_t full_size = 0;
+	{
+		managed_region<seat_dict> reg{max_snapshot_size};
+		using int_allocator = suspendable_region::allocator<int, decltype(reg)>;
+		using region_dict_type = fastcws::freq_dict::dict<int_allocator, std::allocator<int>, fastcws::freq_dict::trie_backend::double_array>;
+		auto dict_alloc = suspendable_region::allocator_of(reg).get<region_dict_type>();
+		using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+		auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
+		reg.tag_ptr(dict_ptr_tag, dict_ptr);
+		alloc_traits::construct(dict_alloc, dict_ptr.get());
+		load_dict_file(dict_filename, *dict_ptr, 0, true);
+		std::ostringstream oss;
+		reg.suspend(oss);
+		full_size = oss.str().size();
+	}
+
+	managed_region<seat_dict> reg{max_snapshot_size};
+	using compact_dict_type = fastcws::defaults::custom_compact_dict_in<decltype(reg)>;
+	auto dict_alloc = suspendable_region::allocator_of(reg).get<compact_dict_type>();
+	using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+	auto compact_ptr = alloc_traits::allocate(dict_alloc, 1);
+	reg.tag_ptr(dict_ptr_tag, compact_ptr);
+	alloc_traits::construct(dict_alloc, compact_ptr.get());
+	compact_ptr->build_from(dict, opt, true);
+	size_t compact_size = 0;
+	{
+		std::ofstream ofs{snapshot_filename, std::ios::binary};
+		assert(ofs.good());
+		fastcws::defaults::snapshot_header::of(fastcws::defaults::snapshot_kind::compact_dict).write(ofs);
+		reg.suspend(ofs);
+		compact_size = static_cast<size_t>(ofs.tellp());
+	}
+
+	size_t lines = 0;
+	size_t changed_lines = 0;
+	size_t boundaries = 0;
+	size_t changed_boundaries = 0;
+	{
+		std::ifstream ifs{sample_filename};
+		assert(ifs.good());
+		std::string line;
+		while (std::getline(ifs, line)) {
+			auto before = dict_boundaries(line, dict);
+			auto after = dict_boundaries(line, *compact_ptr);
+			lines++;
+			changed_lines += (before != after) ? 1 : 0;
+			boundaries += before.size();
+			for (size_t b : before) {
+				changed_boundaries += after.count(b) ? 0 : 1;
+			}
+		}
+	}
+
+	size_t words = 0;
+	dict.for_each_word([&words](std::string_view, uint64_t) {
+		words++;
+	});
+	auto pct = [](size_t part, size_t whole) {
+		return (whole == 0) ? 0.0 : (part * 100.0 / whole);
+	};
+	std::cout << "words: " << words << " -> " << compact_ptr->size() << "\n"
+		<< "snapshot bytes: " << full_size << " -> " << compact_size << " (" << pct(compact_size, full_size) << "%)\n"
+		<< "cost step: " << compact_ptr->cost_step_ << " bits\n"
+		<< "sample lines changed: " << changed_lines << "/" << lines << " (" << pct(changed_lines, lines) << "%)\n"
+		<< "sample word boundaries lost: " << changed_boundaries << "/" << boundaries << " (" << pct(changed_boundaries, boundaries) << "%)\n";
+	std::flush(std::cout);
+}
+
+void dump_compact_dict_snapshot(const char *snapshot_filename) {
+	using fastcws::suspendable_region::managed_region;
+
+	std::ifstream ifs{snapshot_filename, std::ios::binary};
+	assert(ifs.good());
+	fastcws::defaults::snapshot_header::check(ifs, fastcws::defaults::snapshot_kind::compact_dict);
+	auto reg = managed_region<seat_dict>::recover(ifs);
+	ifs.close();
+	using compact_dict_type = fastcws::defaults::custom_compact_dict_in<decltype(reg)>;
+
+	auto compact_ptr = reg.retrieve_ptr<compact_dict_type>(dict_ptr_tag);
+	save_dict(*compact_ptr, std::cout);
+	std::flush(std::cout);
+}
+
+void save_compact_model(const char* model_filename, const char* compact_filename, unsigned bits) {
+	std::ifstream ifs{model_filename};
+	assert(ifs.good());
+	const auto model = fastcws::hmm::wseg_4tag::load(ifs);
+	std::ofstream ofs{compact_filename, std::ios::binary};
+	assert(ofs.good());
+	fastcws::hmm::wseg_4tag::save_compact(model, ofs, bits);
+}
+
+void save_hmm_model_snapshot(const char* model_filename, const char* snapshot_filename, bool compiled=false) {
 	namespace suspendable_region = fastcws::suspendable_region;
 	using fastcws::suspendable_region::managed_region;
 
 	managed_region<seat_model> reg{max_snapshot_size};
-	using int_allocator = suspendable_region::allocator<int, decltype(reg)>;
-	using model_type = fastcws::hmm::wseg_4tag::model<fastcws::hmm::basic_normalizer<uint64_t, double>, int_allocator>;
+	using model_type = fastcws::defaults::custom_hmm_model_in<decltype(reg)>;
 	auto model_alloc = suspendable_region::allocator_of(reg).get<model_type>();
 	using alloc_traits = std::allocator_traits<decltype(model_alloc)>;
 
@@ -79,6 +227,9 @@ void save_hmm_model_snapshot(const char* model_filename, const char* snapshot_fi
 	{
 		std::ofstream ofs{snapshot_filename, std::ios::binary};
 		assert(ofs.good());
+		if (compiled) {
+			fastcws::defaults::snapshot_header::of(fastcws::defaults::snapshot_kind::hmm_model).write(ofs);
+		}
 		reg.suspend(ofs);
 	}
 }
@@ -154,13 +305,45 @@ int main(int argc, char** argv) {
 	std::string_view command{argv[1]};
 	if (command == "save_dict_snapshot") {
 		assert(argc > 3);
-		save_dict_snapshot(argv[2], argv[3]);
+		save_dict_snapshot(argv[2], argv[3], (argc > 4) ? argv[4] : nullptr);
 	} else if (command == "dump_dict_snapshot") {
 		assert(argc > 2);
 		dump_dict_snapshot(argv[2]);
+	} else if (command == "dump_unmatched_words") {
+		assert(argc > 3);
+		dump_unmatched_words(argv[2], argv[3]);
+	} else if (command == "compact_dict_snapshot") {
+		// compact_dict_snapshot <dict> <snapshot> <sample corpus> [min freq] [coverage] [cost bits]
+		assert(argc > 4);
+		fastcws::freq_dict::compact_options opt;
+		if (argc > 5) {
+			opt.min_freq = std::stoull(argv[5]);
+		}
+		if (argc > 6) {
+			opt.coverage = std::stod(argv[6]);
+		}
+		if (argc > 7) {
+			opt.cost_bits = static_cast<unsigned>(std::stoul(argv[7]));
+		}
+		compact_dict_snapshot(argv[2], argv[3], argv[4], opt);
+	} else if (command == "dump_compact_dict_snapshot") {
+		assert(argc > 2);
+		dump_compact_dict_snapshot(argv[2]);
 	} else if (command == "save_hmm_model_snapshot") {
 		assert(argc > 3);
 		save_hmm_model_snapshot(argv[2], argv[3]);
+	} else if (command == "compile_dict") {
+		// compile_dict <dict> <compiled dict> [sample corpus]
+		assert(argc > 3);
+		save_dict_snapshot(argv[2], argv[3], (argc > 4) ? argv[4] : nullptr, true);
+	} else if (command == "compile_model") {
+		// compile_model <model> <compiled model>
+		assert(argc > 3);
+		save_hmm_model_snapshot(argv[2], argv[3], true);
+	} else if (command == "compact_model") {
+		// compact_model <model> <compact model> [bits]
+		assert(argc > 3);
+		save_compact_model(argv[2], argv[3], (argc > 4) ? static_cast<unsigned>(std::stoul(argv[4])) : 32);
 	} else if (command == "snapshot2hpp") {
 		assert(argc > 4);
 		snapshot2hpp(argv[2], argv[3], argv[4]);
@@ -4,6 +4,11 @@
 #include <iostream>
 #include <vector>
 #include <tuple>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 
 #include "fastcws/aho_corasick.hpp"
 
@@ -99,3 +104,317 @@ TEST(double_array_trie, build) {
 	**/
 }
 
+
+TEST(double_array_trie, build_from_sorted) {
+	using namespace fastcws;
+
+	std::vector<std::string_view> words = {"he", "hers", "his", "i", "i", "she"};
+	aho_corasick::double_array_trie dat;
+	dat.build_from_sorted(words.cbegin(), words.cend(), [](std::string_view w) { return w; }, true);
+
+	std::string to_scan = "ushersheishis";
+	std::vector<std::tuple<size_t, size_t>> matches;
+	auto matched = [to_scan, &matches](size_t end_pos, std::string_view found){
+		matches.emplace_back(end_pos - found.size(), found.size());
+	};
+	dat.scan(to_scan, matched);
+
+	std::vector<std::tuple<size_t, size_t>> expected_matches;
+	expected_matches.emplace_back(1, 3);
+	expected_matches.emplace_back(2, 2);
+	expected_matches.emplace_back(2, 4);
+	expected_matches.emplace_back(5, 3);
+	expected_matches.emplace_back(6, 2);
+	expected_matches.emplace_back(8, 1);
+	expected_matches.emplace_back(11, 1);
+	expected_matches.emplace_back(10, 3);
+
+	EXPECT_EQ(matches, expected_matches);
+}
+
+TEST(double_array_trie, lookups) {
+	using namespace fastcws;
+
+	std::vector<std::string_view> words = {"he", "hers", "his", "i", "i", "in", "inn", "she"};
+	aho_corasick::double_array_trie dat;
+	dat.build_from_sorted(words.cbegin(), words.cend(), [](std::string_view w) { return w; }, true);
+	constexpr size_t not_found = aho_corasick::double_array_trie<>::not_found;
+
+	EXPECT_EQ(dat.exact_match("he"), 0);
+	EXPECT_EQ(dat.exact_match("hers"), 1);
+	EXPECT_EQ(dat.exact_match("i"), 3);
+	EXPECT_EQ(dat.exact_match("she"), 7);
+	EXPECT_EQ(dat.exact_match("h"), not_found);
+	EXPECT_EQ(dat.exact_match("her"), not_found);
+	EXPECT_EQ(dat.exact_match("e"), not_found); // reached through a fail link only
+	EXPECT_EQ(dat.exact_match("herself"), not_found);
+	EXPECT_EQ(dat.exact_match(""), not_found);
+
+	std::vector<std::pair<size_t, size_t>> prefixes;
+	dat.common_prefix_search("innate", [&prefixes](size_t length, size_t id) {
+		prefixes.emplace_back(length, id);
+	});
+	EXPECT_EQ(prefixes, (std::vector<std::pair<size_t, size_t>>{{1, 3}, {2, 5}, {3, 6}}));
+	prefixes.clear();
+	dat.common_prefix_search("sh", [&prefixes](size_t length, size_t id) {
+		prefixes.emplace_back(length, id);
+	});
+	EXPECT_TRUE(prefixes.empty());
+
+	std::vector<std::pair<std::string_view, size_t>> predicted;
+	auto collect = [&predicted](std::string_view word, size_t id) {
+		predicted.emplace_back(word, id);
+	};
+	EXPECT_EQ(dat.predictive_search("h", collect), 3);
+	EXPECT_EQ(predicted, (std::vector<std::pair<std::string_view, size_t>>{{"he", 0}, {"hers", 1}, {"his", 2}}));
+	predicted.clear();
+	EXPECT_EQ(dat.predictive_search("", collect, 4), 4);
+	EXPECT_EQ(predicted, (std::vector<std::pair<std::string_view, size_t>>{{"he", 0}, {"hers", 1}, {"his", 2}, {"i", 3}}));
+	predicted.clear();
+	EXPECT_EQ(dat.predictive_search("x", collect), 0);
+	EXPECT_EQ(dat.predictive_search("in", collect, 0), 0);
+	EXPECT_TRUE(predicted.empty());
+}
+
+// the 4G unit limit of uint32_t is out of reach for a unit test, so a 16-bit offset stands in for it
+TEST(double_array_trie, offset_overflow) {
+	using namespace fastcws;
+
+	std::vector<std::string> words;
+	std::mt19937 rng{42};
+	for (size_t i = 0; i < 30000; i++) {
+		std::string word;
+		for (size_t j = 0; j < 6; j++) {
+			word.push_back(static_cast<char>('a' + rng() % 26));
+		}
+		words.push_back(std::move(word));
+	}
+	std::sort(words.begin(), words.end());
+	auto word_of = [](const std::string& w) { return std::string_view{w}; };
+
+	aho_corasick::double_array_trie<std::allocator<int>, uint16_t> narrow;
+	EXPECT_THROW(narrow.build_from_sorted(words.cbegin(), words.cend(), word_of, true), std::overflow_error);
+
+	aho_corasick::double_array_trie<std::allocator<int>, uint64_t> wide;
+	wide.build_from_sorted(words.cbegin(), words.cend(), word_of, true);
+	EXPECT_GT(wide.units_.size(), std::numeric_limits<uint16_t>::max());
+
+	size_t num_matches = 0;
+	std::string to_scan = words[12345];
+	wide.scan(to_scan, [&num_matches, &to_scan](size_t end_pos, std::string_view found) {
+		EXPECT_EQ(end_pos, to_scan.size());
+		EXPECT_EQ(found, to_scan);
+		num_matches++;
+	});
+	EXPECT_EQ(num_matches, 1);
+}
+
+TEST(double_array_trie, profile_guided_layout) {
+	using namespace fastcws;
+
+	std::vector<std::string> words;
+	std::mt19937 rng{42};
+	for (size_t i = 0; i < 3000; i++) {
+		std::string word;
+		size_t len = 2 + rng() % 4;
+		for (size_t j = 0; j < len; j++) {
+			word.push_back(static_cast<char>('a' + rng() % 26));
+		}
+		words.push_back(std::move(word));
+	}
+	words.push_back("zzzzzzzz");
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+	auto word_of = [](const std::string& w) { return std::string_view{w}; };
+
+	aho_corasick::double_array_trie<> dat;
+	dat.build_from_sorted(words.cbegin(), words.cend(), word_of, true);
+
+	std::string sample = "zzzzzzzz-zzzzzzzz-zzzzzzzz";
+	auto prof = dat.make_profile();
+	dat.record(sample, prof);
+
+	std::vector<std::string> unmatched;
+	dat.for_each_unmatched(prof, [&unmatched](std::string_view word) {
+		unmatched.emplace_back(word);
+	});
+	EXPECT_EQ(std::count(unmatched.begin(), unmatched.end(), "zzzzzzzz"), 0);
+	EXPECT_EQ(std::count(unmatched.begin(), unmatched.end(), "zz"), 0); // if present, it is matched too
+	EXPECT_GT(unmatched.size(), words.size() / 2);
+
+	aho_corasick::double_array_trie<> relaid;
+	relaid.build_from_sorted(words.cbegin(), words.cend(), word_of, dat, prof, true);
+
+	// the hot path is laid out before anything else
+	size_t status = 0;
+	for (char ch : std::string_view{"zzzzzzzz"}) {
+		status = relaid._child(status, static_cast<uint8_t>(ch));
+		ASSERT_NE(status, relaid.not_found);
+		EXPECT_LT(status, 0x100 * 9);
+	}
+
+	std::string to_scan;
+	for (size_t i = 0; i < 2000; i++) {
+		to_scan.push_back(static_cast<char>('a' + rng() % 27));
+	}
+	std::vector<std::tuple<size_t, std::string>> before, after;
+	dat.scan(to_scan, [&before](size_t end_pos, std::string_view found) {
+		before.emplace_back(end_pos, found);
+	});
+	relaid.scan(to_scan, [&after](size_t end_pos, std::string_view found) {
+		after.emplace_back(end_pos, found);
+	});
+	std::sort(before.begin(), before.end());
+	std::sort(after.begin(), after.end());
+	EXPECT_FALSE(before.empty());
+	EXPECT_EQ(before, after);
+}
+
+TEST(dynamic_double_array_trie, scan) {
+	using namespace fastcws;
+
+	aho_corasick::dynamic_double_array_trie<> dat;
+	dat.insert("i", 1);
+	dat.insert("he", 2);
+	dat.insert("his", 3);
+	dat.insert("she", 4);
+	dat.insert("hers", 5);
+	dat.insert("ushe", 6);
+	dat.erase("ushe");
+
+	std::string to_scan = "ushersheishis";
+	std::vector<std::tuple<size_t, size_t>> matches;
+	auto matched = [to_scan, &matches](size_t end_pos, std::string_view found){
+		matches.emplace_back(end_pos - found.size(), found.size());
+	};
+	dat.scan(to_scan, matched);
+	std::sort(matches.begin(), matches.end());
+
+	std::vector<std::tuple<size_t, size_t>> expected_matches;
+	expected_matches.emplace_back(1, 3);
+	expected_matches.emplace_back(2, 2);
+	expected_matches.emplace_back(2, 4);
+	expected_matches.emplace_back(5, 3);
+	expected_matches.emplace_back(6, 2);
+	expected_matches.emplace_back(8, 1);
+	expected_matches.emplace_back(10, 3);
+	expected_matches.emplace_back(11, 1);
+
+	EXPECT_EQ(matches, expected_matches);
+	dat.scan_values(to_scan, [&dat](size_t end_pos, std::string_view found, uint64_t value) {
+		(void)end_pos;
+		EXPECT_EQ(value, *dat.find(found));
+	});
+	EXPECT_EQ(*dat.find("hers"), 5);
+	EXPECT_EQ(dat.find("ushe"), nullptr);
+	EXPECT_EQ(dat.find("her"), nullptr);
+}
+
+TEST(dynamic_double_array_trie, insert_and_erase) {
+	using namespace fastcws;
+
+	aho_corasick::dynamic_double_array_trie<> dat;
+	std::map<std::string, uint64_t> expected;
+	std::mt19937 rng{42};
+	for (size_t i = 0; i < 20000; i++) {
+		std::string key;
+		size_t len = 1 + rng() % 6;
+		for (size_t j = 0; j < len; j++) {
+			key.push_back(static_cast<char>(1 + rng() % ((j == 0) ? 255 : 8)));
+		}
+		if (rng() % 3 == 0) {
+			EXPECT_EQ(dat.erase(key), expected.erase(key) == 1);
+		} else {
+			EXPECT_EQ(dat.insert(key, i), expected.count(key) == 0);
+			expected[key] = i;
+		}
+	}
+
+	EXPECT_EQ(dat.size(), expected.size());
+	std::map<std::string, uint64_t> visited;
+	dat.for_each([&visited](std::string_view key, uint64_t value) {
+		visited.emplace(std::string{key}, value);
+	});
+	EXPECT_EQ(visited, expected);
+	for (const auto& [key, value] : expected) {
+		ASSERT_NE(dat.find(key), nullptr);
+		EXPECT_EQ(*dat.find(key), value);
+	}
+}
+
+TEST(louds_trie, scan) {
+	using namespace fastcws;
+
+	std::vector<std::pair<std::string, uint64_t>> words{
+		{"he", 2}, {"hers", 5}, {"his", 3}, {"i", 1}, {"she", 4}, {"she", 7},
+	};
+	aho_corasick::louds_trie<> trie;
+	trie.build_from_sorted(words.cbegin(), words.cend(), [](const auto& w) {
+		return std::string_view{w.first};
+	}, [](const auto& w) {
+		return w.second;
+	}, true);
+
+	std::string to_scan = "ushersheishis";
+	std::vector<std::tuple<size_t, size_t>> matches;
+	auto matched = [to_scan, &matches](size_t end_pos, std::string_view found){
+		matches.emplace_back(end_pos - found.size(), found.size());
+	};
+	trie.scan(to_scan, matched);
+	std::sort(matches.begin(), matches.end());
+
+	std::vector<std::tuple<size_t, size_t>> expected_matches;
+	expected_matches.emplace_back(1, 3);
+	expected_matches.emplace_back(2, 2);
+	expected_matches.emplace_back(2, 4);
+	expected_matches.emplace_back(5, 3);
+	expected_matches.emplace_back(6, 2);
+	expected_matches.emplace_back(8, 1);
+	expected_matches.emplace_back(10, 3);
+	expected_matches.emplace_back(11, 1);
+
+	EXPECT_EQ(matches, expected_matches);
+	trie.scan_values(to_scan, [&trie](size_t end_pos, std::string_view found, uint64_t value) {
+		(void)end_pos;
+		EXPECT_EQ(value, *trie.find(found));
+	});
+	EXPECT_EQ(trie.size(), 5);
+	EXPECT_EQ(*trie.find("hers"), 5);
+	EXPECT_EQ(*trie.find("she"), 4);
+	EXPECT_EQ(trie.find("her"), nullptr);
+	EXPECT_EQ(trie.find("hersh"), nullptr);
+}
+
+TEST(louds_trie, find_and_for_each) {
+	using namespace fastcws;
+
+	std::map<std::string, uint64_t> expected;
+	std::mt19937 rng{42};
+	for (size_t i = 0; i < 20000; i++) {
+		std::string key;
+		size_t len = 1 + rng() % 8;
+		for (size_t j = 0; j < len; j++) {
+			key.push_back(static_cast<char>(1 + rng() % ((j == 0) ? 255 : 4)));
+		}
+		expected.emplace(key, i);
+	}
+
+	aho_corasick::louds_trie<> trie;
+	trie.build_from_sorted(expected.cbegin(), expected.cend(), [](const auto& kv) {
+		return std::string_view{kv.first};
+	}, [](const auto& kv) {
+		return kv.second;
+	}, true);
+
+	EXPECT_EQ(trie.size(), expected.size());
+	std::map<std::string, uint64_t> visited;
+	trie.for_each([&visited](std::string_view key, uint64_t value) {
+		visited.emplace(std::string{key}, value);
+	});
+	EXPECT_EQ(visited, expected);
+	for (const auto& [key, value] : expected) {
+		ASSERT_NE(trie.find(key), nullptr);
+		EXPECT_EQ(*trie.find(key), value);
+		EXPECT_EQ(trie.find(key + '\x09'), nullptr);
+	}
+}
@@ -3,6 +3,9 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
 
 #include "fastcws/freq_dict.hpp"
 #include "fastcws/word_dag.hpp"
@@ -24,3 +27,462 @@ TEST(dict, load_and_build_dag) {
 	EXPECT_EQ(dag.adjacents(21).count(27), 1);
 }
 
+
+TEST(dict, double_array_trie) {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array> d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("最终的", 5);
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	d.add_edges(dag);
+
+	EXPECT_EQ(dag.adjacents(3).count(9), 1);
+	EXPECT_EQ(dag.adjacents(12).count(18), 1);
+	EXPECT_EQ(dag.adjacents(12).count(21), 1);
+	EXPECT_EQ(dag.adjacents(21).count(27), 1);
+}
+
+TEST(dict, double_array_trie_64bit_offset) {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array, uint64_t> d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("果实", 10);
+	d.finalize(true);
+	static_assert(sizeof(d.trie_holder_.dat_.units_[0]) == 4 * sizeof(uint64_t));
+
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	d.add_edges(dag);
+
+	EXPECT_EQ(dag.adjacents(3).count(9), 1);
+	EXPECT_EQ(dag.adjacents(12).count(18), 1);
+	EXPECT_EQ(dag.adjacents(21).count(27), 1);
+}
+
+TEST(dict, lookups) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 20);
+	d.add_word("最终的", 5);
+	d.add_word("果实", 30);
+	d.finalize(true);
+
+	size_t id = d.exact_match("最终");
+	ASSERT_NE(id, dict_type::not_found);
+	EXPECT_EQ(d.word_at(id), "最终");
+	EXPECT_EQ(d.freq_at(id), 20);
+	EXPECT_EQ(d.exact_match("最"), dict_type::not_found);
+
+	std::vector<std::pair<size_t, uint64_t>> prefixes;
+	d.common_prefix_search("最终的果实", [&prefixes](size_t length, size_t id, uint64_t freq) {
+		(void)id;
+		prefixes.emplace_back(length, freq);
+	});
+	EXPECT_EQ(prefixes, (std::vector<std::pair<size_t, uint64_t>>{{6, 20}, {9, 5}}));
+
+	std::vector<std::string_view> predicted;
+	EXPECT_EQ(d.predictive_search("最", [&d, &predicted](std::string_view word, size_t id, uint64_t freq) {
+		EXPECT_EQ(d.word_at(id), word);
+		EXPECT_EQ(d.freq_at(id), freq);
+		predicted.push_back(word);
+	}), 2);
+	EXPECT_EQ(predicted, (std::vector<std::string_view>{"最终", "最终的"}));
+}
+
+template <fastcws::freq_dict::trie_backend Backend>
+void expect_absent_words_have_no_freq() {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, Backend> d{};
+	d.add_word("b", 10);
+	d.add_word("d", 20);
+	d.add_word("f", 30);
+	d.finalize(true);
+
+	EXPECT_EQ(d.get_freq("b"), 10);
+	EXPECT_EQ(d.get_freq("d"), 20);
+	EXPECT_EQ(d.get_freq("f"), 30);
+	// before, between & after the entries, and a prefix & an extension of one
+	EXPECT_EQ(d.get_freq("a"), 0);
+	EXPECT_EQ(d.get_freq("c"), 0);
+	EXPECT_EQ(d.get_freq("e"), 0);
+	EXPECT_EQ(d.get_freq("g"), 0);
+	EXPECT_EQ(d.get_freq("dd"), 0);
+	EXPECT_EQ(d.get_freq(""), 0);
+}
+
+TEST(dict, get_freq_of_absent_words) {
+	expect_absent_words_have_no_freq<fastcws::freq_dict::trie_backend::trie>();
+	expect_absent_words_have_no_freq<fastcws::freq_dict::trie_backend::double_array>();
+}
+
+TEST(dict, profile_guided_layout) {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array> d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("最终的", 5);
+	d.add_word("果实", 10);
+	d.add_word("春风", 10);
+	d.finalize(true);
+
+	auto prof = d.make_profile();
+	d.record_profile("而雪花是最终的果实", prof);
+
+	std::vector<std::string> unmatched;
+	d.for_each_unmatched_word(prof, [&unmatched](std::string_view word) {
+		unmatched.emplace_back(word);
+	});
+	EXPECT_EQ(unmatched, std::vector<std::string>{"春风"});
+
+	d.relayout(prof, true);
+
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	d.add_edges(dag);
+
+	EXPECT_EQ(dag.adjacents(3).count(9), 1);
+	EXPECT_EQ(dag.adjacents(12).count(18), 1);
+	EXPECT_EQ(dag.adjacents(12).count(21), 1);
+	EXPECT_EQ(dag.adjacents(21).count(27), 1);
+}
+
+TEST(dict, dynamic_double_array_trie) {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::dynamic_double_array> d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	d.add_word("最终的", 5);
+	d.add_word("雪花", 20);
+	d.erase_word("果实");
+	EXPECT_EQ(d.total_, 35);
+	EXPECT_EQ(d.get_freq("雪花"), 20);
+
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	d.add_edges(dag);
+
+	EXPECT_EQ(dag.adjacents(3).count(9), 1);
+	EXPECT_EQ(dag.adjacents(12).count(18), 1);
+	EXPECT_EQ(dag.adjacents(12).count(21), 1);
+	EXPECT_EQ(dag.adjacents(21).count(27), 0);
+}
+
+TEST(dict, louds) {
+	using namespace fastcws;
+
+	freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::louds> d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("最终的", 5);
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	EXPECT_TRUE(d.freq_.empty());
+	EXPECT_EQ(d.get_freq("最终的"), 5);
+	EXPECT_EQ(d.get_freq("最"), 0);
+
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	d.add_edges(dag);
+
+	EXPECT_EQ(dag.adjacents(3).count(9), 1);
+	EXPECT_EQ(dag.adjacents(12).count(18), 1);
+	EXPECT_EQ(dag.adjacents(12).count(21), 1);
+	EXPECT_EQ(dag.adjacents(21).count(27), 1);
+}
+
+TEST(dict, load_dict_text) {
+	using namespace fastcws;
+
+	std::string text = "雪花 10 n\r\n\n最终\t20\n  果实 30 n extra\n";
+	// big enough to be split among threads
+	for (size_t i = 0; i < 50000; i++) {
+		text += "w" + std::to_string(i) + " " + std::to_string(i + 1) + " x\n";
+	}
+	text += "last 7";
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type parallel{};
+	freq_dict::load_dict_text(text, parallel, 4);
+	dict_type streamed{};
+	std::istringstream iss{text};
+	freq_dict::load_dict(iss, streamed);
+
+	EXPECT_EQ(parallel.freq_.size(), 50004);
+	EXPECT_EQ(parallel.total_, streamed.total_);
+	EXPECT_EQ(parallel.freq_, streamed.freq_);
+	EXPECT_EQ(parallel.get_freq("雪花"), 10);
+	EXPECT_EQ(parallel.get_freq("最终"), 20);
+	EXPECT_EQ(parallel.get_freq("果实"), 30);
+	EXPECT_EQ(parallel.get_freq("w49999"), 50000);
+	EXPECT_EQ(parallel.get_freq("last"), 7);
+
+	dict_type bad{};
+	EXPECT_THROW(freq_dict::load_dict_text(std::string_view{"雪花 10\n最终\n"}, bad, 1), std::invalid_argument);
+	EXPECT_THROW(freq_dict::load_dict_file("/nonexistent/freq_dict.txt", bad), std::system_error);
+}
+
+TEST(dict, layered) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type base{};
+	base.add_word("雪花", 10);
+	base.add_word("最终", 10);
+	base.add_word("果实", 10);
+	base.add_word("是", 100);
+	base.finalize(true);
+
+	dict_type overlay{};
+	overlay.add_word("花是", 1000);
+	overlay.add_word("最终的果实", 1);
+	overlay.finalize(true);
+
+	dict_type demote{};
+	demote.add_word("果实", 1);
+	demote.finalize(true);
+
+	using weight_t = word_dag::dag<>::weight_t;
+	auto weight_of = [](const word_dag::dag<>& dag, size_t from, size_t to) -> weight_t {
+		auto it = dag.adjacents(from).find(to);
+		return (it == dag.adjacents(from).end()) ? -1 : it->second;
+	};
+
+	// base alone gives the same edges as the dict
+	freq_dict::layered_dict<dict_type> only_base{base};
+	word_dag::dag<> expected{"而雪花是最终的果实"};
+	base.add_edges(expected);
+	word_dag::dag<> dag{"而雪花是最终的果实"};
+	only_base.add_edges(dag);
+	EXPECT_EQ(dag.adjacents_, expected.adjacents_);
+
+	freq_dict::layered_dict<dict_type> layered{base};
+	layered.add_layer(overlay, freq_dict::layer_rule{-1.0, false});
+	layered.add_layer(demote, freq_dict::layer_rule{0.0, true});
+	EXPECT_EQ(layered.num_layers(), 3);
+	EXPECT_EQ(layered.suggest_single_rune_weight<word_dag::dag<>>(), base.suggest_single_rune_weight<word_dag::dag<>>());
+
+	word_dag::dag<> layered_dag{"而雪花是最终的果实"};
+	layered.add_edges(layered_dag);
+	const weight_t log2_total = calc_log2<weight_t>::log2(base.total_);
+	EXPECT_EQ(weight_of(layered_dag, 3, 9), weight_of(expected, 3, 9));
+	EXPECT_EQ(weight_of(layered_dag, 6, 12), log2_total - calc_log2<weight_t>::log2(1000) - 1);
+	EXPECT_EQ(weight_of(layered_dag, 12, 27), log2_total - calc_log2<weight_t>::log2(1) - 1);
+	// overridden, although the base weight is lower
+	EXPECT_EQ(weight_of(layered_dag, 21, 27), log2_total - calc_log2<weight_t>::log2(1));
+	EXPECT_GT(weight_of(layered_dag, 21, 27), weight_of(expected, 21, 27));
+}
+
+TEST(dict, ephemeral_words) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type base{};
+	base.add_word("雪花", 10);
+	base.add_word("最终", 10);
+	base.add_word("果实", 10);
+	base.add_word("是", 100);
+	base.finalize(true);
+
+	using weight_t = word_dag::dag<>::weight_t;
+	auto weight_of = [](const word_dag::dag<>& dag, size_t from, size_t to) -> weight_t {
+		auto it = dag.adjacents(from).find(to);
+		return (it == dag.adjacents(from).end()) ? -1 : it->second;
+	};
+	const weight_t log2_total = calc_log2<weight_t>::log2(base.total_);
+	const std::string sentence = "而雪花是最终的果实，雪花是";
+
+	freq_dict::ephemeral_words<> none;
+	none.finalize();
+	word_dag::dag<> expected{sentence};
+	base.add_edges(expected);
+	word_dag::dag<> dag{sentence};
+	freq_dict::ephemeral_dict<dict_type>{base, none}.add_edges(dag);
+	EXPECT_EQ(dag.adjacents_, expected.adjacents_);
+
+	// the words, which match the same either way, then enough fillers to compile an automaton
+	std::vector<std::string> fillers;
+	for (size_t i = 0; i < freq_dict::ephemeral_words<>::small_set_size; i++) {
+		fillers.push_back("填充" + std::to_string(i));
+	}
+	for (bool large : {false, true}) {
+		freq_dict::ephemeral_words<> words;
+		words.add_word("雪花是");
+		words.add_word("的果", 1);
+		words.add_word("的果", 20); // the most frequent duplicate wins
+		words.add_word("最终", 1000);
+		words.add_word("果子", 0); // ignored
+		if (large) {
+			for (const auto& filler : fillers) {
+				words.add_word(filler, 1);
+			}
+		}
+		words.finalize();
+		EXPECT_EQ(words.size(), large ? (3 + fillers.size()) : 3);
+
+		word_dag::dag<> ephemeral_dag{sentence};
+		freq_dict::ephemeral_dict<dict_type>{base, words}.add_edges(ephemeral_dag);
+		EXPECT_EQ(weight_of(ephemeral_dag, 3, 12), 0);
+		EXPECT_EQ(weight_of(ephemeral_dag, 30, 39), 0);
+		EXPECT_EQ(weight_of(ephemeral_dag, 18, 24), log2_total - calc_log2<weight_t>::log2(20));
+		// lower than the one of the dict, which is kept otherwise
+		EXPECT_EQ(weight_of(ephemeral_dag, 12, 18), 0);
+		EXPECT_EQ(weight_of(ephemeral_dag, 3, 9), weight_of(expected, 3, 9));
+		EXPECT_EQ(weight_of(ephemeral_dag, 24, 27), -1);
+	}
+}
+
+namespace {
+
+// part of speech, entity type & stop word flag, from `word freq pos entity stop` lines
+struct word_info {
+	fastcws::freq_dict::pos_tag pos;
+	char entity = '-';
+	bool stop = false;
+
+	static word_info from_columns(std::string_view columns) {
+		word_info ret;
+		ret.pos = fastcws::freq_dict::pos_tag::from_columns(columns);
+		std::istringstream iss{std::string{columns}};
+		std::string pos, entity;
+		int stop = 0;
+		iss >> pos >> entity >> stop;
+		ret.entity = entity.empty() ? '-' : entity[0];
+		ret.stop = (stop != 0);
+		return ret;
+	}
+};
+
+}
+
+TEST(dict, attributes) {
+	using namespace fastcws;
+
+	std::string text = "最终 20 d - 0\n的 1000 uj - 1\n雪花 10 n\n北京 30 ns L 0\n";
+	for (size_t i = 0; i < 50000; i++) {
+		text += "w" + std::to_string(i) + " 1 eng\n";
+	}
+
+	using dat_dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>,
+		freq_dict::trie_backend::double_array, uint32_t, word_info>;
+	dat_dict_type d{};
+	freq_dict::load_dict_text(text, d, 4);
+	using trie_dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>,
+		freq_dict::trie_backend::trie, uint32_t, word_info>;
+	trie_dict_type t{};
+	std::istringstream iss{text};
+	freq_dict::load_dict(iss, t);
+
+	auto check = [](const auto& dict) {
+		const word_info* info = dict.find_attributes("北京");
+		ASSERT_NE(info, nullptr);
+		EXPECT_EQ(info->pos.view(), "ns");
+		EXPECT_EQ(info->entity, 'L');
+		EXPECT_FALSE(info->stop);
+		info = dict.find_attributes("的");
+		ASSERT_NE(info, nullptr);
+		EXPECT_EQ(info->pos.view(), "uj");
+		EXPECT_TRUE(info->stop);
+		info = dict.find_attributes("雪花");
+		ASSERT_NE(info, nullptr);
+		EXPECT_EQ(info->pos.view(), "n");
+		EXPECT_EQ(info->entity, '-');
+		info = dict.find_attributes("w12345");
+		ASSERT_NE(info, nullptr);
+		EXPECT_EQ(info->pos.view(), "eng");
+		EXPECT_EQ(dict.find_attributes("北"), nullptr);
+		EXPECT_EQ(dict.find_attributes("w123456"), nullptr);
+	};
+	check(d);
+	check(t);
+
+	// attributes follow the words through the sort of finalize()
+	d.for_each_word([&d](std::string_view word, uint64_t freq) {
+		(void)freq;
+		size_t id = d.exact_match(word);
+		ASSERT_NE(id, dat_dict_type::not_found);
+		EXPECT_EQ(&d.attributes_at(id), d.find_attributes(word));
+	});
+	EXPECT_EQ(d.attributes_at(d.exact_match("最终")).pos.view(), "d");
+
+	using pos_dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>,
+		freq_dict::trie_backend::double_array, uint32_t, freq_dict::pos_tag>;
+	pos_dict_type p{};
+	p.add_word("雪花", 10, freq_dict::pos_tag::from_columns("n"));
+	p.add_word("果实", 10);
+	p.finalize(true);
+	EXPECT_EQ(p.find_attributes("雪花")->view(), "n");
+	EXPECT_EQ(p.find_attributes("果实")->view(), "");
+}
+
+TEST(dict, compact) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("最终的", 5);
+	d.add_word("果实", 10);
+	d.add_word("是", 100);
+	d.add_word("而", 1);
+	for (size_t i = 0; i < 100; i++) {
+		d.add_word("w" + std::to_string(i), 2);
+	}
+	d.finalize(true);
+
+	freq_dict::compact_dict<> c;
+	c.build_from(d);
+	EXPECT_EQ(c.size(), 106);
+
+	// same edges, weights within half a cost bucket
+	word_dag::dag<> expected{"而雪花是最终的果实w42"};
+	d.add_edges(expected);
+	word_dag::dag<> dag{"而雪花是最终的果实w42"};
+	c.add_edges(dag);
+	for (size_t from = 0; from < expected.adjacents_.size(); from++) {
+		ASSERT_EQ(dag.adjacents(from).size(), expected.adjacents(from).size());
+		for (auto [to, weight] : expected.adjacents(from)) {
+			ASSERT_EQ(dag.adjacents(from).count(to), 1);
+			EXPECT_NEAR(dag.adjacents(from).at(to), weight, c.cost_step_ / 2 + 1e-9);
+		}
+	}
+	EXPECT_EQ(c.suggest_single_rune_weight<word_dag::dag<>>(), d.suggest_single_rune_weight<word_dag::dag<>>());
+
+	// front coded words decode back across buckets
+	std::vector<std::pair<std::string, uint64_t>> words;
+	c.for_each_word([&words](std::string_view word, uint64_t freq) {
+		words.emplace_back(word, freq);
+	});
+	std::vector<std::pair<std::string, uint64_t>> expected_words;
+	d.for_each_word([&expected_words](std::string_view word, uint64_t freq) {
+		expected_words.emplace_back(word, freq);
+	});
+	EXPECT_EQ(words, expected_words);
+	EXPECT_EQ(c.get_freq("最终的"), 5);
+	EXPECT_EQ(c.exact_match("最"), freq_dict::compact_dict<>::not_found);
+
+	// pruned & quantized to 8 bits
+	freq_dict::compact_dict<std::allocator<int>, uint32_t, uint8_t> pruned;
+	pruned.build_from(d, freq_dict::compact_options{5, 1.0, 8});
+	EXPECT_EQ(pruned.size(), 5);
+	EXPECT_EQ(pruned.exact_match("而"), freq_dict::compact_dict<>::not_found);
+	EXPECT_NE(pruned.exact_match("最终的"), freq_dict::compact_dict<>::not_found);
+	// 是, 雪花, 最终, 果实 & 最终的 cover 135 of the total of 336
+	freq_dict::compact_dict<> covered;
+	covered.build_from(d, freq_dict::compact_options{0, 0.4, 16});
+	EXPECT_EQ(covered.size(), 5);
+	EXPECT_THROW(pruned.build_from(d, freq_dict::compact_options{0, 1.0, 9}), std::invalid_argument);
+}
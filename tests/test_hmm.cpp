@@ -0,0 +1,478 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sstream>
+#include <iterator>
+#include <utility>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include "fastcws/hmm.hpp"
+#include "fastcws/misc/rune_hopper.hpp"
+#include "fastcws/word_dag/dag.hpp"
+
+namespace {
+
+using fastcws::hmm::wseg_4tag::state;
+
+const std::vector<std::string> training_sentences{
+	"在 春风 吹拂 的 季节 翩翩起舞 。",
+	"而 雪花 是 最终 的 果实",
+	"我们 在 河边 看见 了 雪花 ， 还有 iPhone 15",
+	"春风 又 绿 江南 岸 ， 明月 何时 照 我 还 ？",
+	"季节 变换 ， 果实 成熟 了 。",
+};
+
+const std::vector<std::string> test_sentences{
+	"在春风吹拂的季节翩翩起舞。而雪花是最终的果实",
+	"明月照我还，江南的雪花",
+	"未见过的字龘也能切分",
+	"iPhone的果实",
+	"雪",
+};
+
+// splits space separated words into runes tagged B/M/E/S
+void tag_sentence(std::string_view sentence, std::vector<std::string>& runes, std::vector<state>& tags) {
+	std::istringstream iss{std::string{sentence}};
+	std::string word;
+	while (iss >> word) {
+		std::vector<std::string_view> word_runes;
+		fastcws::split_runes(std::string_view{word}, std::back_inserter(word_runes));
+		for (size_t i = 0; i < word_runes.size(); i++) {
+			runes.emplace_back(word_runes[i]);
+			if (word_runes.size() == 1) {
+				tags.push_back(state::S);
+			} else if (i == 0) {
+				tags.push_back(state::B);
+			} else if (i + 1 == word_runes.size()) {
+				tags.push_back(state::E);
+			} else {
+				tags.push_back(state::M);
+			}
+		}
+	}
+}
+
+template <class Model>
+void train(Model& model) {
+	for (const auto& sentence : training_sentences) {
+		std::vector<std::string> runes;
+		std::vector<state> tags;
+		tag_sentence(sentence, runes, tags);
+		model.train(runes.cbegin(), runes.cend(), tags.cbegin(), tags.cend());
+	}
+	model.normalize();
+}
+
+}
+
+TEST(hmm, emission_table) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	// one row per trained character, plus the one of unseen characters
+	EXPECT_EQ(model.emissions_.size(), model.characters_.size() + 1);
+	EXPECT_TRUE(model.normalized_.b.empty());
+	EXPECT_NE(model.emission_of(std::string_view{"春"}).row, 0);
+	EXPECT_NE(model.emission_of(std::string_view{"，"}).row, 0);
+	EXPECT_NE(model.emission_of(std::string_view{"i"}).row, 0);
+	EXPECT_EQ(model.emission_of(std::string_view{"龘"}).row, 0);
+	EXPECT_EQ(model.emission_of(std::string_view{"x"}).row, 0);
+
+	for (size_t s = 0; s < hmm::wseg_4tag::num_states; s++) {
+		const auto st = static_cast<state>(s);
+		EXPECT_DOUBLE_EQ(model.initial(st, model.emission_of(std::string_view{"龘"})),
+			model.normalized_.pi[s] - 2.0);
+	}
+}
+
+TEST(hmm, viterbi_matches_hashed_model) {
+	using namespace fastcws;
+
+	// the generic model keeps its emissions in a hash map keyed by the character
+	hmm::model<std::string, state, hmm::wseg_4tag::num_states> reference;
+	train(reference);
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	for (const auto& sentence : test_sentences) {
+		std::vector<std::string> runes;
+		std::vector<std::string_view> rune_views;
+		split_runes(std::string_view{sentence}, std::back_inserter(rune_views));
+		for (auto rune : rune_views) {
+			runes.emplace_back(rune);
+		}
+		std::vector<decltype(model)::emission_t> observed;
+		for (auto rune : rune_views) {
+			observed.push_back(model.emission_of(rune));
+		}
+
+		std::vector<state> expected(runes.size());
+		hmm::viterbi(reference, runes.cbegin(), runes.cend(), expected.begin());
+		std::vector<state> tags(runes.size());
+		hmm::viterbi(model, observed.cbegin(), observed.cend(), tags.begin());
+		EXPECT_EQ(tags, expected) << sentence;
+	}
+}
+
+TEST(hmm, viterbi_4state_matches_viterbi) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+	using emission_t = decltype(model)::emission_t;
+
+	// random sentences over every row, the one of unseen characters included
+	uint64_t rng = 7;
+	auto next = [&rng](size_t n) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		return static_cast<size_t>((rng >> 33) % n);
+	};
+	for (size_t round = 0; round < 2000; round++) {
+		std::vector<emission_t> observed(1 + next(64));
+		for (auto& obs : observed) {
+			obs.row = static_cast<uint32_t>(next(model.emissions_.size()));
+		}
+		std::vector<state> expected(observed.size());
+		hmm::viterbi(model, observed.cbegin(), observed.cend(), expected.begin());
+		std::vector<state> tags(observed.size());
+		model.decode(observed.data(), observed.size(), tags.data());
+		ASSERT_EQ(tags, expected) << "round " << round;
+	}
+}
+
+TEST(hmm, oov_only_decodes_uncovered_runs) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	const std::string_view sentence{"在春风吹拂的季节翩翩起舞。而雪花是最终的果实"};
+	auto base = [sentence]() {
+		word_dag::dag<> dag{sentence};
+		populate_rune_chain<rune_hopper::utf8_hopper>(dag, 32);
+		// 春风, 季节 & words overlapping over 花是最终的
+		dag.add_edge(3, 9, 8);
+		dag.add_edge(18, 24, 8);
+		dag.add_edge(45, 51, 8);
+		dag.add_edge(48, 57, 8);
+		dag.add_edge(54, 60, 8);
+		return dag;
+	};
+
+	auto dag = base();
+	hmm::wseg_4tag::oov_only<decltype(model)>{model}.add_edges<word_dag::dag<>, rune_hopper::utf8_hopper>(dag, 16);
+
+	// the same as decoding every uncovered run on its own
+	auto expected = base();
+	for (auto [begin, end] : {std::pair<size_t, size_t>{0, 3}, {9, 18}, {24, 45}, {60, 66}}) {
+		word_dag::dag<> run{sentence.substr(begin, end - begin)};
+		model.add_edges<word_dag::dag<>, rune_hopper::utf8_hopper>(run, 16);
+		for (size_t from = 0; from < end - begin; from++) {
+			for (auto [to, weight] : run.adjacents(from)) {
+				expected.add_edge(begin + from, begin + to, weight);
+			}
+		}
+	}
+	EXPECT_EQ(dag.adjacents_, expected.adjacents_);
+	EXPECT_EQ(dag.in_degree_, expected.in_degree_);
+}
+
+TEST(hmm, decode_batch_matches_decode) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+	using emission_t = decltype(model)::emission_t;
+
+	uint64_t rng = 11;
+	auto next = [&rng](size_t n) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		return static_cast<size_t>((rng >> 33) % n);
+	};
+	for (size_t round = 0; round < 200; round++) {
+		// batches of any size, some lanes idle, sequences empty or far longer than others
+		std::vector<std::vector<emission_t>> observed(next(20));
+		for (auto& sequence : observed) {
+			sequence.resize(next(4) == 0 ? next(100) : next(8));
+			for (auto& obs : sequence) {
+				obs.row = static_cast<uint32_t>(next(model.emissions_.size()));
+			}
+		}
+		std::vector<const emission_t*> pointers;
+		std::vector<size_t> sizes;
+		std::vector<std::vector<state>> tags;
+		for (const auto& sequence : observed) {
+			pointers.push_back(sequence.data());
+			sizes.push_back(sequence.size());
+			tags.emplace_back(sequence.size());
+		}
+		std::vector<state*> out;
+		for (auto& t : tags) {
+			out.push_back(t.data());
+		}
+		model.decode_batch(pointers.data(), sizes.data(), observed.size(), out.data());
+
+		for (size_t k = 0; k < observed.size(); k++) {
+			std::vector<state> expected(observed[k].size());
+			model.decode(observed[k].data(), observed[k].size(), expected.data());
+			ASSERT_EQ(tags[k], expected) << "round " << round << ", sequence " << k;
+		}
+	}
+}
+
+TEST(hmm, compact_model) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	double max_cost = 0;
+	for (const auto& row : model.emissions_) {
+		for (double p : row) {
+			if (std::isfinite(p)) {
+				max_cost = std::max(max_cost, -p);
+			}
+		}
+	}
+	for (unsigned bits : {32u, 16u, 8u}) {
+		std::ostringstream oss;
+		hmm::wseg_4tag::save_compact(model, oss, bits);
+		const std::string bytes = oss.str();
+		const hmm::wseg_4tag::compact_model compact{bytes};
+		ASSERT_EQ(compact.bits(), bits);
+		ASSERT_EQ(compact.rows(), model.emissions_.size());
+
+		for (const auto& sentence : test_sentences) {
+			std::vector<std::string_view> runes;
+			split_runes(std::string_view{sentence}, std::back_inserter(runes));
+			std::vector<hmm::wseg_4tag::emission_t> observed;
+			for (auto rune : runes) {
+				ASSERT_EQ(compact.emission_of(rune).row, model.emission_of(rune).row) << rune;
+				observed.push_back(model.emission_of(rune));
+			}
+			// quantized costs are off by half a step at most
+			const double half_step = (bits == 32) ? 0 : max_cost / ((1u << bits) - 2) / 2;
+			for (auto obs : observed) {
+				for (size_t s = 0; s < hmm::wseg_4tag::num_states; s++) {
+					const float expected = model._packed_rows()[obs.row][s];
+					const float got = compact._packed_rows()[obs.row][s];
+					if (std::isinf(expected) || (bits == 32)) {
+						EXPECT_EQ(got, expected);
+					} else {
+						EXPECT_NEAR(got, expected, half_step + 1e-4);
+					}
+				}
+			}
+			if (bits == 32) {
+				std::vector<state> expected(observed.size());
+				model.decode(observed.data(), observed.size(), expected.data());
+				std::vector<state> tags(observed.size());
+				compact.decode(observed.data(), observed.size(), tags.data());
+				EXPECT_EQ(tags, expected) << sentence;
+			}
+		}
+	}
+
+	std::ostringstream oss;
+	hmm::wseg_4tag::save_compact(model, oss);
+	std::string bytes = oss.str();
+	EXPECT_THROW(hmm::wseg_4tag::compact_model{std::string_view{bytes}.substr(0, bytes.size() - 1)}, std::invalid_argument);
+	bytes[0] = 'x';
+	EXPECT_THROW(hmm::wseg_4tag::compact_model{bytes}, std::invalid_argument);
+	EXPECT_THROW(hmm::wseg_4tag::save_compact(hmm::wseg_4tag::model<>{}, oss), std::invalid_argument);
+}
+
+TEST(hmm, compact_model_row_tables) {
+	using namespace fastcws;
+
+	// trains model on the training sentences, & on count code points from first as words of a single rune
+	auto train_with = [](hmm::wseg_4tag::model<>& model, uint32_t first, size_t count) {
+		std::vector<std::string> runes;
+		for (uint32_t cp = first; cp < first + count; cp++) {
+			std::string rune;
+			if (cp >= 0x10000) {
+				rune += static_cast<char>(0xf0 | (cp >> 18));
+				rune += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+			} else {
+				rune += static_cast<char>(0xe0 | (cp >> 12));
+			}
+			rune += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+			rune += static_cast<char>(0x80 | (cp & 0x3f));
+			runes.push_back(rune);
+		}
+		const std::vector<state> tags(runes.size(), state::S);
+		model.train(runes.cbegin(), runes.cend(), tags.cbegin(), tags.cend());
+		train(model);
+	};
+	const size_t dense_size = hmm::wseg_4tag::model<>::dense_last - hmm::wseg_4tag::model<>::dense_first + 1;
+
+	// the few ideographs of the training sentences are only in the sparse table
+	hmm::wseg_4tag::model<> sparse;
+	train(sparse);
+	std::ostringstream sparse_oss;
+	hmm::wseg_4tag::save_compact(sparse, sparse_oss);
+	EXPECT_LT(sparse_oss.str().size(), dense_size * sizeof(hmm::wseg_4tag::compact_row_t));
+
+	// most of the block is looked up by code point
+	hmm::wseg_4tag::model<> dense;
+	train_with(dense, 0x4e00, 12000);
+	std::ostringstream dense_oss;
+	hmm::wseg_4tag::save_compact(dense, dense_oss, 8);
+	const std::string bytes = dense_oss.str();
+	const hmm::wseg_4tag::compact_model compact{bytes};
+	EXPECT_LT(bytes.size(), dense.emissions_.size() * (sizeof(uint32_t) + sizeof(hmm::wseg_4tag::compact_row_t) + 4));
+	for (std::string_view rune : {"在", "龘", "一", "i", "？"}) {
+		EXPECT_EQ(compact.emission_of(rune).row, dense.emission_of(rune).row) << rune;
+	}
+	for (uint32_t cp = 0x4e00; cp < 0x4e00 + 12000; cp += 997) {
+		EXPECT_EQ(compact.emission_of_codepoint(cp).row, dense.emission_of_codepoint(cp).row) << cp;
+	}
+
+	// rows are 16 bits
+	hmm::wseg_4tag::model<> oversized;
+	train_with(oversized, 0x10000, 65536);
+	std::ostringstream oversized_oss;
+	EXPECT_THROW(hmm::wseg_4tag::save_compact(oversized, oversized_oss), std::invalid_argument);
+}
+
+TEST(hmm, train_corpus) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> expected;
+	train(expected);
+
+	// the training sentences in both formats, cut into many chunks counted by several threads
+	std::string tagged;
+	std::string tagged_crlf;
+	std::string segmented;
+	for (const auto& sentence : training_sentences) {
+		std::vector<std::string> runes;
+		std::vector<state> tags;
+		tag_sentence(sentence, runes, tags);
+		for (size_t i = 0; i < runes.size(); i++) {
+			tagged += runes[i] + " " + "BMES"[static_cast<size_t>(tags[i])] + "\n";
+			tagged_crlf += runes[i] + " " + "BMES"[static_cast<size_t>(tags[i])] + "\r\n";
+		}
+		tagged += "SENTENCE END\n";
+		tagged_crlf += "SENTENCE END\r\n";
+		segmented += sentence + "\r\n";
+	}
+	// CRLF files are cut at their sentence ends too, rather than counted as one chunk
+	const auto crlf_chunks = _split_corpus_at_line(tagged_crlf, 16, "SENTENCE END");
+	EXPECT_EQ(crlf_chunks.size(), _split_corpus_at_line(tagged, 16, "SENTENCE END").size());
+	EXPECT_GT(crlf_chunks.size(), 1);
+	for (const auto& chunk : crlf_chunks) {
+		EXPECT_EQ(chunk.find("SENTENCE END"), std::string_view::npos);
+	}
+	for (const std::string* corpus : {&tagged, &tagged_crlf, &segmented}) {
+		hmm::wseg_4tag::training_options opt;
+		opt.threads = 3;
+		opt.segmented = (corpus == &segmented);
+		opt.chunk_size = 16;
+		hmm::wseg_4tag::model<> model;
+		hmm::wseg_4tag::train_corpus(model, *corpus, opt);
+
+		EXPECT_EQ(model.training_.pi, expected.training_.pi);
+		EXPECT_EQ(model.training_.a, expected.training_.a);
+		EXPECT_EQ(model.characters_, expected.characters_);
+		ASSERT_EQ(model.training_.b.size(), expected.training_.b.size());
+		for (const auto& [character, row] : expected.training_.b) {
+			EXPECT_EQ(model.training_.b.at(character), row) << character;
+		}
+	}
+
+	hmm::wseg_4tag::model<> model;
+	EXPECT_THROW(hmm::wseg_4tag::train_corpus(model, "春 B\n风 X\n"), std::invalid_argument);
+}
+
+TEST(hmm, decode_cache) {
+	using namespace fastcws;
+
+	// one shard of two runs, the least recently used one is evicted
+	hmm::wseg_4tag::decode_cache cache{2, 8, 1};
+	const state bes[] = {state::B, state::E, state::S};
+	state out[3];
+	EXPECT_FALSE(cache.find("abc", out));
+	cache.insert("abc", bes, 3);
+	cache.insert("de", bes + 1, 2);
+	ASSERT_TRUE(cache.find("abc", out));
+	EXPECT_TRUE(std::equal(bes, bes + 3, out));
+	cache.insert("f", bes + 2, 1);
+	EXPECT_FALSE(cache.find("de", out));
+	EXPECT_TRUE(cache.find("f", out));
+	EXPECT_EQ(out[0], state::S);
+	EXPECT_EQ(cache.size(), 2);
+	EXPECT_EQ(cache.hits(), 2);
+	EXPECT_EQ(cache.misses(), 2);
+	EXPECT_FALSE(cache.cacheable("123456789"));
+}
+
+TEST(hmm, cached_matches_uncached) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	for (bool oov_only : {false, true}) {
+		hmm::wseg_4tag::decode_cache cache{1024};
+		hmm::wseg_4tag::cached cached{model, cache, oov_only};
+		// threads decoding the same sentences at once, the second time round from the cache
+		auto run = [&]() {
+			for (size_t round = 0; round < 2; round++) {
+				for (const auto& sentence : test_sentences) {
+					word_dag::dag<> expected{sentence};
+					word_dag::dag<> dag{sentence};
+					populate_rune_chain<rune_hopper::utf8_hopper>(expected, 32);
+					populate_rune_chain<rune_hopper::utf8_hopper>(dag, 32);
+					// the run of 果实 is covered
+					if (sentence.size() > 6) {
+						expected.add_edge(0, 6, 8);
+						dag.add_edge(0, 6, 8);
+					}
+					model._add_edges<word_dag::dag<>, rune_hopper::utf8_hopper>(expected, 16, oov_only);
+					cached.add_edges<word_dag::dag<>, rune_hopper::utf8_hopper>(dag, 16);
+					EXPECT_EQ(dag.adjacents_, expected.adjacents_) << sentence;
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < 4; t++) {
+			threads.emplace_back(run);
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		// everything cacheable has been seen by now
+		const uint64_t hits = cache.hits();
+		const uint64_t misses = cache.misses();
+		run();
+		EXPECT_GT(cache.hits(), hits);
+		EXPECT_EQ(cache.misses(), misses);
+	}
+}
+
+TEST(hmm, add_edges_over_decoded_runes) {
+	using namespace fastcws;
+
+	hmm::wseg_4tag::model<> model;
+	train(model);
+
+	for (const auto& sentence : test_sentences) {
+		for (bool oov_only : {false, true}) {
+			word_dag::dag<> expected{sentence};
+			word_dag::dag<> dag{sentence};
+			populate_rune_chain<rune_hopper::utf8_hopper>(expected, 32);
+			populate_rune_chain<rune_hopper::utf8_hopper>(dag, 32);
+			model._add_edges<word_dag::dag<>, rune_hopper::utf8_hopper>(expected, 16, oov_only);
+			model._add_edges(dag, 16, decoded_runes::decode(sentence), oov_only);
+			EXPECT_EQ(dag.adjacents_, expected.adjacents_) << sentence;
+		}
+	}
+}
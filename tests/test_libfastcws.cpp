@@ -0,0 +1,188 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <filesystem>
+#include <cstdio>
+
+#include "fastcws/hmm.hpp"
+#include "fastcws/freq_dict.hpp"
+#include "fastcws/suspendable_region.hpp"
+#include "fastcws_defaults/snapshot.hpp"
+extern "C" {
+#include "libfastcws.h"
+}
+
+namespace {
+
+using fastcws::hmm::wseg_4tag::state;
+
+// a model trained on a single sentence of space separated words
+fastcws::hmm::wseg_4tag::model<> model_of(std::string_view sentence) {
+	fastcws::hmm::wseg_4tag::model<> model;
+	std::vector<std::string> runes;
+	std::vector<state> tags;
+	std::istringstream iss{std::string{sentence}};
+	std::string word;
+	while (iss >> word) {
+		std::vector<std::string_view> word_runes;
+		fastcws::split_runes(std::string_view{word}, std::back_inserter(word_runes));
+		for (size_t i = 0; i < word_runes.size(); i++) {
+			runes.emplace_back(word_runes[i]);
+			if (word_runes.size() == 1) {
+				tags.push_back(state::S);
+			} else if (i == 0) {
+				tags.push_back(state::B);
+			} else if (i + 1 == word_runes.size()) {
+				tags.push_back(state::E);
+			} else {
+				tags.push_back(state::M);
+			}
+		}
+	}
+	model.train(runes.cbegin(), runes.cend(), tags.cbegin(), tags.cend());
+	model.normalize();
+	return model;
+}
+
+// a compiled dict holding the words of dict_text
+void save_dict_snapshot_of(const char* dict_text, const std::string& filename) {
+	using namespace fastcws::suspendable_region;
+	namespace defaults = fastcws::defaults;
+
+	managed_region<seats::seat_7> reg{1024 * 1024};
+	using dict_type = defaults::custom_freq_dict_in<decltype(reg)>;
+	auto dict_alloc = allocator_of(reg).get<dict_type>();
+	using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+	auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
+	reg.tag_ptr(defaults::dict_ptr_tag, dict_ptr);
+	alloc_traits::construct(dict_alloc, dict_ptr.get());
+
+	std::istringstream iss{dict_text};
+	fastcws::freq_dict::load_dict(iss, *dict_ptr);
+	std::ofstream ofs{filename, std::ios::binary};
+	defaults::snapshot_header::of(defaults::snapshot_kind::freq_dict).write(ofs);
+	reg.suspend(ofs);
+}
+
+std::vector<std::string> word_break(const char* sentence, const fastcws_ctx* ctx) {
+	fastcws_result* result = fastcws_alloc_result();
+	std::vector<std::string> ret;
+	if (fastcws_word_break2(sentence, result, ctx) == FASTCWS_OK) {
+		const char* word;
+		size_t len;
+		while (fastcws_result_next(result, &word, &len) == FASTCWS_OK) {
+			ret.emplace_back(word, len);
+		}
+	}
+	fastcws_result_free(result);
+	return ret;
+}
+
+}
+
+TEST(libfastcws, hmm_cache_follows_model) {
+	const auto dir = std::filesystem::temp_directory_path();
+	const std::string dict_filename = (dir / "fastcws_test_capi.dict").string();
+	const std::string joined_filename = (dir / "fastcws_test_capi_joined.hmm").string();
+	const std::string split_filename = (dir / "fastcws_test_capi_split.hmm").string();
+	{
+		std::ofstream ofs{dict_filename, std::ios::binary};
+		ofs << "果实 10\n";
+	}
+	const std::string compact_filename = (dir / "fastcws_test_capi_split.chmm").string();
+	{
+		std::ofstream ofs{joined_filename, std::ios::binary};
+		fastcws::hmm::wseg_4tag::save(model_of("在 春风 吹拂 的 季节 翩翩起舞 。"), ofs);
+	}
+	{
+		const auto model = model_of("在 春风吹拂 的 季节 翩翩 起舞 。");
+		std::ofstream ofs{split_filename, std::ios::binary};
+		fastcws::hmm::wseg_4tag::save(model, ofs);
+		std::ofstream compact_ofs{compact_filename, std::ios::binary};
+		fastcws::hmm::wseg_4tag::save_compact(model, compact_ofs);
+	}
+	const char* sentence = "在春风吹拂的季节翩翩起舞。";
+
+	// what each model segments, with no cache
+	fastcws_ctx* plain = fastcws_alloc_ctx();
+	ASSERT_EQ(fastcws_load_freq_dict(dict_filename.c_str(), plain), FASTCWS_OK);
+	ASSERT_EQ(fastcws_load_hmm_model(joined_filename.c_str(), plain), FASTCWS_OK);
+	const auto joined = word_break(sentence, plain);
+	ASSERT_EQ(fastcws_load_hmm_model(split_filename.c_str(), plain), FASTCWS_OK);
+	const auto split = word_break(sentence, plain);
+	ASSERT_NE(joined, split);
+
+	fastcws_ctx* ctx = fastcws_alloc_ctx();
+	fastcws_set_hmm_cache(ctx, 1024);
+	ASSERT_EQ(fastcws_load_freq_dict(dict_filename.c_str(), ctx), FASTCWS_OK);
+	ASSERT_EQ(fastcws_load_hmm_model(joined_filename.c_str(), ctx), FASTCWS_OK);
+	EXPECT_EQ(word_break(sentence, ctx), joined);
+	EXPECT_EQ(word_break(sentence, ctx), joined);
+	uint64_t hits, misses;
+	fastcws_hmm_cache_stats(ctx, &hits, &misses);
+	EXPECT_GT(hits, 0);
+	// the tags the first model decoded are not those of the second
+	ASSERT_EQ(fastcws_load_hmm_model(split_filename.c_str(), ctx), FASTCWS_OK);
+	EXPECT_EQ(word_break(sentence, ctx), split);
+	ASSERT_EQ(fastcws_load_hmm_model(joined_filename.c_str(), ctx), FASTCWS_OK);
+	EXPECT_EQ(word_break(sentence, ctx), joined);
+	ASSERT_EQ(fastcws_load_compact_hmm_model(compact_filename.c_str(), ctx), FASTCWS_OK);
+	EXPECT_EQ(word_break(sentence, ctx), split);
+
+	fastcws_ctx_free(ctx);
+	fastcws_ctx_free(plain);
+	std::remove(dict_filename.c_str());
+	std::remove(joined_filename.c_str());
+	std::remove(split_filename.c_str());
+	std::remove(compact_filename.c_str());
+}
+
+TEST(libfastcws, failed_snapshot_load_keeps_the_old_one) {
+	const auto dir = std::filesystem::temp_directory_path();
+	const std::string model_filename = (dir / "fastcws_test_capi.hmm").string();
+	const std::string joined_filename = (dir / "fastcws_test_capi_joined.dict").string();
+	const std::string split_filename = (dir / "fastcws_test_capi_split.dict").string();
+	const std::string bad_filename = (dir / "fastcws_test_capi_bad.dict").string();
+	const std::string missing_filename = (dir / "fastcws_test_capi_missing.dict").string();
+	{
+		std::ofstream ofs{model_filename, std::ios::binary};
+		fastcws::hmm::wseg_4tag::save(model_of("在 春风 吹拂 的 季节 翩翩 起舞 。"), ofs);
+		std::ofstream bad_ofs{bad_filename, std::ios::binary};
+		bad_ofs << "翩翩起舞 100\n";
+	}
+	save_dict_snapshot_of("翩翩起舞 100\n", joined_filename);
+	save_dict_snapshot_of("翩翩 100\n起舞 100\n", split_filename);
+	const char* sentence = "翩翩起舞";
+	const std::vector<std::string> joined{"翩翩起舞"};
+	const std::vector<std::string> split{"翩翩", "起舞"};
+
+	fastcws_ctx* ctx = fastcws_alloc_ctx();
+	ASSERT_EQ(fastcws_load_hmm_model(model_filename.c_str(), ctx), FASTCWS_OK);
+	ASSERT_EQ(fastcws_load_freq_dict_snapshot(joined_filename.c_str(), ctx), FASTCWS_OK);
+	ASSERT_EQ(word_break(sentence, ctx), joined);
+	// held by ctx alone, refused before it is let go of
+	EXPECT_EQ(fastcws_load_freq_dict_snapshot(missing_filename.c_str(), ctx), FASTCWS_E_IO);
+	EXPECT_EQ(fastcws_load_freq_dict_snapshot(bad_filename.c_str(), ctx), FASTCWS_E_IO);
+	EXPECT_EQ(word_break(sentence, ctx), joined);
+
+	// held by another ctx too
+	fastcws_ctx* other = fastcws_alloc_ctx();
+	ASSERT_EQ(fastcws_load_freq_dict_snapshot(joined_filename.c_str(), other), FASTCWS_OK);
+	EXPECT_EQ(fastcws_load_freq_dict_snapshot(split_filename.c_str(), ctx), FASTCWS_E_BUSY);
+	EXPECT_EQ(word_break(sentence, ctx), joined);
+	fastcws_ctx_free(other);
+
+	ASSERT_EQ(fastcws_load_freq_dict_snapshot(split_filename.c_str(), ctx), FASTCWS_OK);
+	EXPECT_EQ(word_break(sentence, ctx), split);
+
+	fastcws_ctx_free(ctx);
+	std::remove(model_filename.c_str());
+	std::remove(joined_filename.c_str());
+	std::remove(split_filename.c_str());
+	std::remove(bad_filename.c_str());
+}
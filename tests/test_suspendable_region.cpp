@@ -4,9 +4,26 @@
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <filesystem>
+#include <chrono>
+#include <thread>
 
 #include "fastcws/suspendable_region.hpp"
 #include "fastcws/bindings/containers.hpp"
+#include "fastcws/freq_dict.hpp"
+#include "fastcws_defaults/snapshot.hpp"
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fastcws/suspendable_region/shared_region.hpp"
+#endif
 
 #ifndef FASTCWS_NO_BOOST
 
@@ -70,5 +87,247 @@ TEST(managed_region, suspend_and_recover) {
 	}
 }
 
+TEST(managed_region, dict_with_attributes) {
+	using namespace fastcws::suspendable_region;
+	namespace freq_dict = fastcws::freq_dict;
+	const uint16_t dict_ptr_tag = 0x88;
+
+	std::stringstream ss;
+	{
+		managed_region<seats::seat_2> reg{1024 * 1024};
+		using int_allocator = allocator<int, decltype(reg)>;
+		using dict_type = freq_dict::dict<int_allocator, std::allocator<int>,
+			freq_dict::trie_backend::double_array, uint32_t, freq_dict::pos_tag>;
+		auto dict_alloc = allocator_of(reg).get<dict_type>();
+		using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+		auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
+		reg.tag_ptr(dict_ptr_tag, dict_ptr);
+		alloc_traits::construct(dict_alloc, dict_ptr.get());
+
+		std::istringstream iss{"雪花 10 n\n北京 30 ns\n最终 20 d\n"};
+		freq_dict::load_dict(iss, *dict_ptr);
+		reg.suspend(ss);
+	}
+	{
+		auto reg = managed_region<seats::seat_3>::recover(ss);
+		using int_allocator = allocator<int, decltype(reg)>;
+		using dict_type = freq_dict::dict<int_allocator, std::allocator<int>,
+			freq_dict::trie_backend::double_array, uint32_t, freq_dict::pos_tag>;
+		auto dict_ptr = reg.retrieve_ptr<dict_type>(dict_ptr_tag);
+
+		ASSERT_NE(dict_ptr->find_attributes("北京"), nullptr);
+		EXPECT_EQ(dict_ptr->find_attributes("北京")->view(), "ns");
+		EXPECT_EQ(dict_ptr->find_attributes("最终")->view(), "d");
+		EXPECT_EQ(dict_ptr->find_attributes("雪花")->view(), "n");
+		EXPECT_EQ(dict_ptr->find_attributes("果实"), nullptr);
+	}
+}
+
+TEST(managed_region, compiled_snapshot) {
+	using namespace fastcws::suspendable_region;
+	namespace defaults = fastcws::defaults;
+	const std::string filename = (std::filesystem::temp_directory_path() / "fastcws_test_compiled.dict").string();
+	const std::string stale_filename = (std::filesystem::temp_directory_path() / "fastcws_test_stale.dict").string();
+
+	{
+		managed_region<seats::seat_7> reg{1024 * 1024};
+		using dict_type = defaults::custom_freq_dict_in<decltype(reg)>;
+		auto dict_alloc = allocator_of(reg).get<dict_type>();
+		using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+		auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
+		reg.tag_ptr(defaults::dict_ptr_tag, dict_ptr);
+		alloc_traits::construct(dict_alloc, dict_ptr.get());
+
+		std::istringstream iss{"雪花 10\n北京 30\n最终 20\n"};
+		fastcws::freq_dict::load_dict(iss, *dict_ptr);
+		std::ofstream ofs{filename, std::ios::binary};
+		defaults::snapshot_header::of(defaults::snapshot_kind::freq_dict).write(ofs);
+		reg.suspend(ofs);
+
+		// as if compiled by a build laying the dict out otherwise
+		std::ofstream stale_ofs{stale_filename, std::ios::binary};
+		auto stale_hdr = defaults::snapshot_header::of(defaults::snapshot_kind::freq_dict);
+		stale_hdr.layout ^= 1;
+		stale_hdr.write(stale_ofs);
+		reg.suspend(stale_ofs);
+	}
+	EXPECT_THROW(defaults::load_freq_dict_snapshot(stale_filename.c_str()), std::invalid_argument);
+	std::remove(stale_filename.c_str());
+	{
+		auto loaded = defaults::load_freq_dict_snapshot(filename.c_str());
+		EXPECT_EQ(loaded.object->get_freq("北京"), 30);
+		EXPECT_NE(loaded.object->exact_match("最终"), defaults::custom_freq_dict_t::not_found);
+		// its seat is taken
+		try {
+			defaults::load_freq_dict_snapshot(filename.c_str());
+			ADD_FAILURE();
+		} catch (const std::system_error& e) {
+			EXPECT_EQ(e.code(), fastcws::errc::resource_busy);
+		}
+		EXPECT_THROW(defaults::load_hmm_model_snapshot(filename.c_str()), std::invalid_argument);
+	}
+	auto reloaded = defaults::load_freq_dict_snapshot(filename.c_str());
+	EXPECT_EQ(reloaded.object->get_freq("最终"), 20);
+	std::remove(filename.c_str());
+	EXPECT_THROW(defaults::load_hmm_model_snapshot(filename.c_str()), std::system_error);
+}
+
+TEST(managed_region, compact_dict_snapshot) {
+	using namespace fastcws::suspendable_region;
+	namespace defaults = fastcws::defaults;
+	const std::string filename = (std::filesystem::temp_directory_path() / "fastcws_test_compact.dict").string();
+
+	{
+		fastcws::freq_dict::dict<> dict;
+		std::istringstream iss{"雪花 10\n北京 30\n最终 20\n"};
+		fastcws::freq_dict::load_dict(iss, dict);
+
+		managed_region<seats::seat_8> reg{1024 * 1024};
+		using compact_type = defaults::custom_compact_dict_in<decltype(reg)>;
+		auto compact_alloc = allocator_of(reg).get<compact_type>();
+		using alloc_traits = std::allocator_traits<decltype(compact_alloc)>;
+		auto compact_ptr = alloc_traits::allocate(compact_alloc, 1);
+		reg.tag_ptr(defaults::dict_ptr_tag, compact_ptr);
+		alloc_traits::construct(compact_alloc, compact_ptr.get());
+		compact_ptr->build_from(dict);
+
+		std::ofstream ofs{filename, std::ios::binary};
+		defaults::snapshot_header::of(defaults::snapshot_kind::compact_dict).write(ofs);
+		reg.suspend(ofs);
+	}
+	{
+		auto loaded = defaults::load_compact_freq_dict_snapshot(filename.c_str());
+		EXPECT_EQ(loaded.object->size(), 3);
+		EXPECT_NE(loaded.object->exact_match("北京"), defaults::custom_compact_dict_t::not_found);
+		EXPECT_EQ(loaded.object->exact_match("果实"), defaults::custom_compact_dict_t::not_found);
+		// a compact dict is not a compiled one
+		EXPECT_THROW(defaults::load_freq_dict_snapshot(filename.c_str()), std::invalid_argument);
+	}
+	std::remove(filename.c_str());
+}
+
+#ifndef _WIN32
+
+template <class Region>
+using seated_dict = fastcws::freq_dict::dict<fastcws::suspendable_region::allocator<int, Region>, std::allocator<int>,
+	fastcws::freq_dict::trie_backend::double_array>;
+
+TEST(shared_region, publish_and_attach) {
+	using namespace fastcws::suspendable_region;
+	const uint16_t dict_ptr_tag = 0x89;
+	const uint64_t version = 42;
+	const std::string name = "/fastcws_test_" + std::to_string(::getpid());
+
+	std::stringstream ss;
+	{
+		managed_region<seats::seat_4> reg{1024 * 1024};
+		auto dict_alloc = allocator_of(reg).get<seated_dict<decltype(reg)>>();
+		using alloc_traits = std::allocator_traits<decltype(dict_alloc)>;
+		auto dict_ptr = alloc_traits::allocate(dict_alloc, 1);
+		reg.tag_ptr(dict_ptr_tag, dict_ptr);
+		alloc_traits::construct(dict_alloc, dict_ptr.get());
+
+		std::istringstream iss{"雪花 10\n北京 30\n最终 20\n"};
+		fastcws::freq_dict::load_dict(iss, *dict_ptr);
+		reg.suspend(ss);
+	}
+
+	using publisher_t = shared_region<managed_region<seats::seat_5>>;
+	using attacher_t = shared_region<managed_region<seats::seat_6>>;
+	publisher_t::unlink(name.c_str());
+	{
+		auto pub = publisher_t::attach_or_publish(name.c_str(), version, [&ss](auto publish) {
+			publish(ss);
+		});
+		EXPECT_TRUE(pub.published());
+		auto dict_ptr = pub.region().retrieve_ptr<seated_dict<managed_region<seats::seat_5>>>(dict_ptr_tag);
+		EXPECT_EQ(dict_ptr->get_freq("北京"), 30);
+
+		EXPECT_THROW(attacher_t::attach(name.c_str(), version + 1), std::system_error);
+
+		// another process maps it elsewhere, without the image
+		pid_t child = ::fork();
+		ASSERT_GE(child, 0);
+		if (child == 0) {
+			auto att = attacher_t::attach_or_publish(name.c_str(), version, [](auto publish) {
+				(void)publish;
+				::_exit(2);
+			});
+			auto attached_ptr = att.region().retrieve_ptr<seated_dict<managed_region<seats::seat_6>>>(dict_ptr_tag);
+			const bool ok = !att.published() && (attached_ptr->get_freq("雪花") == 10)
+				&& (attached_ptr->get_freq("最终") == 20) && (attached_ptr->get_freq("果实") == 0);
+			::_exit(ok ? 0 : 1);
+		}
+		int status = 0;
+		ASSERT_EQ(::waitpid(child, &status, 0), child);
+		ASSERT_TRUE(WIFEXITED(status));
+		EXPECT_EQ(WEXITSTATUS(status), 0);
+	}
+	publisher_t::unlink(name.c_str());
+	EXPECT_THROW(attacher_t::attach(name.c_str(), version), std::system_error);
+
+	// a publisher killed before the image was ready is taken over, rather than waited for until the timeout
+	auto publish_in_child = [&name, &ss](std::chrono::milliseconds delay, bool die) {
+		pid_t child = ::fork();
+		if (child == 0) {
+			publisher_t::attach_or_publish(name.c_str(), version, [&ss, delay, die](auto publish) {
+				std::this_thread::sleep_for(delay);
+				if (die) {
+					::kill(::getpid(), SIGKILL);
+				}
+				ss.clear();
+				ss.seekg(0);
+				publish(ss);
+			});
+			::_exit(0);
+		}
+		return child;
+	};
+	auto wait_for_publisher = [&name]() {
+		int fd = -1;
+		while ((fd = ::shm_open(name.c_str(), O_RDONLY, 0)) < 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		}
+		::close(fd);
+	};
+	pid_t child = publish_in_child(std::chrono::milliseconds{100}, true);
+	ASSERT_GE(child, 0);
+	wait_for_publisher();
+	{
+		const auto start = std::chrono::steady_clock::now();
+		auto pub = publisher_t::attach_or_publish(name.c_str(), version, [&ss](auto publish) {
+			ss.clear();
+			ss.seekg(0);
+			publish(ss);
+		});
+		EXPECT_TRUE(pub.published());
+		EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds{2});
+		auto dict_ptr = pub.region().retrieve_ptr<seated_dict<managed_region<seats::seat_5>>>(dict_ptr_tag);
+		EXPECT_EQ(dict_ptr->get_freq("北京"), 30);
+	}
+	int status = 0;
+	ASSERT_EQ(::waitpid(child, &status, 0), child);
+	EXPECT_TRUE(WIFSIGNALED(status));
+	publisher_t::unlink(name.c_str());
+
+	// while a slow publisher alive is waited for
+	child = publish_in_child(std::chrono::milliseconds{300}, false);
+	ASSERT_GE(child, 0);
+	wait_for_publisher();
+	{
+		auto att = attacher_t::attach_or_publish(name.c_str(), version, [](auto publish) {
+			(void)publish;
+			FAIL() << "published while the publisher was alive";
+		});
+		EXPECT_FALSE(att.published());
+	}
+	ASSERT_EQ(::waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(WEXITSTATUS(status), 0);
+	publisher_t::unlink(name.c_str());
+}
+
+#endif
+
 #endif
 
@@ -3,8 +3,14 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <random>
 
 #include "fastcws/word_dag.hpp"
+#include "fastcws/fastcws.hpp"
+#include "fastcws/word_count.hpp"
+#include "fastcws/word_discovery.hpp"
 
 TEST(word_dag, kahn) {
 	using namespace fastcws;
@@ -24,3 +30,384 @@ TEST(word_dag, kahn) {
 	EXPECT_EQ(result.score, 19.0);
 }
 
+
+TEST(word_dag, chunk_end) {
+	using namespace fastcws;
+
+	auto chunks_of = [](std::string_view s, size_t max_size) {
+		std::vector<std::string_view> ret;
+		for (size_t begin = 0; begin < s.size();) {
+			size_t end = chunk_end(s, begin, max_size);
+			EXPECT_GT(end, begin);
+			ret.push_back(s.substr(begin, end - begin));
+			begin = end;
+		}
+		return ret;
+	};
+
+	std::string spaced;
+	for (size_t i = 0; i < 100; i++) {
+		spaced += "abcdefg ";
+	}
+	std::string joined;
+	for (auto chunk : chunks_of(spaced, 50)) {
+		EXPECT_LE(chunk.size(), 50);
+		EXPECT_EQ(chunk.back(), ' ');
+		joined += chunk;
+	}
+	EXPECT_EQ(joined, spaced);
+
+	std::string cjk;
+	for (size_t i = 0; i < 100; i++) {
+		cjk += u8"春风";
+	}
+	joined.clear();
+	for (auto chunk : chunks_of(cjk, 50)) {
+		EXPECT_EQ(chunk.size(), 48); // cut at the last rune boundary
+		joined += chunk;
+		if (joined.size() + 48 > cjk.size()) {
+			break;
+		}
+	}
+	EXPECT_EQ(cjk.substr(0, joined.size()), joined);
+
+	EXPECT_EQ(chunk_end(std::string_view{"short"}, 0, 50), 5);
+	EXPECT_EQ(chunk_end(std::string_view{u8"春风"}, 0, 2), 3); // a rune longer than max_size is kept whole
+
+	// the cut backs off from the middle of a dict word
+	freq_dict::dict<> d{};
+	d.add_word("春风", 10);
+	d.finalize(true);
+	const std::string shifted = "a" + cjk;
+	EXPECT_EQ(chunk_end(std::string_view{shifted}, 0, 48), 46);
+	EXPECT_EQ(chunk_end(std::string_view{shifted}, 0, 48, d), 43);
+	EXPECT_EQ(chunk_end(std::string_view{shifted}, 0, 48, no_dict), 46);
+
+	// so that a sentence segmented chunk by chunk keeps its dict words whole
+	std::string long_sentence = "a";
+	while (long_sentence.size() <= 2 * max_dag_sentence_size) {
+		long_sentence += u8"春风";
+	}
+	std::vector<std::string_view> words;
+	word_break(std::string_view{long_sentence}, std::back_inserter(words), d, no_hmm_model);
+	ASSERT_EQ(words.size(), (long_sentence.size() - 1) / 6 + 1);
+	EXPECT_EQ(words[0], "a");
+	for (size_t i = 1; i < words.size(); i++) {
+		ASSERT_EQ(words[i], u8"春风") << i;
+	}
+}
+
+TEST(word_dag, decoded_runes) {
+	using namespace fastcws;
+
+	const std::string_view sentence{u8"在　春风——吹拂 的季节……iPhone 15\r\n翩翩起舞🌸"};
+	const auto runes = decoded_runes::decode(sentence);
+	std::vector<std::string_view> split;
+	split_runes(sentence, std::back_inserter(split));
+	ASSERT_EQ(runes.size(), split.size());
+	for (size_t i = 0; i < runes.size(); i++) {
+		EXPECT_EQ(runes.rune(i), split[i]);
+		EXPECT_EQ(runes[i].codepoint, utf8_codepoint(split[i]));
+		EXPECT_EQ(runes[i].special, special_hopper::utf8_special_hopper::classify_special(split[i]));
+	}
+	EXPECT_EQ(runes.offset(runes.size()), sentence.size());
+	EXPECT_EQ(runes[runes.size() - 1].codepoint, 0x1f338);
+
+	// the same edges as the stages splitting the sentence themselves
+	word_dag::dag<> expected{sentence};
+	populate_rune_chain(expected, 32);
+	add_special_edges(expected);
+	word_dag::dag<> dag{sentence};
+	populate_rune_chain(dag, runes, 32);
+	add_special_edges(dag, runes);
+	EXPECT_EQ(dag.adjacents_, expected.adjacents_);
+	EXPECT_EQ(dag.in_degree_, expected.in_degree_);
+
+	EXPECT_EQ(decoded_runes::decode(std::string_view{}).size(), 0);
+	EXPECT_THROW(decoded_runes::decode(std::string_view{"ab\xe6\x98"}), exception::bad_encoding);
+}
+
+TEST(word_dag, utf8_scan) {
+	using namespace fastcws;
+
+	std::vector<std::pair<const char*, _utf8_scan_t>> scans{{"scalar", _utf8_scan_scalar}};
+#ifdef FASTCWS_UTF8_SCAN_X86
+	if (__builtin_cpu_supports("sse4.1")) {
+		scans.emplace_back("sse4.1", _utf8_scan_sse41);
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		scans.emplace_back("avx2", _utf8_scan_avx2);
+	}
+#endif
+
+	const std::vector<std::string> valid{"", "a", u8"春", u8"é", u8"🌸", "\x7f", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80",
+		"\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf"};
+	const std::vector<std::string> invalid{"\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xc2", "\xc2\x41", "\xe0\x80\x80",
+		"\xe0\x9f\xbf", "\xed\xa0\x80", "\xed\xbf\xbf", "\xe6\x98", "\xe6\x41\x98", "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf",
+		"\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xf8\x88\x80\x80\x80", "\xff", "\xc2\x80\x80", "\xe6\x98\xa5\x80"};
+
+	// at every offset across the blocks of the vector scans, surrounded by ascii & by chinese
+	for (const std::string& fill : {std::string{"x"}, std::string{u8"春"}}) {
+		for (size_t before = 0; before < 70; before++) {
+			std::string prefix;
+			while (prefix.size() < before) {
+				prefix += fill;
+			}
+			auto check = [&](const std::string& rune, bool expected) {
+				for (const std::string& suffix : {std::string{}, prefix}) {
+					const std::string s = prefix + rune + suffix;
+					for (const auto& [name, scan] : scans) {
+						std::vector<uint32_t> offsets(s.size());
+						size_t runes = 0;
+						ASSERT_EQ(scan(s.data(), s.size(), offsets.data(), runes), expected) << name << " " << s;
+						if (expected) {
+							offsets.resize(runes);
+							size_t at = 0;
+							for (size_t i = 0; i < runes; i++) {
+								ASSERT_EQ(offsets[i], at) << name << " " << s;
+								at += rune_hopper::utf8_hopper::hop(static_cast<uint8_t>(s[at]));
+							}
+							ASSERT_EQ(at, s.size()) << name;
+						}
+					}
+				}
+			};
+			for (const std::string& rune : valid) {
+				check(rune, true);
+			}
+			for (const std::string& rune : invalid) {
+				check(rune, false);
+			}
+		}
+	}
+
+	// random bytes, mostly valid runes, agree with the scalar scan
+	std::mt19937 rng{42};
+	const std::vector<std::string> alphabet{"a", " ", u8"春", u8"é", u8"🌸", "\x80", "\xe6", "\xed\xa0\x80", "\xf4\x90"};
+	for (size_t n = 0; n < 2000; n++) {
+		std::string s;
+		const size_t runes = rng() % 80;
+		for (size_t i = 0; i < runes; i++) {
+			const size_t k = rng() % 64;
+			s += alphabet[(k < alphabet.size()) ? k : (k % 5)];
+		}
+		std::vector<uint32_t> expected_offsets(s.size());
+		size_t expected_runes = 0;
+		const bool expected = _utf8_scan_scalar(s.data(), s.size(), expected_offsets.data(), expected_runes);
+		for (const auto& [name, scan] : scans) {
+			std::vector<uint32_t> offsets(s.size());
+			size_t runes = 0;
+			ASSERT_EQ(scan(s.data(), s.size(), offsets.data(), runes), expected) << name;
+			if (expected) {
+				ASSERT_EQ(runes, expected_runes) << name;
+				offsets.resize(runes);
+				expected_offsets.resize(runes);
+				ASSERT_EQ(offsets, expected_offsets) << name;
+			}
+		}
+	}
+
+	EXPECT_TRUE(utf8_valid(u8"在春风吹拂的季节"));
+	EXPECT_FALSE(utf8_valid("\xe5\x9c\xa8\x80\xe6\x98\xa5"));
+	EXPECT_THROW(decoded_runes::decode(std::string_view{"\xe5\x9c\xa8\x80\xe6\x98\xa5"}), exception::bad_encoding);
+	std::vector<std::string_view> words;
+	EXPECT_THROW(split_runes(std::string_view{"ab\xc0\xafx"}, std::back_inserter(words)), exception::bad_encoding);
+}
+
+TEST(word_dag, word_break_with_ephemeral_words) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type d{};
+	d.add_word("雪花", 10);
+	d.add_word("是", 10);
+	d.add_word("最终", 10);
+	d.add_word("的", 10);
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	std::vector<std::string_view> words;
+	word_break(std::string_view{"雪花是最终的果实"}, std::back_inserter(words), d, no_hmm_model);
+	EXPECT_EQ(words, (std::vector<std::string_view>{"雪花", "是", "最终", "的", "果实"}));
+
+	freq_dict::ephemeral_words<> ephemeral;
+	ephemeral.add_word("最终的果实");
+	ephemeral.finalize();
+	words.clear();
+	word_break(std::string_view{"雪花是最终的果实"}, std::back_inserter(words), d, no_hmm_model, ephemeral);
+	EXPECT_EQ(words, (std::vector<std::string_view>{"雪花", "是", "最终的果实"}));
+	EXPECT_EQ(d.exact_match("最终的果实"), dict_type::not_found);
+}
+
+namespace {
+
+// stands for an hmm model segmenting "翩翩起舞" as one token
+struct dancing_model {
+	template <class WordDag, class RuneHopper>
+	void add_edges(WordDag& dag, typename WordDag::weight_t weight) const {
+		const std::string_view word{"翩翩起舞"};
+		const std::string_view sentence{dag.sentence().data(), dag.sentence().size()};
+		for (size_t i = sentence.find(word); i != std::string_view::npos; i = sentence.find(word, i + 1)) {
+			dag.add_edge(i, i + word.size(), weight);
+		}
+	}
+};
+
+}
+
+TEST(word_dag, word_break_with_attributes) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>,
+		freq_dict::trie_backend::double_array, uint32_t, freq_dict::pos_tag>;
+	dict_type d{};
+	d.add_word("雪花", 10, freq_dict::pos_tag::from_columns("n"));
+	d.add_word("是", 10, freq_dict::pos_tag::from_columns("v"));
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	std::vector<std::pair<std::string_view, const freq_dict::pos_tag*>> tokens;
+	word_break_with_attributes(std::string_view{"雪花是翩翩起舞的果实"}, std::back_inserter(tokens), d, dancing_model{});
+	ASSERT_EQ(tokens.size(), 5);
+	const std::vector<std::string_view> words{"雪花", "是", "翩翩起舞", "的", "果实"};
+	for (size_t i = 0; i < tokens.size(); i++) {
+		EXPECT_EQ(tokens[i].first, words[i]);
+		EXPECT_EQ(tokens[i].second, d.find_attributes(words[i])) << words[i];
+	}
+	EXPECT_EQ(tokens[0].second->view(), "n");
+	EXPECT_EQ(tokens[1].second->view(), "v");
+	// segmented by the hmm model, or a single rune missing from the dict
+	EXPECT_EQ(tokens[2].second, nullptr);
+	EXPECT_EQ(tokens[3].second, nullptr);
+	EXPECT_EQ(tokens[4].second->view(), "");
+}
+
+TEST(word_count, id_dag) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type d{};
+	d.add_word("雪花", 10);
+	d.add_word("最终", 10);
+	d.add_word("最终的果实", 10);
+	d.finalize(true);
+	static_assert(can_count_words_v<dict_type>);
+	static_assert(!can_count_words_v<freq_dict::dict<>>);
+
+	const std::string_view sentence{"雪花是最终的果实"};
+	auto dag = build_dag<dict_type, no_hmm_model_t, rune_hopper::utf8_hopper, word_dag::id_dag<>>(sentence, d, no_hmm_model);
+	EXPECT_EQ(dag.word_id(0, 6), d.exact_match("雪花"));
+	EXPECT_EQ(dag.word_id(9, 15), d.exact_match("最终"));
+	EXPECT_EQ(dag.word_id(9, 24), d.exact_match("最终的果实"));
+	// single runes & specials carry no id
+	EXPECT_EQ(dag.word_id(6, 9), word_dag::id_dag<>::no_id);
+	EXPECT_EQ(dag.word_id(0, 3), word_dag::id_dag<>::no_id);
+	// the same segmentation as with a plain dag
+	std::vector<std::string_view> words;
+	word_break_by_dag(dag, std::back_inserter(words));
+	EXPECT_EQ(words, (std::vector<std::string_view>{"雪花", "是", "最终的果实"}));
+}
+
+TEST(word_count, count_words) {
+	using namespace fastcws;
+
+	using dict_type = freq_dict::dict<std::allocator<int>, std::allocator<int>, freq_dict::trie_backend::double_array>;
+	dict_type d{};
+	d.add_word("雪花", 10);
+	d.add_word("是", 10);
+	d.add_word("最终", 10);
+	d.add_word("的", 10);
+	d.add_word("果实", 10);
+	d.finalize(true);
+
+	std::string corpus;
+	for (size_t i = 0; i < 1000; i++) {
+		corpus += "雪花是最终的果实。\n雪花 是 嘿\n";
+	}
+	auto counts_of = [](const std::string& text) {
+		std::map<std::string, uint64_t> ret;
+		std::istringstream iss{text};
+		std::string word;
+		uint64_t count;
+		while (iss >> word >> count) {
+			EXPECT_EQ(ret.count(word), 0);
+			ret[word] = count;
+		}
+		return ret;
+	};
+	const std::map<std::string, uint64_t> expected{
+		{"雪花", 2000}, {"是", 2000}, {"最终", 1000}, {"的", 1000}, {"果实", 1000}, {"。", 1000}, {"嘿", 1000}
+	};
+
+	for (size_t memory_limit : {size_t{0}, size_t{1} << 30}) {
+		count_options opt;
+		opt.threads = 2;
+		opt.memory_limit = memory_limit; // 0 spills every word missing from the dict
+		std::ostringstream oss;
+		count_words(corpus, d, no_hmm_model, oss, opt);
+		EXPECT_EQ(counts_of(oss.str()), expected);
+	}
+
+	count_options opt;
+	opt.min_count = 1001;
+	std::ostringstream oss;
+	count_words(corpus, d, no_hmm_model, oss, opt);
+	EXPECT_EQ(counts_of(oss.str()), (std::map<std::string, uint64_t>{{"雪花", 2000}, {"是", 2000}}));
+}
+
+TEST(word_discovery, discover_words) {
+	using namespace fastcws;
+
+	const std::vector<std::string> known{
+		"春风", "吹拂", "季节", "雪花", "最终", "果实", "而", "是", "的", "在", "我们", "看见",
+		"河流", "山川", "明天", "今天", "朋友", "城市", "安静", "美丽"
+	};
+	freq_dict::dict<> d{};
+	for (const auto& word : known) {
+		d.add_word(word, 100);
+	}
+	d.finalize(true);
+
+	// known words in random order, with an unknown word every few words
+	std::string corpus;
+	uint64_t state = 42;
+	auto next = [&state](size_t n) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return static_cast<size_t>((state >> 33) % n);
+	};
+	for (size_t line = 0; line < 1000; line++) {
+		for (size_t i = 0; i < 12; i++) {
+			corpus += (next(20) == 0) ? "翩翩起舞" : known[next(known.size())];
+		}
+		corpus += (next(2) == 0) ? "。\n" : "，";
+	}
+
+	std::vector<std::string> outputs;
+	for (size_t memory_limit : {size_t{16} * 1024, size_t{1} << 30, size_t{1}}) {
+		discovery_options opt;
+		opt.threads = 2;
+		opt.memory_limit = memory_limit; // spills & compacts many runs with the smaller one
+		opt.min_partition_bytes = 0; // scores many partitions with the smaller one too
+		std::ostringstream oss;
+		discover_words(corpus, d, oss, opt);
+		outputs.push_back(oss.str());
+		std::istringstream iss{oss.str()};
+		std::map<std::string, uint64_t> found;
+		std::string word;
+		uint64_t count;
+		while (iss >> word >> count) {
+			found[word] = count;
+		}
+		ASSERT_EQ(found.count("翩翩起舞"), 1);
+		EXPECT_GE(found["翩翩起舞"], 5);
+		// its parts are no words, the runes around them never vary
+		EXPECT_EQ(found.count("翩翩起"), 0);
+		EXPECT_EQ(found.count("起舞"), 0);
+		for (const auto& [w, c] : found) {
+			EXPECT_EQ(d.get_freq(w), 0) << w;
+		}
+	}
+	// scoring a candidate at a time finds the same words, in the same order
+	EXPECT_EQ(outputs[2], outputs[1]);
+	EXPECT_EQ(outputs[0], outputs[1]);
+}